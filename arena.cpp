@@ -0,0 +1,61 @@
+#include "arena.h"
+
+#include <stdint.h>
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                           Class definition: Arena                           *
+ *******************************************************************************
+*/
+
+
+Arena::Arena(size_t block_size):
+    d_block_size(block_size),
+    d_pos(nullptr),
+    d_left(0),
+    d_size(0)
+{}
+
+void *Arena::allocate (size_t size, size_t alignment)
+{
+    size_t padding = (alignment - (reinterpret_cast<uintptr_t>(d_pos) & (alignment - 1))) & (alignment - 1);
+
+    if (padding + size > d_left) {
+
+        // Large requests get a block of their own (the current one stays in use)
+        if (size > d_block_size / 4) {
+            d_blocks.emplace_back(new char[size + alignment]);
+            d_size += size + alignment;
+            char *block = d_blocks.back().get();
+            padding = (alignment - (reinterpret_cast<uintptr_t>(block) & (alignment - 1))) & (alignment - 1);
+            return block + padding;
+        }
+
+        d_blocks.emplace_back(new char[d_block_size]);
+        d_size += d_block_size;
+        d_pos = d_blocks.back().get();
+        d_left = d_block_size;
+        padding = (alignment - (reinterpret_cast<uintptr_t>(d_pos) & (alignment - 1))) & (alignment - 1);
+    }
+
+    char *p = d_pos + padding;
+    d_pos = p + size;
+    d_left -= padding + size;
+    return p;
+}
+
+void Arena::release ()
+{
+    d_blocks.clear();
+    d_pos = nullptr;
+    d_left = 0;
+    d_size = 0;
+}
+
+size_t Arena::size () const
+{
+    return d_size;
+}
@@ -0,0 +1,66 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace SWU {
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * Memory for data that lives exactly as long as one task (e.g. parsing the
+ * configuration). Allocations are carved one after the other out of large
+ * blocks and are never freed one by one: every block is given back at once,
+ * when the arena is released or destroyed. Only for types without a
+ * destructor; a request larger than a quarter block gets a block of its own.
+\*/
+class Arena
+{
+private:
+    std::vector<std::unique_ptr<char[]>> d_blocks;
+    size_t d_block_size;
+    char *d_pos;
+    size_t d_left;
+    size_t d_size;
+
+public:
+    explicit Arena(size_t block_size = 64 << 10);
+    Arena(const Arena &) = delete;
+    Arena &operator= (const Arena &) = delete;
+
+    /*\
+     * Returns "size" bytes aligned to "alignment" (a power of two)
+    \*/
+    void *allocate (size_t size, size_t alignment = alignof(std::max_align_t));
+
+    /*\
+     * Returns room for "count" objects of type T (left uninitialized)
+    \*/
+    template <typename T>
+    T *allocateArray (size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    /*\
+     * Gives every block back (whatever was allocated is gone)
+    \*/
+    void release ();
+
+    /*\
+     * Returns the bytes held in blocks
+    \*/
+    size_t size () const;
+};
+
+}
+
+#endif // ARENA_H
@@ -1,4 +1,5 @@
 #include "attributes.h"
+#include "lexemetable.h"
 
 using namespace SWU;
 
@@ -10,18 +11,38 @@ using namespace SWU;
 */
 
 
-static const char *g_attr_key_str_map[ATTRIBUTE_KEY_ENUM_MAX] = {
-    [ATTRIBUTE_KEY_PATH]     = "path",
-    [ATTRIBUTE_KEY_ROOT]     = "root",
-    [ATTRIBUTE_KEY_PRODUCT]  = "product",
-    [ATTRIBUTE_KEY_PLATFORM] = "platform",
+static constexpr const char *g_attr_key_str_map[ATTRIBUTE_KEY_ENUM_MAX] = {
+    [ATTRIBUTE_KEY_PATH]        = "path",
+    [ATTRIBUTE_KEY_ROOT]        = "root",
+    [ATTRIBUTE_KEY_PRODUCT]     = "product",
+    [ATTRIBUTE_KEY_PLATFORM]    = "platform",
+    [ATTRIBUTE_KEY_INCREMENTAL] = "incremental",
+    [ATTRIBUTE_KEY_SHA256]      = "sha256",
+    [ATTRIBUTE_KEY_PIPELINED]   = "pipelined",
+    [ATTRIBUTE_KEY_QUEUE_DEPTH] = "queue-depth",
+    [ATTRIBUTE_KEY_CACHE]       = "cache",
+    [ATTRIBUTE_KEY_DURABILITY]  = "durability",
+    [ATTRIBUTE_KEY_MERKLE]      = "merkle",
 };
 
-static const char *g_attr_val_str_map[ATTRIBUTE_VALUE_ENUM_MAX] = {
+static constexpr const char *g_attr_val_str_map[ATTRIBUTE_VALUE_ENUM_MAX] = {
     [ATTRIBUTE_VALUE_REMOTE]    = "Remote",
-    [ATTRIBUTE_VALUE_TARGET]    = "Target"
+    [ATTRIBUTE_VALUE_TARGET]    = "Target",
+    [ATTRIBUTE_VALUE_TRUE]      = "true",
+    [ATTRIBUTE_VALUE_FALSE]     = "false",
+    [ATTRIBUTE_VALUE_CACHED]    = "cached",
+    [ATTRIBUTE_VALUE_STREAMING] = "streaming",
+    [ATTRIBUTE_VALUE_NONE]      = "none",
+    [ATTRIBUTE_VALUE_PHASE]     = "phase",
+    [ATTRIBUTE_VALUE_FILE]      = "file"
 };
 
+// Map: Keys -> Attribute keys
+static constexpr LexemeTable<ATTRIBUTE_KEY_ENUM_MAX, 32> g_attr_key_table(g_attr_key_str_map);
+
+// Map: Values -> Attribute values
+static constexpr LexemeTable<ATTRIBUTE_VALUE_ENUM_MAX, 32> g_attr_val_table(g_attr_val_str_map);
+
 
 /*
  *******************************************************************************
@@ -45,35 +66,30 @@ Attributes& Attributes::get_instance()
 
 
 Attributes::Attributes()
+{}
+
+attribute_key_t Attributes::key(const QString &k)
 {
+    int index = g_attr_key_table.find(k);
+    return (index < 0 ? ATTRIBUTE_KEY_ENUM_MAX : static_cast<attribute_key_t>(index));
+}
 
-    /* Init hashmaps */
-    for (off_t i = 0; i < ATTRIBUTE_KEY_ENUM_MAX; ++i) {
-        attribute_key_t katt = static_cast<attribute_key_t>(i);
-        d_key_map[g_attr_key_str_map[i]] = katt;
-    }
-    for (off_t i = 0; i < ATTRIBUTE_VALUE_ENUM_MAX; ++i) {
-        attribute_value_t vatt = static_cast<attribute_value_t>(i);
-        d_value_map[g_attr_val_str_map[i]] = vatt;
-    }
+attribute_key_t Attributes::key(const char *k, size_t length)
+{
+    int index = g_attr_key_table.find(k, length);
+    return (index < 0 ? ATTRIBUTE_KEY_ENUM_MAX : static_cast<attribute_key_t>(index));
 }
 
-attribute_key_t Attributes::key(QString k)
+attribute_value_t Attributes::value(const QString &v)
 {
-    attribute_key_t retval = ATTRIBUTE_KEY_ENUM_MAX;
-    if (d_key_map.contains(k)) {
-        retval = d_key_map[k];
-    }
-    return retval;
+    int index = g_attr_val_table.find(v);
+    return (index < 0 ? ATTRIBUTE_VALUE_ENUM_MAX : static_cast<attribute_value_t>(index));
 }
 
-attribute_value_t Attributes::value(QString v)
+attribute_value_t Attributes::value(const char *v, size_t length)
 {
-    attribute_value_t retval = ATTRIBUTE_VALUE_ENUM_MAX;
-    if (d_value_map.contains(v)) {
-        retval = d_value_map[v];
-    }
-    return retval;
+    int index = g_attr_val_table.find(v, length);
+    return (index < 0 ? ATTRIBUTE_VALUE_ENUM_MAX : static_cast<attribute_value_t>(index));
 }
 
 QString Attributes::key_to_str (attribute_key_t key)
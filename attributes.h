@@ -1,7 +1,7 @@
 #ifndef ATTRIBUTES_H
 #define ATTRIBUTES_H
 #include <QString>
-#include <QMap>
+#include <stddef.h>
 
 namespace SWU {
 
@@ -17,6 +17,13 @@ enum attribute_key_t {
     ATTRIBUTE_KEY_ROOT,
     ATTRIBUTE_KEY_PRODUCT,
     ATTRIBUTE_KEY_PLATFORM,
+    ATTRIBUTE_KEY_INCREMENTAL,
+    ATTRIBUTE_KEY_SHA256,
+    ATTRIBUTE_KEY_PIPELINED,
+    ATTRIBUTE_KEY_QUEUE_DEPTH,
+    ATTRIBUTE_KEY_CACHE,
+    ATTRIBUTE_KEY_DURABILITY,
+    ATTRIBUTE_KEY_MERKLE,
 
     /* Size */
     ATTRIBUTE_KEY_ENUM_MAX
@@ -26,49 +33,43 @@ enum attribute_key_t {
 enum attribute_value_t {
     ATTRIBUTE_VALUE_REMOTE = 0,
     ATTRIBUTE_VALUE_TARGET,
+    ATTRIBUTE_VALUE_TRUE,
+    ATTRIBUTE_VALUE_FALSE,
+    ATTRIBUTE_VALUE_CACHED,
+    ATTRIBUTE_VALUE_STREAMING,
+    ATTRIBUTE_VALUE_NONE,
+    ATTRIBUTE_VALUE_PHASE,
+    ATTRIBUTE_VALUE_FILE,
 
     /* Size */
     ATTRIBUTE_VALUE_ENUM_MAX
 };
 
-/* Attribute key-value pair */
-struct attribute_kv_pair {
-    attribute_key_t key;
-    attribute_value_t val;
-    QString lexeme;
-};
-
 /* Attribute key-value pair, with a pointer lexeme */
 struct attribute_kp_pair {
     attribute_key_t key;
     QString *lexeme_p;
 };
 
-/* Symbolic constant: unset/uninitialized attribute type */
-#define ATTRIBUTE_UNSET          attribute_kv_pair{ATTRIBUTE_KEY_ENUM_MAX, \
-                                     ATTRIBUTE_VALUE_ENUM_MAX, \
-                                     nullptr \
-                                 }
-/* Symbolic constant: returns true if a given attribute is unset */
-#define ATTRIBUTE_IS_UNSET(a)    ((a)->key == ATTRIBUTE_KEY_ENUM_MAX ? true : false)
-
-
 /*
  *******************************************************************************
  *                             Class declarations                              *
  *******************************************************************************
 */
 
+/*\
+ * Attribute keys and values, recognized through tables hashed at compile
+ * time: looking one up neither builds nor allocates anything.
+\*/
 class Attributes
 {
-private:
-    QMap<QString, attribute_key_t> d_key_map;
-    QMap<QString, attribute_value_t> d_value_map;
 public:
     Attributes();
     static Attributes& get_instance();
-    attribute_key_t key(QString);
-    attribute_value_t value(QString);
+    attribute_key_t key(const QString &k);
+    attribute_key_t key(const char *k, size_t length);
+    attribute_value_t value(const QString &v);
+    attribute_value_t value(const char *v, size_t length);
     QString key_to_str (attribute_key_t key);
     QString value_to_str (attribute_value_t value);
 };
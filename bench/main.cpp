@@ -0,0 +1,114 @@
+#include "configreader.h"
+#include "cfgparser.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+
+
+/*
+ *******************************************************************************
+ *                            Function definitions                             *
+ *******************************************************************************
+*/
+
+
+/* Drops informational messages: the parser logs every checksum it defers */
+static void quiet (QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    Q_UNUSED(context);
+    if (type != QtInfoMsg && type != QtDebugMsg) {
+        fprintf(stderr, "%s\n", message.toLocal8Bit().constData());
+    }
+}
+
+/*\
+ * Writes a configuration with "entries" checksummed files to validate, and
+ * a copy of each of them (pipelined, so every copy takes over a checksum)
+\*/
+static bool generate (const QString path, unsigned entries)
+{
+    FILE *file = fopen(QFile::encodeName(path).constData(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    fprintf(file, "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"
+                  "<configuration product=\"Bench\" platform=\"linux\" incremental=\"true\">\n"
+                  "    <resource-uri>/run/media/sda</resource-uri>\n"
+                  "    <validate pipelined=\"true\">\n");
+    for (unsigned i = 0; i < entries; ++i) {
+        fprintf(file, "        <file sha256=\"%064x\">data/%03u/file-%07u.bin</file>\n", i, i % 1000, i);
+    }
+    fprintf(file, "    </validate>\n"
+                  "    <operations>\n");
+    for (unsigned i = 0; i < entries; ++i) {
+        fprintf(file, "        <copy>\n"
+                      "            <from root=\"Remote\">data/%03u/file-%07u.bin</from>\n"
+                      "            <to root=\"Target\">/opt/bench/%03u</to>\n"
+                      "        </copy>\n", i % 1000, i, i % 1000);
+    }
+    fprintf(file, "    </operations>\n"
+                  "</configuration>\n");
+    return (0 == fclose(file));
+}
+
+
+/*!
+ * \brief Times parsing a generated configuration
+ *
+ * Usage: swu_bench [<entries> [<runs>]]
+ *
+ * Generates a configuration with <entries> files to validate and copy
+ * (100000 unless given) and parses it <runs> times (5 unless given), from
+ * mapping the file to the finished operations, as the updater does at start.
+ * Prints the time of every run, the fastest and the median.
+ */
+int main (int argc, char *argv[])
+{
+    unsigned entries = (argc > 1 ? QString(argv[1]).toUInt() : 100000);
+    unsigned runs = (argc > 2 ? QString(argv[2]).toUInt() : 5);
+    QString path = QDir::tempPath() + QString("/swu_bench_%1.xml").arg(getpid());
+    std::vector<double> times;
+
+    if (entries == 0 || runs == 0) {
+        qCritical() << "Usage:" << QString(argv[0]) << "[<entries> [<runs>]]";
+        return 2;
+    }
+    if (false == generate(path, entries)) {
+        qCritical() << "Unable to write" << path;
+        return 1;
+    }
+    qInstallMessageHandler(quiet);
+
+    for (unsigned run = 0; run < runs; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        SWU::ConfigReader reader;
+        if (false == reader.open(path)) {
+            QFile::remove(path);
+            return 1;
+        }
+        SWU::Parser parser(reader);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        if (reader.failed() || parser.status() != SWU::PARSE_OK ||
+            parser.update_operations().size() != static_cast<int>(entries)) {
+            qCritical() << "Parse failed:" << parser.fault();
+            QFile::remove(path);
+            return 1;
+        }
+        printf("run %u: %.1f ms (%u entries, %zu bytes of elements)\n", run + 1, elapsed.count(), entries,
+               reader.memory());
+        times.push_back(elapsed.count());
+    }
+    QFile::remove(path);
+
+    std::sort(times.begin(), times.end());
+    printf("fastest %.1f ms, median %.1f ms: %.0f entries/s\n", times.front(), times[times.size() / 2],
+           entries / (times[times.size() / 2] / 1000));
+    return 0;
+}
@@ -0,0 +1,488 @@
+#include "bundle.h"
+#include "fileio.h"
+#include "hasher.h"
+#include "merkle.h"
+#include "treewalker.h"
+#include "workpool.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+
+/* A file or directory found by pack() */
+struct pack_entry_t {
+    std::string name;                   // Relative to the packed directory
+    struct stat st;
+    QByteArray digest;
+};
+
+static_assert(sizeof(bundle_header_t) == 64, "bundle_header_t must match the on-media layout");
+static_assert(sizeof(bundle_entry_t) == 80, "bundle_entry_t must match the on-media layout");
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "bundles are read and written in host order");
+
+
+/*
+ *******************************************************************************
+ *                         Static variable definitions                         *
+ *******************************************************************************
+*/
+
+
+static const char g_bundle_magic[8] = {'S', 'W', 'U', 'B', 'N', 'D', 'L', '\0'};
+
+static const uint32_t g_bundle_version = 1;
+
+// Alignment of the data section
+static const uint64_t g_bundle_alignment = 4096;
+
+
+/*
+ *******************************************************************************
+ *                            Forward declarations                             *
+ *******************************************************************************
+*/
+
+
+static QByteArray entry_key (const QString name);
+static bool pack_data (int fd, const QString directory, off_t offset,
+                       std::vector<char> &buffer, pack_entry_t *entry);
+
+
+/*
+ *******************************************************************************
+ *                          Class definition: Bundle                           *
+ *******************************************************************************
+*/
+
+
+Bundle::Bundle(const QString path, int fd):
+    d_path(path),
+    d_fd(fd),
+    d_map(MAP_FAILED),
+    d_map_size(0),
+    d_header(nullptr),
+    d_entries(nullptr),
+    d_names(nullptr),
+    d_buffer_size(1 << 20)
+{}
+
+Bundle::~Bundle()
+{
+    if (d_map != MAP_FAILED) {
+        munmap(d_map, d_map_size);
+    }
+    close(d_fd);
+}
+
+std::shared_ptr<Bundle> Bundle::open (const QString path)
+{
+    int fd;
+
+    if (-1 == (fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC))) {
+        qDebug() << " --- Unable to open bundle" << path << ":" << QString(strerror(errno));
+        return nullptr;
+    }
+    std::shared_ptr<Bundle> bundle(new Bundle(path, fd));
+    if (false == bundle->load()) {
+        qCritical() << "Malformed bundle:" << path;
+        return nullptr;
+    }
+    return bundle;
+}
+
+bool Bundle::load ()
+{
+    bundle_header_t header;
+    struct stat st;
+    Sha256 hash;
+
+    // Header: the sizes must fit the file before anything is mapped
+    if (sizeof(header) != read_chunk(d_fd, reinterpret_cast<char *>(&header), sizeof(header), 0) ||
+        -1 == fstat(d_fd, &st)) {
+        return false;
+    }
+    if (0 != memcmp(header.magic, g_bundle_magic, sizeof(g_bundle_magic)) || header.version != g_bundle_version) {
+        return false;
+    }
+    const uint64_t size = st.st_size;
+    if (header.count > size / sizeof(bundle_entry_t) || header.names_size > size) {
+        return false;
+    }
+    const uint64_t index_end = sizeof(header) + header.count * sizeof(bundle_entry_t) + header.names_size;
+    if (index_end > header.data_offset || header.data_offset > size) {
+        return false;
+    }
+
+    // Map the index and name table (the pages are faulted in on lookup)
+    d_map_size = index_end;
+    if (MAP_FAILED == (d_map = mmap(nullptr, d_map_size, PROT_READ, MAP_SHARED, d_fd, 0))) {
+        return false;
+    }
+    d_header = static_cast<const bundle_header_t *>(d_map);
+    d_entries = reinterpret_cast<const bundle_entry_t *>(d_header + 1);
+    d_names = reinterpret_cast<const char *>(d_entries + d_header->count);
+
+    // The index must be intact, or lookups and offsets cannot be trusted
+    hash.update(d_entries, index_end - sizeof(header));
+    if (hash.result() != QByteArray(reinterpret_cast<const char *>(d_header->index_digest), 32)) {
+        qDebug() << " --- Bundle index digest mismatch";
+        return false;
+    }
+
+    // Names in range and strictly ascending; data within the data section
+    const uint64_t data_size = size - d_header->data_offset;
+    for (uint32_t i = 0; i < d_header->count; ++i) {
+        const bundle_entry_t *entry = &d_entries[i];
+        if (entry->name_size == 0 || entry->name_offset > d_header->names_size ||
+            entry->name_size > d_header->names_size - entry->name_offset) {
+            return false;
+        }
+        if (i > 0 && compare(&d_entries[i - 1], QByteArray::fromRawData(d_names + entry->name_offset,
+                                                                        entry->name_size)) >= 0) {
+            return false;
+        }
+        if (false == S_ISDIR(entry->mode) && false == S_ISREG(entry->mode)) {
+            return false;
+        }
+        if (S_ISREG(entry->mode) && (entry->offset > data_size || entry->size > data_size - entry->offset)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int Bundle::compare (const bundle_entry_t *entry, const QByteArray &name)
+{
+    const size_t length = std::min<size_t>(entry->name_size, name.size());
+    int result = memcmp(d_names + entry->name_offset, name.constData(), length);
+    if (result != 0) {
+        return result;
+    }
+    return (entry->name_size < (size_t)name.size() ? -1 : (entry->name_size > (size_t)name.size() ? 1 : 0));
+}
+
+QString Bundle::path ()
+{
+    return d_path;
+}
+
+int Bundle::fd ()
+{
+    return d_fd;
+}
+
+const bundle_entry_t *Bundle::find (const QString name)
+{
+    const bundle_entry_t *end = d_entries + d_header->count;
+    const QByteArray key = entry_key(name);
+
+    if (key.isEmpty()) {
+        return nullptr;
+    }
+    const bundle_entry_t *entry = std::lower_bound(d_entries, end, key,
+        [this] (const bundle_entry_t &e, const QByteArray &k) { return compare(&e, k) < 0; });
+    if (entry == end || compare(entry, key) != 0) {
+        return nullptr;
+    }
+    return entry;
+}
+
+bool Bundle::below (const QString name, const bundle_entry_t **first_p, const bundle_entry_t **last_p)
+{
+    const bundle_entry_t *end = d_entries + d_header->count;
+    QByteArray key = entry_key(name), from = key, to = key;
+    auto less = [this] (const bundle_entry_t &e, const QByteArray &k) { return compare(&e, k) < 0; };
+
+    // Everything below "dir" sorts within ["dir/", "dir0"), as '0' follows '/'
+    if (key.isEmpty()) {
+        (*first_p) = d_entries;
+        (*last_p) = end;
+    } else {
+        (*first_p) = std::lower_bound(d_entries, end, from.append('/'), less);
+        (*last_p) = std::lower_bound(*first_p, end, to.append('0'), less);
+    }
+    return (*first_p) != (*last_p);
+}
+
+QString Bundle::name (const bundle_entry_t *entry)
+{
+    return QFile::decodeName(QByteArray(d_names + entry->name_offset, entry->name_size));
+}
+
+off_t Bundle::dataOffset (const bundle_entry_t *entry)
+{
+    return d_header->data_offset + entry->offset;
+}
+
+QByteArray Bundle::digest (const bundle_entry_t *entry)
+{
+    return QByteArray(reinterpret_cast<const char *>(entry->digest), sizeof(entry->digest));
+}
+
+bool Bundle::extract (const bundle_entry_t *entry, int to_fd, Sha256 *hash,
+                      ChunkStream *chunks, progress_callback_t progress, copy_report_t *report_p)
+{
+    copy_report_t report = copy_report_t{COPY_METHOD_PIPELINED, 0, 0, 0};
+    std::unique_ptr<char[]> buffers[2] = {std::unique_ptr<char[]>(new char[d_buffer_size]),
+                                          std::unique_ptr<char[]>(new char[d_buffer_size])};
+    ssize_t lengths[2];
+    int errors[2] = {0, 0};
+    WorkPool &pool = WorkPool::get_instance();
+    WorkGroup group;
+    const off_t base = dataOffset(entry), size = entry->size;
+    off_t offset = 0;
+    int current = 0, fd = d_fd;
+
+    posix_fadvise(d_fd, base, size, POSIX_FADV_SEQUENTIAL);
+
+    // Claim the space of the whole file before writing any of it
+    if (false == CopyEngine::preallocate(to_fd, 0, size)) {
+        report.error = errno;
+    }
+
+    // Prime the first buffer
+    lengths[0] = read_chunk(d_fd, buffers[0].get(), std::min<off_t>(d_buffer_size, size), base);
+    errors[0] = errno;
+
+    while (report.error == 0 && offset < size) {
+        int next = current ^ 1;
+        const off_t next_offset = offset + lengths[current];
+
+        // The bundle turned out shorter than its index (e.g. media pulled)
+        if (lengths[current] <= 0) {
+            report.error = (lengths[current] == 0 ? EIO : errors[current]);
+            break;
+        }
+
+        // Read ahead into the other buffer
+        if (next_offset < size) {
+            char *next_buffer = buffers[next].get();
+            ssize_t *next_length = &lengths[next];
+            int *next_error = &errors[next];
+            size_t length = std::min<off_t>(d_buffer_size, size - next_offset);
+            pool.submit(group, [fd, next_buffer, length, base, next_offset, next_length, next_error] {
+                (*next_length) = read_chunk(fd, next_buffer, length, base + next_offset);
+                (*next_error) = errno;
+            });
+        }
+
+        // Check, hash and write the current one
+        if (chunks != nullptr) {
+            chunks->feed(pool, group, offset, buffers[current].get(), lengths[current]);
+        }
+        if (hash != nullptr) {
+            hash->update(buffers[current].get(), lengths[current]);
+        }
+        if (false == write_chunk(to_fd, buffers[current].get(), lengths[current], offset)) {
+            report.error = errno;
+        }
+        pool.wait(group);
+        if (report.error == 0 && chunks != nullptr && chunks->failed()) {
+            report.error = EBADMSG;
+        }
+        if (report.error != 0) {
+            break;
+        }
+        if (progress) {
+            progress(lengths[current]);
+        }
+        offset = next_offset;
+        current = next;
+    }
+
+    if (report.error == 0 && chunks != nullptr && false == chunks->finish(offset)) {
+        report.error = EBADMSG;
+    }
+    report.bytes = offset;
+    if (report_p != nullptr) {
+        (*report_p) = report;
+    }
+    return (report.error == 0);
+}
+
+bool Bundle::pack (const QString directory, const QString path)
+{
+    std::vector<pack_entry_t> entries;
+    std::vector<std::string> parents;
+    std::vector<char> buffer(1 << 20);
+    walk_entry_t walked;
+    bundle_header_t header;
+    std::string names;
+    Sha256 hash;
+    uint64_t data_size = 0;
+    bool ok = true;
+    int fd;
+
+    // Collect the tree (parents keeps the path of the directory being walked)
+    TreeWalker walker(directory);
+    if (0 != walker.error()) {
+        qCritical() << "Unable to open" << directory << ":" << QString(strerror(walker.error()));
+        return false;
+    }
+    while (walker.next(&walked)) {
+        pack_entry_t entry;
+        switch (walked.event) {
+        case WALK_ENTER_DIRECTORY:
+        case WALK_FILE:
+            entry.name = (parents.empty() ? std::string() : parents.back() + "/") + walked.name;
+            if (-1 == fstatat(walked.parent->fd(), walked.name, &entry.st, AT_SYMLINK_NOFOLLOW)) {
+                qCritical() << "Unable to stat" << QString::fromStdString(entry.name) << ":" << QString(strerror(errno));
+                return false;
+            }
+            entries.push_back(entry);
+            if (walked.event == WALK_ENTER_DIRECTORY) {
+                parents.push_back(entry.name);
+            }
+            break;
+        case WALK_LEAVE_DIRECTORY:
+            parents.pop_back();
+            break;
+        case WALK_OTHER:
+            qWarning() << "Skipping non-regular file:" << QString(walked.name);
+            break;
+        default:
+            qCritical() << "Unable to read directory:" << QString(walked.name);
+            return false;
+        }
+    }
+
+    // Index order is byte order of the names; the data follows it
+    std::sort(entries.begin(), entries.end(), [] (const pack_entry_t &a, const pack_entry_t &b) {
+        return a.name < b.name;
+    });
+    std::vector<bundle_entry_t> index(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const struct stat &st = entries[i].st;
+        index[i] = bundle_entry_t();
+        index[i].name_offset = names.size();
+        index[i].name_size = entries[i].name.size();
+        index[i].mode = st.st_mode;
+        index[i].mtime_sec = st.st_mtim.tv_sec;
+        index[i].mtime_nsec = st.st_mtim.tv_nsec;
+        if (S_ISREG(st.st_mode)) {
+            index[i].offset = data_size;
+            index[i].size = st.st_size;
+            data_size += st.st_size;
+        }
+        names += entries[i].name;
+    }
+    header = bundle_header_t();
+    memcpy(header.magic, g_bundle_magic, sizeof(g_bundle_magic));
+    header.version = g_bundle_version;
+    header.count = index.size();
+    header.names_size = names.size();
+    header.data_offset = sizeof(header) + index.size() * sizeof(bundle_entry_t) + names.size();
+    header.data_offset = (header.data_offset + g_bundle_alignment - 1) & ~(g_bundle_alignment - 1);
+
+    // Write next to the target and rename it into place once complete
+    QString part_path = path + ".part";
+    if (-1 == (fd = ::open(QFile::encodeName(part_path).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))) {
+        qCritical() << "Unable to create" << part_path << ":" << QString(strerror(errno));
+        return false;
+    }
+
+    // Data first: the digests go into the index
+    for (size_t i = 0; ok && i < entries.size(); ++i) {
+        if (S_ISREG(index[i].mode)) {
+            ok = pack_data(fd, directory, header.data_offset + index[i].offset, buffer, &entries[i]);
+            memcpy(index[i].digest, entries[i].digest.constData(), sizeof(index[i].digest));
+        }
+    }
+
+    // Then the index, its name table, and the header that covers both
+    if (ok) {
+        hash.update(index.data(), index.size() * sizeof(bundle_entry_t));
+        hash.update(names.data(), names.size());
+        QByteArray index_digest = hash.result();
+        memcpy(header.index_digest, index_digest.constData(), sizeof(header.index_digest));
+        ok = (write_chunk(fd, reinterpret_cast<const char *>(&header), sizeof(header), 0) &&
+              write_chunk(fd, reinterpret_cast<const char *>(index.data()), index.size() * sizeof(bundle_entry_t),
+                          sizeof(header)) &&
+              write_chunk(fd, names.data(), names.size(), sizeof(header) + index.size() * sizeof(bundle_entry_t)) &&
+              0 == ftruncate(fd, header.data_offset + data_size) &&
+              0 == fsync(fd));
+        if (false == ok) {
+            qCritical() << "Unable to write" << part_path << ":" << QString(strerror(errno));
+        }
+    }
+    ok = (0 == close(fd)) && ok;
+    if (ok && -1 == rename(QFile::encodeName(part_path).constData(), QFile::encodeName(path).constData())) {
+        qCritical() << "Unable to rename" << part_path << ":" << QString(strerror(errno));
+        ok = false;
+    }
+    if (false == ok) {
+        unlink(QFile::encodeName(part_path).constData());
+    }
+    return ok;
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function definitions                             *
+ *******************************************************************************
+*/
+
+
+/* Returns the index key of a resource path (empty for the bundle root) */
+static QByteArray entry_key (const QString name)
+{
+    QByteArray key = QFile::encodeName(QDir::cleanPath(name));
+
+    while (key.startsWith('/')) {
+        key = key.mid(1);
+    }
+    return (key == "." ? QByteArray() : key);
+}
+
+/* Copies one file into the bundle at "offset", digesting it on the way */
+static bool pack_data (int fd, const QString directory, off_t offset,
+                       std::vector<char> &buffer, pack_entry_t *entry)
+{
+    QByteArray path = QFile::encodeName(QDir(directory).filePath(QString::fromStdString(entry->name)));
+    Sha256 hash;
+    off_t copied = 0;
+    ssize_t n;
+    int from_fd;
+
+    if (-1 == (from_fd = ::open(path.constData(), O_RDONLY | O_CLOEXEC))) {
+        qCritical() << "Unable to open" << QString(path) << ":" << QString(strerror(errno));
+        return false;
+    }
+    posix_fadvise(from_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while (0 < (n = read_chunk(from_fd, buffer.data(), buffer.size(), copied))) {
+        hash.update(buffer.data(), n);
+        if (copied + n > entry->st.st_size || false == write_chunk(fd, buffer.data(), n, offset + copied)) {
+            break;
+        }
+        copied += n;
+    }
+    close(from_fd);
+
+    // The file must not have changed size since it was listed
+    if (n != 0 || copied != entry->st.st_size) {
+        qCritical() << "Unable to pack" << QString(path) << ": read error or changed while packing";
+        return false;
+    }
+    entry->digest = hash.result();
+    return true;
+}
@@ -0,0 +1,165 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <QString>
+#include <QByteArray>
+#include <sys/types.h>
+#include <stdint.h>
+#include <memory>
+#include "copyengine.h"
+#include "progress.h"
+
+namespace SWU {
+
+class Sha256;
+class ChunkStream;
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * Layout of a bundle file (all integers little-endian):
+ *
+ *   bundle_header_t
+ *   bundle_entry_t[count]      Sorted by name (byte order), no duplicates
+ *   name table                 Entry names, not terminated
+ *   (padding)
+ *   data section               Page aligned; file contents in index order
+ *
+ * Names are relative, '/' separated paths without empty, "." or ".."
+ * components. Every directory on the way to a file has an entry of its own
+ * (so that empty directories and their modes are kept), and the entries
+ * below a directory form one contiguous run of the index.
+\*/
+
+/* Header of a bundle file */
+struct bundle_header_t {
+    char magic[8];                      /**< g_bundle_magic */
+    uint32_t version;                   /**< g_bundle_version */
+    uint32_t count;                     /**< Entries in the index */
+    uint64_t names_size;                /**< Bytes of the name table */
+    uint64_t data_offset;               /**< Start of the data section */
+    uint8_t index_digest[32];           /**< SHA-256 of the index and name table */
+};
+
+/* Index entry of a bundle file */
+struct bundle_entry_t {
+    uint64_t name_offset;               /**< Into the name table */
+    uint32_t name_size;                 /**< Bytes of the name */
+    uint32_t mode;                      /**< st_mode (type and permission bits) */
+    uint64_t offset;                    /**< Into the data section (files only) */
+    uint64_t size;                      /**< Bytes of data (files only) */
+    int64_t mtime_sec;                  /**< Modification time of the packed file */
+    uint32_t mtime_nsec;
+    uint32_t reserved;
+    uint8_t digest[32];                 /**< SHA-256 of the data (files only) */
+};
+
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * A Bundle packs the files of an update into a single file: a sorted index
+ * followed by the contents, back to back. On FAT media this replaces a
+ * directory lookup (and cluster chain walk) per file by one open, and the
+ * data is read front to back.
+ *
+ * The header, index and name table are mapped read-only, so a lookup is a
+ * binary search that only faults in the pages it touches. The index is
+ * checked against its digest (and for consistency) once, when the bundle
+ * is opened; file data is checked by the copy, against the entry digest.
+\*/
+class Bundle
+{
+private:
+    QString d_path;
+    int d_fd;
+    void *d_map;
+    size_t d_map_size;
+    const bundle_header_t *d_header;
+    const bundle_entry_t *d_entries;
+    const char *d_names;
+    size_t d_buffer_size;
+
+    Bundle(const QString path, int fd);
+    bool load ();
+    int compare (const bundle_entry_t *entry, const QByteArray &name);
+
+public:
+    ~Bundle();
+    Bundle(const Bundle &) = delete;
+    Bundle &operator= (const Bundle &) = delete;
+
+    /*\
+     * Opens and maps the bundle file at "path" (nullptr if it cannot be
+     * read or is malformed)
+    \*/
+    static std::shared_ptr<Bundle> open (const QString path);
+
+    /*\
+     * Path of the bundle file
+    \*/
+    QString path ();
+
+    /*\
+     * Descriptor of the bundle file (for reading entry data in place)
+    \*/
+    int fd ();
+
+    /*\
+     * Returns the entry named "name" (a resource path; leading and trailing
+     * slashes are ignored), or nullptr if there is none
+    \*/
+    const bundle_entry_t *find (const QString name);
+
+    /*\
+     * Returns the run of entries below directory "name" ("" or "/": all of
+     * them) as [*first_p, *last_p); false if there are none
+    \*/
+    bool below (const QString name, const bundle_entry_t **first_p, const bundle_entry_t **last_p);
+
+    /*\
+     * Returns the name of an entry
+    \*/
+    QString name (const bundle_entry_t *entry);
+
+    /*\
+     * Returns the offset of the data of an entry within the bundle file
+    \*/
+    off_t dataOffset (const bundle_entry_t *entry);
+
+    /*\
+     * Returns the digest of an entry as a 32 byte array
+    \*/
+    QByteArray digest (const bundle_entry_t *entry);
+
+    /*\
+     * Writes the data of a file entry to the open descriptor "to_fd" (from
+     * its start). The next chunk is read on the worker pool while the
+     * current one is hashed and written.
+     * - hash: Optional hash fed every byte written
+     * - chunks: Optional chunk digests checked alongside (stops with EBADMSG)
+     * - progress: Optional callback receiving the bytes written
+    \*/
+    bool extract (const bundle_entry_t *entry, int to_fd, Sha256 *hash = nullptr,
+                  ChunkStream *chunks = nullptr, progress_callback_t progress = nullptr,
+                  copy_report_t *report_p = nullptr);
+
+    /*\
+     * Packs the tree below "directory" into a new bundle file at "path"
+     * (written next to it, then renamed into place). Symbolic links and
+     * special files are skipped.
+    \*/
+    static bool pack (const QString directory, const QString path);
+};
+
+}
+
+#endif // BUNDLE_H
@@ -1,67 +1,238 @@
 #include "cfgparser.h"
+#include "decompressor.h"
+#include <QHash>
 using namespace SWU;
 
-// Array-designation map: Token to lexeme
-extern QString g_token_lexeme_map[];
-
 // Forward declarations
 static QString dropRootPrefix (const QString s);
 static QString dropNameAndRootPrefix (const QString s);
 
-std::shared_ptr<CFGElement> next(QVector<std::shared_ptr<CFGElement>> &elements)
-{
-    std::shared_ptr<CFGElement> e = nullptr;
-    if (elements.count() > 0) {
-        e = elements.first();
-        elements.pop_front();
-    }
-    return e;
-}
-
-bool Parser::hasAttributeKeys (std::shared_ptr<CFGElement> element,
-                             QVector<attribute_kp_pair> key_pointer_pairs)
+bool Parser::hasAttributeKeys (const config_element_t *element,
+                               std::initializer_list<attribute_kp_pair> key_pointer_pairs)
 {
     off_t matched = 0;
-    Attributes a = Attributes::get_instance();
 
     for (auto keyval : key_pointer_pairs) {
 
         // Extract kv-pair
-        attribute_kv_pair *kvpair = element->attribute_index(keyval.key);
+        const config_attribute_t *kvpair = config_attribute(element, keyval.key);
 
         // If the attribute index is not valid - move on
-        if (ATTRIBUTE_IS_UNSET(kvpair)) {
+        if (kvpair == nullptr) {
             break;
         }
 
         // Else copy the value to the given pointer
-        (*keyval.lexeme_p) = QString(kvpair->lexeme);
+        (*keyval.lexeme_p) = kvpair->lexeme.toString();
 
         // Increment the counter
         matched++;
     }
 
-    return matched == key_pointer_pairs.length();
+    return matched == static_cast<off_t>(key_pointer_pairs.size());
 }
 
-off_t Parser::attributeValueInSet (QString raw_attribute, QVector<attribute_value_t> values) {
-    Attributes a = Attributes::get_instance();
+off_t Parser::attributeValueInSet (const QString &raw_attribute, std::initializer_list<attribute_value_t> values) {
+    Attributes &a = Attributes::get_instance();
     attribute_value_t value = a.value(raw_attribute);
-    for (off_t i = 0; i < values.length(); ++i) {
-        if (values[i] == value) {
+    off_t i = 0;
+    for (attribute_value_t candidate : values) {
+        if (candidate == value) {
             return i;
         }
+        i++;
     }
     return -1;
 }
 
-Parser::Parser(const QVector<std::shared_ptr<CFGElement>>& elements)
+const config_element_t *Parser::peek (ConfigReader &reader)
+{
+    return reader.element(d_cursor);
+}
+
+const config_element_t *Parser::take (ConfigReader &reader)
+{
+    const config_element_t *element = reader.element(d_cursor);
+    if (element != nullptr) {
+        d_cursor++;
+    }
+    return element;
+}
+
+ParseStatus Parser::acceptFlag (const config_element_t *element,
+                                attribute_key_t key, bool *flag_p)
+{
+    const config_attribute_t *kvpair = config_attribute(element, key);
+
+    // Optional: absent is fine
+    if (kvpair == nullptr) {
+        return PARSE_OK;
+    }
+
+    switch (kvpair->val) {
+    case ATTRIBUTE_VALUE_TRUE:
+        (*flag_p) = true;
+        return PARSE_OK;
+    case ATTRIBUTE_VALUE_FALSE:
+        (*flag_p) = false;
+        return PARSE_OK;
+    default:
+        return PARSE_INVALID_ATTRIBUTE_VALUE;
+    }
+}
+
+ParseStatus Parser::acceptNumber (const config_element_t *element,
+                                  attribute_key_t key, unsigned max, unsigned *value_p)
+{
+    const config_attribute_t *kvpair = config_attribute(element, key);
+    bool ok = false;
+
+    // Optional: absent is fine
+    if (kvpair == nullptr) {
+        return PARSE_OK;
+    }
+
+    unsigned value = kvpair->lexeme.toString().trimmed().toUInt(&ok);
+    if (false == ok || value > max) {
+        return PARSE_INVALID_ATTRIBUTE_VALUE;
+    }
+    (*value_p) = value;
+
+    return PARSE_OK;
+}
+
+ParseStatus Parser::acceptCacheMode (const config_element_t *element, cache_mode_t *mode_p)
 {
-    // Clone the elements
-    QVector<std::shared_ptr<CFGElement>> elements_stack_copy(elements);
+    const config_attribute_t *kvpair = config_attribute(element, ATTRIBUTE_KEY_CACHE);
+
+    // Optional: absent is fine
+    if (kvpair == nullptr) {
+        return PARSE_OK;
+    }
 
-    // Accept configuration
-    d_status = acceptConfiguration(elements_stack_copy);
+    switch (kvpair->val) {
+    case ATTRIBUTE_VALUE_CACHED:
+        (*mode_p) = CACHE_MODE_CACHED;
+        return PARSE_OK;
+    case ATTRIBUTE_VALUE_STREAMING:
+        (*mode_p) = CACHE_MODE_STREAMING;
+        return PARSE_OK;
+    default:
+        return PARSE_INVALID_ATTRIBUTE_VALUE;
+    }
+}
+
+ParseStatus Parser::acceptDurability (const config_element_t *element, Durability *durability_p)
+{
+    const config_attribute_t *kvpair = config_attribute(element, ATTRIBUTE_KEY_DURABILITY);
+
+    // Optional: absent is fine
+    if (kvpair == nullptr) {
+        return PARSE_OK;
+    }
+
+    switch (kvpair->val) {
+    case ATTRIBUTE_VALUE_NONE:
+        (*durability_p) = DURABILITY_NONE;
+        return PARSE_OK;
+    case ATTRIBUTE_VALUE_PHASE:
+        (*durability_p) = DURABILITY_PHASE;
+        return PARSE_OK;
+    case ATTRIBUTE_VALUE_FILE:
+        (*durability_p) = DURABILITY_FILE;
+        return PARSE_OK;
+    default:
+        return PARSE_INVALID_ATTRIBUTE_VALUE;
+    }
+}
+
+ParseStatus Parser::acceptDigest (const config_element_t *element, attribute_key_t key, QByteArray *digest_p)
+{
+    const config_attribute_t *kvpair = config_attribute(element, key);
+
+    // Optional: absent means "no digest"
+    (*digest_p) = QByteArray();
+    if (kvpair == nullptr) {
+        return PARSE_OK;
+    }
+
+    // Require exactly 64 hexadecimal digits
+    QByteArray hex = kvpair->lexeme.toString().trimmed().toLatin1();
+    if (hex.size() != 2 * (int)SHA256_DIGEST_SIZE) {
+        return PARSE_INVALID_ATTRIBUTE_VALUE;
+    }
+    for (off_t i = 0; i < hex.size(); ++i) {
+        if (false == isxdigit(static_cast<unsigned char>(hex.at(i)))) {
+            return PARSE_INVALID_ATTRIBUTE_VALUE;
+        }
+    }
+    (*digest_p) = QByteArray::fromHex(hex);
+
+    return PARSE_OK;
+}
+
+Parser::Parser(ConfigReader &reader):
+    d_cursor(0),
+    d_incremental(false),
+    d_pipelined(false),
+    d_queue_depth(IoRing::queueDepth()),
+    d_cache_mode(CACHE_MODE_CACHED),
+    d_durability(DURABILITY_PHASE)
+{
+    // Accept configuration, as it is read
+    d_status = acceptConfiguration(reader);
+
+    // Defer checksums to the copies if requested
+    if (d_status == PARSE_OK && d_pipelined) {
+        linkPipelinedDigests();
+    }
+}
+
+void Parser::linkPipelinedDigests ()
+{
+    // Update copies reading a file from the media, by path
+    QHash<QString, QVector<std::shared_ptr<CopyOperation>>> copies;
+    for (auto update_op : d_update_operations) {
+        std::shared_ptr<CopyOperation> copy = std::dynamic_pointer_cast<CopyOperation>(update_op);
+        if (copy == nullptr) {
+            continue;
+        }
+        Resource source = copy->source();
+        if (source.rootKey() == RESOURCE_KEY_REMOTE && source.resourceType() == RESOURCE_TYPE_FILE) {
+            copies[QDir::cleanPath(source.path())].append(copy);
+        }
+    }
+
+    for (auto validate_op : d_validate_operations) {
+        std::shared_ptr<ExpectOperation> expect = std::dynamic_pointer_cast<ExpectOperation>(validate_op);
+        if (expect == nullptr || (expect->digest().isEmpty() && expect->merkleRoot().isEmpty())) {
+            continue;
+        }
+        Resource checked = expect->resource();
+
+        // A compressed file is copied decompressed: its chunks (as stored on
+        // the media) can only be checked up front
+        const bool compressed = (Decompressor::codec_of(checked.path()) != CODEC_NONE);
+        if (compressed && expect->digest().isEmpty()) {
+            continue;
+        }
+
+        // The update copies reading exactly this file from the media
+        auto found = copies.constFind(QDir::cleanPath(checked.path()));
+        if (found == copies.constEnd()) {
+            continue;
+        }
+        for (auto copy : found.value()) {
+            copy->setExpectedDigest(expect->digest());
+            if (false == compressed) {
+                copy->setMerkleRoot(expect->merkleRoot());
+            }
+        }
+
+        // Only files that are copied can skip the up-front check
+        qInfo() << "checksum of" << checked.path() << "deferred to" << found.value().size() << "copy operation(s)";
+        expect->setDeferred(true);
+    }
 }
 
 ParseStatus Parser::status()
@@ -69,44 +240,64 @@ ParseStatus Parser::status()
     return d_status;
 }
 
-ParseStatus Parser::acceptConfiguration(QVector<std::shared_ptr<CFGElement>>& elements)
+ParseStatus Parser::acceptConfiguration(ConfigReader &reader)
 {
     ParseStatus retval = PARSE_OK;
-    std::shared_ptr<CFGElement> config = nullptr;
+    const config_element_t *config = nullptr;
 
     // First stack element is the configuration
-    if ((config = next(elements)) == nullptr) {
+    if ((config = take(reader)) == nullptr) {
         return PARSE_INVALID_ELEMENT;
     } else {
-        d_parse_stack.push_back(config->token());
+        d_parse_stack.push_back(config->token);
     }
 
     // Extract expected attributes
-    QVector<attribute_kp_pair> req_atts = QVector<attribute_kp_pair>({
+    const std::initializer_list<attribute_kp_pair> req_atts = {
         {ATTRIBUTE_KEY_PLATFORM, &d_platform},
         {ATTRIBUTE_KEY_PRODUCT,  &d_product}
-    });
+    };
     if (!hasAttributeKeys(config, req_atts)) {
         return PARSE_INVALID_ATTRIBUTE_KEY;
     }
 
+    // Optional attribute: incremental (default for all copies)
+    if ((retval = acceptFlag(config, ATTRIBUTE_KEY_INCREMENTAL, &d_incremental)) != PARSE_OK) {
+        return retval;
+    }
+
+    // Optional attribute: queue-depth (batched I/O)
+    if ((retval = acceptNumber(config, ATTRIBUTE_KEY_QUEUE_DEPTH, 4096, &d_queue_depth)) != PARSE_OK) {
+        return retval;
+    }
+
+    // Optional attribute: cache (default for all copies)
+    if ((retval = acceptCacheMode(config, &d_cache_mode)) != PARSE_OK) {
+        return retval;
+    }
+
+    // Optional attribute: durability
+    if ((retval = acceptDurability(config, &d_durability)) != PARSE_OK) {
+        return retval;
+    }
+
     // While there remain more elements on the stack
-    while (elements.length() > 0) {
-        std::shared_ptr<CFGElement> element = elements.front();
-        d_parse_stack.push_back(element->token());
+    while (peek(reader) != nullptr) {
+        const config_element_t *element = peek(reader);
+        d_parse_stack.push_back(element->token);
 
-        switch (element->token()) {
+        switch (element->token) {
         case T_RESOURCE_URI_OPEN:
-            retval = acceptResourceURI(elements);
+            retval = acceptResourceURI(reader);
             break;
         case T_VALIDATE_OPEN:
-            retval = acceptValidate(elements);
+            retval = acceptValidate(reader);
             break;
         case T_BACKUP_OPEN:
-            retval = acceptBackup(elements);
+            retval = acceptBackup(reader);
             break;
         case T_OPERATION_OPEN:
-            retval = acceptOperations(elements);
+            retval = acceptOperations(reader);
             break;
 
         default:
@@ -128,78 +319,80 @@ ParseStatus Parser::acceptConfiguration(QVector<std::shared_ptr<CFGElement>>& el
     return retval;
 }
 
-ParseStatus Parser::acceptFile (QVector<std::shared_ptr<CFGElement>>& elements,
+ParseStatus Parser::acceptFile (ConfigReader &reader,
                               QString *value_p)
 {
     ParseStatus retval = PARSE_OK;
     Q_ASSERT(value_p != nullptr);
 
-    // Pop the lead element off the stack
-    std::shared_ptr<CFGElement> file = next(elements);
+    // Take the lead element
+    const config_element_t *file = take(reader);
 
     // Copy value to pointer
-    (*value_p) = QString(file->value());
+    (*value_p) = file->value.toString();
 
     return retval;
 }
 
-ParseStatus Parser::acceptDirectory (QVector<std::shared_ptr<CFGElement>>& elements,
+ParseStatus Parser::acceptDirectory (ConfigReader &reader,
                                    QString *value_p)
 {
     ParseStatus retval = PARSE_OK;
     Q_ASSERT(value_p != nullptr);
 
-    // Pop the lead element off the stack
-    std::shared_ptr<CFGElement> directory = next(elements);
+    // Take the lead element
+    const config_element_t *directory = take(reader);
 
     // Copy value to pointer
-    (*value_p) = QString(directory->value());
+    (*value_p) = directory->value.toString();
 
     return retval;
 }
 
-ParseStatus Parser::acceptBackup (QVector<std::shared_ptr<CFGElement>>& elements)
+ParseStatus Parser::acceptBackup (ConfigReader &reader)
 {
     ParseStatus retval = PARSE_OK;
     QString temp_path_value = nullptr;
-    std::shared_ptr<CFGElement> backup;
+    const config_element_t *backup;
 
-    // Pop the lead element off the stack
-    if ((backup = next(elements)) == nullptr) {
+    // Take the lead element
+    if ((backup = take(reader)) == nullptr) {
         return PARSE_INVALID_ELEMENT;
     } else {
-        d_parse_stack.push_back(backup->token());
+        d_parse_stack.push_back(backup->token);
     }
 
     // Extract expected attributes
-    QVector<attribute_kp_pair> req_atts = QVector<attribute_kp_pair>({
+    const std::initializer_list<attribute_kp_pair> req_atts = {
         {ATTRIBUTE_KEY_PATH, &d_backup_path}
-    });
+    };
     if (!hasAttributeKeys(backup, req_atts)) {
         return PARSE_INVALID_ATTRIBUTE_KEY;
     }
 
     // While we encounter elements of type: {file, directory}
     bool more = true;
-    while (elements.length() > 0 && more) {
-        std::shared_ptr<CFGElement> element = elements.front();
-        d_parse_stack.push_back(element->token());
+    while (peek(reader) != nullptr && more) {
+        const config_element_t *element = peek(reader);
+        d_parse_stack.push_back(element->token);
 
-        switch (element->token()) {
+        switch (element->token) {
         case T_FILE_OPEN:
-            retval = acceptFile(elements, &temp_path_value);
+            retval = acceptFile(reader, &temp_path_value);
             qInfo() << "backup to: " << QDir(d_backup_path).filePath(dropNameAndRootPrefix(temp_path_value));
             d_backup_operations.push_back(std::make_shared<CopyOperation>(CopyOperation(
               Resource(QString(temp_path_value), RESOURCE_TYPE_FILE),
-              Resource(QDir(d_backup_path).filePath(dropNameAndRootPrefix(temp_path_value)),RESOURCE_TYPE_FILE))
+              Resource(QDir(d_backup_path).filePath(dropNameAndRootPrefix(temp_path_value)),RESOURCE_TYPE_FILE),
+              d_incremental, d_cache_mode)
             ));
             break;
         case T_DIRECTORY_OPEN:
-            retval = acceptDirectory(elements, &temp_path_value);
+            retval = acceptDirectory(reader, &temp_path_value);
             qInfo() << "backup to: " << QDir(d_backup_path).filePath(dropNameAndRootPrefix(temp_path_value));
             d_backup_operations.push_back(std::make_shared<CopyOperation>(CopyOperation(
               Resource(QString(temp_path_value), RESOURCE_TYPE_DIRECTORY),
-              Resource(QDir(d_backup_path).filePath(dropNameAndRootPrefix(temp_path_value)), RESOURCE_TYPE_DIRECTORY))
+              Resource(QDir(d_backup_path).filePath(dropNameAndRootPrefix(temp_path_value)), RESOURCE_TYPE_DIRECTORY),
+              d_incremental, d_cache_mode)
             ));
             break;
         default:
@@ -222,35 +415,46 @@ ParseStatus Parser::acceptBackup (QVector<std::shared_ptr<CFGElement>>& elements
     return retval;
 }
 
-ParseStatus Parser::acceptValidate (QVector<std::shared_ptr<CFGElement>>& elements)
+ParseStatus Parser::acceptValidate (ConfigReader &reader)
 {
     ParseStatus retval = PARSE_OK;
     QString temp_path_value = nullptr;
-    std::shared_ptr<CFGElement> validate;
+    QByteArray temp_digest_value, temp_merkle_value;
+    const config_element_t *validate;
+    std::shared_ptr<ExpectOperation> expect;
 
-    // Pop the lead element off the stack
-    if ((validate = next(elements)) == nullptr) {
+    // Take the lead element
+    if ((validate = take(reader)) == nullptr) {
         return PARSE_INVALID_ELEMENT;
     } else {
-        d_parse_stack.push_back(validate->token());
+        d_parse_stack.push_back(validate->token);
+    }
+
+    // Optional attribute: pipelined (verify checksums while copying)
+    if ((retval = acceptFlag(validate, ATTRIBUTE_KEY_PIPELINED, &d_pipelined)) != PARSE_OK) {
+        return retval;
     }
 
     // While we encounter elements of type: {file, directory}
     bool more = true;
-    while (elements.length() > 0 && more) {
-        std::shared_ptr<CFGElement> element = elements.front();
-        d_parse_stack.push_back(element->token());
+    while (peek(reader) != nullptr && more) {
+        const config_element_t *element = peek(reader);
+        d_parse_stack.push_back(element->token);
 
-        switch (element->token()) {
+        switch (element->token) {
         case T_FILE_OPEN:
-            retval = acceptFile(elements, &temp_path_value);
-            d_validate_operations.push_back(
-                std::make_shared<ExpectOperation>(ExpectOperation(Resource(QString(temp_path_value), RESOURCE_TYPE_FILE,
-                                         RESOURCE_KEY_REMOTE)))
-            );
+            if ((retval = acceptDigest(element, ATTRIBUTE_KEY_SHA256, &temp_digest_value)) != PARSE_OK ||
+                (retval = acceptDigest(element, ATTRIBUTE_KEY_MERKLE, &temp_merkle_value)) != PARSE_OK) {
+                break;
+            }
+            retval = acceptFile(reader, &temp_path_value);
+            expect = std::make_shared<ExpectOperation>(ExpectOperation(Resource(QString(temp_path_value), RESOURCE_TYPE_FILE,
+                                                                                RESOURCE_KEY_REMOTE), temp_digest_value));
+            expect->setMerkleRoot(temp_merkle_value);
+            d_validate_operations.push_back(expect);
             break;
         case T_DIRECTORY_OPEN:
-            retval = acceptDirectory(elements, &temp_path_value);
+            retval = acceptDirectory(reader, &temp_path_value);
             d_validate_operations.push_back(
                 std::make_shared<ExpectOperation>(ExpectOperation(Resource(QString(temp_path_value), RESOURCE_TYPE_DIRECTORY,
                                          RESOURCE_KEY_REMOTE)))
@@ -277,43 +481,43 @@ ParseStatus Parser::acceptValidate (QVector<std::shared_ptr<CFGElement>>& elemen
     return retval;
 }
 
-ParseStatus Parser::acceptResourceURI(QVector<std::shared_ptr<CFGElement>>& elements)
+ParseStatus Parser::acceptResourceURI(ConfigReader &reader)
 {
     ParseStatus retval = PARSE_OK;
 
-    // Pop the lead element off the stack
-    std::shared_ptr<CFGElement> resourceURI = next(elements);
+    // Take the lead element
+    const config_element_t *resourceURI = take(reader);
 
     // Copy URI to ordered vector
-    d_resource_uris.append(QString(resourceURI->value()));
+    d_resource_uris.append(resourceURI->value.toString());
 
     return retval;
 }
 
-ParseStatus Parser::acceptOperations(QVector<std::shared_ptr<CFGElement>>& elements)
+ParseStatus Parser::acceptOperations(ConfigReader &reader)
 {
     ParseStatus retval = PARSE_OK;
-    std::shared_ptr<CFGElement> operations;
+    const config_element_t *operations;
 
-    // Pop the lead element off the stack
-    if ((operations = next(elements)) == nullptr) {
+    // Take the lead element
+    if ((operations = take(reader)) == nullptr) {
         return PARSE_INVALID_ELEMENT;
     } else {
-        d_parse_stack.push_back(operations->token());
+        d_parse_stack.push_back(operations->token);
     }
 
     // While we encounter elements of type: {copy, remove}
     bool more = true;
-    while (elements.length() > 0 && more) {
-        std::shared_ptr<CFGElement> element = elements.front();
-        d_parse_stack.push_back(element->token());
+    while (peek(reader) != nullptr && more) {
+        const config_element_t *element = peek(reader);
+        d_parse_stack.push_back(element->token);
 
-        switch (element->token()) {
+        switch (element->token) {
         case T_COPY_OPEN:
-            retval = acceptCopy(elements);
+            retval = acceptCopy(reader);
             break;
         case T_REMOVE_OPEN:
-            retval = acceptRemove(elements);
+            retval = acceptRemove(reader);
             break;
         default:
             more = false;
@@ -335,36 +539,51 @@ ParseStatus Parser::acceptOperations(QVector<std::shared_ptr<CFGElement>>& eleme
     return retval;
 }
 
-ParseStatus Parser::acceptCopy(QVector<std::shared_ptr<CFGElement>>& elements)
+ParseStatus Parser::acceptCopy(ConfigReader &reader)
 {
     ParseStatus retval = PARSE_OK;
-    std::shared_ptr<CFGElement> copy;
+    const config_element_t *copy;
     resource_root_key_t from_root = RESOURCE_KEY_ENUM_MAX;
     resource_root_key_t to_root = RESOURCE_KEY_ENUM_MAX;
 
     QString from_path = nullptr, to_path = nullptr;
     QString from_root_value = nullptr, to_root_value = nullptr;
+    bool incremental = d_incremental;
+    cache_mode_t cache_mode = d_cache_mode;
     off_t i = -1;
 
-    // Pop the lead element off the stack
-    if ((copy = next(elements)) == nullptr) {
+    // Take the lead element
+    if ((copy = take(reader)) == nullptr) {
         return PARSE_INVALID_ELEMENT;
     }
 
+    // Optional attribute: incremental (overrides the configuration default)
+    if ((retval = acceptFlag(copy, ATTRIBUTE_KEY_INCREMENTAL, &incremental)) != PARSE_OK) {
+        return retval;
+    }
+
+    // Optional attribute: cache (overrides the configuration default)
+    if ((retval = acceptCacheMode(copy, &cache_mode)) != PARSE_OK) {
+        return retval;
+    }
+
     // Require element: from
-    d_parse_stack.push_back(elements.front()->token());
-    if (elements.front()->token() != T_FROM_OPEN) {
+    if (peek(reader) == nullptr) {
+        return PARSE_INVALID_ELEMENT;
+    }
+    d_parse_stack.push_back(peek(reader)->token);
+    if (peek(reader)->token != T_FROM_OPEN) {
         return PARSE_INVALID_ELEMENT;
     }
-    if ((retval = acceptFrom(elements, &from_root_value, &from_path)) != PARSE_OK) {
+    if ((retval = acceptFrom(reader, &from_root_value, &from_path)) != PARSE_OK) {
         return retval;
     }
 
-    // Valid attribute vector
-    QVector<attribute_value_t> valid_attribute_index({
+    // Valid attribute values
+    const std::initializer_list<attribute_value_t> valid_attribute_index = {
         ATTRIBUTE_VALUE_REMOTE,
         ATTRIBUTE_VALUE_TARGET
-    });
+    };
 
     // CFGRootType array with index parity
     resource_root_key_t valid_root_index[] = {RESOURCE_KEY_REMOTE, RESOURCE_KEY_ROOT};
@@ -378,11 +597,14 @@ ParseStatus Parser::acceptCopy(QVector<std::shared_ptr<CFGElement>>& elements)
     d_parse_stack.pop_back();
 
     // Require element: to
-    d_parse_stack.push_back(elements.front()->token());
-    if (elements.front()->token() != T_TO_OPEN) {
+    if (peek(reader) == nullptr) {
         return PARSE_INVALID_ELEMENT;
     }
-    if ((retval = acceptTo(elements, &to_root_value, &to_path)) != PARSE_OK) {
+    d_parse_stack.push_back(peek(reader)->token);
+    if (peek(reader)->token != T_TO_OPEN) {
+        return PARSE_INVALID_ELEMENT;
+    }
+    if ((retval = acceptTo(reader, &to_root_value, &to_path)) != PARSE_OK) {
         return retval;
     }
 
@@ -397,13 +619,14 @@ ParseStatus Parser::acceptCopy(QVector<std::shared_ptr<CFGElement>>& elements)
     // Push copy operation
     d_update_operations.push_back(std::make_shared<CopyOperation>(CopyOperation(
         Resource(from_path, RESOURCE_TYPE_FILE, from_root),
-        Resource(to_path, RESOURCE_TYPE_DIRECTORY, to_root))
+        Resource(to_path, RESOURCE_TYPE_DIRECTORY, to_root),
+        incremental, cache_mode)
     ));
 
     return retval;
 }
 
-ParseStatus Parser::acceptFrom(QVector<std::shared_ptr<CFGElement>>& elements,
+ParseStatus Parser::acceptFrom(ConfigReader &reader,
                              QString *root_p,
                              QString *value_p)
 {
@@ -411,24 +634,24 @@ ParseStatus Parser::acceptFrom(QVector<std::shared_ptr<CFGElement>>& elements,
     Q_ASSERT(root_p != nullptr);
     Q_ASSERT(value_p != nullptr);
 
-    // Pop the lead element off the stack
-    std::shared_ptr<CFGElement> from = next(elements);
+    // Take the lead element
+    const config_element_t *from = take(reader);
 
     // Require attributes: {root}
-    QVector<attribute_kp_pair> req_atts = QVector<attribute_kp_pair>({
+    const std::initializer_list<attribute_kp_pair> req_atts = {
         {ATTRIBUTE_KEY_ROOT, root_p}
-    });
+    };
     if (!hasAttributeKeys(from, req_atts)) {
         return PARSE_INVALID_ATTRIBUTE_KEY;
     }
 
     // Copy value to pointer
-    (*value_p) = QString(from->value());
+    (*value_p) = from->value.toString();
 
     return retval;
 }
 
-ParseStatus Parser::acceptTo(QVector<std::shared_ptr<CFGElement>>& elements,
+ParseStatus Parser::acceptTo(ConfigReader &reader,
                            QString *root_p,
                            QString *value_p)
 {
@@ -436,38 +659,38 @@ ParseStatus Parser::acceptTo(QVector<std::shared_ptr<CFGElement>>& elements,
     Q_ASSERT(root_p != nullptr);
     Q_ASSERT(value_p != nullptr);
 
-    // Pop the lead element off the stack
-    std::shared_ptr<CFGElement> to = next(elements);
+    // Take the lead element
+    const config_element_t *to = take(reader);
 
     // Require attributes: {root}
-    QVector<attribute_kp_pair> req_atts = QVector<attribute_kp_pair>({
+    const std::initializer_list<attribute_kp_pair> req_atts = {
         {ATTRIBUTE_KEY_ROOT, root_p}
-    });
+    };
     if (!hasAttributeKeys(to, req_atts)) {
         return PARSE_INVALID_ATTRIBUTE_KEY;
     }
 
     // Copy value to pointer
-    (*value_p) = QString(to->value());
+    (*value_p) = to->value.toString();
 
     return retval;
 }
 
-ParseStatus Parser::acceptRemove(QVector<std::shared_ptr<CFGElement>>& elements)
+ParseStatus Parser::acceptRemove(ConfigReader &reader)
 {
     ParseStatus retval = PARSE_OK;
     QString root_value_raw = nullptr;
     attribute_value_t root_value = ATTRIBUTE_VALUE_ENUM_MAX;
-    Attributes a = Attributes::get_instance();
+    Attributes &a = Attributes::get_instance();
     resource_root_key_t root_type = RESOURCE_KEY_ENUM_MAX;
 
-    // Pop the lead element off the stack
-    std::shared_ptr<CFGElement> remove = next(elements);
+    // Take the lead element
+    const config_element_t *remove = take(reader);
 
     // Require attributes: {root}
-    QVector<attribute_kp_pair> req_atts = QVector<attribute_kp_pair>({
+    const std::initializer_list<attribute_kp_pair> req_atts = {
         {ATTRIBUTE_KEY_ROOT, &root_value_raw}
-    });
+    };
     if (!hasAttributeKeys(remove, req_atts)) {
         return PARSE_INVALID_ATTRIBUTE_KEY;
     }
@@ -485,13 +708,12 @@ ParseStatus Parser::acceptRemove(QVector<std::shared_ptr<CFGElement>>& elements)
 
     // Create a new resource
     std::shared_ptr<Resource> resource = std::make_shared<Resource>(
-        QString(remove->value()),
+        remove->value.toString(),
         RESOURCE_TYPE_FILE,
         root_type
     );
 
-    qDebug() << "acceptRemove(): " << remove.get()->description();
-    qDebug() << "acceptRemove(): " << remove->value() ;
+    qDebug() << "acceptRemove(): " << remove->value.toString();
 
     // Append remove operation
     d_update_operations.push_back(
@@ -526,7 +748,7 @@ QString Parser::fault()
     }
 
     for (off_t i = d_parse_stack.length() - 1; i >= 0; --i) {
-        description += g_token_lexeme_map[d_parse_stack[i]];
+        description += Machine::lexeme(d_parse_stack[i]);
         if (i > 0) {
             description += " in\n\t";
         }
@@ -554,6 +776,31 @@ QString Parser::backup_path()
     return d_backup_path;
 }
 
+bool Parser::incremental()
+{
+    return d_incremental;
+}
+
+bool Parser::pipelined()
+{
+    return d_pipelined;
+}
+
+unsigned Parser::queue_depth()
+{
+    return d_queue_depth;
+}
+
+cache_mode_t Parser::cache_mode()
+{
+    return d_cache_mode;
+}
+
+Durability Parser::durability()
+{
+    return d_durability;
+}
+
 QVector<std::shared_ptr<SWU::FSOperation>> Parser::validate_operations()
 {
     return d_validate_operations;
@@ -3,10 +3,13 @@
 
 #include <QtDebug>
 #include <QDir>
+#include <QVector>
+#include <initializer_list>
 #include "attributes.h"
-#include "cfgelement.h"
+#include "configreader.h"
 #include "resource.h"
 #include "fsoperation.h"
+#include "ioring.h"
 
 namespace SWU {
 
@@ -32,6 +35,9 @@ private:
     // Status of the parser
     ParseStatus d_status;
 
+    // Index of the next element to parse
+    size_t d_cursor;
+
     // Parse error stack
     QVector<SWU::Token> d_parse_stack;
 
@@ -44,6 +50,21 @@ private:
     // Path (implicitly on target) at which to backup specified files/directories
     QString d_backup_path;
 
+    // Default copy mode: only copy files whose content differs
+    bool d_incremental;
+
+    // Verify checksummed files while they are copied instead of in advance
+    bool d_pipelined;
+
+    // Requests kept in flight by batched (io_uring) I/O; 0 disables batching
+    unsigned d_queue_depth;
+
+    // Default page cache policy of copies
+    SWU::cache_mode_t d_cache_mode;
+
+    // How much of the update is synced to disk, and when
+    SWU::Durability d_durability;
+
     // Validation operations for files and directories (implicitly on resource)
     QVector<std::shared_ptr<SWU::FSOperation>> d_validate_operations;
 
@@ -53,96 +74,164 @@ private:
     // Operations (copy/remove files from/to target and resource)
     QVector<std::shared_ptr<SWU::FSOperation>> d_update_operations;
 
-    bool hasAttributeKeys (std::shared_ptr<CFGElement> element,
-                           QVector<attribute_kp_pair> key_pointer_pairs);
+    bool hasAttributeKeys (const config_element_t *element,
+                           std::initializer_list<attribute_kp_pair> key_pointer_pairs);
 
-    off_t attributeValueInSet (QString raw_attribute,
-                               QVector<attribute_value_t> values);
+    off_t attributeValueInSet (const QString &raw_attribute,
+                               std::initializer_list<attribute_value_t> values);
 
+    /*\
+     * Returns the element at the cursor (nullptr past the last one)
+     * - reader: Reader of the configuration
+    \*/
+    const config_element_t *peek (SWU::ConfigReader &reader);
+
+    /*\
+     * Returns the element at the cursor and moves the cursor past it
+     * - reader: Reader of the configuration
+    \*/
+    const config_element_t *take (SWU::ConfigReader &reader);
 
     /*\
-     * Returns OK if configuration could be parsed (mutates elements)
-     * - elements: Ordered stack of elements
+     * Returns OK if the optional boolean attribute is absent (flag untouched)
+     * or holds "true"/"false" (flag assigned)
+     * - element: Element carrying the attribute
+     * - key: Attribute key
+     * - flag_p: Pointer at which to store the value
     \*/
-    ParseStatus acceptConfiguration(QVector<std::shared_ptr<SWU::CFGElement>>& elements);
+    ParseStatus acceptFlag (const config_element_t *element,
+                            attribute_key_t key, bool *flag_p);
 
     /*\
-     * Returns OK if a file could be parsed from the stack (mutates elements)
-     * - elements: Ordered stack of elements
+     * Returns OK if the optional numeric attribute is absent (value untouched)
+     * or holds a non-negative integer no larger than "max" (value assigned)
+     * - element: Element carrying the attribute
+     * - key: Attribute key
+     * - max: Largest accepted value
+     * - value_p: Pointer at which to store the value
+    \*/
+    ParseStatus acceptNumber (const config_element_t *element,
+                              attribute_key_t key, unsigned max, unsigned *value_p);
+
+    /*\
+     * Returns OK if the optional digest attribute (sha256, merkle) is absent
+     * (digest emptied) or holds a hex encoded SHA-256 digest (digest assigned)
+     * - element: Element carrying the attribute
+     * - key: Attribute key
+     * - digest_p: Pointer at which to store the raw digest
+    \*/
+    ParseStatus acceptDigest (const config_element_t *element,
+                              attribute_key_t key, QByteArray *digest_p);
+
+    /*\
+     * Returns OK if the optional cache attribute is absent (mode untouched)
+     * or holds "cached"/"streaming" (mode assigned)
+     * - element: Element carrying the attribute
+     * - mode_p: Pointer at which to store the mode
+    \*/
+    ParseStatus acceptCacheMode (const config_element_t *element,
+                                 SWU::cache_mode_t *mode_p);
+
+    /*\
+     * Returns OK if the optional durability attribute is absent (level
+     * untouched) or holds "none"/"phase"/"file" (level assigned)
+     * - element: Element carrying the attribute
+     * - durability_p: Pointer at which to store the level
+    \*/
+    ParseStatus acceptDurability (const config_element_t *element,
+                                  SWU::Durability *durability_p);
+
+
+    /*\
+     * Hands the digests of every validated file over to the update copy that
+     * reads it (pipelined mode), so the file is read from the media once
+    \*/
+    void linkPipelinedDigests ();
+
+    /*\
+     * Returns OK if configuration could be read from the reader (takes its elements)
+     * - reader: Reader of the configuration
+    \*/
+    ParseStatus acceptConfiguration(SWU::ConfigReader &reader);
+
+    /*\
+     * Returns OK if a file could be read from the reader (takes its elements)
+     * - reader: Reader of the configuration
      * - value_p: Filepath contained within the element
     \*/
-    ParseStatus acceptFile (QVector<std::shared_ptr<SWU::CFGElement>>& elements,
+    ParseStatus acceptFile (SWU::ConfigReader &reader,
                           QString *value_p);
 
     /*\
-     * Returns OK if a directory could be parsed from the stack (mutates elements)
-     * - elements: Ordered stack of elements
+     * Returns OK if a directory could be read from the reader (takes its elements)
+     * - reader: Reader of the configuration
      * - value_p: Directory path contained within the element
     \*/
-    ParseStatus acceptDirectory (QVector<std::shared_ptr<SWU::CFGElement>>& elements,
+    ParseStatus acceptDirectory (SWU::ConfigReader &reader,
                                QString *value_p);
 
     /*\
-     * Returns OK if a backup set could be parsed from the stack (mutates elements)
-     * - elements: Ordered stack of elements
+     * Returns OK if a backup set could be read from the reader (takes its elements)
+     * - reader: Reader of the configuration
     \*/
-    ParseStatus acceptBackup (QVector<std::shared_ptr<SWU::CFGElement>>& elements);
+    ParseStatus acceptBackup (SWU::ConfigReader &reader);
 
     /*\
-     * Returns OK if a validate section could be parsed from the stack (mutates elements)
-     * - elements: Ordered stack of elements
+     * Returns OK if a validate section could be read from the reader (takes its elements)
+     * - reader: Reader of the configuration
     \*/
-    ParseStatus acceptValidate (QVector<std::shared_ptr<SWU::CFGElement>>& elements);
+    ParseStatus acceptValidate (SWU::ConfigReader &reader);
 
     /*\
-     * Returns OK if a resource URI could be parsed from the stack (mutates elements)
-     * - elements: Ordered stack of elements
+     * Returns OK if a resource URI could be read from the reader (takes its elements)
+     * - reader: Reader of the configuration
     \*/
-    ParseStatus acceptResourceURI(QVector<std::shared_ptr<SWU::CFGElement>>& elements);
+    ParseStatus acceptResourceURI(SWU::ConfigReader &reader);
 
     /*\
-     * Returns OK if a operations section could be parsed from the stack (mutates elements)
-     * - elements: Ordered stack of elements
+     * Returns OK if a operations section could be read from the reader (takes its elements)
+     * - reader: Reader of the configuration
     \*/
-    ParseStatus acceptOperations(QVector<std::shared_ptr<SWU::CFGElement>>& elements);
+    ParseStatus acceptOperations(SWU::ConfigReader &reader);
 
     /*\
-     * Returns OK if a copy operation could be parsed from the stack (mutates elements)
-     * - elements: Ordered stack of elements
+     * Returns OK if a copy operation could be read from the reader (takes its elements)
+     * - reader: Reader of the configuration
     \*/
-    ParseStatus acceptCopy(QVector<std::shared_ptr<SWU::CFGElement>>& elements);
+    ParseStatus acceptCopy(SWU::ConfigReader &reader);
 
     /*\
-     * Returns OK if a 'from' element could be parsed from the stack (mutates elements)
-     * - elements: Ordered stack of elements
+     * Returns OK if a 'from' element could be read from the reader (takes its elements)
+     * - reader: Reader of the configuration
      * - root_p: Pointer at which to store the value assigned to the root attribute
      * - value_p: Pointer at which to store the contents of the 'from' element
     \*/
-    ParseStatus acceptFrom(QVector<std::shared_ptr<SWU::CFGElement>>& elements,
+    ParseStatus acceptFrom(SWU::ConfigReader &reader,
                          QString *root_p, QString *value_p);
 
     /*\
-     * Returns OK if a 'to' element could be parsed from the stack (mutates elements)
-     * - elements: Ordered stack of elements
+     * Returns OK if a 'to' element could be read from the reader (takes its elements)
+     * - reader: Reader of the configuration
      * - root_p: Pointer at which to store the value assigned to the root attribute
      * - value_p: Pointer at which to store the contents of the 'to' element
     \*/
-    ParseStatus acceptTo(QVector<std::shared_ptr<SWU::CFGElement>>& elements,
+    ParseStatus acceptTo(SWU::ConfigReader &reader,
                          QString *root_p, QString *value_p);
 
     /*\
-     * Returns OK if a 'remove' element could be parsed from the stack (mutates elements)
-     * - elements: Ordered stack of elements
+     * Returns OK if a 'remove' element could be read from the reader (takes its elements)
+     * - reader: Reader of the configuration
     \*/
-    ParseStatus acceptRemove(QVector<std::shared_ptr<SWU::CFGElement>>& elements);
+    ParseStatus acceptRemove(SWU::ConfigReader &reader);
 
 public:
 
     /*\
-     * Parses element stack into local fields of the instance
-     * - elements: Constant ordered stack of elements (not mutated)
+     * Parses the configuration into local fields of the instance, taking its
+     * elements from the reader as it goes
+     * - reader: Reader of the configuration (at its first element)
     \*/
-    Parser(const QVector<std::shared_ptr<SWU::CFGElement>>& elements);
+    Parser(SWU::ConfigReader &reader);
 
     /*\
      * Returns the parser status
@@ -175,6 +264,31 @@ public:
     \*/
     QString backup_path();
 
+    /*\
+     * Returns true if copies default to incremental mode
+    \*/
+    bool incremental();
+
+    /*\
+     * Returns true if checksums are verified during the update copies
+    \*/
+    bool pipelined();
+
+    /*\
+     * Returns the queue depth for batched I/O (0: batching disabled)
+    \*/
+    unsigned queue_depth();
+
+    /*\
+     * Returns the default page cache policy of copies
+    \*/
+    SWU::cache_mode_t cache_mode();
+
+    /*\
+     * Returns the durability level of the update
+    \*/
+    SWU::Durability durability();
+
     /*\
      * Returns ordered vector of validation operations
     \*/
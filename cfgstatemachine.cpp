@@ -1,4 +1,5 @@
 #include "cfgstatemachine.h"
+#include "lexemetable.h"
 
 using namespace SWU;
 
@@ -10,125 +11,161 @@ using namespace SWU;
 */
 
 
-#define Q_XML_OPEN(x)         QString("<"  x ">")
-#define Q_XML_CLOSE(x)        QString("</" x ">")
-#define Q_TOK_PAIR(T1,T2,L)     [T1] = Q_XML_OPEN(L), [T2] = Q_XML_CLOSE(L)
-
-// State machine map (init to invalid states)
-static signed short g_map[N_Machine_States][T_ENUM_MAX] = {{FaultState}};
-
-// Array-designation map: Token to lexeme
-QString g_token_lexeme_map[T_ENUM_MAX] = {
-    Q_TOK_PAIR(T_CONFIGURATION_OPEN, T_CONFIGURATION_CLOSE, "configuration"),
-    Q_TOK_PAIR(T_RESOURCE_URI_OPEN, T_RESOURCE_URI_CLOSE, "resource-uri"),
-    Q_TOK_PAIR(T_VALIDATE_OPEN, T_VALIDATE_CLOSE, "validate"),
-    Q_TOK_PAIR(T_FILE_OPEN, T_FILE_CLOSE, "file"),
-    Q_TOK_PAIR(T_DIRECTORY_OPEN, T_DIRECTORY_CLOSE, "directory"),
-    Q_TOK_PAIR(T_BACKUP_OPEN, T_BACKUP_CLOSE, "backup"),
-    Q_TOK_PAIR(T_OPERATION_OPEN, T_OPERATION_CLOSE, "operations"),
-    Q_TOK_PAIR(T_COPY_OPEN, T_COPY_CLOSE, "copy"),
-    Q_TOK_PAIR(T_FROM_OPEN, T_FROM_CLOSE, "from"),
-    Q_TOK_PAIR(T_TO_OPEN, T_TO_CLOSE, "to"),
-    Q_TOK_PAIR(T_REMOVE_OPEN, T_REMOVE_CLOSE, "remove")
+// Transition of the state machine
+struct transition_t {
+    signed short from;
+    Token token;
+    signed short to;
 };
 
+// State machine table (every transition not listed leads to the fault state)
+struct transition_table_t {
+    signed short next[N_Machine_States][T_ENUM_MAX];
+};
 
-/*
- *******************************************************************************
- *                          Class definition: Machine                          *
- *******************************************************************************
-*/
-
+// Transitions of the state machine
+static constexpr transition_t g_transitions[] = {
 
-Machine::Machine(QObject *parent) : QObject(parent)
-{
-    // Initialise the states
-    init_states();
-
-    // Initialize the hashmap
-    for (off_t t = 0; t < T_ENUM_MAX; ++t) {
-        d_token_hash_map[g_token_lexeme_map[t]] = static_cast<Token>(t);
-    }
-}
-
-void Machine::init_states ()
-{
     // State 0
-    g_map[0][T_CONFIGURATION_OPEN]  = 1;
+    {0,  T_CONFIGURATION_OPEN,  1},
 
     // State 1
-    g_map[1][T_RESOURCE_URI_OPEN]   = 2;
-    g_map[1][T_VALIDATE_OPEN]       = 3;
-    g_map[1][T_BACKUP_OPEN]         = 6;
-    g_map[1][T_OPERATION_OPEN]      = 9;
-    g_map[1][T_CONFIGURATION_CLOSE] = FinalState;
+    {1,  T_RESOURCE_URI_OPEN,   2},
+    {1,  T_VALIDATE_OPEN,       3},
+    {1,  T_BACKUP_OPEN,         6},
+    {1,  T_OPERATION_OPEN,      9},
+    {1,  T_CONFIGURATION_CLOSE, FinalState},
 
     // State 2
-    g_map[2][T_RESOURCE_URI_CLOSE]  = 1;
+    {2,  T_RESOURCE_URI_CLOSE,  1},
 
     // State 3
-    g_map[3][T_VALIDATE_CLOSE]      = 1;
-    g_map[3][T_FILE_OPEN]           = 4;
-    g_map[3][T_DIRECTORY_OPEN]      = 5;
+    {3,  T_VALIDATE_CLOSE,      1},
+    {3,  T_FILE_OPEN,           4},
+    {3,  T_DIRECTORY_OPEN,      5},
 
     // State 4
-    g_map[4][T_FILE_CLOSE]          = 3;
+    {4,  T_FILE_CLOSE,          3},
 
     // State 5
-    g_map[5][T_DIRECTORY_CLOSE]     = 3;
+    {5,  T_DIRECTORY_CLOSE,     3},
 
     // State 6
-    g_map[6][T_FILE_OPEN]           = 7;
-    g_map[6][T_DIRECTORY_OPEN]      = 8;
-    g_map[6][T_BACKUP_CLOSE]        = 1;
+    {6,  T_FILE_OPEN,           7},
+    {6,  T_DIRECTORY_OPEN,      8},
+    {6,  T_BACKUP_CLOSE,        1},
 
     // State 7
-    g_map[7][T_FILE_CLOSE]          = 6;
+    {7,  T_FILE_CLOSE,          6},
 
     // State 8
-    g_map[8][T_DIRECTORY_CLOSE]     = 6;
+    {8,  T_DIRECTORY_CLOSE,     6},
 
     // State 9
-    g_map[9][T_COPY_OPEN]           = 10;
-    g_map[9][T_REMOVE_OPEN]         = 15;
-    g_map[9][T_OPERATION_CLOSE]     = 1;
+    {9,  T_COPY_OPEN,           10},
+    {9,  T_REMOVE_OPEN,         15},
+    {9,  T_OPERATION_CLOSE,     1},
 
     // State 10
-    g_map[10][T_FROM_OPEN]          = 11;
+    {10, T_FROM_OPEN,           11},
 
     // State 11
-    g_map[11][T_FROM_CLOSE]         = 12;
+    {11, T_FROM_CLOSE,          12},
 
     // State 12
-    g_map[12][T_TO_OPEN]            = 13;
+    {12, T_TO_OPEN,             13},
 
     // State 13
-    g_map[13][T_TO_CLOSE]           = 14;
+    {13, T_TO_CLOSE,            14},
 
     // State 14
-    g_map[14][T_COPY_CLOSE]         = 9;
+    {14, T_COPY_CLOSE,          9},
 
     // State 15
-    g_map[15][T_REMOVE_CLOSE]       = 9;
+    {15, T_REMOVE_CLOSE,        9}
+};
+
+/* Builds the state machine table from the transitions (at compile time) */
+static constexpr transition_table_t make_transition_table ()
+{
+    transition_table_t table = {};
+    for (size_t s = 0; s < N_Machine_States; ++s) {
+        for (size_t t = 0; t < T_ENUM_MAX; ++t) {
+            table.next[s][t] = FaultState;
+        }
+    }
+    for (const transition_t &transition : g_transitions) {
+        table.next[transition.from][transition.token] = transition.to;
+    }
+    return table;
 }
 
+// State machine map
+static constexpr transition_table_t g_map = make_transition_table();
+
+// Tag names, in the order of their opening tokens (each closing token follows)
+static constexpr const char *g_tag_names[T_ENUM_MAX / 2] = {
+    "configuration",
+    "resource-uri",
+    "validate",
+    "file",
+    "directory",
+    "backup",
+    "operations",
+    "copy",
+    "from",
+    "to",
+    "remove"
+};
+
+// Map: Tag names -> Opening tokens
+static constexpr LexemeTable<T_ENUM_MAX / 2, 32> g_tag_table(g_tag_names);
+
+
+/*
+ *******************************************************************************
+ *                          Class definition: Machine                          *
+ *******************************************************************************
+*/
+
+
+Machine::Machine(QObject *parent) : QObject(parent)
+{}
+
 Status Machine::input(Token t)
 {
-    d_state = g_map[d_state][t];
+    d_state = g_map.next[d_state][t];
     return status();
 }
 
-Status Machine::input(QString t, Token *t_ptr)
+Status Machine::input(const QString &name, bool closing, Token *t_ptr)
+{
+    return input_index(g_tag_table.find(name), closing, t_ptr);
+}
+
+Status Machine::input(const char *name, size_t length, bool closing, Token *t_ptr)
+{
+    return input_index(g_tag_table.find(name, length), closing, t_ptr);
+}
+
+Status Machine::input_index(int index, bool closing, Token *t_ptr)
 {
-    // Lookup the token for the lexeme
-    QMap<QString, Token>::const_iterator iter = d_token_hash_map.find(t);
-    if (iter == d_token_hash_map.end()) {
+    // Lookup the token for the tag name (an unknown one is a fault, as any
+    // token without a transition)
+    if (index < 0) {
+        d_state = FaultState;
         return STATUS_FAULT;
     }
+    Token t = static_cast<Token>(2 * index + (closing ? 1 : 0));
     if (t_ptr != nullptr) {
-        *t_ptr = iter.value();
+        *t_ptr = t;
     }
-    return input(iter.value());
+    return input(t);
+}
+
+QString Machine::lexeme(Token t)
+{
+    return QString(t % 2 == 0 ? "<" : "</") + g_tag_table.lexeme(t / 2) + ">";
 }
 
 Status Machine::status()
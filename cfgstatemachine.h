@@ -2,7 +2,7 @@
 #define CFGSTATEMACHINE_H
 
 #include <QObject>
-#include <QMap>
+#include <QString>
 
 namespace SWU {
 
@@ -58,11 +58,8 @@ private:
     // Internal state
     unsigned short d_state = 0;
 
-    // Map: Lexemes -> Tokens
-    QMap<QString, Token> d_token_hash_map;
-
-    // Setup state machine
-    void init_states ();
+    // Input: index of a tag name (-1: unknown), opening or closing
+    Status input_index (int index, bool closing, Token *t_ptr);
 
 public:
     explicit Machine(QObject *parent = nullptr);
@@ -70,12 +67,18 @@ public:
     // Input: token
     Status input (Token t);
 
-    // Input: lexeme
-    Status input (QString lex, Token *t_ptr = nullptr);
+    // Input: tag name, opening or closing (looked up without allocating)
+    Status input (const QString &name, bool closing, Token *t_ptr = nullptr);
+
+    // Input: tag name as "length" bytes of UTF-8, opening or closing
+    Status input (const char *name, size_t length, bool closing, Token *t_ptr = nullptr);
 
     // Get: machine status
     Status status ();
 
+    // Get: tag of a token, as written ("<name>" or "</name>")
+    static QString lexeme (Token t);
+
     // Reset the machine to its initial state
     void reset ();
 signals:
@@ -1,8 +1,79 @@
 #include "cfgupdater.h"
+#include "workpool.h"
+#include "ioring.h"
+#include "opgraph.h"
+#include "journal.h"
+#include "bundle.h"
+#include "planner.h"
+#include "treewalker.h"
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <vector>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 using namespace SWU;
 
 
+// Name of the undo journal (in the backup directory)
+static const char *g_journal_name = ".swu-journal";
+
+
+// Returns true if both resource roots are on the same device (or unknown)
+static bool same_device (resource_root_key_t a, resource_root_key_t b)
+{
+    ResourceManager &resourceManager = ResourceManager::get_instance();
+    struct stat st_a, st_b;
+
+    if (-1 == stat(QFile::encodeName(resourceManager.getResourcePath(a)).constData(), &st_a) ||
+        -1 == stat(QFile::encodeName(resourceManager.getResourcePath(b)).constData(), &st_b)) {
+        return true;
+    }
+    return st_a.st_dev == st_b.st_dev;
+}
+
+
+// Folds the size and modification time of a file into the hash
+static void fold_identity (Sha256 &hash, const struct stat &st)
+{
+    const int64_t identity[3] = {st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+    hash.update(identity, sizeof(identity));
+}
+
+// Folds the identity of the file at "path" into the hash, or of every entry
+// below it for a directory (its own mtime misses changes further down)
+static void fold_source (Sha256 &hash, const QString &path)
+{
+    struct stat st;
+    walk_entry_t entry;
+
+    if (0 != stat(QFile::encodeName(path).constData(), &st)) {
+        return;
+    }
+    fold_identity(hash, st);
+    if (false == S_ISDIR(st.st_mode)) {
+        return;
+    }
+    TreeWalker walker(path);
+    while (walker.next(&entry)) {
+        const int32_t position[2] = {entry.event, entry.depth};
+        hash.update(position, sizeof(position));
+        if (entry.event == WALK_LEAVE_DIRECTORY || entry.event == WALK_ERROR) {
+            continue;
+        }
+        hash.update(entry.name, strlen(entry.name) + 1);
+        if (entry.event == WALK_FILE && 0 == fstatat(entry.parent->fd(), entry.name, &st, AT_SYMLINK_NOFOLLOW)) {
+            fold_identity(hash, st);
+        }
+    }
+}
+
+
 UpdateDelegate::UpdateDelegate() {};
 UpdateDelegate::~UpdateDelegate() = default;
 UpdateStatus UpdateDelegate::on_init (SWU::Updater &updater)
@@ -18,6 +89,13 @@ UpdateStatus UpdateDelegate::on_configure_resource_manager (
     Q_UNUSED(resource_uris);
     return STATUS_OK;
 }
+UpdateStatus UpdateDelegate::on_plan (SWU::Updater &updater, const update_plan_t &plan)
+{
+    Q_UNUSED(updater);
+    Q_UNUSED(plan);
+    return STATUS_OK;
+}
+
 UpdateStatus UpdateDelegate::on_pre_validate (std::shared_ptr<ExpectOperation> op, off_t index)
 {
     Q_UNUSED(op);
@@ -36,6 +114,13 @@ UpdateStatus UpdateDelegate::on_pre_update (std::shared_ptr<FSOperation> op, off
     Q_UNUSED(op);
     return STATUS_OK;
 }
+void UpdateDelegate::on_progress (SWU::Updater &updater, off_t done, off_t total, int eta)
+{
+    Q_UNUSED(updater);
+    Q_UNUSED(done);
+    Q_UNUSED(total);
+    Q_UNUSED(eta);
+}
 UpdateStatus UpdateDelegate::on_exit (SWU::Updater &updater,
                                       UpdateStatus status,
                                       std::shared_ptr<FSOperation> op,
@@ -56,8 +141,16 @@ Updater::Updater(std::shared_ptr<SWU::Parser> parser, UpdateDelegate &delegate):
     d_backup_path(parser->backup_path()),
     d_validate_sp(0),
     d_backup_sp(0),
-    d_update_sp(0)
+    d_update_sp(0),
+    d_durability(parser->durability()),
+    d_sync_time(std::chrono::steady_clock::duration::zero()),
+    d_plan(update_plan_t{std::vector<device_plan_t>(), 0, 0, -1, false}),
+    d_dry_run(false),
+    d_bytes_settled(0)
 {
+    // Batched I/O settings are process-wide
+    IoRing::setQueueDepth(parser->queue_depth());
+
     // Set: Validate operations
     for (off_t i = 0; i < parser->validate_operations().length(); ++i) {
         d_validate_operations.push_back(parser->validate_operations().at(i));
@@ -72,6 +165,16 @@ Updater::Updater(std::shared_ptr<SWU::Parser> parser, UpdateDelegate &delegate):
     for (off_t i = 0; i < parser->update_operations().length(); ++i) {
         d_update_operations.push_back(parser->update_operations().at(i));
     }
+
+    // Copies sync each file themselves only at the per-file level
+    for (auto ops : {&d_backup_operations, &d_update_operations}) {
+        for (auto op : *ops) {
+            std::shared_ptr<CopyOperation> c = std::dynamic_pointer_cast<CopyOperation>(op);
+            if (c != nullptr) {
+                c->setDurability(d_durability);
+            }
+        }
+    }
 }
 
 UpdateStatus Updater::execute()
@@ -98,62 +201,250 @@ UpdateStatus Updater::execute()
         return d_update_delegate.on_exit(*this, retval);
     }
 
-    // Run through operations block
-    while (d_validate_sp < d_validate_operations.length()) {
+    // Plan: nothing is stopped or changed unless the update fits, and its
+    // space is held until it commits (each copy takes its share as it starts).
+    // A dry run holds nothing: the planner's figures are all it reports.
+    plan();
+    SpaceReservation reservation;
+    if (d_plan.fits && false == d_dry_run && false == reservation.take(d_plan)) {
+        d_plan.fits = false;
+    }
+    if (false == d_plan.fits) {
+        return d_update_delegate.on_exit(*this, STATUS_BAD_PLAN);
+    }
+    if (d_dry_run) {
+        return d_update_delegate.on_exit(*this, STATUS_OK);
+    }
+    retval = d_update_delegate.on_plan(*this, d_plan);
+    if (STATUS_OK != retval) {
+        return d_update_delegate.on_exit(*this, retval);
+    }
+
+    // Recover from an interrupted update first (resume it if it was applying
+    // this very payload). A reclamation still running for an earlier update
+    // of this process owns the journal until it ends.
+    Graveyard::get_instance().wait();
+    QString root = ResourceManager::get_instance().getResourcePath(RESOURCE_KEY_ROOT);
+    QString journal_path = QDir(QDir(root).filePath(d_backup_path)).filePath(g_journal_name);
+    QByteArray payload = fingerprint();
+    journal_state_t state = journal_state_t();
+    if (false == Journal::recover(journal_path, payload, &state)) {
+        return d_update_delegate.on_exit(*this, STATUS_BAD_UNDO);
+    }
+    if (state.resumed) {
+        qInfo() << "resuming:" << state.completed[JOURNAL_PHASE_BACKUP].size() << "backups and"
+                << state.completed[JOURNAL_PHASE_UPDATE].size() << "updates done,"
+                << (state.checkpoints[JOURNAL_PHASE_BACKUP].size() + state.checkpoints[JOURNAL_PHASE_UPDATE].size())
+                << "copies part way";
+    }
+
+    // Plan: size every operation so that progress is weighted by bytes
+    measure();
+
+    // Run through validate block: every entry is verified by a task of its
+    // own (which streams and hashes its file), started right after its
+    // precondition passed on this thread. A result left at RESULT_ENUM_MAX
+    // marks an entry skipped after a refused precondition or failed backup.
+    off_t validate_base = d_validate_sp;
+    std::atomic<bool> validate_failed(false), validate_cancelled(false);
+    std::vector<OperationResult> validate_results(d_validate_operations.length() - validate_base, RESULT_ENUM_MAX);
+    WorkPool &pool = WorkPool::get_instance();
+    WorkGroup validate_group;
+    for (off_t i = validate_base; i < d_validate_operations.length(); ++i) {
         std::shared_ptr<ExpectOperation> e =
-                std::dynamic_pointer_cast<ExpectOperation>(d_validate_operations.at(d_validate_sp));
+                std::dynamic_pointer_cast<ExpectOperation>(d_validate_operations.at(i));
+        OperationResult *result_p = &validate_results[i - validate_base];
 
         // Precondition
-        if ((retval = d.on_pre_validate(e, d_validate_sp)) != STATUS_OK) {
+        if ((retval = d.on_pre_validate(e, i)) != STATUS_OK) {
+            validate_cancelled = true;
+            pool.wait(validate_group);
             return d_update_delegate.on_exit(*this, STATUS_BAD_PRECONDITION, e);
         }
 
         // Execute
-        if ((err = e.get()->execute()) != RESULT_OK) {
-            return d_update_delegate.on_exit(*this, STATUS_BAD_RESULT, e, err);
-        }
+        pool.submit(validate_group, [e, result_p, &validate_failed, &validate_cancelled] {
+            if (validate_cancelled.load()) {
+                return;
+            }
+            if (((*result_p) = e->execute()) != RESULT_OK) {
+                validate_failed = true;
+            }
+        });
+    }
 
-        // Increment offeset
-        d_validate_sp++;
+    // Validation reads the remote media and backups the target: if these are
+    // different devices, the backups run here while the entries are verified
+    if (d_backup_sp >= d_backup_operations.length() || same_device(RESOURCE_KEY_REMOTE, RESOURCE_KEY_ROOT)) {
+        pool.wait(validate_group);
+    }
+
+    // Journal: intents and completions of the backups and updates from here on
+    d_journal = std::make_shared<Journal>(journal_path);
+    if (false == d_journal->open(payload, state.resumed)) {
+        qCritical() << "Unable to open the journal at" << journal_path;
+        d_journal = nullptr;
+        validate_cancelled = true;
+        pool.wait(validate_group);
+        return d_update_delegate.on_exit(*this, STATUS_BAD_RESULT);
     }
 
-    // Run through backup block
-    while (d_backup_sp < d_backup_operations.length()) {
+    // Run through backup block (stops early once a validation failed)
+    UpdateStatus backup_status = STATUS_OK;
+    std::shared_ptr<CopyOperation> backup_op = nullptr;
+    OperationResult backup_err = RESULT_ENUM_MAX;
+    operation_record_t record;
+    while (d_backup_sp < d_backup_operations.length() && false == validate_failed.load()) {
         std::shared_ptr<CopyOperation> c =
                 std::dynamic_pointer_cast<CopyOperation>(d_backup_operations.at(d_backup_sp));
 
+        // Completed by the interrupted update of this payload
+        if (state.completed[JOURNAL_PHASE_BACKUP].count(d_backup_sp) > 0) {
+            settle(c);
+            d_backup_sp++;
+            continue;
+        }
+
         // Precondition
         if ((retval = d.on_pre_backup(c, d_backup_sp)) != STATUS_OK) {
-            return d_update_delegate.on_exit(*this, STATUS_BAD_PRECONDITION, c);
+            backup_status = STATUS_BAD_PRECONDITION;
+            backup_op = c;
+            break;
         }
 
-        // Execute
+        // Execute (the target is only read: no need to sync the intent first)
+        if (c->record(&record)) {
+            d_journal->intent(JOURNAL_PHASE_BACKUP, d_backup_sp, record);
+        }
+        prepare(c, JOURNAL_PHASE_BACKUP, d_backup_sp, state);
+        reservation.handOver(c->writes().first(), c->measure());
         if ((err = c.get()->execute()) != RESULT_OK) {
-            return d_update_delegate.on_exit(*this, STATUS_BAD_RESULT, c, err);
+            backup_status = STATUS_BAD_RESULT;
+            backup_op = c;
+            backup_err = err;
+            break;
         }
+        d_journal->done(JOURNAL_PHASE_BACKUP, d_backup_sp);
+        settle(c);
 
         // Increment pointer
         d_backup_sp++;
     }
 
-    // Run through update block (could be a remove, or copy operation)
-    while (d_update_sp < d_update_operations.length()) {
-        std::shared_ptr<FSOperation> op = d_update_operations.at(d_update_sp);
+    // Both phases must have succeeded before anything is updated
+    if (backup_status != STATUS_OK) {
+        validate_cancelled = true;
+    }
+    pool.wait(validate_group);
+    for (off_t i = validate_base; i < d_validate_operations.length(); ++i) {
+        if (validate_results[i - validate_base] != RESULT_ENUM_MAX) {
+            settle(d_validate_operations.at(i));
+        }
+    }
+
+    // Advance the pointer over the leading run of verified entries
+    while (d_validate_sp < d_validate_operations.length()) {
+        if ((err = validate_results[d_validate_sp - validate_base]) != RESULT_OK) {
+            break;
+        }
+        d_validate_sp++;
+    }
+
+    // A failed validation precedes any backup failure (as if run in order)
+    if (d_validate_sp < d_validate_operations.length() && err != RESULT_ENUM_MAX) {
+        return d_update_delegate.on_exit(*this, STATUS_BAD_RESULT,
+                                         d_validate_operations.at(d_validate_sp), err);
+    }
+    if (backup_status != STATUS_OK) {
+        return d_update_delegate.on_exit(*this, backup_status, backup_op, backup_err);
+    }
+
+    // The backups must be on disk, and on record, before the target changes
+    QStringList backup_paths;
+    for (auto op : d_backup_operations) {
+        backup_paths.append(op->writes());
+    }
+    if (false == syncPaths("backup", backup_paths) || false == d_journal->sync()) {
+        return d_update_delegate.on_exit(*this, STATUS_BAD_RESULT);
+    }
+
+    // Run through update block (could be a remove, or copy operation). Operations
+    // on disjoint paths run concurrently; conflicting ones in configuration order.
+    const std::set<off_t> &update_done = state.completed[JOURNAL_PHASE_UPDATE];
+    OperationGraph graph(d_update_operations, d_update_sp, update_done);
+    qInfo() << "update plan:" << graph.dependent() << "of" << (d_update_operations.length() - d_update_sp)
+            << "operations wait on" << graph.edges() << "dependencies";
+
+    std::vector<OperationResult> update_results(d_update_operations.length(), RESULT_ENUM_MAX);
+    d_update_started.resize(d_update_operations.length(), false);
+    for (off_t index : update_done) {
+        if (index >= d_update_sp && index < d_update_operations.length()) {
+            update_results[index] = RESULT_OK;
+            d_update_started[index] = true;
+            settle(d_update_operations.at(index));
+        }
+    }
+    std::shared_ptr<FSOperation> refused_op = nullptr;
+    bool journal_failed = false;
+    graph.execute([&] (off_t index) {
+        std::shared_ptr<FSOperation> op = d_update_operations.at(index);
 
         // Precondition
-        if ((retval = d.on_pre_update(op, d_update_sp)) != STATUS_OK) {
-            return d_update_delegate.on_exit(*this, STATUS_BAD_PRECONDITION, op);
+        if (d.on_pre_update(op, index) != STATUS_OK) {
+            refused_op = op;
+            return false;
         }
 
-        // Execute
-        if ((err = op.get()->execute()) != RESULT_OK) {
-            return d_update_delegate.on_exit(*this, STATUS_BAD_RESULT, op, err);
+        // Intent (made durable for the whole round by the flush below)
+        if (op->record(&record)) {
+            d_journal->intent(JOURNAL_PHASE_UPDATE, index, record);
+        }
+        prepare(op, JOURNAL_PHASE_UPDATE, index, state);
+        if (std::dynamic_pointer_cast<CopyOperation>(op) != nullptr) {
+            reservation.handOver(op->writes().first(), op->measure());
         }
+        d_update_started[index] = true;
+        return true;
+    }, [&] (off_t index, OperationResult result) {
+        update_results[index] = result;
+        if (result == RESULT_OK) {
+            d_journal->done(JOURNAL_PHASE_UPDATE, index);
+            settle(d_update_operations.at(index));
+        }
+    }, [&] () {
+        return (journal_failed = (false == d_journal->sync())) == false;
+    });
 
-        // Increment pointer
+    // Advance the pointer over the leading run of completed entries
+    while (d_update_sp < d_update_operations.length() && update_results[d_update_sp] == RESULT_OK) {
         d_update_sp++;
     }
 
+    // Report the first failure in configuration order
+    for (off_t i = d_update_sp; i < d_update_operations.length(); ++i) {
+        if ((err = update_results[i]) != RESULT_OK && err != RESULT_ENUM_MAX) {
+            return d_update_delegate.on_exit(*this, STATUS_BAD_RESULT, d_update_operations.at(i), err);
+        }
+    }
+    if (refused_op != nullptr) {
+        return d_update_delegate.on_exit(*this, STATUS_BAD_PRECONDITION, refused_op);
+    }
+
+    // The update must be on disk before it is committed
+    QStringList update_paths;
+    for (auto op : d_update_operations) {
+        update_paths.append(op->writes());
+    }
+    if (journal_failed || false == syncPaths("update", update_paths) || false == d_journal->commit()) {
+        return d_update_delegate.on_exit(*this, STATUS_BAD_RESULT);
+    }
+
+    // Committed: what was removed can go (in the background), then the journal
+    std::shared_ptr<Journal> journal = d_journal;
+    Graveyard::get_instance().reclaim([journal] {
+        journal->close();
+    });
+
     // Run exit condition
     return d_update_delegate.on_exit(*this, retval);
 }
@@ -167,25 +458,240 @@ UpdateStatus Updater::undo ()
     // 2. All backup operations must then be 'undone'
 
 
-    // We want to undo update operations
-//    for (off_t i = d_update_sp - 1; i >= 0; --i) {
-//        std::shared_ptr<FSOperation> op = d_update_operations.at(i);
-//        if (op->undo() != RESULT_OK) {
-//            return STATUS_BAD_UNDO;
-//        }
-//    }
+    // We want to undo update operations (those that started, latest first).
+    // On failure the journal is kept: the next start retries what is left.
+    for (off_t i = (off_t)d_update_started.size() - 1; i >= 0; --i) {
+        std::shared_ptr<FSOperation> op = d_update_operations.at(i);
+        if (false == d_update_started[i]) {
+            continue;
+        }
+        if (op->undo() != RESULT_OK) {
+            return undo_failed();
+        }
+        d_update_started[i] = false;
+        if (d_journal != nullptr) {
+            d_journal->undone(JOURNAL_PHASE_UPDATE, i);
+        }
+    }
 
     // We want to invert copy operations
     for (off_t i = d_backup_sp - 1; i >= 0; --i) {
         std::shared_ptr<FSOperation> op = d_backup_operations.at(i);
         if (op->invert() != RESULT_OK) {
-            return STATUS_BAD_UNDO;
+            return undo_failed();
+        }
+        if (d_journal != nullptr) {
+            d_journal->undone(JOURNAL_PHASE_BACKUP, i);
         }
     }
 
+    // Settled (once on disk): the journal can go, and the graveyards are empty now
+    QStringList undo_paths;
+    for (auto op : d_update_operations) {
+        undo_paths.append(op->writes());
+    }
+    for (off_t i = 0; i < d_backup_sp; ++i) {
+        undo_paths.append(d_backup_operations.at(i)->reads());
+    }
+    if (false == syncPaths("undo", undo_paths)) {
+        return undo_failed();
+    }
+    if (d_journal != nullptr) {
+        d_journal->close();
+        d_journal = nullptr;
+    }
+    Graveyard::get_instance().reclaim();
+
     return retval;
 }
 
+UpdateStatus Updater::undo_failed ()
+{
+    if (d_journal != nullptr) {
+        d_journal->sync();
+    }
+    return STATUS_BAD_UNDO;
+}
+
+bool Updater::syncPaths (const char *phase, const QStringList &paths)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<dev_t> devices;
+    QStringList directories;
+    struct stat st;
+    bool ok = true;
+    int fd;
+
+    if (d_durability == DURABILITY_NONE) {
+        return true;
+    }
+    for (const QString &path : paths) {
+        QString directory = QFileInfo(path).path();
+        if (false == directories.contains(directory)) {
+            directories.append(directory);
+        }
+    }
+
+    // Contents first: one syncfs per filesystem
+    for (const QString &directory : directories) {
+        if (-1 == (fd = open(QFile::encodeName(directory).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC))) {
+            ok = ok && (errno == ENOENT);
+            continue;
+        }
+        if (0 == fstat(fd, &st) && std::find(devices.begin(), devices.end(), st.st_dev) == devices.end()) {
+            devices.push_back(st.st_dev);
+            ok = (0 == syncfs(fd)) && ok;
+        }
+        close(fd);
+    }
+
+    // Then the entries, directory by directory, in the order they were changed
+    for (const QString &directory : directories) {
+        if (-1 == (fd = open(QFile::encodeName(directory).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC))) {
+            continue;
+        }
+        ok = (0 == fsync(fd)) && ok;
+        close(fd);
+    }
+
+    std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+    d_sync_time += elapsed;
+    qInfo() << "synced" << phase << "over" << devices.size() << "filesystem(s) and" << directories.length()
+            << "directories in" << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << "ms";
+    return ok;
+}
+
+QByteArray Updater::fingerprint ()
+{
+    Sha256 hash;
+    struct stat st;
+
+    for (auto ops : {&d_validate_operations, &d_backup_operations, &d_update_operations}) {
+        for (auto op : *ops) {
+            std::shared_ptr<CopyOperation> c = std::dynamic_pointer_cast<CopyOperation>(op);
+            QByteArray label = QString("%1 %2").arg(c != nullptr ? "cp" : "op").arg(op->label()).toUtf8();
+            hash.update(label.constData(), label.size() + 1);
+        }
+    }
+
+    // What the update copies from the remote media, as found on it now, down
+    // to every file of a directory (the target changes while the update
+    // runs: the backups are left out)
+    for (auto op : d_update_operations) {
+        std::shared_ptr<CopyOperation> c = std::dynamic_pointer_cast<CopyOperation>(op);
+        if (c == nullptr) {
+            continue;
+        }
+        QByteArray digest = c->expectedDigest(), root = c->merkleRoot();
+        const uint8_t sizes[2] = {(uint8_t)digest.size(), (uint8_t)root.size()};
+        hash.update(sizes, sizeof(sizes));
+        hash.update(digest.constData(), digest.size());
+        hash.update(root.constData(), root.size());
+        fold_source(hash, c->reads().first());
+    }
+
+    // A bundle stands for everything that is read from it
+    for (int key = 0; key < RESOURCE_KEY_ENUM_MAX; ++key) {
+        std::shared_ptr<Bundle> bundle = ResourceManager::get_instance().getBundle(static_cast<resource_root_key_t>(key));
+        if (bundle != nullptr && 0 == fstat(bundle->fd(), &st)) {
+            fold_identity(hash, st);
+        }
+    }
+    return hash.result();
+}
+
+void Updater::prepare (std::shared_ptr<FSOperation> op, journal_phase_t phase, off_t index,
+                       const journal_state_t &state)
+{
+    std::shared_ptr<CopyOperation> c = std::dynamic_pointer_cast<CopyOperation>(op);
+    std::shared_ptr<Journal> journal = d_journal;
+
+    if (c == nullptr) {
+        return;
+    }
+    c->setCheckpointCallback([journal, phase, index] (const copy_checkpoint_t &checkpoint) {
+        journal->checkpoint(phase, index, checkpoint);
+    });
+
+    // Started before: keep the files that made it, and the part of the file
+    // that did (its checkpoint is recorded anew, as the intent supersedes it)
+    if (state.started[phase].count(index) > 0) {
+        c->setIncremental(true);
+        auto it = state.checkpoints[phase].find(index);
+        if (it != state.checkpoints[phase].end()) {
+            c->resumeFrom(it->second);
+            journal->checkpoint(phase, index, it->second);
+        }
+    }
+}
+
+/*\
+ * Validations only read. Copies read their source and write their
+ * destination, replacing what is there; removes only rename (into the
+ * graveyard), so they free nothing before the update commits.
+\*/
+void Updater::plan ()
+{
+    Planner planner;
+
+    // A dry run changes nothing, not even by a probe file
+    planner.setWriteProbe(false == d_dry_run);
+    for (auto op : d_validate_operations) {
+        planner.read(op->reads().first(), op->measure());
+    }
+    for (auto ops : {&d_backup_operations, &d_update_operations}) {
+        for (auto op : *ops) {
+            std::shared_ptr<CopyOperation> c = std::dynamic_pointer_cast<CopyOperation>(op);
+            if (c == nullptr) {
+                continue;
+            }
+            off_t bytes = c->measure();
+            planner.read(c->reads().first(), bytes);
+            planner.write(c->writes().first(), bytes, c->replaced());
+        }
+    }
+    d_plan = planner.finish();
+}
+
+void Updater::measure ()
+{
+    off_t total = 0;
+    progress_callback_t progress = [this] (off_t bytes) { advance(bytes); };
+
+    for (auto ops : {&d_validate_operations, &d_backup_operations, &d_update_operations}) {
+        for (auto op : *ops) {
+            total += op->measure();
+            op->setProgressCallback(progress);
+        }
+    }
+    qInfo() << "planned" << total << "bytes over" << operationCount() << "operations";
+
+    d_bytes_settled = 0;
+    d_progress.start(total);
+    d_update_delegate.on_progress(*this, 0, total, -1);
+}
+
+void Updater::advance (off_t bytes)
+{
+    d_progress.add(bytes);
+
+    // Whoever finds the lock taken leaves the notification to its holder
+    std::unique_lock<std::mutex> lock(d_progress_lock, std::try_to_lock);
+    if (lock.owns_lock() && d_progress.sample()) {
+        d_update_delegate.on_progress(*this, d_progress.done(), d_progress.total(), d_progress.eta());
+    }
+}
+
+void Updater::settle (std::shared_ptr<FSOperation> op)
+{
+    std::lock_guard<std::mutex> lock(d_progress_lock);
+
+    d_bytes_settled += op->bytes();
+    d_progress.settle(d_bytes_settled);
+    d_progress.sample(true);
+    d_update_delegate.on_progress(*this, d_progress.done(), d_progress.total(), d_progress.eta());
+}
+
 off_t Updater::validate_sp ()
 {
     return d_validate_sp;
@@ -222,6 +728,31 @@ off_t Updater::operationCount()
     return sum;
 }
 
+off_t Updater::byteCount()
+{
+    return d_progress.total();
+}
+
+int64_t Updater::syncTime()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(d_sync_time).count();
+}
+
+void Updater::setDryRun(bool dry_run)
+{
+    d_dry_run = dry_run;
+}
+
+bool Updater::dryRun()
+{
+    return d_dry_run;
+}
+
+update_plan_t Updater::prediction()
+{
+    return d_plan;
+}
+
 QString Updater::product()
 {
     return d_product;
@@ -7,6 +7,12 @@
 #include "fsoperation.h"
 #include "resource.h"
 #include "resource_manager.h"
+#include "progress.h"
+#include "journal.h"
+#include "planner.h"
+#include <chrono>
+#include <mutex>
+#include <vector>
 
 namespace SWU {
 
@@ -18,6 +24,7 @@ enum UpdateStatus {
     STATUS_BAD_RESULT,
     STATUS_BAD_PRECONDITION,
     STATUS_BAD_UNDO,
+    STATUS_BAD_PLAN,
 
     /* Size */
     STATUS_ENUM_MAX
@@ -40,12 +47,34 @@ public:
             ResourceManager &resourceManager,
             QVector<QString> &resource_uris) = 0;
 
+    /*\
+     * Called once the plan passed (every device has the space the update
+     * needs, and holds it until this returns), before anything is changed:
+     * the place to stop services. Not called in dry-run mode. Optional.
+    \*/
+    virtual UpdateStatus on_plan (SWU::Updater &updater, const update_plan_t &plan);
+
+    /*\
+     * Called on the updater thread, in order, right before entry "index" is
+     * verified: the entry is not read unless this returns STATUS_OK. Entries
+     * are verified in the background once started, so the check of an entry
+     * may still run during the next calls (and, if the remote media is on
+     * another device than the target, during the backups).
+    \*/
     virtual UpdateStatus on_pre_validate (std::shared_ptr<ExpectOperation> op, off_t index) = 0;
 
     virtual UpdateStatus on_pre_backup (std::shared_ptr<CopyOperation> op, off_t index) = 0;
 
     virtual UpdateStatus on_pre_update (std::shared_ptr<FSOperation> op, off_t index) = 0;
 
+    /*\
+     * Reports the bytes processed against the planned total, together with
+     * the estimated seconds left (-1 while unknown). Called at most every few
+     * hundred milliseconds and at every operation boundary, possibly from a
+     * worker thread (never from two threads at once). Optional.
+    \*/
+    virtual void on_progress (SWU::Updater &updater, off_t done, off_t total, int eta);
+
     virtual UpdateStatus on_exit (SWU::Updater &updater,
                                   UpdateStatus status,
                                   std::shared_ptr<FSOperation> op = nullptr,
@@ -74,7 +103,8 @@ private:
     // Backup path
     QString d_backup_path;
 
-    // Operation stack pointers
+    // Operation stack pointers (each past the leading run of completed
+    // operations; concurrent ones further on may have completed as well)
     off_t d_validate_sp, d_backup_sp, d_update_sp;
 
     // Operation stack
@@ -82,6 +112,54 @@ private:
     QVector<std::shared_ptr<SWU::FSOperation>> d_backup_operations;
     QVector<std::shared_ptr<SWU::FSOperation>> d_update_operations;
 
+    // Update operations that were started (also those past d_update_sp)
+    std::vector<bool> d_update_started;
+
+    // Undo journal of the running update (nullptr before it opens)
+    std::shared_ptr<SWU::Journal> d_journal;
+
+    // Durability level, and the time spent syncing so far
+    Durability d_durability;
+    std::chrono::steady_clock::duration d_sync_time;
+
+    // Prediction made before the update starts, and whether to stop there
+    update_plan_t d_plan;
+    bool d_dry_run;
+
+    // Byte-weighted progress over all phases
+    ProgressMeter d_progress;
+    std::mutex d_progress_lock;
+    off_t d_bytes_settled;
+
+    // Resolves and sizes every operation (needs the resource paths), and
+    // predicts the space and time the update takes on every device
+    void plan ();
+
+    // Sizes every operation (needs the resource paths) and starts the meter
+    void measure ();
+
+    // Accounts for processed bytes and notifies the delegate (rate-limited)
+    void advance (off_t bytes);
+
+    // Accounts for a completed operation and notifies the delegate
+    void settle (std::shared_ptr<SWU::FSOperation> op);
+
+    // Keeps what undo() recorded so far for the next start
+    UpdateStatus undo_failed ();
+
+    // Makes the given paths durable (unless the level is DURABILITY_NONE):
+    // one syncfs per filesystem, then the directories holding them in order
+    bool syncPaths (const char *phase, const QStringList &paths);
+
+    // Identifies the payload: the operations and the sources they copy (every
+    // file below a copied directory)
+    QByteArray fingerprint ();
+
+    // Arms the checkpoints of a copy (once its intent is on record), and
+    // continues it where an interrupted update of the same payload left off
+    void prepare (std::shared_ptr<SWU::FSOperation> op, SWU::journal_phase_t phase, off_t index,
+                  const SWU::journal_state_t &state);
+
 public:
     Updater(std::shared_ptr<SWU::Parser> parser, SWU::UpdateDelegate &delegate);
     UpdateStatus execute ();
@@ -93,6 +171,11 @@ public:
     const QVector<std::shared_ptr<SWU::FSOperation>> backup_operations ();
     const QVector<std::shared_ptr<SWU::FSOperation>> update_operations ();
     off_t operationCount();
+    off_t byteCount();
+    int64_t syncTime(); // Milliseconds spent syncing to disk so far
+    void setDryRun(bool dry_run); // Dry run: execute() stops once it planned
+    bool dryRun();
+    update_plan_t prediction(); // Plan made by the last execute()
     QString product();
     QString platform();
 };
@@ -0,0 +1,520 @@
+#include "configreader.h"
+
+#include <QDebug>
+#include <QFile>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                            Forward declarations                             *
+ *******************************************************************************
+*/
+
+
+static inline bool is_space (char c);
+static inline bool has_prefix (const char *p, const char *end, const char *prefix);
+static inline const char *next_markup (const char *p, const char *end);
+static size_t put_utf8 (char *out, uint32_t c);
+
+
+/*
+ *******************************************************************************
+ *                       Class definition: ConfigReader                        *
+ *******************************************************************************
+*/
+
+
+ConfigReader::ConfigReader():
+    d_map(MAP_FAILED),
+    d_map_size(0),
+    d_pos(nullptr),
+    d_end(nullptr),
+    d_line(1),
+    d_elements(nullptr),
+    d_count(0),
+    d_capacity(0),
+    d_done(false),
+    d_failed(false)
+{}
+
+ConfigReader::~ConfigReader()
+{
+    if (d_map != MAP_FAILED) {
+        munmap(d_map, d_map_size);
+    }
+}
+
+bool ConfigReader::open (const QString &path)
+{
+    struct stat st;
+    int fd;
+
+    d_path = path;
+    if (-1 == (fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC))) {
+        qCritical() << "FILE: Cannot open: " << path << ": " << QString(strerror(errno));
+        return false;
+    }
+    if (-1 == fstat(fd, &st)) {
+        qCritical() << "FILE: Cannot stat: " << path << ": " << QString(strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    // Map the file (an empty one is simply an incomplete document)
+    if (st.st_size > 0) {
+        d_map_size = st.st_size;
+        if (MAP_FAILED == (d_map = mmap(nullptr, d_map_size, PROT_READ, MAP_PRIVATE, fd, 0))) {
+            qCritical() << "FILE: Cannot map: " << path << ": " << QString(strerror(errno));
+            close(fd);
+            return false;
+        }
+        madvise(d_map, d_map_size, MADV_SEQUENTIAL);
+        d_pos = static_cast<const char *>(d_map);
+        d_end = d_pos + d_map_size;
+    }
+    close(fd);
+
+    // Skip a byte order mark
+    if (at("\xEF\xBB\xBF")) {
+        d_pos += 3;
+    }
+    return true;
+}
+
+const config_element_t *ConfigReader::element (size_t index)
+{
+    while (index >= d_count && false == d_done) {
+
+        // Grow the array (the old one stays in the arena: elements handed out stay valid)
+        if (d_count == d_capacity) {
+            size_t capacity = (d_capacity == 0 ? d_map_size / 64 + 16 : 2 * d_capacity);
+            config_element_t *elements = d_arena.allocateArray<config_element_t>(capacity);
+            if (d_count > 0) {
+                memcpy(elements, d_elements, d_count * sizeof(config_element_t));
+            }
+            d_elements = elements;
+            d_capacity = capacity;
+        }
+
+        if (read(&d_elements[d_count])) {
+            d_count++;
+        } else {
+            d_done = true;
+        }
+    }
+    return (index < d_count ? &d_elements[index] : nullptr);
+}
+
+bool ConfigReader::failed ()
+{
+    return d_failed;
+}
+
+size_t ConfigReader::memory ()
+{
+    return d_arena.size();
+}
+
+/*\
+ * Reads up to the next opening tag, feeding the closing tags met on the way
+ * to the state machine. Returns false at the end of the document, or on an
+ * error.
+\*/
+bool ConfigReader::read (config_element_t *element)
+{
+    const char *name;
+    size_t length;
+    bool empty;
+
+    while (false == d_failed) {
+
+        // Text between elements carries nothing: skip to the next markup
+        const char *lt = next_markup(d_pos, d_end);
+        if (lt == d_end) {
+            advance(d_end);
+            if (d_state_machine.status() != STATUS_COMPLETE) {
+                return fail("Parse ended in incomplete state");
+            }
+            return false;
+        }
+        advance(lt);
+
+        // Comments, processing instructions, stray CDATA and the document type
+        if (at("<!--")) {
+            if (false == skipPast("-->")) {
+                return false;
+            }
+            continue;
+        }
+        if (at("<?")) {
+            if (false == skipPast("?>")) {
+                return false;
+            }
+            continue;
+        }
+        if (at("<![CDATA[")) {
+            if (false == skipPast("]]>")) {
+                return false;
+            }
+            continue;
+        }
+        if (at("<!")) {
+            const char *gt = static_cast<const char *>(memchr(d_pos, '>', d_end - d_pos));
+            if (gt != nullptr && memchr(d_pos, '[', gt - d_pos) != nullptr) {
+                return fail("Document type with an internal subset is not supported");
+            }
+            if (false == skipPast(">")) {
+                return false;
+            }
+            continue;
+        }
+
+        // Closing tag
+        if (at("</")) {
+            d_pos += 2;
+            if (false == readName(&name, &length)) {
+                return false;
+            }
+            skipSpace();
+            if (d_pos == d_end || *d_pos != '>') {
+                return fail("Malformed closing tag");
+            }
+            advance(d_pos + 1);
+            if (d_state_machine.input(name, length, true) == STATUS_FAULT) {
+                return fail(QString("The closing tag %1 is recognized, but not expected here (check nested level)")
+                            .arg(QString::fromUtf8(name, length)));
+            }
+            continue;
+        }
+
+        // Opening tag
+        d_pos += 1;
+        if (false == readName(&name, &length)) {
+            return false;
+        }
+        if (d_state_machine.input(name, length, false, &element->token) == STATUS_FAULT) {
+            return fail(QString("The opening tag %1 is either unrecognized, or unexpected in the scope")
+                        .arg(QString::fromUtf8(name, length)));
+        }
+        if (false == readAttributes(element, &empty)) {
+            return false;
+        }
+        if (empty) {
+            element->value = config_text_t{d_pos, 0};
+            if (d_state_machine.input(static_cast<Token>(element->token + 1)) == STATUS_FAULT) {
+                return fail(QString("The tag %1 may not be empty").arg(QString::fromUtf8(name, length)));
+            }
+            return true;
+        }
+        return readText(&element->value);
+    }
+    return false;
+}
+
+bool ConfigReader::readAttributes (config_element_t *element, bool *empty_p)
+{
+    Attributes &a = Attributes::get_instance();
+    config_attribute_t attributes[ATTRIBUTE_KEY_ENUM_MAX];
+    uint32_t count = 0;
+    unsigned seen = 0;
+    const char *name;
+    size_t length;
+
+    while (true) {
+        skipSpace();
+        if (d_pos == d_end) {
+            return fail("Unterminated tag");
+        }
+        if (*d_pos == '>' || at("/>")) {
+            (*empty_p) = (*d_pos == '/');
+            advance(d_pos + ((*empty_p) ? 2 : 1));
+            break;
+        }
+
+        // Key
+        if (false == readName(&name, &length)) {
+            return false;
+        }
+        skipSpace();
+        if (d_pos == d_end || *d_pos != '=') {
+            return fail("Attribute without a value");
+        }
+        advance(d_pos + 1);
+        skipSpace();
+
+        // Value, in either kind of quotes
+        if (d_pos == d_end || (*d_pos != '"' && *d_pos != '\'')) {
+            return fail("Attribute value without quotes");
+        }
+        const char *begin = d_pos + 1;
+        const char *quote = static_cast<const char *>(memchr(begin, *d_pos, d_end - begin));
+        if (quote == nullptr || memchr(begin, '<', quote - begin) != nullptr) {
+            return fail("Malformed attribute value");
+        }
+
+        // Only the keys known are kept (the others are ignored)
+        attribute_key_t key = a.key(name, length);
+        if (key != ATTRIBUTE_KEY_ENUM_MAX) {
+            if (0 != (seen & (1u << key))) {
+                return fail(QString("Attribute key \"%1\" duplicated").arg(QString::fromUtf8(name, length)));
+            }
+            seen |= (1u << key);
+
+            config_attribute_t *attribute = &attributes[count++];
+            attribute->key = key;
+            if (false == decode(begin, quote, &attribute->lexeme)) {
+                return false;
+            }
+            attribute->val = a.value(attribute->lexeme.data, attribute->lexeme.size);
+        }
+        advance(quote + 1);
+    }
+
+    // Keep the attributes next to the rest of the parse
+    element->attribute_count = count;
+    element->attributes = nullptr;
+    if (count > 0) {
+        config_attribute_t *kept = d_arena.allocateArray<config_attribute_t>(count);
+        memcpy(kept, attributes, count * sizeof(config_attribute_t));
+        element->attributes = kept;
+    }
+    return true;
+}
+
+/*\
+ * Reads the text of an element (up to its first child or its closing tag),
+ * with the CDATA sections and references in it
+\*/
+bool ConfigReader::readText (config_text_t *text_p)
+{
+    const char *lt = next_markup(d_pos, d_end);
+
+    // Most text runs straight to the next tag
+    if (false == has_prefix(lt, d_end, "<![CDATA[") && false == has_prefix(lt, d_end, "<!--")) {
+        if (false == decode(d_pos, lt, text_p)) {
+            return false;
+        }
+        advance(lt);
+        return true;
+    }
+
+    // Otherwise find where it ends, past every CDATA section and comment in it
+    const char *stop = lt;
+    while (has_prefix(stop, d_end, "<![CDATA[") || has_prefix(stop, d_end, "<!--")) {
+        const bool cdata = (stop[2] == '[');
+        const char *close = static_cast<const char *>(memmem(stop, d_end - stop, (cdata ? "]]>" : "-->"), 3));
+        if (close == nullptr) {
+            return fail(cdata ? "Unterminated CDATA section" : "Unterminated comment");
+        }
+        stop = next_markup(close + 3, d_end);
+    }
+
+    // And join its pieces in the arena (never longer than the markup they come from)
+    char *out = d_arena.allocateArray<char>(stop - d_pos);
+    size_t size = 0;
+    while (d_pos < stop) {
+        config_text_t piece;
+        lt = next_markup(d_pos, d_end);
+        if (false == decode(d_pos, lt, &piece)) {
+            return false;
+        }
+        memcpy(out + size, piece.data, piece.size);
+        size += piece.size;
+        advance(lt);
+
+        if (at("<![CDATA[")) {
+            const char *close = static_cast<const char *>(memmem(d_pos, d_end - d_pos, "]]>", 3));
+            memcpy(out + size, d_pos + 9, close - (d_pos + 9));
+            size += close - (d_pos + 9);
+            advance(close + 3);
+        } else if (at("<!--")) {
+            skipPast("-->");
+        }
+    }
+    (*text_p) = config_text_t{out, size};
+    return true;
+}
+
+bool ConfigReader::readName (const char **name_p, size_t *length_p)
+{
+    const char *begin = d_pos;
+
+    while (d_pos < d_end && false == is_space(*d_pos) && *d_pos != '>' && *d_pos != '/' &&
+           *d_pos != '=' && *d_pos != '<') {
+        ++d_pos;
+    }
+    if (d_pos == begin) {
+        return fail("Missing name");
+    }
+    (*name_p) = begin;
+    (*length_p) = d_pos - begin;
+    return true;
+}
+
+/*\
+ * Sets "text_p" to the text between "begin" and "end", with its character
+ * and entity references replaced (decoded into the arena if it has any)
+\*/
+bool ConfigReader::decode (const char *begin, const char *end, config_text_t *text_p)
+{
+    const char *amp = static_cast<const char *>(memchr(begin, '&', end - begin));
+
+    // Most text has no references: it is used where it is, in the map
+    if (amp == nullptr) {
+        (*text_p) = config_text_t{begin, static_cast<size_t>(end - begin)};
+        return true;
+    }
+
+    // A reference never decodes to more bytes than it takes
+    char *out = d_arena.allocateArray<char>(end - begin);
+    size_t size = 0;
+    while (amp != nullptr) {
+        memcpy(out + size, begin, amp - begin);
+        size += amp - begin;
+
+        const char *semicolon = static_cast<const char *>(memchr(amp, ';', end - amp));
+        if (semicolon == nullptr) {
+            return fail("Unterminated reference");
+        }
+        const char *ref = amp + 1;
+        const size_t length = semicolon - ref;
+
+        if (length == 3 && 0 == memcmp(ref, "amp", 3)) {
+            out[size++] = '&';
+        } else if (length == 2 && 0 == memcmp(ref, "lt", 2)) {
+            out[size++] = '<';
+        } else if (length == 2 && 0 == memcmp(ref, "gt", 2)) {
+            out[size++] = '>';
+        } else if (length == 4 && 0 == memcmp(ref, "quot", 4)) {
+            out[size++] = '"';
+        } else if (length == 4 && 0 == memcmp(ref, "apos", 4)) {
+            out[size++] = '\'';
+        } else if (length >= 2 && ref[0] == '#') {
+            const bool hex = (ref[1] == 'x');
+            const char *digits = ref + (hex ? 2 : 1);
+            char *stop = nullptr;
+            unsigned long c = 0;
+            if (digits < semicolon && isxdigit(static_cast<unsigned char>(*digits))) {
+                c = strtoul(digits, &stop, (hex ? 16 : 10));
+            }
+            if (stop != semicolon || c == 0 || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+                return fail("Invalid character reference");
+            }
+            size += put_utf8(out + size, c);
+        } else {
+            return fail(QString("Unknown entity reference &%1;").arg(QString::fromUtf8(ref, length)));
+        }
+
+        begin = semicolon + 1;
+        amp = static_cast<const char *>(memchr(begin, '&', end - begin));
+    }
+    memcpy(out + size, begin, end - begin);
+    size += end - begin;
+
+    (*text_p) = config_text_t{out, size};
+    return true;
+}
+
+bool ConfigReader::at (const char *prefix)
+{
+    return has_prefix(d_pos, d_end, prefix);
+}
+
+bool ConfigReader::skipPast (const char *terminator)
+{
+    const size_t length = strlen(terminator);
+    const char *found = static_cast<const char *>(memmem(d_pos, d_end - d_pos, terminator, length));
+
+    if (found == nullptr) {
+        return fail(QString("Missing \"%1\"").arg(terminator));
+    }
+    advance(found + length);
+    return true;
+}
+
+void ConfigReader::skipSpace ()
+{
+    while (d_pos < d_end && is_space(*d_pos)) {
+        d_line += (*d_pos == '\n');
+        ++d_pos;
+    }
+}
+
+/* Moves the read position to "to", counting the lines passed */
+void ConfigReader::advance (const char *to)
+{
+    const char *p = d_pos;
+
+    while (nullptr != (p = static_cast<const char *>(memchr(p, '\n', to - p)))) {
+        d_line++;
+        p++;
+    }
+    d_pos = to;
+}
+
+bool ConfigReader::fail (const QString &reason)
+{
+    qCritical() << d_path << ":" << d_line << " - " << reason;
+    d_failed = true;
+    return false;
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function definitions                             *
+ *******************************************************************************
+*/
+
+
+static inline bool is_space (char c)
+{
+    return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+}
+
+static inline bool has_prefix (const char *p, const char *end, const char *prefix)
+{
+    const size_t length = strlen(prefix);
+    return (static_cast<size_t>(end - p) >= length && 0 == memcmp(p, prefix, length));
+}
+
+/* Returns the next '<' from "p" on ("end" if there is none) */
+static inline const char *next_markup (const char *p, const char *end)
+{
+    const char *lt = static_cast<const char *>(memchr(p, '<', end - p));
+    return (lt != nullptr ? lt : end);
+}
+
+/* Writes code point "c" in UTF-8, returning its bytes */
+static size_t put_utf8 (char *out, uint32_t c)
+{
+    if (c < 0x80) {
+        out[0] = static_cast<char>(c);
+        return 1;
+    } else if (c < 0x800) {
+        out[0] = static_cast<char>(0xC0 | (c >> 6));
+        out[1] = static_cast<char>(0x80 | (c & 0x3F));
+        return 2;
+    } else if (c < 0x10000) {
+        out[0] = static_cast<char>(0xE0 | (c >> 12));
+        out[1] = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out[2] = static_cast<char>(0x80 | (c & 0x3F));
+        return 3;
+    } else {
+        out[0] = static_cast<char>(0xF0 | (c >> 18));
+        out[1] = static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+        out[2] = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out[3] = static_cast<char>(0x80 | (c & 0x3F));
+        return 4;
+    }
+}
@@ -0,0 +1,157 @@
+#ifndef CONFIGREADER_H
+#define CONFIGREADER_H
+
+#include <QString>
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "attributes.h"
+#include "cfgstatemachine.h"
+
+namespace SWU {
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+/* Text of the configuration, in UTF-8: in the mapped file, or in the arena if it was decoded */
+struct config_text_t {
+    const char *data;
+    size_t size;
+
+    QString toString () const
+    {
+        return QString::fromUtf8(data, static_cast<int>(size));
+    }
+};
+
+/* Attribute of an element (only keys known to Attributes are kept) */
+struct config_attribute_t {
+    attribute_key_t key;
+    attribute_value_t val;                  /**< ATTRIBUTE_VALUE_ENUM_MAX if not a known value */
+    config_text_t lexeme;
+};
+
+/* Element of the configuration: an opening tag and the text that follows it */
+struct config_element_t {
+    SWU::Token token;
+    uint32_t attribute_count;
+    const config_attribute_t *attributes;   /**< In the arena */
+    config_text_t value;                    /**< Text up to the next tag */
+};
+
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * Reads a configuration file into an array of elements, as far as the
+ * parser asks for it. The file is mapped and scanned once, front to back:
+ * every tag is fed to the state machine as it is met (so the document is
+ * validated while it is read), and the elements are appended to one
+ * contiguous array that the parser walks by index.
+ *
+ * Elements hold no objects of their own: their text and attributes are
+ * views of the mapped file (or, where references had to be replaced, of
+ * decoded copies), and everything (the array, the attributes, decoded
+ * text) is allocated from one arena that goes with the reader. The parser
+ * makes strings of what it keeps. Elements stay valid as long as the
+ * reader, also after the array grew.
+ *
+ * The XML understood is what configurations use: elements, attributes,
+ * character and entity references, CDATA sections, comments, processing
+ * instructions and a DOCTYPE without an internal subset, in UTF-8.
+\*/
+class ConfigReader
+{
+private:
+    QString d_path;
+    void *d_map;
+    size_t d_map_size;
+
+    // Unread part of the mapped file
+    const char *d_pos;
+    const char *d_end;
+    int d_line;
+
+    // Validates the order of the tags
+    SWU::Machine d_state_machine;
+
+    // Elements read so far, and everything they refer to
+    SWU::Arena d_arena;
+    config_element_t *d_elements;
+    size_t d_count;
+    size_t d_capacity;
+
+    bool d_done;
+    bool d_failed;
+
+    bool read (config_element_t *element);
+    bool readAttributes (config_element_t *element, bool *empty_p);
+    bool readText (config_text_t *text_p);
+    bool readName (const char **name_p, size_t *length_p);
+    bool decode (const char *begin, const char *end, config_text_t *text_p);
+    bool at (const char *prefix);
+    bool skipPast (const char *terminator);
+    void skipSpace ();
+    void advance (const char *to);
+    bool fail (const QString &reason);
+
+public:
+    ConfigReader();
+    ~ConfigReader();
+    ConfigReader(const ConfigReader &) = delete;
+    ConfigReader &operator= (const ConfigReader &) = delete;
+
+    /*\
+     * Maps the file at "path". Returns false if the file cannot be mapped.
+    \*/
+    bool open (const QString &path);
+
+    /*\
+     * Returns the element at "index", reading up to it. Returns nullptr past
+     * the last element: the document ended, or it could not be read further
+     * (see failed()).
+    \*/
+    const config_element_t *element (size_t index);
+
+    /*\
+     * Returns true if the document turned out malformed: not well-formed, a
+     * tag the state machine does not accept there, or ended before its time
+    \*/
+    bool failed ();
+
+    /*\
+     * Returns the bytes of memory the elements take
+    \*/
+    size_t memory ();
+};
+
+
+/*
+ *******************************************************************************
+ *                            Function declarations                            *
+ *******************************************************************************
+*/
+
+/*\
+ * Returns the attribute "key" of an element (nullptr if it has none)
+\*/
+inline const config_attribute_t *config_attribute (const config_element_t *element, attribute_key_t key)
+{
+    for (uint32_t i = 0; i < element->attribute_count; ++i) {
+        if (element->attributes[i].key == key) {
+            return &element->attributes[i];
+        }
+    }
+    return nullptr;
+}
+
+}
+
+#endif // CONFIGREADER_H
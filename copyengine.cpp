@@ -0,0 +1,870 @@
+#include "copyengine.h"
+#include "fileio.h"
+#include "hasher.h"
+#include "merkle.h"
+#include "workpool.h"
+
+#include <QFile>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <algorithm>
+#include <memory>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                         Global variable definitions                         *
+ *******************************************************************************
+*/
+
+
+static const char *g_copy_method_str_map[COPY_METHOD_ENUM_MAX] = {
+    [COPY_METHOD_REFLINK]         = "reflink",
+    [COPY_METHOD_COPY_FILE_RANGE] = "copy_file_range",
+    [COPY_METHOD_SENDFILE]        = "sendfile",
+    [COPY_METHOD_BUFFERED]        = "buffered",
+    [COPY_METHOD_PIPELINED]       = "pipelined",
+    [COPY_METHOD_DIRECT]          = "direct",
+    [COPY_METHOD_DROP_BEHIND]     = "drop-behind",
+    [COPY_METHOD_DECOMPRESS]      = "decompress"
+};
+
+static const char *g_cache_mode_str_map[CACHE_MODE_ENUM_MAX] = {
+    [CACHE_MODE_CACHED]           = "cached",
+    [CACHE_MODE_STREAMING]        = "streaming"
+};
+
+// Largest request handed to the kernel in one in-kernel copy call
+static const size_t g_max_chunk = 1 << 30;
+
+// As above, while progress is being reported
+static const size_t g_progress_chunk = 16 << 20;
+
+// Streaming: smaller files are copied as usual (the cache hardly matters)
+static const off_t g_stream_min_size = 8 << 20;
+
+// Streaming: smallest buffer size
+static const size_t g_stream_buffer_size = 8 << 20;
+
+// Streaming: alignment of buffers, offsets and lengths under O_DIRECT
+static const size_t g_direct_alignment = 4096;
+
+/* Page cache treatment of a pipelined copy */
+enum stream_mode_t {
+    STREAM_CACHED,          /**< Plain reads and writes */
+    STREAM_DIRECT,          /**< Both descriptors are in O_DIRECT mode */
+    STREAM_DROP_BEHIND      /**< Write back and drop behind, read ahead */
+};
+
+/* Buffer allocated with posix_memalign */
+typedef std::unique_ptr<char, void (*)(void *)> aligned_buffer_t;
+
+
+/*
+ *******************************************************************************
+ *                            Forward declarations                             *
+ *******************************************************************************
+*/
+
+static bool method_unsupported (int error);
+static bool copy_reflink (int from_fd, int to_fd);
+static bool copy_range (int from_fd, int to_fd, off_t size,
+                        const progress_callback_t &progress, off_t *offset_p);
+static bool copy_sendfile (int from_fd, int to_fd, off_t size,
+                           const progress_callback_t &progress, off_t *offset_p);
+static bool copy_buffered (int from_fd, int to_fd, size_t buffer_size,
+                           const progress_callback_t &progress, off_t *offset_p);
+static bool copy_pipelined (int from_fd, int to_fd, size_t buffer_size, stream_mode_t stream,
+                            Sha256 *hash, ChunkStream *chunks, const progress_callback_t &progress,
+                            off_t *offset_p);
+static bool copy_sparse (int from_fd, int to_fd, off_t size, size_t buffer_size, Sha256 *hash,
+                         ChunkStream *chunks, const progress_callback_t &progress, off_t *offset_p,
+                         off_t *holes_p, copy_method_t *method_p);
+static bool set_direct (int fd, bool direct);
+static ssize_t read_direct (int fd, char *buffer, size_t size, off_t offset);
+static void drop_behind (int from_fd, int to_fd, off_t offset, size_t length, size_t buffer_size);
+static aligned_buffer_t aligned_buffer (size_t size);
+static bool hash_prefix (int fd, off_t length, size_t buffer_size, Sha256 *hash);
+static bool check_prefix (int fd, off_t length, size_t buffer_size, ChunkStream *chunks);
+
+
+/*
+ *******************************************************************************
+ *                              Class definition                               *
+ *******************************************************************************
+*/
+
+
+CopyEngine::CopyEngine(size_t buffer_size):
+    d_buffer_size(buffer_size),
+    d_hash(nullptr),
+    d_stream(nullptr),
+    d_progress(nullptr),
+    d_cache_mode(CACHE_MODE_CACHED),
+    d_checkpoint(nullptr),
+    d_checkpoint_interval(0),
+    d_resume_offset(0),
+    d_durable(false)
+{}
+
+void CopyEngine::setHash (Sha256 *hash)
+{
+    d_hash = hash;
+}
+
+void CopyEngine::setChunkStream (ChunkStream *stream)
+{
+    d_stream = stream;
+}
+
+void CopyEngine::setProgress (progress_callback_t progress)
+{
+    d_progress = progress;
+}
+
+void CopyEngine::setCacheMode (cache_mode_t mode)
+{
+    d_cache_mode = mode;
+}
+
+void CopyEngine::setCheckpoint (durable_callback_t checkpoint, off_t interval)
+{
+    d_checkpoint = checkpoint;
+    d_checkpoint_interval = interval;
+}
+
+void CopyEngine::setResumeOffset (off_t offset)
+{
+    d_resume_offset = offset;
+}
+
+void CopyEngine::setDurable (bool durable)
+{
+    d_durable = durable;
+}
+
+bool CopyEngine::copy (int from_fd, int to_fd, copy_report_t *report_p)
+{
+    copy_report_t report = COPY_REPORT_EMPTY;
+    struct stat st, to_st;
+    off_t offset = 0, resumed = 0;
+    bool done = false;
+    size_t stream_buffer_size;
+    bool streaming, sparse;
+    progress_callback_t progress = d_progress;
+    const bool seen = (d_hash != nullptr || d_stream != nullptr);
+
+    if (-1 == fstat(from_fd, &st) || -1 == fstat(to_fd, &to_st)) {
+        report.error = errno;
+        goto end;
+    }
+    streaming = (d_cache_mode == CACHE_MODE_STREAMING && st.st_size >= g_stream_min_size);
+    sparse = ((off_t)st.st_blocks * 512 < st.st_size);
+
+    // Resume: aligned (O_DIRECT may take over), and only over bytes in place
+    resumed = d_resume_offset & ~(off_t)(g_direct_alignment - 1);
+    if (d_stream != nullptr) {
+        resumed -= resumed % d_stream->tree()->chunkSize();
+    }
+    if (resumed > 0 && (resumed > to_st.st_size || resumed > st.st_size)) {
+        resumed = 0;
+    }
+    if (resumed > 0 && d_hash != nullptr && false == hash_prefix(to_fd, resumed, d_buffer_size, d_hash)) {
+        resumed = 0;
+        d_hash->reset();
+    }
+    if (resumed > 0 && d_stream != nullptr && false == check_prefix(to_fd, resumed, d_buffer_size, d_stream)) {
+        resumed = 0;
+        d_stream->reset();
+        if (d_hash != nullptr) {
+            d_hash->reset();
+        }
+    }
+    if (d_resume_offset > 0 && resumed == 0 && -1 == ftruncate(to_fd, 0)) {
+        report.error = errno;
+        goto end;
+    }
+    if (resumed > 0 && d_progress) {
+        d_progress(resumed);
+    }
+    offset = resumed;
+
+    // Checkpoints: the progress reports come right after each chunk landed
+    if (d_checkpoint) {
+        std::shared_ptr<off_t> position = std::make_shared<off_t>(offset), next = std::make_shared<off_t>(offset);
+        const durable_callback_t checkpoint = d_checkpoint;
+        const progress_callback_t forward = d_progress;
+        const off_t interval = d_checkpoint_interval, size = st.st_size;
+        (*next) += interval;
+        progress = [=] (off_t bytes) {
+            if (forward) {
+                forward(bytes);
+            }
+            (*position) += bytes;
+            if ((*position) >= (*next) && (*position) < size && 0 == fdatasync(to_fd)) {
+                checkpoint(*position);
+                (*next) = (*position) + interval;
+            }
+        };
+    }
+
+    // Method: reflink (shares extents, nothing is copied; not worth resuming)
+    if (false == seen && resumed == 0 && copy_reflink(from_fd, to_fd)) {
+        report.method = COPY_METHOD_REFLINK;
+        report.bytes = st.st_size;
+        if (d_progress) {
+            d_progress(st.st_size);
+        }
+        done = true;
+        goto end;
+    } else if (false == seen && resumed == 0 && false == method_unsupported(errno)) {
+        report.error = errno;
+        goto end;
+    }
+
+    // Method: sparse (fewer blocks than bytes: only the data extents are copied)
+    if (sparse) {
+        report.method = (seen ? COPY_METHOD_BUFFERED : COPY_METHOD_COPY_FILE_RANGE);
+        done = copy_sparse(from_fd, to_fd, st.st_size, d_buffer_size, d_hash, d_stream, progress, &offset,
+                           &report.holes, &report.method);
+        report.error = (done ? 0 : errno);
+        goto end;
+    }
+
+    // Space: claimed for the rest of the file before its first byte lands, so
+    // that a full device fails here rather than part way, and the file gets
+    // as few extents as the filesystem can give it
+    if (false == preallocate(to_fd, offset, st.st_size - offset)) {
+        report.error = errno;
+        goto end;
+    }
+
+    // Method: pipelined (the bytes must be seen to be hashed or checked)
+    if (seen && false == streaming) {
+        report.method = COPY_METHOD_PIPELINED;
+        if (copy_pipelined(from_fd, to_fd, d_buffer_size, STREAM_CACHED, d_hash, d_stream, progress, &offset)) {
+            done = true;
+        } else {
+            report.error = errno;
+        }
+        goto end;
+    }
+
+    // Method: direct (bypasses the page cache), else drop-behind
+    if (streaming) {
+        stream_buffer_size = (d_buffer_size > g_stream_buffer_size ? d_buffer_size : g_stream_buffer_size);
+        stream_buffer_size = (stream_buffer_size + g_direct_alignment - 1) & ~(g_direct_alignment - 1);
+
+        report.method = COPY_METHOD_DIRECT;
+        if (set_direct(from_fd, true) && set_direct(to_fd, true)) {
+            done = copy_pipelined(from_fd, to_fd, stream_buffer_size, STREAM_DIRECT, d_hash, d_stream,
+                                  progress, &offset);
+            report.error = (done ? 0 : errno);
+        } else {
+            report.error = EINVAL;
+        }
+        set_direct(from_fd, false);
+        set_direct(to_fd, false);
+
+        // Refused before anything was written: go through the cache instead
+        if (false == done && report.error == EINVAL && offset == resumed) {
+            report.method = COPY_METHOD_DROP_BEHIND;
+            done = copy_pipelined(from_fd, to_fd, stream_buffer_size, STREAM_DROP_BEHIND, d_hash, d_stream,
+                                  progress, &offset);
+            report.error = (done ? 0 : errno);
+        }
+        goto end;
+    }
+
+    // Method: copy_file_range (in-kernel, may use server-side copy)
+    report.method = COPY_METHOD_COPY_FILE_RANGE;
+    if (copy_range(from_fd, to_fd, st.st_size, progress, &offset)) {
+        done = true;
+        goto end;
+    } else if (false == method_unsupported(errno)) {
+        report.error = errno;
+        goto end;
+    }
+
+    // Method: sendfile (in-kernel, page cache to page cache)
+    report.method = COPY_METHOD_SENDFILE;
+    if (copy_sendfile(from_fd, to_fd, st.st_size, progress, &offset)) {
+        done = true;
+        goto end;
+    } else if (false == method_unsupported(errno)) {
+        report.error = errno;
+        goto end;
+    }
+
+    // Method: buffered (read into userspace, then write)
+    report.method = COPY_METHOD_BUFFERED;
+    if (copy_buffered(from_fd, to_fd, d_buffer_size, progress, &offset)) {
+        done = true;
+    } else {
+        report.error = errno;
+    }
+
+end:
+
+    // The source shrank underneath us: what landed is not the file
+    if (done && report.method != COPY_METHOD_REFLINK && offset < st.st_size) {
+        report.error = EIO;
+        done = false;
+    }
+
+    // Every chunk must have been seen, up to where the file should end
+    if (done && d_stream != nullptr && false == d_stream->finish(offset)) {
+        report.error = EBADMSG;
+        done = false;
+    }
+
+    // A resumed destination may hold stale bytes past the end of the source
+    if (done && resumed > 0 && -1 == ftruncate(to_fd, offset)) {
+        report.error = errno;
+        done = false;
+    }
+    if (report.method != COPY_METHOD_REFLINK) {
+        report.bytes = offset - resumed - report.holes;
+    }
+    if (report_p != nullptr) {
+        (*report_p) = report;
+    }
+    return done;
+}
+
+bool CopyEngine::copy (const QString from, const QString to, copy_report_t *report_p)
+{
+    return copyat(AT_FDCWD, QFile::encodeName(from).constData(),
+                  AT_FDCWD, QFile::encodeName(to).constData(), report_p);
+}
+
+bool CopyEngine::copyat (int from_dirfd, const char *from, int to_dirfd, const char *to,
+                         copy_report_t *report_p)
+{
+    int from_fd = -1, to_fd = -1;
+    struct stat st;
+    bool done = false;
+    copy_report_t report = COPY_REPORT_EMPTY;
+
+    // Open the source
+    if (-1 == (from_fd = openat(from_dirfd, from, O_RDONLY | O_CLOEXEC))) {
+        report.error = errno;
+        goto end;
+    }
+    if (-1 == fstat(from_fd, &st)) {
+        report.error = errno;
+        goto end;
+    }
+
+    // Open (and truncate, unless resuming) the destination with the mode of the source
+    if (-1 == (to_fd = openat(to_dirfd, to,
+                              (d_resume_offset > 0 ? O_RDWR : O_WRONLY | O_TRUNC) | O_CREAT | O_CLOEXEC,
+                              st.st_mode & 07777))) {
+        report.error = errno;
+        goto end;
+    }
+    if (-1 == fchmod(to_fd, st.st_mode & 07777)) {
+        report.error = errno;
+        goto end;
+    }
+
+    // Move the data, then carry over the timestamps (incremental runs rely on them)
+    done = copy(from_fd, to_fd, &report);
+    if (done) {
+        const struct timespec times[2] = {st.st_atim, st.st_mtim};
+        if (-1 == futimens(to_fd, times) || (d_durable && -1 == fsync(to_fd))) {
+            report.error = errno;
+            done = false;
+        }
+    }
+
+end:
+    if (to_fd != -1 && 0 != close(to_fd) && done) {
+        report.error = errno;
+        done = false;
+    }
+    if (from_fd != -1) {
+        close(from_fd);
+    }
+    if (report_p != nullptr) {
+        (*report_p) = report;
+    }
+    return done;
+}
+
+bool CopyEngine::preallocate (int fd, off_t offset, off_t length)
+{
+    if (length <= 0) {
+        return true;
+    }
+    while (-1 == fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, length)) {
+        switch (errno) {
+        case EINTR:
+            continue;
+        case EOPNOTSUPP:
+        case ENOSYS:
+        case ENODEV:
+        case ESPIPE:
+        case EINVAL:
+            return true;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+QString CopyEngine::method_to_str (copy_method_t method)
+{
+    if (method == COPY_METHOD_ENUM_MAX) {
+        return nullptr;
+    } else {
+        return QString::fromUtf8(g_copy_method_str_map[method]);
+    }
+}
+
+QString CopyEngine::cache_mode_to_str (cache_mode_t mode)
+{
+    if (mode == CACHE_MODE_ENUM_MAX) {
+        return nullptr;
+    } else {
+        return QString::fromUtf8(g_cache_mode_str_map[mode]);
+    }
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function definitions                             *
+ *******************************************************************************
+*/
+
+
+/* Returns true if the error means "try the next method" rather than failure */
+static bool method_unsupported (int error)
+{
+    switch (error) {
+    case EXDEV:
+    case EINVAL:
+    case ENOSYS:
+    case ENOTTY:
+    case EOPNOTSUPP:
+    case EBADF:
+    case ETXTBSY:
+    case EPERM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool copy_reflink (int from_fd, int to_fd)
+{
+#ifdef FICLONE
+    return (0 == ioctl(to_fd, FICLONE, from_fd));
+#else
+    Q_UNUSED(from_fd);
+    Q_UNUSED(to_fd);
+    errno = EOPNOTSUPP;
+    return false;
+#endif
+}
+
+static bool copy_range (int from_fd, int to_fd, off_t size,
+                        const progress_callback_t &progress, off_t *offset_p)
+{
+    const size_t chunk = (progress ? g_progress_chunk : g_max_chunk);
+
+    while (*offset_p < size) {
+        loff_t in = *offset_p, out = *offset_p;
+        size_t len = (size_t)(size - *offset_p) < chunk ? (size - *offset_p) : chunk;
+        ssize_t n = copy_file_range(from_fd, &in, to_fd, &out, len, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        // Source shrank underneath us: what we have is not the file
+        if (n == 0) {
+            errno = EIO;
+            return false;
+        }
+        (*offset_p) += n;
+        if (progress) {
+            progress(n);
+        }
+    }
+    return true;
+}
+
+static bool copy_sendfile (int from_fd, int to_fd, off_t size,
+                           const progress_callback_t &progress, off_t *offset_p)
+{
+    const size_t chunk = (progress ? g_progress_chunk : g_max_chunk);
+
+    // sendfile() writes at the current file offset of the destination
+    if (-1 == lseek(to_fd, *offset_p, SEEK_SET)) {
+        return false;
+    }
+    while (*offset_p < size) {
+        off_t in = *offset_p;
+        size_t len = (size_t)(size - *offset_p) < chunk ? (size - *offset_p) : chunk;
+        ssize_t n = sendfile(to_fd, from_fd, &in, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (n == 0) {
+            errno = EIO;
+            return false;
+        }
+        (*offset_p) += n;
+        if (progress) {
+            progress(n);
+        }
+    }
+    return true;
+}
+
+static bool copy_buffered (int from_fd, int to_fd, size_t buffer_size,
+                           const progress_callback_t &progress, off_t *offset_p)
+{
+    std::unique_ptr<char[]> buffer(new char[buffer_size]);
+    ssize_t n;
+
+    while ((n = read_chunk(from_fd, buffer.get(), buffer_size, *offset_p)) > 0) {
+        if (false == write_chunk(to_fd, buffer.get(), n, *offset_p)) {
+            return false;
+        }
+        (*offset_p) += n;
+        if (progress) {
+            progress(n);
+        }
+    }
+    return (n == 0);
+}
+
+/*\
+ * Two buffers alternate: while one is hashed and written on this thread, the
+ * next chunk is read into the other by a pool task (and its chunk digests
+ * are checked by more, so a bad chunk stops the copy before the next write). Under O_DIRECT, offsets
+ * stay aligned as long as every chunk is a full buffer. The first short one
+ * (the tail of the file, or a short read some filesystems return before it)
+ * turns O_DIRECT off, and the rest of the file goes through the cache.
+\*/
+static bool copy_pipelined (int from_fd, int to_fd, size_t buffer_size, stream_mode_t stream,
+                            Sha256 *hash, ChunkStream *chunks, const progress_callback_t &progress,
+                            off_t *offset_p)
+{
+    aligned_buffer_t buffers[2] = {aligned_buffer(buffer_size), aligned_buffer(buffer_size)};
+    ssize_t lengths[2];
+    int errors[2] = {0, 0};
+    WorkPool &pool = WorkPool::get_instance();
+    WorkGroup group;
+    int current = 0;
+    bool ok = true;
+
+    if (buffers[0] == nullptr || buffers[1] == nullptr) {
+        errno = ENOMEM;
+        return false;
+    }
+    if (stream == STREAM_DIRECT && 0 != (*offset_p) % g_direct_alignment) {
+        errno = EINVAL;
+        return false;
+    }
+    posix_fadvise(from_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Prime the first buffer
+    lengths[0] = (stream == STREAM_DIRECT ? read_direct : read_chunk)(from_fd, buffers[0].get(), buffer_size,
+                                                                      *offset_p);
+    errors[0] = errno;
+
+    while (lengths[current] > 0) {
+        int next = current ^ 1;
+        off_t next_offset = (*offset_p) + lengths[current];
+        char *next_buffer = buffers[next].get();
+        ssize_t *next_length = &lengths[next];
+        int *next_error = &errors[next];
+
+        // A short chunk leaves the next offset unaligned: finish through the cache
+        if (stream == STREAM_DIRECT && lengths[current] < (ssize_t)buffer_size) {
+            if (false == set_direct(from_fd, false) || false == set_direct(to_fd, false)) {
+                return false;
+            }
+            stream = STREAM_DROP_BEHIND;
+        }
+
+        // Read ahead into the other buffer
+        auto read = (stream == STREAM_DIRECT ? read_direct : read_chunk);
+        pool.submit(group, [read, from_fd, next_buffer, buffer_size, next_offset, next_length, next_error] {
+            (*next_length) = read(from_fd, next_buffer, buffer_size, next_offset);
+            (*next_error) = errno;
+        });
+        if (chunks != nullptr) {
+            chunks->feed(pool, group, *offset_p, buffers[current].get(), lengths[current]);
+        }
+
+        // Write the current one
+        ok = write_chunk(to_fd, buffers[current].get(), lengths[current], *offset_p);
+        int write_error = errno;
+
+        // Hash it only once written: a refused write may be retried by another method
+        if (ok && hash != nullptr) {
+            hash->update(buffers[current].get(), lengths[current]);
+        }
+        pool.wait(group);
+        if (false == ok) {
+            errno = write_error;
+            return false;
+        }
+        if (chunks != nullptr && chunks->failed()) {
+            errno = EBADMSG;
+            return false;
+        }
+        if (stream == STREAM_DROP_BEHIND) {
+            drop_behind(from_fd, to_fd, *offset_p, lengths[current], buffer_size);
+        }
+        if (progress) {
+            progress(lengths[current]);
+        }
+
+        (*offset_p) = next_offset;
+        current = next;
+    }
+
+    if (lengths[current] < 0) {
+        errno = errors[current];
+        return false;
+    }
+    return true;
+}
+
+/*\
+ * Copies the data extents of a sparse source (found with SEEK_DATA and
+ * SEEK_HOLE) and leaves its holes unwritten, so that they stay holes at the
+ * destination. The holes still count as zeros for the hash, the chunk
+ * digests and the progress. The data goes in-kernel unless it must be seen.
+\*/
+static bool copy_sparse (int from_fd, int to_fd, off_t size, size_t buffer_size, Sha256 *hash,
+                         ChunkStream *chunks, const progress_callback_t &progress, off_t *offset_p,
+                         off_t *holes_p, copy_method_t *method_p)
+{
+    std::unique_ptr<char[]> buffer(new char[buffer_size]);
+    WorkPool &pool = WorkPool::get_instance();
+    WorkGroup group;
+    bool in_kernel = (hash == nullptr && chunks == nullptr);
+
+    // Past the offset, what is not written again must read as a hole
+    if (-1 == ftruncate(to_fd, *offset_p)) {
+        return false;
+    }
+
+    while (*offset_p < size) {
+        off_t data = lseek(from_fd, *offset_p, SEEK_DATA), hole = size;
+
+        // ENXIO: nothing but a hole up to the end
+        if (data == -1 && errno != ENXIO) {
+            return false;
+        }
+        data = (data == -1 ? size : std::min(data, size));
+        if (data < size && -1 == (hole = lseek(from_fd, data, SEEK_HOLE))) {
+            return false;
+        }
+        hole = std::min(hole, size);
+
+        // Hole: skipped, though the hash and the chunk digests see its zeros
+        for (off_t at = *offset_p; at < data && (hash != nullptr || chunks != nullptr); ) {
+            size_t length = std::min<off_t>(buffer_size, data - at);
+            memset(buffer.get(), 0, length);
+            if (chunks != nullptr) {
+                chunks->feed(pool, group, at, buffer.get(), length);
+            }
+            if (hash != nullptr) {
+                hash->update(buffer.get(), length);
+            }
+            pool.wait(group);
+            if (chunks != nullptr && chunks->failed()) {
+                errno = EBADMSG;
+                return false;
+            }
+            at += length;
+        }
+        if (data > *offset_p) {
+            (*holes_p) += data - (*offset_p);
+            if (progress) {
+                progress(data - (*offset_p));
+            }
+            (*offset_p) = data;
+        }
+        if (data == size) {
+            break;
+        }
+
+        // Data: claimed, then copied in-kernel (or through the buffer)
+        if (false == CopyEngine::preallocate(to_fd, data, hole - data)) {
+            return false;
+        }
+        if (in_kernel && false == copy_range(from_fd, to_fd, hole, progress, offset_p)) {
+            if (false == method_unsupported(errno)) {
+                return false;
+            }
+            in_kernel = false;
+            (*method_p) = COPY_METHOD_BUFFERED;
+        }
+        while ((*offset_p) < hole) {
+            ssize_t n = read_chunk(from_fd, buffer.get(), std::min<off_t>(buffer_size, hole - (*offset_p)), *offset_p);
+            if (n <= 0) {
+                if (n == 0) {
+                    errno = EIO;
+                }
+                return false;
+            }
+            if (chunks != nullptr) {
+                chunks->feed(pool, group, *offset_p, buffer.get(), n);
+            }
+            if (hash != nullptr) {
+                hash->update(buffer.get(), n);
+            }
+            bool ok = write_chunk(to_fd, buffer.get(), n, *offset_p);
+            int write_error = errno;
+            pool.wait(group);
+            if (false == ok) {
+                errno = write_error;
+                return false;
+            }
+            if (chunks != nullptr && chunks->failed()) {
+                errno = EBADMSG;
+                return false;
+            }
+            (*offset_p) += n;
+            if (progress) {
+                progress(n);
+            }
+        }
+    }
+
+    // A hole at the end is only a length
+    return (0 == ftruncate(to_fd, *offset_p));
+}
+
+/* Switches O_DIRECT on or off for an open descriptor */
+static bool set_direct (int fd, bool direct)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1) {
+        return false;
+    }
+    flags = (direct ? (flags | O_DIRECT) : (flags & ~O_DIRECT));
+    return (0 == fcntl(fd, F_SETFL, flags));
+}
+
+/*\
+ * Reads like read_chunk() under O_DIRECT, but stops at the first read that
+ * leaves the offset unaligned (the next one would be refused)
+\*/
+static ssize_t read_direct (int fd, char *buffer, size_t size, off_t offset)
+{
+    size_t filled = 0;
+
+    while (filled < size) {
+        ssize_t n = pread(fd, buffer + filled, size - filled, offset + filled);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        filled += n;
+        if (n == 0 || 0 != filled % g_direct_alignment) {
+            break;
+        }
+    }
+    return filled;
+}
+
+/*\
+ * Called once the chunk at "offset" was written: starts its writeback, waits
+ * for the previous chunk to reach the disk and drops it from the cache (the
+ * dirty backlog stays at two chunks), drops the source chunk, and asks for
+ * the chunk after the one being read ahead.
+\*/
+static void drop_behind (int from_fd, int to_fd, off_t offset, size_t length, size_t buffer_size)
+{
+    sync_file_range(to_fd, offset, length, SYNC_FILE_RANGE_WRITE);
+    if (offset >= (off_t)buffer_size) {
+        off_t previous = offset - buffer_size;
+        sync_file_range(to_fd, previous, buffer_size,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(to_fd, previous, buffer_size, POSIX_FADV_DONTNEED);
+    }
+
+    // A short chunk is the last one: settle it now
+    if (length < buffer_size) {
+        sync_file_range(to_fd, offset, length,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(to_fd, offset, length, POSIX_FADV_DONTNEED);
+    }
+    posix_fadvise(from_fd, offset, length, POSIX_FADV_DONTNEED);
+    posix_fadvise(from_fd, offset + 2 * buffer_size, buffer_size, POSIX_FADV_WILLNEED);
+}
+
+/* Returns a buffer aligned for O_DIRECT (nullptr if out of memory) */
+static aligned_buffer_t aligned_buffer (size_t size)
+{
+    void *p = nullptr;
+    if (0 != posix_memalign(&p, g_direct_alignment, size)) {
+        p = nullptr;
+    }
+    return aligned_buffer_t(static_cast<char *>(p), free);
+}
+
+/* Feeds the first "length" bytes of a file into the hash */
+static bool hash_prefix (int fd, off_t length, size_t buffer_size, Sha256 *hash)
+{
+    std::unique_ptr<char[]> buffer(new char[buffer_size]);
+    off_t offset = 0;
+
+    while (offset < length) {
+        size_t size = (size_t)(length - offset) < buffer_size ? (length - offset) : buffer_size;
+        if ((ssize_t)size != read_chunk(fd, buffer.get(), size, offset)) {
+            return false;
+        }
+        hash->update(buffer.get(), size);
+        offset += size;
+    }
+    return true;
+}
+
+/* Checks the first "length" bytes of a file (whole chunks) against the stream */
+static bool check_prefix (int fd, off_t length, size_t buffer_size, ChunkStream *chunks)
+{
+    std::unique_ptr<char[]> buffer(new char[buffer_size]);
+    WorkPool &pool = WorkPool::get_instance();
+    WorkGroup group;
+    off_t offset = 0;
+
+    while (offset < length && false == chunks->failed()) {
+        size_t size = (size_t)(length - offset) < buffer_size ? (length - offset) : buffer_size;
+        if ((ssize_t)size != read_chunk(fd, buffer.get(), size, offset)) {
+            return false;
+        }
+        chunks->feed(pool, group, offset, buffer.get(), size);
+        pool.wait(group);
+        offset += size;
+    }
+    return (false == chunks->failed());
+}
+
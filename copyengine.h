@@ -0,0 +1,201 @@
+#ifndef COPYENGINE_H
+#define COPYENGINE_H
+
+#include <QString>
+#include <sys/types.h>
+#include <functional>
+#include "progress.h"
+
+namespace SWU {
+
+class Sha256;
+class ChunkStream;
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+/* enumeration of copy methods (in order of preference) */
+enum copy_method_t {
+    COPY_METHOD_REFLINK = 0,
+    COPY_METHOD_COPY_FILE_RANGE,
+    COPY_METHOD_SENDFILE,
+    COPY_METHOD_BUFFERED,
+    COPY_METHOD_PIPELINED,  /**< Double-buffered read, hash and write */
+    COPY_METHOD_DIRECT,     /**< As above, with O_DIRECT on both files */
+    COPY_METHOD_DROP_BEHIND,/**< As above, through the page cache with fadvise */
+    COPY_METHOD_DECOMPRESS, /**< Decoded from a compressed source (see Decompressor) */
+
+    /* Size */
+    COPY_METHOD_ENUM_MAX
+};
+
+/* enumeration of page cache policies */
+enum cache_mode_t {
+    CACHE_MODE_CACHED = 0,  /**< Let the kernel cache everything (default) */
+    CACHE_MODE_STREAMING,   /**< Keep large copies out of the page cache */
+
+    /* Size */
+    CACHE_MODE_ENUM_MAX
+};
+
+/* Outcome of a copy */
+struct copy_report_t {
+    copy_method_t method;   /**< Last (slowest) method that moved data */
+    off_t bytes;            /**< Bytes transferred to the destination */
+    int error;              /**< errno of the failing call (0 on success) */
+    off_t holes;            /**< Bytes of source holes left unwritten */
+};
+
+/* Symbolic constant: empty copy report */
+#define COPY_REPORT_EMPTY        copy_report_t{COPY_METHOD_REFLINK, 0, 0, 0}
+
+/* Receives the number of leading destination bytes that reached the disk */
+typedef std::function<void(off_t durable)> durable_callback_t;
+
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * The CopyEngine moves the contents of one file into another while keeping
+ * the data inside the kernel wherever possible. Methods are attempted in the
+ * order of copy_method_t: a reflink shares extents on filesystems that support
+ * it; copy_file_range and sendfile copy in-kernel; a buffered read/write loop
+ * is the last resort. A method that fails part way hands over to the next one
+ * at the current offset, so no byte is transferred twice.
+ *
+ * If a hash (or chunk stream) is attached, the data must pass through
+ * userspace anyway: the engine then reads the next chunk on the worker pool
+ * while the current one is hashed and written (pipelined), so the source is
+ * read exactly once.
+ *
+ * In streaming mode, files of at least g_stream_min_size that cannot be
+ * reflinked are pipelined through large aligned buffers with O_DIRECT, so
+ * they neither evict the page cache of running processes nor pile up dirty
+ * pages. Where the filesystem refuses O_DIRECT, the copy goes through the
+ * page cache but starts writeback behind the write cursor, drops what was
+ * written and read, and asks for read-ahead in front of the read cursor.
+ *
+ * A sparse source (fewer blocks allocated than its size) that cannot be
+ * reflinked is copied extent by extent: SEEK_DATA and SEEK_HOLE find the
+ * data, which is copied as usual, while the holes are skipped (and fed to
+ * the hash as zeros), so they stay holes at the destination.
+ *
+ * Before any data is copied (a reflink aside), the rest of the destination
+ * (or each data extent of a sparse one) is preallocated: a device without
+ * the space fails the copy up front.
+ *
+ * A copy can be checkpointed (the destination is synced every so many bytes
+ * and the durable length reported) and resumed from such a checkpoint: the
+ * destination is then kept, and only the bytes past the offset are copied.
+\*/
+class CopyEngine
+{
+private:
+    size_t d_buffer_size;
+    Sha256 *d_hash;
+    ChunkStream *d_stream;
+    progress_callback_t d_progress;
+    cache_mode_t d_cache_mode;
+    durable_callback_t d_checkpoint;
+    off_t d_checkpoint_interval;
+    off_t d_resume_offset;
+    bool d_durable;
+
+public:
+    CopyEngine(size_t buffer_size = 1 << 20);
+
+    /*\
+     * Feeds every byte copied into the given hash (nullptr: no hashing)
+    \*/
+    void setHash (Sha256 *hash);
+
+    /*\
+     * Checks every byte copied against the chunk digests of the stream, in
+     * parallel with the writes (nullptr: none). The copy stops with EBADMSG
+     * at the first bad chunk, or if the file does not end where it should.
+    \*/
+    void setChunkStream (ChunkStream *stream);
+
+    /*\
+     * Reports the bytes transferred as the copy advances (nullptr: silent).
+     * In-kernel copies are then issued in smaller requests so that the
+     * reports keep coming; a reflink is reported in one go.
+    \*/
+    void setProgress (progress_callback_t progress);
+
+    /*\
+     * Sets the page cache policy (CACHE_MODE_CACHED by default)
+    \*/
+    void setCacheMode (cache_mode_t mode);
+
+    /*\
+     * Syncs the destination each time another "interval" bytes were copied
+     * and reports its durable length (nullptr: no checkpoints). None is
+     * reported once the copy is complete.
+    \*/
+    void setCheckpoint (durable_callback_t checkpoint, off_t interval);
+
+    /*\
+     * Continues an earlier copy of which the first "offset" bytes are in place
+     * at the destination (0 by default: copy everything). If the destination
+     * turns out shorter, the copy starts over. An attached hash is fed the
+     * destination bytes up to the offset first; with a chunk stream, the
+     * offset is rounded down to a chunk and the chunks in place are checked.
+    \*/
+    void setResumeOffset (off_t offset);
+
+    /*\
+     * Makes copyat() fsync the destination before it returns (off by default)
+    \*/
+    void setDurable (bool durable);
+
+    /*\
+     * Copies an open source descriptor into an open (empty) destination.
+     * - from_fd: Readable descriptor, positioned anywhere
+     * - to_fd: Writable descriptor (also readable to resume with a hash)
+     * - report_p: Optional pointer at which to store the outcome
+    \*/
+    bool copy (int from_fd, int to_fd, copy_report_t *report_p = nullptr);
+
+    /*\
+     * Copies file "from" to file "to", replacing "to" if it exists. The
+     * destination inherits the permission bits and timestamps of the source.
+    \*/
+    bool copy (const QString from, const QString to, copy_report_t *report_p = nullptr);
+
+    /*\
+     * As above, with "from" and "to" relative to the given directory
+     * descriptors (or AT_FDCWD)
+    \*/
+    bool copyat (int from_dirfd, const char *from, int to_dirfd, const char *to,
+                 copy_report_t *report_p = nullptr);
+
+    /*\
+     * Allocates "length" bytes of "fd" from "offset" without changing its
+     * size, so that later writes there cannot run out of space. Returns false
+     * (with errno set, e.g. ENOSPC) if the space is not there; a filesystem
+     * or file that cannot preallocate counts as success.
+    \*/
+    static bool preallocate (int fd, off_t offset, off_t length);
+
+    /*\
+     * Returns a printable name for the given method
+    \*/
+    static QString method_to_str (copy_method_t method);
+
+    /*\
+     * Returns a printable name for the given cache mode
+    \*/
+    static QString cache_mode_to_str (cache_mode_t mode);
+};
+
+}
+
+#endif // COPYENGINE_H
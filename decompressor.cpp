@@ -0,0 +1,488 @@
+#include "decompressor.h"
+#include "fileio.h"
+#include "hasher.h"
+#include "workpool.h"
+
+#include <QDebug>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <lzma.h>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#ifdef SWU_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+
+/* Streaming decoder of one codec */
+class Decoder
+{
+public:
+    virtual ~Decoder() {}
+
+    // Returns false if the decoder could not be set up
+    virtual bool ready () = 0;
+
+    /*\
+     * Decodes from "*in_p" into "*out_p", advancing both and decrementing the
+     * bytes left. "eof" tells that no input follows; "*end_p" is set once the
+     * input ended cleanly and all output was produced. False on corrupt data.
+    \*/
+    virtual bool decode (const char **in_p, size_t *in_left_p, char **out_p, size_t *out_left_p,
+                         bool eof, bool *end_p) = 0;
+};
+
+/* xz: a multi-threaded stream decoder (liblzma 5.4 on), else a plain one */
+class XzDecoder : public Decoder
+{
+private:
+    lzma_stream d_stream;
+    bool d_ready;
+
+public:
+    XzDecoder():
+        d_stream(LZMA_STREAM_INIT),
+        d_ready(false)
+    {
+#if LZMA_VERSION >= 50040002
+        lzma_mt mt;
+        memset(&mt, 0, sizeof(mt));
+        mt.flags = LZMA_CONCATENATED;
+        mt.threads = std::max(1u, std::thread::hardware_concurrency());
+        mt.memlimit_threading = lzma_physmem() / 4;
+        mt.memlimit_stop = UINT64_MAX;
+        d_ready = (LZMA_OK == lzma_stream_decoder_mt(&d_stream, &mt));
+#else
+        d_ready = (LZMA_OK == lzma_stream_decoder(&d_stream, UINT64_MAX, LZMA_CONCATENATED));
+#endif
+    }
+
+    ~XzDecoder()
+    {
+        lzma_end(&d_stream);
+    }
+
+    bool ready () override
+    {
+        return d_ready;
+    }
+
+    bool decode (const char **in_p, size_t *in_left_p, char **out_p, size_t *out_left_p,
+                 bool eof, bool *end_p) override
+    {
+        d_stream.next_in = reinterpret_cast<const uint8_t *>(*in_p);
+        d_stream.avail_in = *in_left_p;
+        d_stream.next_out = reinterpret_cast<uint8_t *>(*out_p);
+        d_stream.avail_out = *out_left_p;
+
+        lzma_ret ret = lzma_code(&d_stream, eof ? LZMA_FINISH : LZMA_RUN);
+
+        (*in_p) = reinterpret_cast<const char *>(d_stream.next_in);
+        (*in_left_p) = d_stream.avail_in;
+        (*out_p) = reinterpret_cast<char *>(d_stream.next_out);
+        (*out_left_p) = d_stream.avail_out;
+        (*end_p) = (ret == LZMA_STREAM_END);
+
+        if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+            qDebug() << " --- xz decoder error:" << (int)ret;
+            return false;
+        }
+        return true;
+    }
+};
+
+#ifdef SWU_HAVE_ZSTD
+
+/* zstd: a streaming decoder (frames may follow each other) */
+class ZstdDecoder : public Decoder
+{
+private:
+    ZSTD_DStream *d_stream;
+    size_t d_hint;
+
+public:
+    ZstdDecoder():
+        d_stream(ZSTD_createDStream()),
+        d_hint(1)
+    {
+        if (d_stream != nullptr && ZSTD_isError(ZSTD_initDStream(d_stream))) {
+            ZSTD_freeDStream(d_stream);
+            d_stream = nullptr;
+        }
+    }
+
+    ~ZstdDecoder()
+    {
+        ZSTD_freeDStream(d_stream);
+    }
+
+    bool ready () override
+    {
+        return (d_stream != nullptr);
+    }
+
+    bool decode (const char **in_p, size_t *in_left_p, char **out_p, size_t *out_left_p,
+                 bool eof, bool *end_p) override
+    {
+        ZSTD_inBuffer in = {*in_p, *in_left_p, 0};
+        ZSTD_outBuffer out = {*out_p, *out_left_p, 0};
+
+        // A call that consumes and produces nothing (draining at the end of
+        // the input) returns the hint of a next frame: keep the previous one
+        size_t hint = ZSTD_decompressStream(d_stream, &out, &in);
+        if (ZSTD_isError(hint) || in.pos > 0 || out.pos > 0) {
+            d_hint = hint;
+        }
+
+        (*in_p) += in.pos;
+        (*in_left_p) -= in.pos;
+        (*out_p) += out.pos;
+        (*out_left_p) -= out.pos;
+
+        if (ZSTD_isError(d_hint)) {
+            qDebug() << " --- zstd decoder error:" << QString(ZSTD_getErrorName(d_hint));
+            return false;
+        }
+
+        // Ends with the input, on a frame boundary (0), once the output is flushed
+        (*end_p) = (eof && (*in_left_p) == 0 && d_hint == 0 && (*out_left_p) > 0);
+
+        // Truncated: no input left, nothing produced, yet inside a frame
+        return (false == eof || (*in_left_p) > 0 || d_hint == 0 || out.pos > 0);
+    }
+};
+
+#endif
+
+
+/*
+ *******************************************************************************
+ *                         Static variable definitions                         *
+ *******************************************************************************
+*/
+
+
+static const char *g_codec_str_map[CODEC_ENUM_MAX] = {
+    [CODEC_NONE]                  = "none",
+    [CODEC_XZ]                    = "xz",
+    [CODEC_ZSTD]                  = "zstd"
+};
+
+static const char *g_codec_suffix_map[CODEC_ENUM_MAX] = {
+    [CODEC_NONE]                  = "",
+    [CODEC_XZ]                    = ".xz",
+    [CODEC_ZSTD]                  = ".zst"
+};
+
+// Decompressed bytes handed to the sink at once
+static const size_t g_output_buffer_size = 4 << 20;
+
+
+/*
+ *******************************************************************************
+ *                            Forward declarations                             *
+ *******************************************************************************
+*/
+
+
+static std::unique_ptr<Decoder> make_decoder (codec_t codec);
+
+
+/*
+ *******************************************************************************
+ *                       Class definition: Decompressor                        *
+ *******************************************************************************
+*/
+
+
+Decompressor::Decompressor(codec_t codec, size_t buffer_size):
+    d_codec(codec),
+    d_buffer_size(buffer_size),
+    d_hash(nullptr),
+    d_progress(nullptr),
+    d_durable(false),
+    d_offset(0),
+    d_length(-1)
+{}
+
+void Decompressor::setHash (Sha256 *hash)
+{
+    d_hash = hash;
+}
+
+void Decompressor::setProgress (progress_callback_t progress)
+{
+    d_progress = progress;
+}
+
+void Decompressor::setDurable (bool durable)
+{
+    d_durable = durable;
+}
+
+void Decompressor::setRange (off_t offset, off_t length)
+{
+    d_offset = offset;
+    d_length = length;
+}
+
+size_t Decompressor::chunk (off_t offset)
+{
+    if (d_length < 0) {
+        return d_buffer_size;
+    }
+    return std::min<off_t>(d_buffer_size, d_offset + d_length - offset);
+}
+
+bool Decompressor::decompress (int from_fd, decompress_sink_t sink, off_t *size_p)
+{
+    std::unique_ptr<Decoder> decoder = make_decoder(d_codec);
+    std::unique_ptr<char[]> buffers[2] = {std::unique_ptr<char[]>(new char[d_buffer_size]),
+                                          std::unique_ptr<char[]>(new char[d_buffer_size])};
+    std::unique_ptr<char[]> output(new char[g_output_buffer_size]);
+    ssize_t lengths[2];
+    int errors[2] = {0, 0};
+    WorkPool &pool = WorkPool::get_instance();
+    WorkGroup group;
+    off_t offset = d_offset, size = 0;
+    int current = 0;
+    bool end = false, ok = true;
+
+    if (decoder == nullptr || false == decoder->ready()) {
+        errno = ENOTSUP;
+        return false;
+    }
+    posix_fadvise(from_fd, d_offset, (d_length < 0 ? 0 : d_length), POSIX_FADV_SEQUENTIAL);
+
+    // Prime the first buffer
+    lengths[0] = read_chunk(from_fd, buffers[0].get(), chunk(offset), offset);
+    errors[0] = errno;
+
+    while (ok && false == end) {
+        int next = current ^ 1;
+        const bool eof = (lengths[current] == 0);
+        const char *in = buffers[current].get();
+        size_t in_left = lengths[current];
+
+        if (lengths[current] < 0) {
+            errno = errors[current];
+            return false;
+        }
+
+        // Read ahead into the other buffer
+        if (false == eof) {
+            off_t next_offset = offset + lengths[current];
+            char *next_buffer = buffers[next].get();
+            ssize_t *next_length = &lengths[next];
+            int *next_error = &errors[next];
+            size_t buffer_size = chunk(next_offset);
+            pool.submit(group, [from_fd, next_buffer, buffer_size, next_offset, next_length, next_error] {
+                (*next_length) = read_chunk(from_fd, next_buffer, buffer_size, next_offset);
+                (*next_error) = errno;
+            });
+        }
+
+        // Decode the chunk (at the end of the input: drain the decoder)
+        while (ok) {
+            char *out = output.get();
+            size_t out_left = g_output_buffer_size;
+            if (false == (ok = decoder->decode(&in, &in_left, &out, &out_left, eof, &end))) {
+                errno = EBADMSG;
+                break;
+            }
+            size_t produced = g_output_buffer_size - out_left;
+            if (produced > 0) {
+                if (d_hash != nullptr) {
+                    d_hash->update(output.get(), produced);
+                }
+                ok = sink(output.get(), produced);
+                size += produced;
+            }
+
+            // More input is needed (at the end of it: nothing more came out)
+            if (end || (in_left == 0 && out_left > 0 && (false == eof || produced == 0))) {
+                break;
+            }
+        }
+        pool.wait(group);
+
+        // Out of input, yet the stream did not end: truncated
+        if (ok && eof && false == end) {
+            qDebug() << " --- Compressed stream is truncated";
+            errno = EBADMSG;
+            return false;
+        }
+        if (false == ok) {
+            return false;
+        }
+        if (d_progress && lengths[current] > 0) {
+            d_progress(lengths[current]);
+        }
+        offset += lengths[current];
+        current = next;
+    }
+
+    if (size_p != nullptr) {
+        (*size_p) = size;
+    }
+    return true;
+}
+
+bool Decompressor::decompressat (int from_dirfd, const char *from, int to_dirfd, const char *to,
+                                 copy_report_t *report_p)
+{
+    int from_fd = -1, to_fd = -1;
+    struct stat st;
+    off_t size = 0;
+    bool done = false;
+    copy_report_t report = copy_report_t{COPY_METHOD_DECOMPRESS, 0, 0, 0};
+
+    // Open the source
+    if (-1 == (from_fd = openat(from_dirfd, from, O_RDONLY | O_CLOEXEC))) {
+        report.error = errno;
+        goto end;
+    }
+    if (-1 == fstat(from_fd, &st)) {
+        report.error = errno;
+        goto end;
+    }
+
+    // Open (and truncate) the destination with the mode of the source
+    if (-1 == (to_fd = openat(to_dirfd, to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777))) {
+        report.error = errno;
+        goto end;
+    }
+    if (-1 == fchmod(to_fd, st.st_mode & 07777)) {
+        report.error = errno;
+        goto end;
+    }
+
+    // Decode straight into the destination, then carry over the timestamps
+    done = decompress(from_fd, [to_fd] (const char *data, size_t length) {
+        return write_all(to_fd, data, length);
+    }, &size);
+    if (false == done) {
+        report.error = errno;
+    } else {
+        const struct timespec times[2] = {st.st_atim, st.st_mtim};
+        if (-1 == futimens(to_fd, times) || (d_durable && -1 == fsync(to_fd))) {
+            report.error = errno;
+            done = false;
+        }
+    }
+    report.bytes = size;
+
+end:
+    if (to_fd != -1 && 0 != close(to_fd) && done) {
+        report.error = errno;
+        done = false;
+    }
+    if (from_fd != -1) {
+        close(from_fd);
+    }
+    if (report_p != nullptr) {
+        (*report_p) = report;
+    }
+    return done;
+}
+
+bool Decompressor::digest_file (int dirfd, const char *name, codec_t codec, QByteArray *digest_p,
+                                off_t *size_p, progress_callback_t progress)
+{
+    Sha256 hash;
+    Decompressor decompressor(codec);
+    int fd;
+
+    if (-1 == (fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC))) {
+        return false;
+    }
+    decompressor.setHash(&hash);
+    decompressor.setProgress(progress);
+    bool ok = decompressor.decompress(fd, [] (const char *data, size_t length) {
+        Q_UNUSED(data);
+        Q_UNUSED(length);
+        return true;
+    }, size_p);
+    close(fd);
+
+    if (ok) {
+        (*digest_p) = hash.result();
+    }
+    return ok;
+}
+
+codec_t Decompressor::codec_of (const QString name)
+{
+    for (int codec = CODEC_NONE + 1; codec < CODEC_ENUM_MAX; ++codec) {
+        if (name.endsWith(g_codec_suffix_map[codec])) {
+            return static_cast<codec_t>(codec);
+        }
+    }
+    return CODEC_NONE;
+}
+
+QString Decompressor::plain_name (const QString name)
+{
+    return name.left(name.length() - strlen(g_codec_suffix_map[codec_of(name)]));
+}
+
+bool Decompressor::available (codec_t codec)
+{
+    switch (codec) {
+    case CODEC_NONE:
+    case CODEC_XZ:
+        return true;
+#ifdef SWU_HAVE_ZSTD
+    case CODEC_ZSTD:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+QString Decompressor::codec_to_str (codec_t codec)
+{
+    if (codec == CODEC_ENUM_MAX) {
+        return nullptr;
+    } else {
+        return QString::fromUtf8(g_codec_str_map[codec]);
+    }
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function definitions                             *
+ *******************************************************************************
+*/
+
+
+/* Returns the decoder of a codec (nullptr if this build has none) */
+static std::unique_ptr<Decoder> make_decoder (codec_t codec)
+{
+    switch (codec) {
+    case CODEC_XZ:
+        return std::unique_ptr<Decoder>(new XzDecoder());
+#ifdef SWU_HAVE_ZSTD
+    case CODEC_ZSTD:
+        return std::unique_ptr<Decoder>(new ZstdDecoder());
+#endif
+    default:
+        return nullptr;
+    }
+}
+
@@ -0,0 +1,133 @@
+#ifndef DECOMPRESSOR_H
+#define DECOMPRESSOR_H
+
+#include <QString>
+#include <QByteArray>
+#include <sys/types.h>
+#include <functional>
+#include "copyengine.h"
+#include "progress.h"
+
+namespace SWU {
+
+class Sha256;
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+/* enumeration of compression formats of payload files (by file name suffix) */
+enum codec_t {
+    CODEC_NONE = 0,
+    CODEC_XZ,               /**< ".xz", through liblzma */
+    CODEC_ZSTD,             /**< ".zst", through libzstd (if built with SWU_HAVE_ZSTD) */
+
+    /* Size */
+    CODEC_ENUM_MAX
+};
+
+/* Receives decompressed bytes in order; returns false to stop */
+typedef std::function<bool(const char *data, size_t size)> decompress_sink_t;
+
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * The Decompressor streams a compressed payload file into its plain form.
+ * The next compressed chunk is read on the worker pool while the current
+ * one is decoded, so the (slow) media is read once and only for the
+ * compressed bytes. Concatenated streams and frames are accepted, and
+ * the integrity checks of the format are enforced.
+ *
+ * Progress is reported in compressed bytes, as those are what is read.
+ *
+ * xz is decoded on several threads when the file was compressed in blocks
+ * (as multi-threaded xz does). libzstd decodes on one thread only; reads
+ * still overlap with decoding.
+\*/
+class Decompressor
+{
+private:
+    codec_t d_codec;
+    size_t d_buffer_size;
+    Sha256 *d_hash;
+    progress_callback_t d_progress;
+    bool d_durable;
+    off_t d_offset, d_length;
+
+    size_t chunk (off_t offset);
+
+public:
+    Decompressor(codec_t codec, size_t buffer_size = 1 << 20);
+
+    /*\
+     * Feeds every decompressed byte into the given hash (nullptr: no hashing)
+    \*/
+    void setHash (Sha256 *hash);
+
+    /*\
+     * Reports the compressed bytes consumed as decoding advances
+    \*/
+    void setProgress (progress_callback_t progress);
+
+    /*\
+     * Makes decompressat() fsync the destination before it returns
+    \*/
+    void setDurable (bool durable);
+
+    /*\
+     * Limits decompress() to the "length" bytes of the source at "offset"
+     * (e.g. an entry of a bundle); by default the whole file
+    \*/
+    void setRange (off_t offset, off_t length);
+
+    /*\
+     * Decompresses an open source descriptor into the sink
+     * - size_p: Optional pointer at which to store the decompressed size
+    \*/
+    bool decompress (int from_fd, decompress_sink_t sink, off_t *size_p = nullptr);
+
+    /*\
+     * Decompresses file "from" into file "to" (replacing it), relative to
+     * the given directory descriptors. The destination inherits the
+     * permission bits and timestamps of the source.
+    \*/
+    bool decompressat (int from_dirfd, const char *from, int to_dirfd, const char *to,
+                       copy_report_t *report_p = nullptr);
+
+    /*\
+     * Hashes the decompressed content of file "name" (relative to "dirfd")
+    \*/
+    static bool digest_file (int dirfd, const char *name, codec_t codec, QByteArray *digest_p,
+                             off_t *size_p = nullptr, progress_callback_t progress = nullptr);
+
+    /*\
+     * Returns the codec of a file by the suffix of its name
+    \*/
+    static codec_t codec_of (const QString name);
+
+    /*\
+     * Returns the name without the suffix of its codec (unchanged if none)
+    \*/
+    static QString plain_name (const QString name);
+
+    /*\
+     * Returns true if this build can decode the given codec
+    \*/
+    static bool available (codec_t codec);
+
+    /*\
+     * Returns a printable name for the given codec
+    \*/
+    static QString codec_to_str (codec_t codec);
+};
+
+}
+
+#endif // DECOMPRESSOR_H
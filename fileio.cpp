@@ -0,0 +1,93 @@
+#include "fileio.h"
+
+#include <QByteArray>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                            Function definitions                             *
+ *******************************************************************************
+*/
+
+
+ssize_t SWU::read_chunk (int fd, char *buffer, size_t size, off_t offset)
+{
+    size_t filled = 0;
+
+    while (filled < size) {
+        ssize_t n = pread(fd, buffer + filled, size - filled, offset + filled);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        filled += n;
+    }
+    return filled;
+}
+
+bool SWU::write_chunk (int fd, const char *buffer, size_t size, off_t offset)
+{
+    while (size > 0) {
+        ssize_t n = pwrite(fd, buffer, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buffer += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+bool SWU::write_all (int fd, const char *buffer, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, buffer, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buffer += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool SWU::sync_directory (int dirfd, const char *path)
+{
+    int fd = openat(dirfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = (0 == fsync(fd));
+    close(fd);
+    return ok;
+}
+
+bool SWU::sync_parent (int dirfd, const char *name)
+{
+    QByteArray path(name);
+    off_t cut_index = path.lastIndexOf('/');
+
+    // Sync "dirfd" itself if "name" sits right in it
+    if (dirfd != AT_FDCWD && cut_index < 0) {
+        return (0 == fsync(dirfd));
+    }
+    QByteArray parent = (cut_index < 0 ? QByteArray(".") : (cut_index == 0 ? QByteArray("/") : path.left(cut_index)));
+    return sync_directory(dirfd, parent.constData());
+}
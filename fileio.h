@@ -0,0 +1,45 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+namespace SWU {
+
+/*
+ *******************************************************************************
+ *                            Function declarations                            *
+ *******************************************************************************
+*/
+
+/*\
+ * Fills the buffer from "offset" unless end-of-file comes first. Returns the
+ * bytes read (fewer than "size" only at the end of the file), or -1 on error.
+\*/
+ssize_t read_chunk (int fd, char *buffer, size_t size, off_t offset);
+
+/*\
+ * Writes the whole buffer at "offset" (short writes are legal)
+\*/
+bool write_chunk (int fd, const char *buffer, size_t size, off_t offset);
+
+/*\
+ * Writes the whole buffer at the current file offset (short writes are legal)
+\*/
+bool write_all (int fd, const char *buffer, size_t size);
+
+/*\
+ * Makes the entries of the directory "path" (relative to "dirfd", or
+ * AT_FDCWD) durable
+\*/
+bool sync_directory (int dirfd, const char *path);
+
+/*\
+ * Makes the entries of the directory holding "name" (relative to "dirfd",
+ * or AT_FDCWD) durable
+\*/
+bool sync_parent (int dirfd, const char *name);
+
+}
+
+#endif // FILEIO_H
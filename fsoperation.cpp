@@ -1,22 +1,136 @@
 #include "fsoperation.h"
+#include "workpool.h"
+#include "treewalker.h"
+#include "ioring.h"
+#include "decompressor.h"
+#include "bundle.h"
+#include "merkle.h"
+#include "fileio.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <algorithm>
 
 using namespace SWU;
 
 
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+// Files queued per worker ahead of the directory walk
+static const size_t g_copy_queue_depth = 4;
+
+// Files handed to one io_uring batch
+static const size_t g_copy_batch_size = 128;
+
+// Bytes of a file copy between two checkpoints
+static const off_t g_checkpoint_interval = 64 << 20;
+
+// ioprio_set(2): idle scheduling class of the calling thread (no glibc wrapper)
+static const int g_ioprio_who_process = 1;
+static const int g_ioprio_class_idle = 3;
+static const int g_ioprio_class_shift = 13;
+
+/* Shared state of one (possibly parallel) copy */
+struct copy_job_t {
+    const bool force;
+    const bool incremental;
+    const cache_mode_t cache_mode;
+    const QByteArray digest;    // Expected SHA-256 of a single file (or empty)
+    const progress_callback_t progress;
+    checkpoint_callback_t checkpoint;   // Single file only (or nullptr)
+    copy_checkpoint_t resume;           // Single file only (offset 0: from the start)
+    bool durable;                       // Sync every file and its directory
+    codec_t codec;                      // Single file only: decompress it
+    QByteArray merkle_root;             // Single file only: check its chunks (or empty)
+    std::atomic<OperationResult> result;
+    std::atomic<int> error;             // errno left by the first failure
+    std::atomic<off_t> bytes_copied, bytes_skipped, bytes_holes;
+    WorkGroup group;
+
+    copy_job_t (bool f, bool i, cache_mode_t c, const QByteArray d = QByteArray(), progress_callback_t p = nullptr):
+        force(f), incremental(i), cache_mode(c), digest(d), progress(p), checkpoint(nullptr),
+        resume(copy_checkpoint_t{0, 0, {0, 0}}), durable(false), codec(CODEC_NONE),
+        result(RESULT_OK), error(0),
+        bytes_copied(0), bytes_skipped(0), bytes_holes(0) {}
+
+    // Reports bytes that were dealt with without going through the engine
+    void advance (off_t bytes) {
+        if (progress) {
+            progress(bytes);
+        }
+    }
+
+    // Records the first failure (later ones are dropped), with the errno the
+    // failed step left on this thread
+    void fail (OperationResult r) {
+        OperationResult expected = RESULT_OK;
+        int e = errno;
+        if (RESULT_OK != r && result.compare_exchange_strong(expected, r)) {
+            error = e;
+        }
+    }
+};
+
+
+/* A file of a directory copy, waiting for its batch */
+struct batch_entry_t {
+    std::shared_ptr<DirectoryHandle> from, to;
+    std::string name;
+};
+
+typedef std::vector<batch_entry_t> copy_batch_t;
+
+
 /*
  *******************************************************************************
  *                            Forward declarations                             *
  *******************************************************************************
 */
 
-static OperationResult remove_file (const QString filename);
 static OperationResult remove_directory (const QString dirname);
-static OperationResult copy_directory (const QString dirname,
-                                       const QString directory,
-                                       bool force);
-static OperationResult copy_file (const QString filename,
-                                  const QString directory,
-                                  bool force);
+static OperationResult copy_directory (const resource_handle_t &source,
+                                       const resource_handle_t &directory,
+                                       copy_job_t *job);
+static OperationResult copy_file (const resource_handle_t &source,
+                                  const resource_handle_t &directory,
+                                  copy_job_t *job);
+static OperationResult copy_entry (int from_dirfd, const char *from,
+                                   int to_dirfd, const char *to,
+                                   copy_job_t *job);
+static void copy_batch (std::shared_ptr<copy_batch_t> batch, copy_job_t *job);
+static OperationResult copy_verified (int from_dirfd, const char *from,
+                                      int to_dirfd, const char *to,
+                                      copy_job_t *job);
+static bool same_content (int from_dirfd, const char *from,
+                          int to_dirfd, const char *to,
+                          const QByteArray expected,
+                          off_t *size_p);
+static void set_checkpoints (CopyEngine *engine, int from_dirfd, const char *from, copy_job_t *job);
+static bool transfer (int from_dirfd, const char *from, int to_dirfd, const char *to,
+                      copy_job_t *job, Sha256 *hash, ChunkStream *chunks, copy_report_t *report_p);
+static OperationResult copy_bundle (std::shared_ptr<Bundle> bundle, Resource from,
+                                    const resource_handle_t &directory, copy_job_t *job);
+static OperationResult copy_bundle_entry (Bundle *bundle, const bundle_entry_t *entry,
+                                          int to_dirfd, const char *to, codec_t codec, copy_job_t *job);
+static OperationResult expect_bundle (std::shared_ptr<Bundle> bundle, Resource resource,
+                                      const QByteArray expected, const QByteArray merkle_root,
+                                      bool deferred, progress_callback_t progress);
+static std::shared_ptr<MerkleTree> bundle_tree (Bundle *bundle, const bundle_entry_t *entry,
+                                                const QByteArray root);
+static OperationResult verify_chunks (MerkleTree *tree, int fd, off_t base, off_t size,
+                                      const QString name, progress_callback_t progress);
+static off_t measure_path (const QString path);
+static off_t measure_bundle (std::shared_ptr<Bundle> bundle, Resource resource, bool data);
+static IoRing *thread_ring ();
+static int unlink_batch (IoRing *ring,
+                         std::vector<std::pair<std::shared_ptr<DirectoryHandle>, std::string>> &unlinks);
+static QByteArray beside (const QByteArray name, const QString buried);
 
 
 /*
@@ -26,62 +140,124 @@ static OperationResult copy_file (const QString filename,
 */
 
 
-FSOperation::FSOperation(){}
+FSOperation::FSOperation():
+    d_bytes(0),
+    d_progress(nullptr)
+{}
 FSOperation::~FSOperation() = default;
 OperationResult FSOperation::execute() { return RESULT_OK; }
 OperationResult FSOperation::undo() { return RESULT_OK; }
 OperationResult FSOperation::invert() { return RESULT_OK; }
-QString FSOperation::errstr() { return nullptr; }
+QString FSOperation::errstr() { return d_errstr; }
 QString FSOperation::label() { return nullptr; }
+off_t FSOperation::measure() { return (d_bytes = 0); }
+off_t FSOperation::bytes() { return d_bytes; }
+void FSOperation::setProgressCallback(progress_callback_t progress) { d_progress = progress; }
+
+OperationResult FSOperation::fail(OperationResult result, const QString path, int error)
+{
+    const char *reason = (result == RESULT_BAD_CHECKSUM ? "checksum mismatch" :
+                          (error != 0 ? strerror(error) : "failed"));
+    d_errstr = QString("%1: %2").arg(path).arg(QString(reason));
+    return result;
+}
+QStringList FSOperation::reads() { return QStringList("/"); }
+QStringList FSOperation::writes() { return QStringList("/"); }
+bool FSOperation::record(operation_record_t *record_p) { Q_UNUSED(record_p); return false; }
 
-RemoveOperation::RemoveOperation(std::shared_ptr<Resource> resource):
-    d_resource(resource)
+std::shared_ptr<FSOperation> FSOperation::from_record(const operation_record_t &record)
+{
+    switch (record.label) {
+    case LABEL_COPY:
+        return std::make_shared<CopyOperation>(
+                    Resource(record.from_path, record.from_type, record.from_key),
+                    Resource(record.to_path, record.to_type, record.to_key),
+                    record.incremental);
+    case LABEL_REMOVE:
+        return std::make_shared<RemoveOperation>(
+                    std::make_shared<Resource>(record.from_path, record.from_type, record.from_key),
+                    record.buried);
+    default:
+        return nullptr;
+    }
+}
+
+RemoveOperation::RemoveOperation(std::shared_ptr<Resource> resource, const QString buried):
+    d_resource(resource),
+    d_buried(buried)
 {}
 
 OperationResult RemoveOperation::execute()
 {
     OperationResult retval = RESULT_OK;
-    ResourceManager resourceManager = ResourceManager::get_instance();
+    ResourceManager &resourceManager = ResourceManager::get_instance();
     std::shared_ptr<Resource> r = d_resource;
+    struct stat st;
 
-    // Build full resource path
-    QString root = resourceManager.getResourcePath(r.get()->rootKey());
-    QString path = QDir(root).filePath(r.get()->path());
+    // Resolve the resource against its root, pinned to the directory holding
+    // it: the type check and the rename below are made relative to that
+    resource_handle_t handle = ResourceManager::pinParent(resourceManager.resolve(*r));
+    QString path = handle.path;
 
     qInfo() << "rm" << (r.get()->resourceType() == RESOURCE_TYPE_FILE ? "" : " -rf ") << path ;
 
-    // TODO: Copy to staging location
-
-    // TODO: Remove from specified location
-
+    // The resource must exist with the expected type
+    if (handle.dirfd == -1 || -1 == fstatat(handle.dirfd, handle.name.constData(), &st, AT_SYMLINK_NOFOLLOW)) {
+        return fail(RESULT_BAD_RESOURCE, path, errno);
+    }
     switch (r->resourceType()) {
     case RESOURCE_TYPE_FILE:
-        retval = remove_file(path);
+        retval = (S_ISDIR(st.st_mode) ? RESULT_BAD_RESOURCE : RESULT_OK);
         break;
     case RESOURCE_TYPE_DIRECTORY:
-        retval = remove_directory(path);
+        retval = (S_ISDIR(st.st_mode) ? RESULT_OK : RESULT_BAD_RESOURCE);
         break;
     default:
         retval = RESULT_BAD_RESOURCE;
     }
+    if (retval != RESULT_OK) {
+        return fail(retval, path, (S_ISDIR(st.st_mode) ? EISDIR : ENOTDIR));
+    }
+
+#ifndef QT_DEBUG
+
+    // Move out of the way (deleted once the update commits). The location
+    // may have been fixed in advance, when the operation was journaled.
+    if (d_buried == nullptr && (d_buried = Graveyard::get_instance().plan(path)) == nullptr) {
+        return fail(RESULT_BAD_DESTINATION, path, errno);
+    }
+    if (false == Graveyard::get_instance().bury(handle.dirfd, handle.name, d_buried)) {
+        return fail(RESULT_BAD_RESOURCE, path, errno);
+    }
+    qDebug() << " --- Buried at: " << d_buried;
+
+#else
+    QThread::msleep(250);
+#endif
 
     return retval;
 }
 
 OperationResult RemoveOperation::undo ()
 {
-    OperationResult retval = RESULT_OK;
-    ResourceManager resourceManager = ResourceManager::get_instance();
+    ResourceManager &resourceManager = ResourceManager::get_instance();
     std::shared_ptr<Resource> r = d_resource;
 
-    // Build full resource path
-    QString root = resourceManager.getResourcePath(r.get()->rootKey());
-    QString path = QDir(root).filePath(r.get()->path());
+    // Resolve the resource against its root, pinned to the directory holding it
+    resource_handle_t handle = ResourceManager::pinParent(resourceManager.resolve(*r));
+    QString path = handle.path;
 
     qInfo() << "undo rm" << (r.get()->resourceType() == RESOURCE_TYPE_FILE ? "" : " -rf ") << path ;
-    // TODO: Copy from staging location back to original
 
-    return retval;
+    // Nothing was buried (not executed, or already undone)
+    if (d_buried == nullptr) {
+        return RESULT_OK;
+    }
+    if (handle.dirfd == -1 || false == Graveyard::get_instance().exhume(d_buried, handle.dirfd, handle.name)) {
+        return fail(RESULT_BAD_DESTINATION, path, errno);
+    }
+
+    return RESULT_OK;
 }
 
 OperationResult RemoveOperation::invert ()
@@ -91,8 +267,7 @@ OperationResult RemoveOperation::invert ()
 
 QString RemoveOperation::errstr()
 {
-    // TODO: Unimplemented
-    return nullptr;
+    return d_errstr;
 }
 
 QString RemoveOperation::label()
@@ -101,35 +276,113 @@ QString RemoveOperation::label()
     return path;
 }
 
-CopyOperation::CopyOperation(Resource from, Resource to):
+QStringList RemoveOperation::reads()
+{
+    return QStringList();
+}
+
+QStringList RemoveOperation::writes()
+{
+    ResourceManager &resourceManager = ResourceManager::get_instance();
+    QString root = resourceManager.getResourcePath(d_resource->rootKey());
+
+    return QStringList(QDir::cleanPath(QDir(root).filePath(d_resource->path())));
+}
+
+bool RemoveOperation::record(operation_record_t *record_p)
+{
+    ResourceManager &resourceManager = ResourceManager::get_instance();
+    QString root = resourceManager.getResourcePath(d_resource->rootKey());
+
+    // The graveyard location must be on record before anything is moved there
+    if (d_buried == nullptr &&
+        (d_buried = Graveyard::get_instance().plan(QDir(root).filePath(d_resource->path()))) == nullptr) {
+        return false;
+    }
+
+    (*record_p) = operation_record_t{LABEL_REMOVE,
+                                     d_resource->rootKey(), RESOURCE_KEY_ENUM_MAX,
+                                     d_resource->resourceType(), RESOURCE_TYPE_ENUM_MAX,
+                                     d_resource->path(), nullptr,
+                                     false,
+                                     d_buried};
+    return true;
+}
+
+CopyOperation::CopyOperation(Resource from, Resource to, bool incremental, cache_mode_t cache_mode):
     d_from_resource(from),
-    d_to_resource(to)
+    d_to_resource(to),
+    d_incremental(incremental),
+    d_cache_mode(cache_mode),
+    d_bytes_copied(0),
+    d_bytes_skipped(0),
+    d_bytes_holes(0),
+    d_checkpoint(nullptr),
+    d_resume(copy_checkpoint_t{0, 0, {0, 0}}),
+    d_durability(DURABILITY_PHASE)
 {}
 
 OperationResult CopyOperation::execute()
 {
     OperationResult retval = RESULT_OK;
-    ResourceManager resourceManager = ResourceManager::get_instance();
+    ResourceManager &resourceManager = ResourceManager::get_instance();
     Resource from = d_from_resource, to = d_to_resource;
 
-    // Build full resource paths
-    QString from_root = resourceManager.getResourcePath(from.rootKey());
-    QString to_root = resourceManager.getResourcePath(to.rootKey());
-    QString from_path = QDir(from_root).filePath(from.path());
-    QString to_path = QDir(to_root).filePath(to.path());
+    // Resolve the resources against their roots
+    resource_handle_t from_handle = resourceManager.resolve(from);
+    resource_handle_t to_handle = resourceManager.resolve(to);
+    QString from_path = from_handle.path;
 
     qInfo() << "from: " << from.path() << ", to: " << to.path();
-    qInfo() << "cp" << (from.resourceType() == RESOURCE_TYPE_FILE ? "" : "-r") << from_path << to_path ;
+    qInfo() << "cp" << (from.resourceType() == RESOURCE_TYPE_FILE ? "" : "-r") << from_path << to_handle.path ;
+
+    copy_job_t job(true, d_incremental, d_cache_mode, d_digest, d_progress);
+    job.durable = (d_durability == DURABILITY_FILE);
+    std::shared_ptr<Bundle> bundle = resourceManager.getBundle(from.rootKey());
+    if (bundle != nullptr) {
+        if (from.resourceType() == RESOURCE_TYPE_FILE && Decompressor::codec_of(from.path()) == CODEC_NONE) {
+            job.merkle_root = d_merkle_root;
+        }
+        retval = copy_bundle(bundle, from, to_handle, &job);
+    } else {
+        switch (from.resourceType()) {
+        case RESOURCE_TYPE_FILE:
+            job.checkpoint = d_checkpoint;
+            job.resume = d_resume;
+            job.codec = Decompressor::codec_of(from_path);
+            if (false == Decompressor::available(job.codec)) {
+                qCritical() << "Unable to decompress" << from_path << ": no"
+                            << Decompressor::codec_to_str(job.codec) << "support in this build";
+                return fail(RESULT_BAD_RESOURCE, from_path, ENOTSUP);
+            }
+            if (job.codec == CODEC_NONE) {
+                job.merkle_root = d_merkle_root;
+            }
+            retval = copy_file(from_handle, to_handle, &job);
+            break;
+        case RESOURCE_TYPE_DIRECTORY:
+            retval = copy_directory(from_handle, to_handle, &job);
+            break;
+        default:
+            retval = RESULT_BAD_RESOURCE;
+        }
+    }
 
-    switch (from.resourceType()) {
-    case RESOURCE_TYPE_FILE:
-        retval = copy_file(from_path, to_path, true);
-        break;
-    case RESOURCE_TYPE_DIRECTORY:
-        retval = copy_directory(from_path, to_path, true);
-        break;
-    default:
-        retval = RESULT_BAD_RESOURCE;
+    // Keep the reason (of the first file that failed, in a directory)
+    int error = errno;
+    if (retval != RESULT_OK) {
+        fail(retval, from_path, (job.result.load() != RESULT_OK ? job.error.load() : error));
+    }
+
+    // Record transfer statistics
+    d_bytes_copied = job.bytes_copied.load();
+    d_bytes_skipped = job.bytes_skipped.load();
+    d_bytes_holes = job.bytes_holes.load();
+    if (d_incremental) {
+        qInfo() << "copied" << d_bytes_copied << "bytes, skipped" << d_bytes_skipped << "unchanged bytes";
+    }
+    if (d_bytes_holes > 0) {
+        qInfo() << "left" << d_bytes_holes << "bytes of holes unwritten";
     }
 
     return retval;
@@ -138,16 +391,39 @@ OperationResult CopyOperation::execute()
 OperationResult CopyOperation::undo()
 {
     OperationResult retval = RESULT_OK;
-    ResourceManager resourceManager = ResourceManager::get_instance();
-    Resource to_remove = d_to_resource;
+    Graveyard &graveyard = Graveyard::get_instance();
+    struct stat st;
 
     // A copy operation is undone by removing the copy at the destination location
-    QString to_remove_root = resourceManager.getResourcePath(to_remove.rootKey());
-    QString to_remove_path = QDir(to_remove_root).filePath(to_remove.path());
+    QString to_remove_path = writes().first();
+    QFileInfo to_remove_fileInfo(to_remove_path);
+
+    qInfo() << "rm" << (d_from_resource.resourceType() == RESOURCE_TYPE_FILE ? "" : "-r") << to_remove_path ;
+
+    // Drop the part file of an interrupted verified copy
+    QString part_path = QDir(to_remove_fileInfo.path()).filePath("." + to_remove_fileInfo.fileName() + ".swu-part");
+    unlink(QFile::encodeName(part_path).constData());
+
+    // Nothing there: never copied, or already undone (the check and the
+    // rename below are made relative to the directory holding the copy)
+    resource_handle_t handle = ResourceManager::pinParent(
+                resource_handle_t{nullptr, AT_FDCWD, QFile::encodeName(to_remove_path), to_remove_path});
+    if (handle.dirfd == -1 || -1 == fstatat(handle.dirfd, handle.name.constData(), &st, AT_SYMLINK_NOFOLLOW)) {
+        return (errno == ENOENT ? RESULT_OK : fail(RESULT_BAD_DESTINATION, to_remove_path, errno));
+    }
 
-    qInfo() << "rm" << (to_remove.resourceType() == RESOURCE_TYPE_FILE ? "" : "-r") << to_remove_path ;
+#ifndef QT_DEBUG
+
+    // Move out of the way (reclaimed along with the removals)
+    QString buried = graveyard.plan(to_remove_path);
+    if (buried == nullptr || false == graveyard.bury(handle.dirfd, handle.name, buried)) {
+        return fail(RESULT_BAD_DESTINATION, to_remove_path, errno);
+    }
 
-    // TODO: Implement undo
+#else
+    Q_UNUSED(graveyard);
+    QThread::msleep(250);
+#endif
 
     return retval;
 }
@@ -155,46 +431,55 @@ OperationResult CopyOperation::undo()
 OperationResult CopyOperation::invert()
 {
     OperationResult retval = RESULT_OK;
-    ResourceManager resourceManager = ResourceManager::get_instance();
+    ResourceManager &resourceManager = ResourceManager::get_instance();
     Resource from = d_to_resource, to = d_from_resource;
 
-    // Build full resource paths
-    QString from_root = resourceManager.getResourcePath(from.rootKey());
-    QString to_root = resourceManager.getResourcePath(to.rootKey());
-    QString from_path = QDir(from_root).filePath(from.path());
-    QString to_path = QDir(to_root).filePath(to.path());
-
     // Get the filename (last element) on the "from" resource path
     QFileInfo from_fileInfo(d_from_resource.path());
     QString from_filename = from_fileInfo.fileName();
 
-    // Append the filename to the new "from" (formerly to) resource path
-    from_path += QString("%1").arg(from_filename);
+    // Append the filename to the new "from" (formerly to) resource path, and
+    // remove it from the "to" (formerly from) resource path
+    resource_handle_t from_handle = resourceManager.resolve(from.rootKey(), from.path() + from_filename);
+    resource_handle_t to_handle = resourceManager.resolve(to.rootKey(), QFileInfo(to.path()).path());
 
-    // Remove the filename from the "to" (formerly from) resource path
-    off_t cut_index = to_path.lastIndexOf('/');
-    to_path = to_path.left(cut_index);
+    qDebug() << "cp" << (to.resourceType() == RESOURCE_TYPE_FILE ? "" : "-r") << from_handle.path << to_handle.path;
 
-    qDebug() << "cp" << (to.resourceType() == RESOURCE_TYPE_FILE ? "" : "-r") << from_path << to_path;
+    // A bundle is read-only
+    if (resourceManager.getBundle(to.rootKey()) != nullptr) {
+        return RESULT_BAD_DESTINATION;
+    }
 
+    copy_job_t job(true, d_incremental, d_cache_mode);
+    job.durable = (d_durability == DURABILITY_FILE);
     switch (from.resourceType()) {
     case RESOURCE_TYPE_FILE:
-        retval = copy_file(from_path, to_path, true);
+        retval = copy_file(from_handle, to_handle, &job);
         break;
     case RESOURCE_TYPE_DIRECTORY:
-        retval = copy_directory(from_path, to_path, true);
+        retval = copy_directory(from_handle, to_handle, &job);
         break;
     default:
         retval = RESULT_BAD_RESOURCE;
     }
 
+    // Record transfer statistics
+    d_bytes_copied = job.bytes_copied.load();
+    d_bytes_skipped = job.bytes_skipped.load();
+    d_bytes_holes = job.bytes_holes.load();
+    if (d_incremental) {
+        qInfo() << "copied" << d_bytes_copied << "bytes, skipped" << d_bytes_skipped << "unchanged bytes";
+    }
+    if (d_bytes_holes > 0) {
+        qInfo() << "left" << d_bytes_holes << "bytes of holes unwritten";
+    }
+
     return retval;
 }
 
 QString CopyOperation::errstr()
 {
-    // TODO: Unimplemented
-    return nullptr;
+    return d_errstr;
 }
 
 QString CopyOperation::label()
@@ -202,25 +487,230 @@ QString CopyOperation::label()
     return d_from_resource.path() + " to " + d_to_resource.path();
 }
 
-ExpectOperation::ExpectOperation(Resource resource):
-    d_resource(resource)
+off_t CopyOperation::measure()
+{
+    ResourceManager &resourceManager = ResourceManager::get_instance();
+    QString from_root = resourceManager.getResourcePath(d_from_resource.rootKey());
+    std::shared_ptr<Bundle> bundle = resourceManager.getBundle(d_from_resource.rootKey());
+
+    // Every byte of the source is either copied or found unchanged
+    if (bundle != nullptr) {
+        return (d_bytes = measure_bundle(bundle, d_from_resource, true));
+    }
+    return (d_bytes = measure_path(QDir(from_root).filePath(d_from_resource.path())));
+}
+
+QStringList CopyOperation::reads()
+{
+    ResourceManager &resourceManager = ResourceManager::get_instance();
+    QString from_root = resourceManager.getResourcePath(d_from_resource.rootKey());
+
+    return QStringList(QDir::cleanPath(QDir(from_root).filePath(d_from_resource.path())));
+}
+
+QStringList CopyOperation::writes()
+{
+    ResourceManager &resourceManager = ResourceManager::get_instance();
+    QString to_root = resourceManager.getResourcePath(d_to_resource.rootKey());
+    QString to_path = QDir(to_root).filePath(d_to_resource.path());
+
+    // The source lands under its own name inside the destination directory
+    // (a compressed file under its plain name)
+    QString from_filename = QFileInfo(d_from_resource.path()).fileName();
+    if (d_from_resource.resourceType() == RESOURCE_TYPE_FILE) {
+        from_filename = Decompressor::plain_name(from_filename);
+    }
+    return QStringList(QDir::cleanPath(QDir(to_path).filePath(from_filename)));
+}
+
+bool CopyOperation::record(operation_record_t *record_p)
+{
+    (*record_p) = operation_record_t{LABEL_COPY,
+                                     d_from_resource.rootKey(), d_to_resource.rootKey(),
+                                     d_from_resource.resourceType(), d_to_resource.resourceType(),
+                                     d_from_resource.path(), d_to_resource.path(),
+                                     d_incremental,
+                                     nullptr};
+    return true;
+}
+
+Resource CopyOperation::source()
+{
+    return d_from_resource;
+}
+
+off_t CopyOperation::replaced()
+{
+    return measure_path(writes().first());
+}
+
+void CopyOperation::setIncremental(bool incremental)
+{
+    d_incremental = incremental;
+}
+
+bool CopyOperation::incremental()
+{
+    return d_incremental;
+}
+
+void CopyOperation::setCacheMode(cache_mode_t cache_mode)
+{
+    d_cache_mode = cache_mode;
+}
+
+cache_mode_t CopyOperation::cacheMode()
+{
+    return d_cache_mode;
+}
+
+void CopyOperation::setExpectedDigest(QByteArray digest)
+{
+    d_digest = digest;
+}
+
+QByteArray CopyOperation::expectedDigest()
+{
+    return d_digest;
+}
+
+void CopyOperation::setMerkleRoot(QByteArray root)
+{
+    d_merkle_root = root;
+}
+
+QByteArray CopyOperation::merkleRoot()
+{
+    return d_merkle_root;
+}
+
+off_t CopyOperation::bytesCopied()
+{
+    return d_bytes_copied;
+}
+
+off_t CopyOperation::bytesSkipped()
+{
+    return d_bytes_skipped;
+}
+
+off_t CopyOperation::bytesInHoles()
+{
+    return d_bytes_holes;
+}
+
+void CopyOperation::setCheckpointCallback(checkpoint_callback_t checkpoint)
+{
+    d_checkpoint = checkpoint;
+}
+
+void CopyOperation::resumeFrom(copy_checkpoint_t checkpoint)
+{
+    d_resume = checkpoint;
+}
+
+void CopyOperation::setDurability(Durability durability)
+{
+    d_durability = durability;
+}
+
+Durability CopyOperation::durability()
+{
+    return d_durability;
+}
+
+ExpectOperation::ExpectOperation(Resource resource, QByteArray digest):
+    d_resource(resource),
+    d_digest(digest),
+    d_deferred(false)
 {}
 
 OperationResult ExpectOperation::execute()
 {
-    OperationResult retval = RESULT_OK;
-    ResourceManager resourceManager = ResourceManager::get_instance();
+    ResourceManager &resourceManager = ResourceManager::get_instance();
     Resource from = d_resource;
-
-    // Build full resource paths
-    QString root = resourceManager.getResourcePath(from.rootKey());
-    QString path = QDir(root).filePath(from.path());
+    QByteArray digest;
+    struct stat st;
+    off_t size;
+
+    // Resolve the resource against its root
+    resource_handle_t handle = resourceManager.resolve(from);
+    QString path = handle.path;
+    std::shared_ptr<Bundle> bundle = resourceManager.getBundle(from.rootKey());
+
+    if (bundle != nullptr) {
+        OperationResult result = expect_bundle(bundle, from, d_digest, d_merkle_root, d_deferred, d_progress);
+        return (result == RESULT_OK ? result : fail(result, path, errno));
+    }
 
     qInfo() << "stat" << path ;
 
-    // TODO: Unimplemented
+    // The resource must exist with the expected type
+    if (-1 == fstatat(handle.dirfd, handle.name.constData(), &st, 0)) {
+        return fail(RESULT_BAD_RESOURCE, path, errno);
+    }
+    switch (from.resourceType()) {
+    case RESOURCE_TYPE_FILE:
+        if (false == S_ISREG(st.st_mode)) {
+            return fail(RESULT_BAD_RESOURCE, path, (S_ISDIR(st.st_mode) ? EISDIR : EINVAL));
+        }
+        break;
+    case RESOURCE_TYPE_DIRECTORY:
+        if (false == S_ISDIR(st.st_mode)) {
+            return fail(RESULT_BAD_RESOURCE, path, ENOTDIR);
+        }
+        break;
+    default:
+        return fail(RESULT_BAD_RESOURCE, path, EINVAL);
+    }
+
+    // Nothing more to check without a declared digest
+    if (d_digest.isEmpty() && d_merkle_root.isEmpty()) {
+        return RESULT_OK;
+    }
 
-    return retval;
+    // The copy of this file verifies it in the same pass that reads it
+    if (d_deferred) {
+        qInfo() << "sha256sum" << path << "deferred to copy";
+        return RESULT_OK;
+    }
+
+    // Chunks are checked in parallel (the file as stored, even if compressed)
+    if (false == d_merkle_root.isEmpty()) {
+        std::shared_ptr<MerkleTree> tree = MerkleTree::loadat(handle.dirfd, handle.name.constData(), d_merkle_root);
+        if (tree == nullptr) {
+            qCritical() << "No valid chunk digests for" << path << "in" << MerkleTree::sidecar(path);
+            return fail(RESULT_BAD_CHECKSUM, path, 0);
+        }
+        int fd = openat(handle.dirfd, handle.name.constData(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return fail(RESULT_BAD_RESOURCE, path, errno);
+        }
+        qInfo() << "merkle" << path << "[" << tree->chunks() << "chunks ]";
+        OperationResult result = verify_chunks(tree.get(), fd, 0, st.st_size, path, d_progress);
+        int error = errno;
+        close(fd);
+        return (result == RESULT_OK ? result : fail(result, path, error));
+    }
+
+    // A compressed file is checked by its decompressed content
+    qInfo() << "sha256sum" << path << "[" << Sha256::kernel_to_str(Sha256::kernel()) << "]";
+    codec_t codec = Decompressor::codec_of(path);
+    if (codec != CODEC_NONE) {
+        if (false == Decompressor::digest_file(handle.dirfd, handle.name.constData(), codec, &digest, &size,
+                                               d_progress)) {
+            return fail(RESULT_BAD_RESOURCE, path, errno);
+        }
+    } else if (false == Sha256::digest_file(handle.dirfd, handle.name.constData(), &digest, &size, d_progress)) {
+        return fail(RESULT_BAD_RESOURCE, path, errno);
+    }
+    if (digest != d_digest) {
+        qCritical() << "Checksum mismatch on" << path << ": expected" << QString(d_digest.toHex())
+                    << "got" << QString(digest.toHex());
+        return fail(RESULT_BAD_CHECKSUM, path, 0);
+    }
+
+    return RESULT_OK;
 }
 
 OperationResult ExpectOperation::undo()
@@ -235,8 +725,7 @@ OperationResult ExpectOperation::invert()
 
 QString ExpectOperation::errstr()
 {
-    // TODO: Unimplemented
-    return nullptr;
+    return d_errstr;
 }
 
 QString ExpectOperation::label()
@@ -244,6 +733,159 @@ QString ExpectOperation::label()
     return d_resource.path();
 }
 
+off_t ExpectOperation::measure()
+{
+    ResourceManager &resourceManager = ResourceManager::get_instance();
+    QString root = resourceManager.getResourcePath(d_resource.rootKey());
+    std::shared_ptr<Bundle> bundle = resourceManager.getBundle(d_resource.rootKey());
+
+    // Only a digest check reads the file (in a bundle: a compressed one, or
+    // one with chunk digests)
+    if ((d_digest.isEmpty() && d_merkle_root.isEmpty()) || d_deferred) {
+        return (d_bytes = 0);
+    }
+    if (bundle != nullptr) {
+        return (d_bytes = measure_bundle(bundle, d_resource, Decompressor::codec_of(d_resource.path()) != CODEC_NONE ||
+                                                             false == d_merkle_root.isEmpty()));
+    }
+    return (d_bytes = measure_path(QDir(root).filePath(d_resource.path())));
+}
+
+QStringList ExpectOperation::reads()
+{
+    ResourceManager &resourceManager = ResourceManager::get_instance();
+    QString root = resourceManager.getResourcePath(d_resource.rootKey());
+
+    return QStringList(QDir::cleanPath(QDir(root).filePath(d_resource.path())));
+}
+
+QStringList ExpectOperation::writes()
+{
+    return QStringList();
+}
+
+Resource ExpectOperation::resource()
+{
+    return d_resource;
+}
+
+QByteArray ExpectOperation::digest()
+{
+    return d_digest;
+}
+
+void ExpectOperation::setMerkleRoot(QByteArray root)
+{
+    d_merkle_root = root;
+}
+
+QByteArray ExpectOperation::merkleRoot()
+{
+    return d_merkle_root;
+}
+
+void ExpectOperation::setDeferred(bool deferred)
+{
+    d_deferred = deferred;
+}
+
+bool ExpectOperation::deferred()
+{
+    return d_deferred;
+}
+
+Graveyard::Graveyard():
+    d_name(QString(".swu-graveyard-%1").arg(getpid())),
+    d_next(0)
+{}
+
+Graveyard::~Graveyard()
+{
+    wait();
+}
+
+Graveyard& Graveyard::get_instance()
+{
+    static Graveyard g;
+    return g;
+}
+
+QString Graveyard::plan(const QString path)
+{
+    std::lock_guard<std::mutex> guard(d_lock);
+    QString clean_path = QDir::cleanPath(path);
+    QString graveyard = QDir(QFileInfo(clean_path).path()).filePath(d_name);
+
+    // One graveyard per directory holding removed entries
+    if (std::find(d_graveyards.begin(), d_graveyards.end(), graveyard) == d_graveyards.end()) {
+        if (-1 == mkdir(QFile::encodeName(graveyard).constData(), 0700) && errno != EEXIST) {
+            return nullptr;
+        }
+        d_graveyards.push_back(graveyard);
+    }
+    return QDir(graveyard).filePath(QString("%1-%2").arg(d_next++).arg(QFileInfo(clean_path).fileName()));
+}
+
+bool Graveyard::bury(int dirfd, const QByteArray name, const QString buried)
+{
+    QByteArray grave = beside(name, buried);
+    return (0 == renameat(dirfd, name.constData(), dirfd, grave.constData()));
+}
+
+bool Graveyard::exhume(const QString buried, int dirfd, const QByteArray name)
+{
+    QByteArray grave = beside(name, buried);
+
+    // Gone from the graveyard: never buried, or already back
+    if (0 == renameat(dirfd, grave.constData(), dirfd, name.constData())) {
+        return true;
+    }
+    return (errno == ENOENT);
+}
+
+void Graveyard::adopt(const QString graveyard)
+{
+    std::lock_guard<std::mutex> guard(d_lock);
+    if (std::find(d_graveyards.begin(), d_graveyards.end(), graveyard) == d_graveyards.end()) {
+        d_graveyards.push_back(graveyard);
+    }
+}
+
+void Graveyard::reclaim(std::function<void()> done)
+{
+    std::vector<QString> graveyards;
+
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(d_lock);
+        graveyards.swap(d_graveyards);
+    }
+
+    d_reaper = std::thread([graveyards, done] {
+
+        // Idle priority: only the leftovers of the update, nobody waits on them
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+        syscall(SYS_ioprio_set, g_ioprio_who_process, 0, g_ioprio_class_idle << g_ioprio_class_shift);
+
+        // Later graveyards may hold earlier ones (a buried parent directory)
+        for (auto it = graveyards.rbegin(); it != graveyards.rend(); ++it) {
+            if (QFileInfo(*it).exists() && RESULT_OK != remove_directory(*it)) {
+                qDebug() << " --- Unable to reclaim: " << *it;
+            }
+        }
+        if (done) {
+            done();
+        }
+    });
+}
+
+void Graveyard::wait()
+{
+    if (d_reaper.joinable()) {
+        d_reaper.join();
+    }
+}
+
 /*
  *******************************************************************************
  *                            Function definitions                             *
@@ -251,52 +893,50 @@ QString ExpectOperation::label()
 */
 
 
-static OperationResult copy_file (const QString filename,
-                                      const QString directory,
-                                      bool force)
+static OperationResult copy_file (const resource_handle_t &source,
+                                  const resource_handle_t &directory,
+                                  copy_job_t *job)
 {
     OperationResult result = RESULT_OK;
+    const bool force = job->force;
+    struct stat st;
 
-    qDebug() << "copy_file(" << filename << ","
-             << directory << ") [force = " << force << "]" ;
+    qDebug() << "copy_file(" << source.path << ","
+             << directory.path << ") [force = " << force << "]" ;
 
     // Check if source file exists
-    const QFileInfo source(filename);
-    if (false == source.exists()) {
+    if (-1 == fstatat(source.dirfd, source.name.constData(), &st, 0)) {
         qDebug() << " --- Source file does not exist!" ;
         return RESULT_BAD_RESOURCE;
     }
 
     // Check if the destination directory exists
-    const QDir destination(directory);
-    if (false == destination.exists() && false == force) {
+    const bool exists = (0 == fstatat(directory.dirfd, directory.name.constData(), &st, 0) && S_ISDIR(st.st_mode));
+    if (false == exists && false == force) {
         qDebug() << " --- Destination directory does not exist!" ;
         return RESULT_BAD_DESTINATION;
     }
 
 #ifndef QT_DEBUG
 
-    // Create the directory if needed
-    if (false == destination.exists() && false == destination.mkpath(directory)) {
+    // Create the directory if needed, and open it
+    if (false == exists && false == QDir().mkpath(directory.path)) {
         qDebug() << " --- Unable to create destination directory" ;
         return RESULT_BAD_DESTINATION;
     }
-
-    // Remove any existing file (if force is specified)
-    QFileInfo copy = destination.absoluteFilePath(source.fileName());
-    qDebug() << "[!] Checking if a copy exists already at: " << copy.filePath() ;
-    if (copy.exists() && false == force) {
+    DirectoryHandle destination(openat(directory.dirfd, directory.name.constData(),
+                                       O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (destination.fd() == -1) {
         return RESULT_BAD_DESTINATION;
-    } else {
-        qDebug() << " --- Removed already existing file at: " << copy.filePath() ;
-        remove_file(copy.absoluteFilePath());
     }
 
-    // Copy the file
-    if (false == QFile::copy(filename, QDir(directory).filePath(source.fileName()))) {
-        qDebug() << " --- Bad result on QFile::copy(" << filename << "," << directory << ")" ;
-        return RESULT_BAD_DESTINATION;
-    }
+    // Copy the file (replacing any existing one if force is specified); a
+    // compressed one is decompressed under its plain name
+    QString filename = QFileInfo(source.path).fileName();
+    QString name = (job->codec == CODEC_NONE ? filename : Decompressor::plain_name(filename));
+    result = copy_entry(source.dirfd, source.name.constData(),
+                        destination.fd(), QFile::encodeName(name).constData(),
+                        job);
 
 #else
     QThread::msleep(250);
@@ -305,55 +945,134 @@ static OperationResult copy_file (const QString filename,
     return result;
 }
 
-static OperationResult copy_directory (const QString dirname, const QString directory, bool force)
+static OperationResult copy_directory (const resource_handle_t &source,
+                                       const resource_handle_t &directory,
+                                       copy_job_t *job)
 {
-    qDebug() << "copy_directory(" << dirname << "," << directory << ") [force = " << force << "]" ;
+    const bool force = job->force;
+    struct stat st;
+
+    qDebug() << "copy_directory(" << source.path << "," << directory.path << ") [force = " << force << "]" ;
 
     // Check if source directory exists
-    const QDir source(dirname);
-    if (false == source.exists()) {
+    if (-1 == fstatat(source.dirfd, source.name.constData(), &st, 0) || false == S_ISDIR(st.st_mode)) {
         qDebug() << " --- Source directory does not exist!" ;
         return RESULT_BAD_RESOURCE;
     }
 
     // Check if the destination directory exists
-    const QDir destination(directory);
-    if (false == destination.exists() && false == force) {
+    const bool exists = (0 == fstatat(directory.dirfd, directory.name.constData(), &st, 0) && S_ISDIR(st.st_mode));
+    if (false == exists && false == force) {
         qDebug() << " --- Destination directory does not exist (and no force)!" ;
         return RESULT_BAD_DESTINATION;
     }
 
 #ifndef QT_DEBUG
 
-    // Create destination directory name
-    qDebug() << "Source.dirname() = " << source.dirName() ;
-    QDir new_destination(destination.absoluteFilePath(source.dirName()));
+    // Create the directory if needed, and open it
+    if (false == exists && false == QDir().mkpath(directory.path)) {
+        qDebug() << " --- Unable to create destination directory at: " << directory.path ;
+        return RESULT_BAD_DESTINATION;
+    }
+    DirectoryHandle destination(openat(directory.dirfd, directory.name.constData(),
+                                       O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (destination.fd() == -1) {
+        return RESULT_BAD_DESTINATION;
+    }
 
-    // Create directory if necessary
-    if (false == new_destination.exists() && false == new_destination.mkpath(new_destination.path())) {
-        qDebug() << " --- Unable to create destination directory at: " << new_destination.path() ;
+    // Create the directory of the same name inside it if necessary
+    const QByteArray name = QFile::encodeName(QDir(source.path).dirName());
+    qDebug() << "Source.dirname() = " << QFile::decodeName(name) ;
+    if (-1 == mkdirat(destination.fd(), name.constData(), 0777) && errno != EEXIST) {
+        qDebug() << " --- Unable to create destination directory at: " << QDir(directory.path).filePath(QFile::decodeName(name)) ;
         return RESULT_BAD_DESTINATION;
     } else {
-        qDebug() << " --- Created: " << new_destination.path() ;
-    }
-
-    // Copy the directory (recursive - perhaps unwise with limited stack)
-    const QFlags<QDir::Filter> flags = QDir::Filter::Dirs | QDir::Filter::Files | QDir::Filter::NoSymLinks |
-                                       QDir::Filter::NoDotAndDotDot | QDir::Filter::Hidden;
-    QFileInfoList contents = source.entryInfoList(flags, QDir::DirsFirst);
-    qDebug() << "There are " << contents.size() << " elements inside directory " << source.dirName() ;
-    for (off_t i = 0; i < contents.size(); ++i) {
-        qDebug() << "Item " << i ;
-        QFileInfo item = contents.at(i);
-        OperationResult result;
-        if (item.isDir()) {
-            result = copy_directory(item.absoluteFilePath(), new_destination.path(), force);
-        } else {
-            result = copy_file(item.absoluteFilePath(), new_destination.path(), force);
+        qDebug() << " --- Created: " << QDir(directory.path).filePath(QFile::decodeName(name)) ;
+    }
+
+    // Walk the source tree: directories are mirrored as they are entered, so
+    // a parent always exists before its entries are queued on the pool
+    TreeWalker walker(source.dirfd, source.name.constData());
+    if (0 != walker.error()) {
+        qDebug() << " --- Unable to open source directory: " << QString(strerror(walker.error()));
+        return RESULT_BAD_RESOURCE;
+    }
+    int fd = openat(destination.fd(), name.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return RESULT_BAD_DESTINATION;
+    }
+
+    WorkPool &pool = WorkPool::get_instance();
+    const size_t max_queued = pool.workers() * g_copy_queue_depth;
+    const bool batched = (job->force && false == job->durable && IoRing::queueDepth() > 0 && IoRing::available());
+    std::shared_ptr<copy_batch_t> batch = std::make_shared<copy_batch_t>();
+    std::vector<std::shared_ptr<DirectoryHandle>> destinations;
+    destinations.push_back(std::make_shared<DirectoryHandle>(fd));
+    walk_entry_t entry;
+
+    while (RESULT_OK == job->result.load() && walker.next(&entry)) {
+        switch (entry.event) {
+        case WALK_ENTER_DIRECTORY: {
+            int parent_fd = destinations.back()->fd();
+            if (-1 == mkdirat(parent_fd, entry.name, 0777) && errno != EEXIST) {
+                qDebug() << " --- Unable to create destination directory: " << QString(entry.name);
+                job->fail(RESULT_BAD_DESTINATION);
+                break;
+            }
+            if (-1 == (fd = openat(parent_fd, entry.name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC))) {
+                job->fail(RESULT_BAD_DESTINATION);
+                break;
+            }
+            destinations.push_back(std::make_shared<DirectoryHandle>(fd));
+            break;
         }
-        if (RESULT_OK != result) {
-            return result;
+        case WALK_LEAVE_DIRECTORY:
+            destinations.pop_back();
+            break;
+        case WALK_FILE: {
+            std::shared_ptr<DirectoryHandle> from = entry.parent, to = destinations.back();
+            std::string name(entry.name);
+
+            // Batched: files are collected and copied through io_uring
+            if (batched) {
+                batch->push_back(batch_entry_t{from, to, name});
+                if (batch->size() < g_copy_batch_size) {
+                    break;
+                }
+                pool.submit(job->group, [job, batch] {
+                    copy_batch(batch, job);
+                });
+                batch = std::make_shared<copy_batch_t>();
+            } else {
+                pool.submit(job->group, [job, from, to, name] {
+                    if (RESULT_OK == job->result.load()) {
+                        job->fail(copy_entry(from->fd(), name.c_str(), to->fd(), name.c_str(), job));
+                    }
+                });
+            }
+
+            // Keep the walk a bounded distance ahead of the copies
+            pool.wait(job->group, max_queued);
+            break;
         }
+        case WALK_OTHER:
+            qDebug() << " --- Skipping non-regular file: " << QString(entry.name);
+            break;
+        default:
+            qDebug() << " --- Unable to read directory: " << QString(entry.name);
+            job->fail(RESULT_BAD_RESOURCE);
+            break;
+        }
+    }
+    if (false == batch->empty()) {
+        pool.submit(job->group, [job, batch] {
+            copy_batch(batch, job);
+        });
+    }
+    pool.wait(job->group);
+
+    if (RESULT_OK != job->result.load()) {
+        return job->result.load();
     }
 
 #else
@@ -363,29 +1082,579 @@ static OperationResult copy_directory (const QString dirname, const QString dire
     return RESULT_OK;
 }
 
-static OperationResult remove_file (const QString filename)
+/* Copies "from" to "to" (each relative to a directory descriptor) */
+static OperationResult copy_entry (int from_dirfd, const char *from,
+                                   int to_dirfd, const char *to,
+                                   copy_job_t *job)
+{
+    struct stat st;
+    off_t size;
+    copy_report_t report;
+    const bool verified = (false == job->digest.isEmpty() || false == job->merkle_root.isEmpty());
+    const bool resuming = (job->resume.offset > 0 && job->codec == CODEC_NONE);
+
+    // Skip files whose content is already in place (incremental mode; sizes
+    // differ from compressed sources, which are always decompressed)
+    if (job->incremental && job->codec == CODEC_NONE && same_content(from_dirfd, from, to_dirfd, to, job->digest, &size)) {
+        qDebug() << " --- Unchanged, skipped" << QString(to) << size << "bytes";
+        job->bytes_skipped += size;
+        job->advance(size);
+        return RESULT_OK;
+    }
+
+    // Replace any existing file (if force is specified). A verified copy
+    // replaces it by renaming over it, only once the digest matched. A
+    // resumed copy continues whatever the interrupted one left there.
+    if (0 == fstatat(to_dirfd, to, &st, AT_SYMLINK_NOFOLLOW)) {
+        if (false == job->force || (false == verified && false == resuming && -1 == unlinkat(to_dirfd, to, 0))) {
+            return RESULT_BAD_DESTINATION;
+        }
+        qDebug() << " --- Replacing already existing file at: " << QString(to) ;
+    }
+    if (verified) {
+        return copy_verified(from_dirfd, from, to_dirfd, to, job);
+    }
+
+    // Copy the file
+    if (false == transfer(from_dirfd, from, to_dirfd, to, job, nullptr, nullptr, &report)) {
+        qDebug() << " --- Bad result on CopyEngine::copyat(" << QString(from) << "," << QString(to) << "): "
+                 << QString(strerror(report.error));
+        return (report.error == ENOENT ? RESULT_BAD_RESOURCE : RESULT_BAD_DESTINATION);
+    }
+    if (job->durable && false == sync_parent(to_dirfd, to)) {
+        return RESULT_BAD_DESTINATION;
+    }
+    qDebug() << " --- Copied" << QString(to) << report.bytes << "bytes via"
+             << CopyEngine::method_to_str(report.method) << QString("(%1 bytes of holes)").arg(report.holes);
+    job->bytes_copied += report.bytes;
+    job->bytes_holes += report.holes;
+
+    return RESULT_OK;
+}
+
+/*\
+ * Copies a batch of files through the io_uring of the calling worker. Files
+ * that are unchanged (incremental mode) are filtered out first; files the
+ * ring hands back (large ones) are copied one by one with the CopyEngine.
+\*/
+static void copy_batch (std::shared_ptr<copy_batch_t> batch, copy_job_t *job)
 {
-    QFileInfo file(filename);
+    std::vector<ring_copy_t> files;
+    IoRing *ring = thread_ring();
+    off_t size;
+
+    for (const batch_entry_t &e : *batch) {
+        const char *name = e.name.c_str();
+        if (job->incremental && same_content(e.from->fd(), name, e.to->fd(), name, job->digest, &size)) {
+            job->bytes_skipped += size;
+            job->advance(size);
+            continue;
+        }
+        files.push_back(ring_copy_t{e.from->fd(), name, e.to->fd(), name, 0, 0, false});
+    }
+    if (RESULT_OK != job->result.load() || files.empty()) {
+        return;
+    }
 
-    // Assert whether file exists
-    if (false == file.exists()) {
+    // Copy through the ring (everything is handed back if there is none)
+    if (ring != nullptr) {
+        RingCopier(*ring).copy(files, job->progress);
+    } else {
+        for (ring_copy_t &f : files) {
+            f.handed_back = true;
+        }
+    }
+
+    for (const ring_copy_t &f : files) {
+        if (RESULT_OK != job->result.load()) {
+            break;
+        }
+        if (f.handed_back) {
+            job->fail(copy_entry(f.from_dirfd, f.from, f.to_dirfd, f.to, job));
+        } else if (0 != f.error) {
+            qDebug() << " --- Bad result on batched copy of" << QString(f.from) << ":" << QString(strerror(f.error));
+            job->fail(f.error == ENOENT ? RESULT_BAD_RESOURCE : RESULT_BAD_DESTINATION);
+        } else {
+            job->bytes_copied += f.bytes;
+        }
+    }
+}
+
+/*\
+ * Copies "from" into a hidden part file next to "to" while hashing the stream,
+ * then commits it with a rename only if the digest matches the expectation.
+ * On a mismatch the part file is dropped and "to" is left untouched.
+\*/
+static OperationResult copy_verified (int from_dirfd, const char *from,
+                                      int to_dirfd, const char *to,
+                                      copy_job_t *job)
+{
+    Sha256 hash;
+    copy_report_t report;
+    QByteArray digest;
+    std::unique_ptr<ChunkStream> chunks;
+
+    // Chunk digests: the leaves come from the sidecar of the source
+    if (false == job->merkle_root.isEmpty()) {
+        std::shared_ptr<MerkleTree> tree = MerkleTree::loadat(from_dirfd, from, job->merkle_root);
+        if (tree == nullptr) {
+            qCritical() << "No valid chunk digests for" << QString(from) << "in"
+                        << MerkleTree::sidecar(QString(from));
+            return RESULT_BAD_CHECKSUM;
+        }
+        chunks.reset(new ChunkStream(tree));
+    }
+
+    // Part file: ".<name>.swu-part" in the destination directory
+    QByteArray to_path(to);
+    off_t cut_index = to_path.lastIndexOf('/') + 1;
+    QByteArray part_path = to_path.left(cut_index) + "." + to_path.mid(cut_index) + ".swu-part";
+    if (0 == job->resume.offset || job->codec != CODEC_NONE) {
+        unlinkat(to_dirfd, part_path.constData(), 0);
+    }
+
+    // Copy, reading the source exactly once (a resumed copy rereads the part
+    // file up to the checkpoint instead, for the hash)
+    if (false == transfer(from_dirfd, from, to_dirfd, part_path.constData(), job,
+                          (job->digest.isEmpty() ? nullptr : &hash), chunks.get(), &report)) {
+        if (report.error == EBADMSG && chunks != nullptr) {
+            qCritical() << "Chunk digest mismatch on" << QString(from) << ": chunk" << chunks->bad()
+                        << "of" << chunks->tree()->chunks();
+            unlinkat(to_dirfd, part_path.constData(), 0);
+            return RESULT_BAD_CHECKSUM;
+        }
+        qDebug() << " --- Bad result on CopyEngine::copyat(" << QString(from) << "," << QString(to) << "): "
+                 << QString(strerror(report.error));
+        unlinkat(to_dirfd, part_path.constData(), 0);
+        return (report.error == ENOENT ? RESULT_BAD_RESOURCE : RESULT_BAD_DESTINATION);
+    }
+
+    // Verify before committing
+    if (false == job->digest.isEmpty() && (digest = hash.result()) != job->digest) {
+        qCritical() << "Checksum mismatch on" << QString(from) << ": expected" << QString(job->digest.toHex())
+                    << "got" << QString(digest.toHex());
+        unlinkat(to_dirfd, part_path.constData(), 0);
+        return RESULT_BAD_CHECKSUM;
+    }
+    if (-1 == renameat(to_dirfd, part_path.constData(), to_dirfd, to)) {
+        unlinkat(to_dirfd, part_path.constData(), 0);
+        return RESULT_BAD_DESTINATION;
+    }
+    if (job->durable && false == sync_parent(to_dirfd, to)) {
+        return RESULT_BAD_DESTINATION;
+    }
+    qDebug() << " --- Copied and verified" << QString(to) << report.bytes << "bytes via"
+             << CopyEngine::method_to_str(report.method) << QString("(%1 bytes of holes)").arg(report.holes);
+    job->bytes_copied += report.bytes;
+    job->bytes_holes += report.holes;
+
+    return RESULT_OK;
+}
+
+/*\
+ * Returns true if "to" is a regular file holding the same bytes as "from".
+ * Equal size and modification time are taken as proof (copies carry over the
+ * source timestamps); equal size with differing times falls back to hashing,
+ * after which the timestamps are aligned for the next run. If the expected
+ * digest of "from" is known, only "to" is hashed.
+\*/
+static bool same_content (int from_dirfd, const char *from,
+                          int to_dirfd, const char *to,
+                          const QByteArray expected,
+                          off_t *size_p)
+{
+    struct stat from_st, to_st;
+    QByteArray from_digest = expected, to_digest;
+
+    if (0 != fstatat(from_dirfd, from, &from_st, 0) ||
+        0 != fstatat(to_dirfd, to, &to_st, AT_SYMLINK_NOFOLLOW)) {
+        return false;
+    }
+    if (false == S_ISREG(to_st.st_mode) || from_st.st_size != to_st.st_size) {
+        return false;
+    }
+    (*size_p) = from_st.st_size;
+
+    // Fast path: size and mtime agree
+    if (from_st.st_mtim.tv_sec == to_st.st_mtim.tv_sec &&
+        from_st.st_mtim.tv_nsec == to_st.st_mtim.tv_nsec) {
+        return true;
+    }
+
+    // Slow path: compare content digests
+    if ((from_digest.isEmpty() && false == Sha256::digest_file(from_dirfd, from, &from_digest)) ||
+        false == Sha256::digest_file(to_dirfd, to, &to_digest) ||
+        from_digest != to_digest) {
+        return false;
+    }
+    const struct timespec times[2] = {from_st.st_atim, from_st.st_mtim};
+    utimensat(to_dirfd, to, times, AT_SYMLINK_NOFOLLOW);
+    return true;
+}
+
+/*\
+ * Moves the data of "from" into "to": through a Decompressor if the job
+ * names a codec, else through the CopyEngine (checkpointed if asked for).
+ * An attached hash sees the data as it lands at "to"; attached chunk
+ * digests (not for a codec) are checked against the data of "from".
+\*/
+static bool transfer (int from_dirfd, const char *from, int to_dirfd, const char *to,
+                      copy_job_t *job, Sha256 *hash, ChunkStream *chunks, copy_report_t *report_p)
+{
+    if (job->codec != CODEC_NONE) {
+        Decompressor decompressor(job->codec);
+        decompressor.setHash(hash);
+        decompressor.setProgress(job->progress);
+        decompressor.setDurable(job->durable);
+        return decompressor.decompressat(from_dirfd, from, to_dirfd, to, report_p);
+    }
+
+    CopyEngine engine;
+    engine.setHash(hash);
+    engine.setChunkStream(chunks);
+    engine.setProgress(job->progress);
+    engine.setCacheMode(job->cache_mode);
+    engine.setDurable(job->durable);
+    set_checkpoints(&engine, from_dirfd, from, job);
+    return engine.copyat(from_dirfd, from, to_dirfd, to, report_p);
+}
+
+/*\
+ * Arms the checkpoints and the resumption of a file copy. The checkpoints
+ * carry the identity of the source, and a copy only resumes from a
+ * checkpoint of the very same source.
+\*/
+static void set_checkpoints (CopyEngine *engine, int from_dirfd, const char *from, copy_job_t *job)
+{
+    struct stat st;
+
+    if ((job->checkpoint == nullptr && job->resume.offset == 0) || 0 != fstatat(from_dirfd, from, &st, 0)) {
+        return;
+    }
+    if (job->checkpoint) {
+        checkpoint_callback_t checkpoint = job->checkpoint;
+        engine->setCheckpoint([checkpoint, st] (off_t durable) {
+            checkpoint(copy_checkpoint_t{durable, st.st_size, st.st_mtim});
+        }, g_checkpoint_interval);
+    }
+    if (job->resume.offset > 0 && job->resume.source_size == st.st_size &&
+        job->resume.source_mtime.tv_sec == st.st_mtim.tv_sec &&
+        job->resume.source_mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        qDebug() << " --- Resuming" << QString(from) << "at" << job->resume.offset;
+        engine->setResumeOffset(job->resume.offset);
+    }
+}
+
+/*\
+ * Copies a resource out of a bundle into "directory". A file lands under
+ * its name (a compressed one decompressed, under its plain name). A
+ * directory is copied entry by entry in index order, which is the order of
+ * their data, so the bundle is read front to back.
+\*/
+static OperationResult copy_bundle (std::shared_ptr<Bundle> bundle, Resource from,
+                                    const resource_handle_t &directory, copy_job_t *job)
+{
+    const bool force = job->force;
+    const bundle_entry_t *entry = bundle->find(from.path()), *first, *last;
+    struct stat st;
+
+    qDebug() << "copy_bundle(" << bundle->path() << ":" << from.path() << ","
+             << directory.path << ") [force = " << force << "]" ;
+
+    // The source must be in the bundle, with the expected type
+    if (entry == nullptr || (from.resourceType() == RESOURCE_TYPE_FILE) != S_ISREG(entry->mode)) {
+        qDebug() << " --- Source does not exist in the bundle!" ;
         return RESULT_BAD_RESOURCE;
     }
 
+    // Check if the destination directory exists
+    const bool exists = (0 == fstatat(directory.dirfd, directory.name.constData(), &st, 0) && S_ISDIR(st.st_mode));
+    if (false == exists && false == force) {
+        qDebug() << " --- Destination directory does not exist!" ;
+        return RESULT_BAD_DESTINATION;
+    }
+
 #ifndef QT_DEBUG
 
-    // Remove file
-    if (false == QFile::remove(filename)) {
-        return RESULT_BAD_RESOURCE;
+    // Create the directory if needed, and open it
+    if (false == exists && false == QDir().mkpath(directory.path)) {
+        qDebug() << " --- Unable to create destination directory" ;
+        return RESULT_BAD_DESTINATION;
+    }
+    DirectoryHandle destination(openat(directory.dirfd, directory.name.constData(),
+                                       O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (destination.fd() == -1) {
+        return RESULT_BAD_DESTINATION;
     }
 
+    QString name = QFileInfo(bundle->name(entry)).fileName();
+    if (S_ISREG(entry->mode)) {
+        codec_t codec = Decompressor::codec_of(name);
+        if (false == Decompressor::available(codec)) {
+            qCritical() << "Unable to decompress" << name << ": no"
+                        << Decompressor::codec_to_str(codec) << "support in this build";
+            return RESULT_BAD_RESOURCE;
+        }
+        return copy_bundle_entry(bundle.get(), entry, destination.fd(),
+                                 QFile::encodeName(Decompressor::plain_name(name)).constData(), codec, job);
+    }
+
+    // Directories come before their entries in the index (all of them are
+    // created relative to the destination)
+    if (-1 == mkdirat(destination.fd(), QFile::encodeName(name).constData(), 0777) && errno != EEXIST) {
+        qDebug() << " --- Unable to create destination directory at: " << QDir(directory.path).filePath(name) ;
+        return RESULT_BAD_DESTINATION;
+    }
+    const int prefix_length = bundle->name(entry).length() + 1;
+    bundle->below(from.path(), &first, &last);
+    for (entry = first; RESULT_OK == job->result.load() && entry != last; ++entry) {
+        const QByteArray path = QFile::encodeName(QDir(name).filePath(bundle->name(entry).mid(prefix_length)));
+        if (S_ISDIR(entry->mode)) {
+            if (-1 == mkdirat(destination.fd(), path.constData(), 0777) && errno != EEXIST) {
+                qDebug() << " --- Unable to create destination directory: " << QFile::decodeName(path);
+                job->fail(RESULT_BAD_DESTINATION);
+            }
+            continue;
+        }
+        job->fail(copy_bundle_entry(bundle.get(), entry, destination.fd(), path.constData(), CODEC_NONE, job));
+    }
+    return job->result.load();
+
 #else
+    Q_UNUSED(first);
+    Q_UNUSED(last);
     QThread::msleep(250);
 #endif
 
     return RESULT_OK;
 }
 
+/*\
+ * Copies a file entry of a bundle to "to" (replacing it if force is
+ * specified). The data goes to a part file next to it, which is renamed
+ * over "to" only once its digest matched: the index digest for stored
+ * data, the declared one (if any) for decompressed data, whose integrity
+ * is otherwise covered by the checks of its format.
+\*/
+static OperationResult copy_bundle_entry (Bundle *bundle, const bundle_entry_t *entry,
+                                          int to_dirfd, const char *to, codec_t codec, copy_job_t *job)
+{
+    const QByteArray to_path(to);
+    const QByteArray stored = bundle->digest(entry);
+    const QByteArray expected = (codec == CODEC_NONE ? stored : job->digest);
+    const struct timespec times[2] = {{(time_t)entry->mtime_sec, (long)entry->mtime_nsec},
+                                      {(time_t)entry->mtime_sec, (long)entry->mtime_nsec}};
+    copy_report_t report = COPY_REPORT_EMPTY;
+    std::unique_ptr<ChunkStream> chunks;
+    QByteArray digest;
+    struct stat st;
+    Sha256 hash;
+    bool ok;
+    int fd;
+
+    // A digest declared for stored data must agree with the index
+    if (codec == CODEC_NONE && false == job->digest.isEmpty() && job->digest != stored) {
+        qCritical() << "Checksum mismatch on" << bundle->name(entry) << ": expected" << QString(job->digest.toHex())
+                    << "bundled" << QString(stored.toHex());
+        return RESULT_BAD_CHECKSUM;
+    }
+
+    // Skip files whose content is already in place (incremental mode)
+    if (job->incremental && codec == CODEC_NONE && 0 == fstatat(to_dirfd, to, &st, AT_SYMLINK_NOFOLLOW) &&
+        S_ISREG(st.st_mode) && (uint64_t)st.st_size == entry->size &&
+        ((st.st_mtim.tv_sec == entry->mtime_sec && (uint64_t)st.st_mtim.tv_nsec == entry->mtime_nsec) ||
+         (Sha256::digest_file(to_dirfd, to, &digest) && digest == stored))) {
+        qDebug() << " --- Unchanged, skipped" << QString(to) << st.st_size << "bytes";
+        utimensat(to_dirfd, to, times, AT_SYMLINK_NOFOLLOW);
+        job->bytes_skipped += st.st_size;
+        job->advance(st.st_size);
+        return RESULT_OK;
+    }
+    if (0 == fstatat(to_dirfd, to, &st, AT_SYMLINK_NOFOLLOW) && false == job->force) {
+        return RESULT_BAD_DESTINATION;
+    }
+
+    // Chunk digests: the leaves come from the sidecar entry next to it
+    if (codec == CODEC_NONE && false == job->merkle_root.isEmpty()) {
+        std::shared_ptr<MerkleTree> tree = bundle_tree(bundle, entry, job->merkle_root);
+        if (tree == nullptr) {
+            return RESULT_BAD_CHECKSUM;
+        }
+        chunks.reset(new ChunkStream(tree));
+    }
+
+    // Part file: ".<name>.swu-part" in the destination directory
+    off_t cut_index = to_path.lastIndexOf('/') + 1;
+    QByteArray part_path = to_path.left(cut_index) + "." + to_path.mid(cut_index) + ".swu-part";
+    unlinkat(to_dirfd, part_path.constData(), 0);
+    if (-1 == (fd = openat(to_dirfd, part_path.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, entry->mode & 07777))) {
+        return RESULT_BAD_DESTINATION;
+    }
+
+    // Stream the data out of the bundle
+    if (codec == CODEC_NONE) {
+        ok = bundle->extract(entry, fd, &hash, chunks.get(), job->progress, &report);
+    } else {
+        Decompressor decompressor(codec);
+        decompressor.setRange(bundle->dataOffset(entry), entry->size);
+        decompressor.setHash(&hash);
+        decompressor.setProgress(job->progress);
+        ok = decompressor.decompress(bundle->fd(), [fd] (const char *data, size_t length) {
+            return write_all(fd, data, length);
+        }, &report.bytes);
+        report.method = COPY_METHOD_DECOMPRESS;
+        report.error = (ok ? 0 : errno);
+    }
+    if (ok && (-1 == fchmod(fd, entry->mode & 07777) || -1 == futimens(fd, times) ||
+               (job->durable && -1 == fsync(fd)))) {
+        report.error = errno;
+        ok = false;
+    }
+    ok = (0 == close(fd)) && ok;
+    if (false == ok && report.error == EBADMSG && chunks != nullptr) {
+        qCritical() << "Chunk digest mismatch on" << bundle->name(entry) << ": chunk" << chunks->bad()
+                    << "of" << chunks->tree()->chunks();
+        unlinkat(to_dirfd, part_path.constData(), 0);
+        return RESULT_BAD_CHECKSUM;
+    }
+    if (false == ok) {
+        qDebug() << " --- Bad result extracting" << bundle->name(entry) << "to" << QString(to) << ": "
+                 << QString(strerror(report.error));
+        unlinkat(to_dirfd, part_path.constData(), 0);
+        return RESULT_BAD_DESTINATION;
+    }
+
+    // Verify before committing
+    if (false == expected.isEmpty() && (digest = hash.result()) != expected) {
+        qCritical() << "Checksum mismatch on" << bundle->name(entry) << ": expected" << QString(expected.toHex())
+                    << "got" << QString(digest.toHex());
+        unlinkat(to_dirfd, part_path.constData(), 0);
+        return RESULT_BAD_CHECKSUM;
+    }
+    if (-1 == renameat(to_dirfd, part_path.constData(), to_dirfd, to)) {
+        unlinkat(to_dirfd, part_path.constData(), 0);
+        return RESULT_BAD_DESTINATION;
+    }
+    if (job->durable && false == sync_parent(to_dirfd, to)) {
+        return RESULT_BAD_DESTINATION;
+    }
+    qDebug() << " --- Copied and verified" << QString(to) << report.bytes << "bytes via"
+             << CopyEngine::method_to_str(report.method);
+    job->bytes_copied += report.bytes;
+
+    return RESULT_OK;
+}
+
+/*\
+ * Checks a resource of a bundle. A declared digest of stored data is held
+ * against the index (the copy checks the data itself against the index);
+ * a compressed file is decompressed and hashed unless the copy does so.
+ * Declared chunk digests are checked against the data in place, unless
+ * the copy does so.
+\*/
+static OperationResult expect_bundle (std::shared_ptr<Bundle> bundle, Resource resource,
+                                      const QByteArray expected, const QByteArray merkle_root,
+                                      bool deferred, progress_callback_t progress)
+{
+    const bundle_entry_t *entry = bundle->find(resource.path());
+    codec_t codec = Decompressor::codec_of(resource.path());
+    QByteArray digest;
+    Sha256 hash;
+
+    qInfo() << "stat" << bundle->path() << ":" << resource.path();
+
+    // The resource must exist with the expected type
+    if (entry == nullptr) {
+        return RESULT_BAD_RESOURCE;
+    }
+    switch (resource.resourceType()) {
+    case RESOURCE_TYPE_FILE:
+        if (false == S_ISREG(entry->mode)) {
+            return RESULT_BAD_RESOURCE;
+        }
+        break;
+    case RESOURCE_TYPE_DIRECTORY:
+        if (false == S_ISDIR(entry->mode)) {
+            return RESULT_BAD_RESOURCE;
+        }
+        break;
+    default:
+        return RESULT_BAD_RESOURCE;
+    }
+    if (false == merkle_root.isEmpty() && false == deferred) {
+        std::shared_ptr<MerkleTree> tree = bundle_tree(bundle.get(), entry, merkle_root);
+        if (tree == nullptr) {
+            return RESULT_BAD_CHECKSUM;
+        }
+        qInfo() << "merkle" << bundle->path() << ":" << resource.path() << "[" << tree->chunks() << "chunks ]";
+        return verify_chunks(tree.get(), bundle->fd(), bundle->dataOffset(entry), entry->size,
+                             resource.path(), progress);
+    }
+    if (expected.isEmpty() || (deferred && codec != CODEC_NONE)) {
+        return RESULT_OK;
+    }
+
+    if (codec == CODEC_NONE) {
+        digest = bundle->digest(entry);
+    } else {
+        Decompressor decompressor(codec);
+        decompressor.setRange(bundle->dataOffset(entry), entry->size);
+        decompressor.setHash(&hash);
+        decompressor.setProgress(progress);
+        qInfo() << "sha256sum" << resource.path() << "[" << Sha256::kernel_to_str(Sha256::kernel()) << "]";
+        if (false == decompressor.decompress(bundle->fd(), [] (const char *data, size_t length) {
+                Q_UNUSED(data);
+                Q_UNUSED(length);
+                return true;
+            })) {
+            return RESULT_BAD_RESOURCE;
+        }
+        digest = hash.result();
+    }
+    if (digest != expected) {
+        qCritical() << "Checksum mismatch on" << resource.path() << ": expected" << QString(expected.toHex())
+                    << "got" << QString(digest.toHex());
+        return RESULT_BAD_CHECKSUM;
+    }
+
+    return RESULT_OK;
+}
+
+/* Loads the chunk digests of a bundle entry from the sidecar entry next to it */
+static std::shared_ptr<MerkleTree> bundle_tree (Bundle *bundle, const bundle_entry_t *entry,
+                                                const QByteArray root)
+{
+    const QString name = MerkleTree::sidecar(bundle->name(entry));
+    const bundle_entry_t *sidecar = bundle->find(name);
+    std::shared_ptr<MerkleTree> tree = nullptr;
+
+    if (sidecar != nullptr && S_ISREG(sidecar->mode)) {
+        tree = MerkleTree::load(bundle->fd(), bundle->dataOffset(sidecar), sidecar->size, root);
+    }
+    if (tree == nullptr || (uint64_t)tree->size() != entry->size) {
+        qCritical() << "No valid chunk digests for" << bundle->name(entry) << "in" << bundle->path() << ":" << name;
+        return nullptr;
+    }
+    return tree;
+}
+
+/* Checks a file (found at "base" of "fd") against its chunk digests */
+static OperationResult verify_chunks (MerkleTree *tree, int fd, off_t base, off_t size,
+                                      const QString name, progress_callback_t progress)
+{
+    off_t bad;
+
+    if (tree->size() != size) {
+        qCritical() << "Size mismatch on" << name << ": expected" << tree->size() << "got" << size;
+        return RESULT_BAD_CHECKSUM;
+    }
+    if (false == tree->verify(fd, base, progress, &bad)) {
+        qCritical() << "Chunk digest mismatch on" << name << ": chunk" << bad << "of" << tree->chunks();
+        return RESULT_BAD_CHECKSUM;
+    }
+    return RESULT_OK;
+}
+
 static OperationResult remove_directory (const QString dirname)
 {
     QDir directory(dirname);
@@ -397,8 +1666,55 @@ static OperationResult remove_directory (const QString dirname)
 
 #ifndef QT_DEBUG
 
-    // Remove directory
-    if (false == directory.removeRecursively()) {
+    // Remove the contents bottom-up (entries before the directory holding them)
+    TreeWalker walker(dirname);
+    walk_entry_t entry;
+    if (0 != walker.error()) {
+        return RESULT_BAD_RESOURCE;
+    }
+
+    // Batched: file unlinks are queued on the ring and flushed when it is
+    // full, and before the directory holding them is removed
+    IoRing *ring = (IoRing::queueDepth() > 0 && IoRing::available() ? thread_ring() : nullptr);
+    std::vector<std::pair<std::shared_ptr<DirectoryHandle>, std::string>> unlinks;
+
+    while (walker.next(&entry)) {
+        int err = 0;
+        switch (entry.event) {
+        case WALK_ENTER_DIRECTORY:
+            break;
+        case WALK_LEAVE_DIRECTORY:
+            if (0 != (err = unlink_batch(ring, unlinks))) {
+                break;
+            }
+            err = unlinkat(entry.parent->fd(), entry.name, AT_REMOVEDIR);
+            break;
+        case WALK_FILE:
+        case WALK_OTHER:
+            if (ring == nullptr) {
+                err = unlinkat(entry.parent->fd(), entry.name, 0);
+                break;
+            }
+            unlinks.push_back(std::make_pair(entry.parent, std::string(entry.name)));
+            if (unlinks.size() >= ring->capacity()) {
+                err = unlink_batch(ring, unlinks);
+            }
+            break;
+        default:
+            err = -1;
+            break;
+        }
+        if (0 != err) {
+            qDebug() << " --- Unable to remove: " << QString(entry.name);
+            return RESULT_BAD_RESOURCE;
+        }
+    }
+    if (0 != unlink_batch(ring, unlinks)) {
+        return RESULT_BAD_RESOURCE;
+    }
+
+    // Remove the (now empty) directory itself
+    if (false == directory.rmdir(directory.absolutePath())) {
         return RESULT_BAD_RESOURCE;
     }
 
@@ -409,4 +1725,107 @@ static OperationResult remove_directory (const QString dirname)
     return RESULT_OK;
 }
 
+/* Returns the size of a file, or the total size of the files below a directory */
+static off_t measure_path (const QString path)
+{
+    struct stat st;
+    walk_entry_t entry;
+    off_t total = 0;
+
+    if (-1 == stat(QFile::encodeName(path).constData(), &st)) {
+        return 0;
+    }
+    if (false == S_ISDIR(st.st_mode)) {
+        return st.st_size;
+    }
+
+    TreeWalker walker(path);
+    while (walker.next(&entry)) {
+        if (entry.event == WALK_FILE && 0 == fstatat(entry.parent->fd(), entry.name, &st, AT_SYMLINK_NOFOLLOW)) {
+            total += st.st_size;
+        }
+    }
+    return total;
+}
 
+/* Sums the data of a bundle resource ("data" false: 0) */
+static off_t measure_bundle (std::shared_ptr<Bundle> bundle, Resource resource, bool data)
+{
+    const bundle_entry_t *entry = bundle->find(resource.path()), *first, *last;
+    off_t total = 0;
+
+    if (entry == nullptr || false == data) {
+        return 0;
+    }
+    if (S_ISREG(entry->mode)) {
+        return entry->size;
+    }
+    if (bundle->below(resource.path(), &first, &last)) {
+        for (entry = first; entry != last; ++entry) {
+            total += entry->size;
+        }
+    }
+    return total;
+}
+
+/* Returns the io_uring of the calling thread (nullptr if it could not be set up) */
+static IoRing *thread_ring ()
+{
+    static thread_local std::unique_ptr<IoRing> ring;
+
+    if (ring == nullptr) {
+        ring.reset(new IoRing(IoRing::queueDepth()));
+        if (0 != ring->error()) {
+            qDebug() << " --- io_uring unavailable: " << QString(strerror(ring->error()));
+        }
+    }
+    return (0 == ring->error() ? ring.get() : nullptr);
+}
+
+/* Unlinks the queued files in one submission (synchronously without a ring); 0 or -1 */
+static int unlink_batch (IoRing *ring,
+                         std::vector<std::pair<std::shared_ptr<DirectoryHandle>, std::string>> &unlinks)
+{
+    int err = 0;
+    size_t queued = 0;
+
+    for (size_t i = 0; i < unlinks.size(); ++i) {
+        if (ring == nullptr || false == ring->prepareUnlink(unlinks[i].first->fd(), unlinks[i].second.c_str(), 0, i)) {
+            err |= unlinkat(unlinks[i].first->fd(), unlinks[i].second.c_str(), 0);
+        } else {
+            queued++;
+        }
+    }
+    if (queued > 0 && false == ring->submit(queued)) {
+        err = -1;
+    }
+
+    // Every request must be done with before the paths go (also after a
+    // failed submission, which leaves requests queued or in flight)
+    if (queued > 0 && false == ring->drain([&] (uint64_t tag, int result) {
+        if (result < 0) {
+            qDebug() << " --- Unable to remove: " << QString(unlinks[tag].second.c_str()) << QString(strerror(-result));
+            err = -1;
+        }
+        queued--;
+    })) {
+        err = -1;
+    }
+    unlinks.clear();
+
+    return (err != 0 || queued > 0 ? -1 : 0);
+}
+
+/*\
+ * Returns the graveyard location "buried" (planned next to "name") as a path
+ * relative to wherever "name" is: the graveyard directory and entry name,
+ * behind the directories of "name"
+\*/
+static QByteArray beside (const QByteArray name, const QString buried)
+{
+    QByteArray grave = QFile::encodeName(QDir::cleanPath(buried));
+    int cut_index = grave.lastIndexOf('/');
+    int graveyard_index = (cut_index > 0 ? grave.left(cut_index).lastIndexOf('/') : -1);
+
+    return name.left(name.lastIndexOf('/') + 1) + grave.mid(graveyard_index + 1);
+}
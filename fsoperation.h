@@ -2,11 +2,19 @@
 #define FSOPERATION_H
 
 #include <QString>
+#include <QStringList>
 #include <QDebug>
 #include <QThread>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "resource.h"
 #include "resource_manager.h"
+#include "copyengine.h"
+#include "hasher.h"
+#include "progress.h"
 
 namespace SWU {
 
@@ -15,11 +23,21 @@ enum OperationResult {
     RESULT_BAD_RESOURCE,
     RESULT_BAD_DESTINATION,
     RESULT_BAD_PERMISSIONS,
+    RESULT_BAD_CHECKSUM,
 
     /* Size */
     RESULT_ENUM_MAX
 };
 
+enum Durability {
+    DURABILITY_NONE,        // Trust the page cache
+    DURABILITY_PHASE,       // One syncfs per filesystem and phase (default)
+    DURABILITY_FILE,        // As above, and every copied file as it lands
+
+    /* Size */
+    DURABILITY_ENUM_MAX
+};
+
 enum OperationLabel {
     LABEL_VALIDATE,
     LABEL_BACKUP,
@@ -30,13 +48,41 @@ enum OperationLabel {
     LABEL_ENUM_MAX
 };
 
+/* Journal record of an operation: enough to rebuild it after a restart */
+struct operation_record_t {
+    OperationLabel label;               // LABEL_COPY or LABEL_REMOVE
+    resource_root_key_t from_key, to_key;
+    resource_type_t from_type, to_type;
+    QString from_path, to_path;         // Resource paths (to: copies only)
+    bool incremental;                   // Copies only
+    QString buried;                     // Removes only: graveyard location
+};
+
+/* Point up to which a file copy is in place at its destination */
+struct copy_checkpoint_t {
+    off_t offset;                       // Leading bytes durable at the destination
+    off_t source_size;                  // Identity of the source when taken
+    struct timespec source_mtime;
+};
+
+/* Receives the checkpoints of a file copy (possibly from a worker thread) */
+typedef std::function<void(const copy_checkpoint_t &checkpoint)> checkpoint_callback_t;
+
 
 /* File System operation base */
 class FSOperation
 {
 private:
     QString d_label;
+protected:
+    off_t d_bytes;
+    progress_callback_t d_progress;
+
+    // Reason of the last failure, for errstr() (empty if none)
     QString d_errstr;
+
+    // Records why "path" failed ("error" is an errno value) and returns "result"
+    OperationResult fail (OperationResult result, const QString path, int error);
 public:
     FSOperation();
     virtual ~FSOperation();
@@ -45,19 +91,83 @@ public:
     virtual OperationResult invert () = 0;
     virtual QString errstr () = 0;
     virtual QString label ();
+
+    // Computes (and keeps) the number of bytes execute() will read or write
+    virtual off_t measure ();
+
+    // Bytes found by the last measure()
+    off_t bytes ();
+
+    // Receives the bytes processed by execute() as it advances (nullptr: none)
+    void setProgressCallback (progress_callback_t progress);
+
+    // Clean absolute paths that execute() reads and writes (needs the resource
+    // paths). Used to order operations; by default the whole filesystem.
+    virtual QStringList reads ();
+    virtual QStringList writes ();
+
+    // Describes the operation for the undo journal, fixing anything execute()
+    // would otherwise choose on the fly. False if it is never journaled.
+    virtual bool record (operation_record_t *record_p);
+
+    // Rebuilds an operation from its journal record (nullptr if malformed)
+    static std::shared_ptr<FSOperation> from_record (const operation_record_t &record);
+};
+
+/*
+ * Holds what an update removes until the update commits. Removed paths are
+ * renamed into a hidden graveyard directory next to them, so on the same
+ * filesystem (O(1), and undone by renaming back); reclaim() deletes the
+ * graveyards afterwards on a background thread at idle CPU and I/O priority.
+ */
+class Graveyard {
+private:
+    std::mutex d_lock;
+    std::vector<QString> d_graveyards;
+    QString d_name;
+    unsigned d_next;
+    std::thread d_reaper;
+public:
+    Graveyard();
+    ~Graveyard();
+    static Graveyard& get_instance();
+
+    // Returns where "path" is to be buried, creating its graveyard (null on failure)
+    QString plan(const QString path);
+
+    // Moves "name" (relative to "dirfd", or AT_FDCWD) to the location plan()
+    // returned for it, which is reached through "dirfd" as well
+    bool bury(int dirfd, const QByteArray name, const QString buried);
+
+    // Moves a buried path back to "name" (true if it is no longer buried)
+    bool exhume(const QString buried, int dirfd, const QByteArray name);
+
+    // Takes over a graveyard left by an earlier process, for reclaim()
+    void adopt(const QString graveyard);
+
+    // Starts deleting every graveyard in the background (the next plan starts
+    // afresh), then calls "done" on that thread (optional)
+    void reclaim(std::function<void()> done = nullptr);
+
+    // Blocks until a reclamation in progress has finished
+    void wait();
 };
 
 /* Remove operation */
 class RemoveOperation : public FSOperation {
 private:
     std::shared_ptr<Resource> d_resource;
+    QString d_buried;
 public:
-    RemoveOperation(std::shared_ptr<Resource> resource);
+    RemoveOperation(std::shared_ptr<Resource> resource, const QString buried = nullptr);
     OperationResult execute () override;
     OperationResult undo () override;
     OperationResult invert () override;
     QString errstr () override;
     QString label () override;
+    QStringList reads () override;
+    QStringList writes () override;
+    bool record (operation_record_t *record_p) override;
 
 };
 
@@ -65,26 +175,104 @@ public:
 class CopyOperation : public FSOperation {
 private:
     Resource d_from_resource, d_to_resource;
+    bool d_incremental;
+    cache_mode_t d_cache_mode;
+    QByteArray d_digest;
+    QByteArray d_merkle_root;
+    off_t d_bytes_copied, d_bytes_skipped, d_bytes_holes;
+    checkpoint_callback_t d_checkpoint;
+    copy_checkpoint_t d_resume;
+    Durability d_durability;
 public:
-    CopyOperation(Resource from, Resource to);
+    CopyOperation(Resource from, Resource to, bool incremental = false,
+                  cache_mode_t cache_mode = CACHE_MODE_CACHED);
     OperationResult execute () override;
     OperationResult undo () override;
     OperationResult invert () override;
     QString errstr() override;
     QString label() override;
+    off_t measure() override;
+    QStringList reads() override;
+    QStringList writes() override;
+    bool record(operation_record_t *record_p) override;
+
+    // Source resource of the copy
+    Resource source();
+
+    // Bytes now at the destination that the copy replaces (freed as it goes)
+    off_t replaced();
+
+    // Incremental mode: only files whose content differs are copied
+    void setIncremental(bool incremental);
+    bool incremental();
+
+    // Page cache policy: streaming keeps large files out of the cache
+    void setCacheMode(cache_mode_t cache_mode);
+    cache_mode_t cacheMode();
+
+    // Expected SHA-256 of a copied file: the data is hashed while it is copied
+    // and only committed to the destination if the digest matches
+    void setExpectedDigest(QByteArray digest);
+    QByteArray expectedDigest();
+
+    // Expected Merkle root of a copied (uncompressed) file: its chunks are
+    // checked in parallel as they are copied, and the copy stops at the
+    // first bad one. The leaves come from the sidecar next to the source.
+    void setMerkleRoot(QByteArray root);
+    QByteArray merkleRoot();
+
+    // Bytes written / bytes found unchanged / bytes of source holes left
+    // unwritten (they stay holes) by the last execute or invert
+    off_t bytesCopied();
+    off_t bytesSkipped();
+    off_t bytesInHoles();
+
+    // Checkpoints of a file copy: the destination is synced every so often
+    // and the durable length reported (nullptr: none; directories: none)
+    void setCheckpointCallback(checkpoint_callback_t checkpoint);
+
+    // Continues the copy of a file from a checkpoint taken by an earlier
+    // execute (ignored if the source changed since)
+    void resumeFrom(copy_checkpoint_t checkpoint);
+
+    // DURABILITY_FILE: every file is fsynced, then its directory, before the
+    // copy moves on (no batched I/O then); otherwise left to the caller
+    void setDurability(Durability durability);
+    Durability durability();
 };
 
 /* Check operation */
 class ExpectOperation : public FSOperation {
 private:
     Resource d_resource;
+    QByteArray d_digest;
+    QByteArray d_merkle_root;
+    bool d_deferred;
 public:
-    ExpectOperation(Resource resource);
+    ExpectOperation(Resource resource, QByteArray digest = QByteArray());
     OperationResult execute() override;
     OperationResult undo () override;
     OperationResult invert () override;
     QString errstr() override;
     QString label() override;
+    off_t measure() override;
+    QStringList reads() override;
+    QStringList writes() override;
+
+    // Resource that is checked
+    Resource resource();
+
+    // Expected SHA-256 digest of the file (empty if none was declared)
+    QByteArray digest();
+
+    // Expected Merkle root of the file (empty if none was declared). The
+    // chunks are then verified in parallel, and cover the file on their own.
+    void setMerkleRoot(QByteArray root);
+    QByteArray merkleRoot();
+
+    // Deferred: the digests are checked by the copy of this file instead
+    void setDeferred(bool deferred);
+    bool deferred();
 };
 
 
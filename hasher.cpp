@@ -0,0 +1,509 @@
+#include "hasher.h"
+
+#include <QFile>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SWU_HAVE_SHA_NI
+#define SWU_HAVE_AVX2
+#endif
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                         Static variable definitions                         *
+ *******************************************************************************
+*/
+
+
+static const char *g_hash_kernel_str_map[HASH_KERNEL_ENUM_MAX] = {
+    [HASH_KERNEL_GENERIC] = "generic",
+    [HASH_KERNEL_SHA_NI]  = "sha-ni",
+    [HASH_KERNEL_AVX2]    = "generic/avx2-x8"
+};
+
+// Messages hashed at once by the multi-buffer kernel (32-bit vector lanes)
+static const size_t g_lanes = 8;
+
+// Read size used when streaming a file through the hash
+static const size_t g_read_size = 1 << 20;
+
+// Round constants
+alignas(16) static const uint32_t g_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// Initial hash value
+static const uint32_t g_h0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+// Block kernel: compresses "blocks" 64 byte blocks into the state
+typedef void (*compress_t)(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+// Multi-buffer block kernel: as above, for g_lanes states and messages at once
+typedef void (*compress_many_t)(uint32_t *const state[], const uint8_t *const data[], size_t blocks);
+
+
+/*
+ *******************************************************************************
+ *                            Forward declarations                             *
+ *******************************************************************************
+*/
+
+static void compress_generic (uint32_t state[8], const uint8_t *data, size_t blocks);
+#ifdef SWU_HAVE_SHA_NI
+static void compress_sha_ni (uint32_t state[8], const uint8_t *data, size_t blocks);
+#endif
+#ifdef SWU_HAVE_AVX2
+static void compress_avx2 (uint32_t *const state[], const uint8_t *const data[], size_t blocks);
+#endif
+static hash_kernel_t select_kernel ();
+static compress_t compress_function ();
+static compress_many_t compress_many_function ();
+
+
+/*
+ *******************************************************************************
+ *                          Class definition: Sha256                           *
+ *******************************************************************************
+*/
+
+
+Sha256::Sha256()
+{
+    reset();
+}
+
+void Sha256::reset ()
+{
+    memcpy(d_state, g_h0, sizeof(d_state));
+    d_buffered = 0;
+    d_length = 0;
+}
+
+void Sha256::update (const void *data, size_t size)
+{
+    static const compress_t compress = compress_function();
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+
+    d_length += size;
+
+    // Complete a partially filled block first
+    if (d_buffered > 0) {
+        size_t n = (64 - d_buffered) < size ? (64 - d_buffered) : size;
+        memcpy(d_buffer + d_buffered, p, n);
+        d_buffered += n;
+        p += n;
+        size -= n;
+        if (d_buffered < 64) {
+            return;
+        }
+        compress(d_state, d_buffer, 1);
+        d_buffered = 0;
+    }
+
+    // Whole blocks straight from the caller's memory
+    if (size >= 64) {
+        compress(d_state, p, size / 64);
+        p += size & ~(size_t)63;
+        size &= 63;
+    }
+
+    // Keep the tail
+    memcpy(d_buffer, p, size);
+    d_buffered = size;
+}
+
+QByteArray Sha256::result ()
+{
+    uint8_t tail[72] = {0x80};
+    uint64_t bits = d_length * 8;
+    size_t pad = (d_buffered < 56 ? 56 - d_buffered : 120 - d_buffered);
+    QByteArray digest(SHA256_DIGEST_SIZE, 0);
+
+    // Padding, then the message length in bits (big endian)
+    for (int i = 0; i < 8; ++i) {
+        tail[pad + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+    }
+    update(tail, pad + 8);
+
+    for (int i = 0; i < 8; ++i) {
+        digest[4 * i + 0] = static_cast<char>(d_state[i] >> 24);
+        digest[4 * i + 1] = static_cast<char>(d_state[i] >> 16);
+        digest[4 * i + 2] = static_cast<char>(d_state[i] >> 8);
+        digest[4 * i + 3] = static_cast<char>(d_state[i]);
+    }
+    return digest;
+}
+
+bool Sha256::digest_file (int dirfd, const char *name, QByteArray *digest_p, off_t *size_p,
+                          progress_callback_t progress)
+{
+    std::unique_ptr<char[]> buffer(new char[g_read_size]);
+    Sha256 hash;
+    off_t total = 0;
+    ssize_t n;
+    int fd;
+
+    if (-1 == (fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC))) {
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    while ((n = read(fd, buffer.get(), g_read_size)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            return false;
+        }
+        hash.update(buffer.get(), n);
+        total += n;
+        if (progress) {
+            progress(n);
+        }
+    }
+    close(fd);
+
+    (*digest_p) = hash.result();
+    if (size_p != nullptr) {
+        (*size_p) = total;
+    }
+    return true;
+}
+
+/*\
+ * Every group of lanes goes through the multi-buffer kernel in step: the
+ * blocks begun earlier are completed first, then the whole blocks are taken
+ * straight from the callers' memory. Lanes left over in the last group hash
+ * a copy of the first message into a spare state.
+\*/
+void Sha256::update_many (Sha256 *hashes, const char *const *data, size_t size, size_t count)
+{
+    static const compress_many_t compress = compress_many_function();
+
+    for (size_t first = 0; first < count; first += g_lanes) {
+        const size_t lanes = std::min(g_lanes, count - first);
+        Sha256 *group = hashes + first, spare;
+        Sha256 *lane[g_lanes];
+        uint32_t *states[g_lanes];
+        const uint8_t *sources[g_lanes], *blocks[g_lanes];
+        bool in_step = true;
+
+        for (size_t i = 1; i < lanes; ++i) {
+            in_step = in_step && group[i].d_buffered == group[0].d_buffered;
+        }
+        if (compress == nullptr || lanes == 1 || false == in_step) {
+            for (size_t i = 0; i < lanes; ++i) {
+                group[i].update(data[first + i], size);
+            }
+            continue;
+        }
+
+        spare = group[0];
+        for (size_t i = 0; i < g_lanes; ++i) {
+            lane[i] = (i < lanes ? &group[i] : &spare);
+            states[i] = lane[i]->d_state;
+            sources[i] = reinterpret_cast<const uint8_t *>(data[first + (i < lanes ? i : 0)]);
+            lane[i]->d_length += size;
+        }
+
+        // Complete the partially filled blocks first
+        size_t offset = 0, buffered = group[0].d_buffered;
+        if (buffered > 0) {
+            offset = std::min(64 - buffered, size);
+            for (size_t i = 0; i < g_lanes; ++i) {
+                memcpy(lane[i]->d_buffer + buffered, sources[i], offset);
+                blocks[i] = lane[i]->d_buffer;
+            }
+            buffered += offset;
+            if (buffered < 64) {
+                for (size_t i = 0; i < lanes; ++i) {
+                    group[i].d_buffered = buffered;
+                }
+                continue;
+            }
+            compress(states, blocks, 1);
+        }
+
+        // Whole blocks straight from the callers' memory, then the tails
+        if (size - offset >= 64) {
+            for (size_t i = 0; i < g_lanes; ++i) {
+                blocks[i] = sources[i] + offset;
+            }
+            compress(states, blocks, (size - offset) / 64);
+            offset += (size - offset) & ~(size_t)63;
+        }
+        for (size_t i = 0; i < lanes; ++i) {
+            memcpy(group[i].d_buffer, sources[i] + offset, size - offset);
+            group[i].d_buffered = size - offset;
+        }
+    }
+}
+
+size_t Sha256::lanes ()
+{
+    return (compress_many_function() != nullptr ? g_lanes : 1);
+}
+
+hash_kernel_t Sha256::kernel ()
+{
+    static const hash_kernel_t k = select_kernel();
+    return k;
+}
+
+QString Sha256::kernel_to_str (hash_kernel_t kernel)
+{
+    if (kernel == HASH_KERNEL_ENUM_MAX) {
+        return nullptr;
+    } else {
+        return QString::fromUtf8(g_hash_kernel_str_map[kernel]);
+    }
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function definitions                             *
+ *******************************************************************************
+*/
+
+
+static hash_kernel_t select_kernel ()
+{
+#if defined(SWU_HAVE_SHA_NI) || defined(SWU_HAVE_AVX2)
+    unsigned int a, b, c, d;
+#endif
+#ifdef SWU_HAVE_SHA_NI
+    // SHA-NI (leaf 7, EBX bit 29) together with SSSE3 and SSE4.1 (leaf 1, ECX)
+    if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSSE3) && (c & bit_SSE4_1) &&
+        __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 29))) {
+        return HASH_KERNEL_SHA_NI;
+    }
+#endif
+#ifdef SWU_HAVE_AVX2
+    unsigned int lo, hi;
+
+    // AVX2 (leaf 7, EBX bit 5), with the OS saving the YMM registers (XCR0)
+    if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_OSXSAVE) && (c & bit_AVX)) {
+        __asm__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+        if ((lo & 0x6) == 0x6 && __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_AVX2)) {
+            return HASH_KERNEL_AVX2;
+        }
+    }
+#endif
+    return HASH_KERNEL_GENERIC;
+}
+
+static compress_t compress_function ()
+{
+    switch (Sha256::kernel()) {
+#ifdef SWU_HAVE_SHA_NI
+    case HASH_KERNEL_SHA_NI:
+        return compress_sha_ni;
+#endif
+    default:
+        return compress_generic;
+    }
+}
+
+static compress_many_t compress_many_function ()
+{
+#ifdef SWU_HAVE_AVX2
+    if (Sha256::kernel() == HASH_KERNEL_AVX2) {
+        return compress_avx2;
+    }
+#endif
+    return nullptr;
+}
+
+#define ROTR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void compress_generic (uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+    uint32_t w[64];
+
+    for (; blocks > 0; --blocks, data += 64) {
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (uint32_t)data[4 * i] << 24 | (uint32_t)data[4 * i + 1] << 16 |
+                   (uint32_t)data[4 * i + 2] << 8 | (uint32_t)data[4 * i + 3];
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + g_k[i] + w[i];
+            uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#ifdef SWU_HAVE_SHA_NI
+__attribute__((target("sha,sse4.1,ssse3")))
+static void compress_sha_ni (uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, tmp, msg, w[4];
+
+    // Rearrange the state into the ABEF/CDGH layout the instructions expect
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; blocks > 0; --blocks, data += 64) {
+        const __m128i abef = state0, cdgh = state1;
+
+        // 16 groups of 4 rounds; the schedule is extended 4 words at a time
+        for (int i = 0; i < 16; ++i) {
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * i)), mask);
+            } else {
+                tmp = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(tmp, w[(i + 3) & 3]);
+            }
+            msg = _mm_add_epi32(w[i & 3], _mm_load_si128((const __m128i *)&g_k[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    // Back to the ABCD/EFGH layout
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+#endif
+
+#ifdef SWU_HAVE_AVX2
+#define ROTR8(x, n)  _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+/* Transposes 8 rows of 8 words: row i, word j moves to row j, word i */
+__attribute__((target("avx2")))
+static inline void transpose8 (__m256i r[8])
+{
+    __m256i t[8], u[8];
+
+    for (int i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+    }
+    for (int i = 0; i < 8; i += 4) {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        r[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+/* One round (extending the schedule past the first 16), on eight lanes */
+__attribute__((target("avx2")))
+static inline void round_avx2 (__m256i a, __m256i b, __m256i c, __m256i &d,
+                               __m256i e, __m256i f, __m256i g, __m256i &h, __m256i w[16], int i)
+{
+    if (i >= 16) {
+        __m256i w15 = w[(i + 1) & 15], w2 = w[(i + 14) & 15];
+        __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w15, 7), ROTR8(w15, 18)), _mm256_srli_epi32(w15, 3));
+        __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w2, 17), ROTR8(w2, 19)), _mm256_srli_epi32(w2, 10));
+        w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0), _mm256_add_epi32(w[(i + 9) & 15], s1));
+    }
+    __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, _mm256_set1_epi32(g_k[i])), w[i & 15]);
+    t1 = _mm256_add_epi32(t1, _mm256_xor_si256(_mm256_xor_si256(ROTR8(e, 6), ROTR8(e, 11)), ROTR8(e, 25)));
+    t1 = _mm256_add_epi32(t1, _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g)));
+    __m256i t2 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(a, 2), ROTR8(a, 13)), ROTR8(a, 22));
+    t2 = _mm256_add_epi32(t2, _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b))));
+    d = _mm256_add_epi32(d, t1);
+    h = _mm256_add_epi32(t1, t2);
+}
+
+/*\
+ * The portable rounds, on eight messages at once: every vector holds one
+ * word of the state or schedule, one message per lane. The blocks are
+ * transposed into that layout as they are loaded.
+\*/
+__attribute__((target("avx2")))
+static void compress_avx2 (uint32_t *const state[], const uint8_t *const data[], size_t blocks)
+{
+    const __m256i swap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                         12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i s[8], w[16];
+
+    for (int i = 0; i < 8; ++i) {
+        s[i] = _mm256_loadu_si256((const __m256i *)state[i]);
+    }
+    transpose8(s);
+
+    for (size_t block = 0; block < blocks; ++block) {
+        for (int half = 0; half < 2; ++half) {
+            for (int i = 0; i < 8; ++i) {
+                w[8 * half + i] = _mm256_shuffle_epi8(
+                        _mm256_loadu_si256((const __m256i *)(data[i] + 64 * block + 32 * half)), swap);
+            }
+            transpose8(&w[8 * half]);
+        }
+
+        __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 64; i += 8) {
+            round_avx2(a, b, c, d, e, f, g, h, w, i + 0);
+            round_avx2(h, a, b, c, d, e, f, g, w, i + 1);
+            round_avx2(g, h, a, b, c, d, e, f, w, i + 2);
+            round_avx2(f, g, h, a, b, c, d, e, w, i + 3);
+            round_avx2(e, f, g, h, a, b, c, d, w, i + 4);
+            round_avx2(d, e, f, g, h, a, b, c, w, i + 5);
+            round_avx2(c, d, e, f, g, h, a, b, w, i + 6);
+            round_avx2(b, c, d, e, f, g, h, a, w, i + 7);
+        }
+        s[0] = _mm256_add_epi32(s[0], a);
+        s[1] = _mm256_add_epi32(s[1], b);
+        s[2] = _mm256_add_epi32(s[2], c);
+        s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e);
+        s[5] = _mm256_add_epi32(s[5], f);
+        s[6] = _mm256_add_epi32(s[6], g);
+        s[7] = _mm256_add_epi32(s[7], h);
+    }
+
+    transpose8(s);
+    for (int i = 0; i < 8; ++i) {
+        _mm256_storeu_si256((__m256i *)state[i], s[i]);
+    }
+}
+#endif
@@ -0,0 +1,96 @@
+#ifndef HASHER_H
+#define HASHER_H
+
+#include <QByteArray>
+#include <QString>
+#include <stdint.h>
+#include <sys/types.h>
+#include "progress.h"
+
+namespace SWU {
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+/* enumeration of SHA-256 block kernels */
+enum hash_kernel_t {
+    HASH_KERNEL_GENERIC = 0,
+    HASH_KERNEL_SHA_NI,
+    HASH_KERNEL_AVX2,                   /**< Generic, eight lanes for many messages */
+
+    /* Size */
+    HASH_KERNEL_ENUM_MAX
+};
+
+/* Size of a SHA-256 digest in bytes */
+static const size_t SHA256_DIGEST_SIZE = 32;
+
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * Streaming SHA-256.
+ *
+ * The block kernel is chosen once per process from what the CPU offers: the
+ * x86 SHA extensions (SHA-NI) when present, otherwise a portable kernel.
+ * Without SHA-NI but with AVX2, independent messages of the same length
+ * (e.g. the chunks of a Merkle tree) are hashed eight at a time, one per
+ * vector lane; a single stream has no such parallelism to offer.
+\*/
+class Sha256
+{
+private:
+    uint32_t d_state[8];
+    uint8_t d_buffer[64];
+    size_t d_buffered;
+    uint64_t d_length;
+
+public:
+    Sha256();
+
+    // Restarts the hash
+    void reset ();
+
+    // Feeds bytes into the hash
+    void update (const void *data, size_t size);
+
+    // Returns the 32 byte digest (the hash must be reset before reuse)
+    QByteArray result ();
+
+    /*\
+     * Hashes the file "name" relative to "dirfd" (or AT_FDCWD) by streaming it
+     * - digest_p: Pointer at which to store the digest
+     * - size_p: Optional pointer at which to store the number of bytes read
+     * - progress: Optional callback receiving the bytes read per chunk
+    \*/
+    static bool digest_file (int dirfd, const char *name, QByteArray *digest_p,
+                             off_t *size_p = nullptr,
+                             progress_callback_t progress = nullptr);
+
+    /*\
+     * Feeds "size" bytes of data[i] into hashes[i], for "count" hashes that
+     * took the same number of bytes so far (several at once if the kernel
+     * allows, see lanes())
+    \*/
+    static void update_many (Sha256 *hashes, const char *const *data, size_t size, size_t count);
+
+    // Returns the number of hashes update_many() feeds at once (1: in turn)
+    static size_t lanes ();
+
+    // Returns the kernel in use
+    static hash_kernel_t kernel ();
+
+    // Returns a printable name for the given kernel
+    static QString kernel_to_str (hash_kernel_t kernel);
+};
+
+}
+
+#endif // HASHER_H
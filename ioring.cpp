@@ -0,0 +1,696 @@
+#include "ioring.h"
+
+#include <QtGlobal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <atomic>
+
+// The opcodes used (unlinkat being the last one added) are enumerators, which
+// the preprocessor cannot test: require the kernel headers that define them
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && __has_include(<linux/version.h>) && defined(STATX_SIZE)
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+#include <linux/io_uring.h>
+#define SWU_HAVE_IO_URING
+#endif
+#endif
+#endif
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                         Static variable definitions                         *
+ *******************************************************************************
+*/
+
+
+// Queue depth for batched I/O
+static std::atomic<unsigned> g_queue_depth(32);
+
+// Files above this size are handed back by the RingCopier
+static const off_t g_ring_max_file = 1 << 20;
+
+// Read/write size of a RingCopier slot
+static const unsigned g_ring_chunk = 128 << 10;
+
+
+/*
+ *******************************************************************************
+ *                         Class definition: IoRing                            *
+ *******************************************************************************
+*/
+
+
+#ifdef SWU_HAVE_IO_URING
+
+IoRing::IoRing(unsigned entries):
+    d_fd(-1),
+    d_error(0),
+    d_entries(0),
+    d_queued(0),
+    d_inflight(0),
+    d_sq_tail(0),
+    d_sq_ring(MAP_FAILED),
+    d_cq_ring(MAP_FAILED),
+    d_sqes(MAP_FAILED)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    if (-1 == (d_fd = syscall(__NR_io_uring_setup, entries, &params))) {
+        d_error = errno;
+        return;
+    }
+    d_entries = params.sq_entries;
+
+    // Map the rings (a single mapping serves both on newer kernels)
+    d_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    d_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        d_sq_ring_size = d_cq_ring_size = (d_sq_ring_size > d_cq_ring_size ? d_sq_ring_size : d_cq_ring_size);
+    }
+    d_sq_ring = mmap(nullptr, d_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     d_fd, IORING_OFF_SQ_RING);
+    if (d_sq_ring == MAP_FAILED) {
+        d_error = errno;
+        return;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        d_cq_ring = d_sq_ring;
+    } else {
+        d_cq_ring = mmap(nullptr, d_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         d_fd, IORING_OFF_CQ_RING);
+        if (d_cq_ring == MAP_FAILED) {
+            d_error = errno;
+            return;
+        }
+    }
+    d_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    d_sqes = mmap(nullptr, d_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  d_fd, IORING_OFF_SQES);
+    if (d_sqes == MAP_FAILED) {
+        d_error = errno;
+        return;
+    }
+
+    char *sq = static_cast<char *>(d_sq_ring), *cq = static_cast<char *>(d_cq_ring);
+    d_sq_head_p = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    d_sq_tail_p = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    d_sq_mask_p = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    d_sq_array  = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    d_cq_head_p = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    d_cq_tail_p = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    d_cq_mask_p = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    d_cqes = cq + params.cq_off.cqes;
+    d_sq_tail = *d_sq_tail_p;
+}
+
+IoRing::~IoRing()
+{
+    if (d_sqes != MAP_FAILED) {
+        munmap(d_sqes, d_sqes_size);
+    }
+    if (d_cq_ring != MAP_FAILED && d_cq_ring != d_sq_ring) {
+        munmap(d_cq_ring, d_cq_ring_size);
+    }
+    if (d_sq_ring != MAP_FAILED) {
+        munmap(d_sq_ring, d_sq_ring_size);
+    }
+    if (d_fd != -1) {
+        close(d_fd);
+    }
+}
+
+void *IoRing::prepare (uint8_t opcode, uint64_t tag)
+{
+    if (0 != d_error || d_queued + d_inflight >= d_entries) {
+        return nullptr;
+    }
+
+    unsigned index = d_sq_tail & (*d_sq_mask_p);
+    struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(d_sqes) + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = tag;
+    d_sq_array[index] = index;
+    d_sq_tail++;
+    d_queued++;
+
+    return sqe;
+}
+
+bool IoRing::prepareOpen (int dirfd, const char *path, int flags, mode_t mode, uint64_t tag)
+{
+    struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(prepare(IORING_OP_OPENAT, tag));
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->fd = dirfd;
+    sqe->addr = reinterpret_cast<uint64_t>(path);
+    sqe->len = mode;
+    sqe->open_flags = flags;
+    return true;
+}
+
+bool IoRing::prepareStat (int dirfd, const char *path, int flags, unsigned mask,
+                          struct statx *statx_p, uint64_t tag)
+{
+    struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(prepare(IORING_OP_STATX, tag));
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->fd = dirfd;
+    sqe->addr = reinterpret_cast<uint64_t>(path);
+    sqe->len = mask;
+    sqe->off = reinterpret_cast<uint64_t>(statx_p);
+    sqe->statx_flags = flags;
+    return true;
+}
+
+bool IoRing::prepareRead (int fd, void *buffer, unsigned size, off_t offset, uint64_t tag)
+{
+    struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(prepare(IORING_OP_READ, tag));
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = size;
+    sqe->off = offset;
+    return true;
+}
+
+bool IoRing::prepareWrite (int fd, const void *buffer, unsigned size, off_t offset, uint64_t tag)
+{
+    struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(prepare(IORING_OP_WRITE, tag));
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = size;
+    sqe->off = offset;
+    return true;
+}
+
+bool IoRing::prepareClose (int fd, uint64_t tag)
+{
+    struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(prepare(IORING_OP_CLOSE, tag));
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->fd = fd;
+    return true;
+}
+
+bool IoRing::prepareUnlink (int dirfd, const char *path, int flags, uint64_t tag)
+{
+    struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(prepare(IORING_OP_UNLINKAT, tag));
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->fd = dirfd;
+    sqe->addr = reinterpret_cast<uint64_t>(path);
+    sqe->unlink_flags = flags;
+    return true;
+}
+
+void IoRing::link ()
+{
+    if (0 == d_error && d_queued > 0) {
+        unsigned index = (d_sq_tail - 1) & (*d_sq_mask_p);
+        (static_cast<struct io_uring_sqe *>(d_sqes) + index)->flags |= IOSQE_IO_HARDLINK;
+    }
+}
+
+bool IoRing::submit (unsigned wait)
+{
+    if (0 != d_error) {
+        errno = d_error;
+        return false;
+    }
+
+    // Publish the prepared entries
+    __atomic_store_n(d_sq_tail_p, d_sq_tail, __ATOMIC_RELEASE);
+
+    for (;;) {
+        long n = syscall(__NR_io_uring_enter, d_fd, d_queued, wait,
+                         (wait > 0 ? IORING_ENTER_GETEVENTS : 0), nullptr, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        d_queued -= n;
+        d_inflight += n;
+        return true;
+    }
+}
+
+bool IoRing::complete (uint64_t *tag_p, int *result_p)
+{
+    if (0 != d_error) {
+        return false;
+    }
+
+    unsigned head = *d_cq_head_p;
+    if (head == __atomic_load_n(d_cq_tail_p, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    struct io_uring_cqe *cqe = static_cast<struct io_uring_cqe *>(d_cqes) + (head & (*d_cq_mask_p));
+    (*tag_p) = cqe->user_data;
+    (*result_p) = cqe->res;
+    __atomic_store_n(d_cq_head_p, head + 1, __ATOMIC_RELEASE);
+    d_inflight--;
+
+    return true;
+}
+
+bool IoRing::drain (std::function<void(uint64_t, int)> reap)
+{
+    uint64_t tag;
+    int result;
+
+    if (0 != d_error) {
+        errno = d_error;
+        return false;
+    }
+
+    // Take back what the kernel did not consume (it only reads the queue when entered)
+    d_sq_tail -= d_queued;
+    __atomic_store_n(d_sq_tail_p, d_sq_tail, __ATOMIC_RELEASE);
+    d_queued = 0;
+
+    // Wait for the rest
+    for (;;) {
+        while (complete(&tag, &result)) {
+            if (reap) {
+                reap(tag, result);
+            }
+        }
+        if (0 == d_inflight) {
+            return true;
+        }
+        if (0 > syscall(__NR_io_uring_enter, d_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) && errno != EINTR) {
+            d_error = errno;
+            return false;
+        }
+    }
+}
+
+bool IoRing::available ()
+{
+    static const bool supported = [] {
+        const uint8_t required[] = {
+            IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+            IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_UNLINKAT
+        };
+        const size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+        std::unique_ptr<char[]> buffer(new char[probe_size]());
+        struct io_uring_probe *probe = reinterpret_cast<struct io_uring_probe *>(buffer.get());
+
+        IoRing ring(2);
+        if (0 != ring.error() ||
+            0 > syscall(__NR_io_uring_register, ring.d_fd, IORING_REGISTER_PROBE, probe, 256)) {
+            return false;
+        }
+        for (uint8_t op : required) {
+            if (op > probe->last_op || 0 == (probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        return true;
+    }();
+    return supported;
+}
+
+#else
+
+IoRing::IoRing(unsigned entries):
+    d_fd(-1),
+    d_error(ENOSYS),
+    d_entries(0),
+    d_queued(0),
+    d_inflight(0)
+{
+    Q_UNUSED(entries);
+}
+
+IoRing::~IoRing() {}
+void *IoRing::prepare (uint8_t, uint64_t) { return nullptr; }
+bool IoRing::prepareOpen (int, const char *, int, mode_t, uint64_t) { return false; }
+bool IoRing::prepareStat (int, const char *, int, unsigned, struct statx *, uint64_t) { return false; }
+bool IoRing::prepareRead (int, void *, unsigned, off_t, uint64_t) { return false; }
+bool IoRing::prepareWrite (int, const void *, unsigned, off_t, uint64_t) { return false; }
+bool IoRing::prepareClose (int, uint64_t) { return false; }
+bool IoRing::prepareUnlink (int, const char *, int, uint64_t) { return false; }
+void IoRing::link () {}
+bool IoRing::submit (unsigned) { errno = ENOSYS; return false; }
+bool IoRing::complete (uint64_t *, int *) { return false; }
+bool IoRing::drain (std::function<void(uint64_t, int)>) { errno = ENOSYS; return false; }
+bool IoRing::available () { return false; }
+
+#endif
+
+int IoRing::error ()
+{
+    return d_error;
+}
+
+unsigned IoRing::capacity ()
+{
+    return d_entries;
+}
+
+unsigned IoRing::outstanding ()
+{
+    return d_queued + d_inflight;
+}
+
+void IoRing::setQueueDepth (unsigned depth)
+{
+    g_queue_depth = depth;
+}
+
+unsigned IoRing::queueDepth ()
+{
+    return g_queue_depth;
+}
+
+
+/*
+ *******************************************************************************
+ *                       Class definition: RingCopier                          *
+ *******************************************************************************
+*/
+
+
+#ifdef SWU_HAVE_IO_URING
+
+/* Stage of a file in flight */
+enum slot_state_t {
+    SLOT_IDLE,
+    SLOT_STAT,      /**< statx(from) and openat(from) */
+    SLOT_OPEN,      /**< unlinkat(to), then openat(to) */
+    SLOT_READ,
+    SLOT_WRITE,
+    SLOT_CLOSE      /**< close(from) and close(to) */
+};
+
+/* A file in flight */
+struct ring_slot_t {
+    ring_copy_t *file;
+    slot_state_t state;
+    int pending;            /**< Requests of the current stage still in flight */
+    int from_fd, to_fd;
+    struct statx st;
+    off_t offset;           /**< Offset of the chunk in the buffer */
+    unsigned length, written;
+    std::unique_ptr<char[]> buffer;
+};
+
+// Tags: slot index times four, plus the side (0: source, 1: destination,
+// 2: stat of the source, 3: unlink of the destination)
+#define RING_TAG(slot, side)     (((uint64_t)(slot) << 2) | (side))
+#define RING_TAG_SLOT(tag)       ((tag) >> 2)
+#define RING_TAG_SIDE(tag)       ((int)((tag) & 3))
+
+/* Records the first error of a file */
+static void slot_fail (ring_slot_t *slot, int error)
+{
+    if (0 == slot->file->error) {
+        slot->file->error = error;
+    }
+}
+
+/* Queues the close of whatever the slot has open (or finishes it) */
+static void slot_close (IoRing &ring, ring_slot_t *slot, size_t index)
+{
+    slot->state = SLOT_CLOSE;
+    slot->pending = 0;
+    if (slot->from_fd != -1) {
+        ring.prepareClose(slot->from_fd, RING_TAG(index, 0));
+        slot->pending++;
+    }
+    if (slot->to_fd != -1) {
+        ring.prepareClose(slot->to_fd, RING_TAG(index, 1));
+        slot->pending++;
+    }
+    if (0 == slot->pending) {
+        slot->state = SLOT_IDLE;
+    }
+}
+
+/* Advances a slot whose requests of the current stage all completed */
+static void slot_advance (IoRing &ring, ring_slot_t *slot, size_t index)
+{
+    ring_copy_t *file = slot->file;
+
+    if (0 != file->error && slot->state != SLOT_CLOSE) {
+        slot_close(ring, slot, index);
+        return;
+    }
+
+    switch (slot->state) {
+    case SLOT_STAT:
+
+        // Large files are left to the in-kernel copy of the caller
+        if ((off_t)slot->st.stx_size > g_ring_max_file) {
+            file->handed_back = true;
+            slot_close(ring, slot, index);
+            break;
+        }
+        // The destination goes only now that the source was found and opened
+        slot->state = SLOT_OPEN;
+        slot->pending = 2;
+        ring.prepareUnlink(file->to_dirfd, file->to, 0, RING_TAG(index, 3));
+        ring.link();
+        ring.prepareOpen(file->to_dirfd, file->to, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                         slot->st.stx_mode & 07777, RING_TAG(index, 1));
+        break;
+
+    case SLOT_OPEN:
+    case SLOT_WRITE:
+
+        // A short write continues where it stopped
+        if (slot->state == SLOT_WRITE && slot->written < slot->length) {
+            slot->pending = 1;
+            ring.prepareWrite(slot->to_fd, slot->buffer.get() + slot->written, slot->length - slot->written,
+                              slot->offset + slot->written, RING_TAG(index, 1));
+            break;
+        }
+        slot->offset += slot->length;
+        slot->length = slot->written = 0;
+        slot->state = SLOT_READ;
+        slot->pending = 1;
+        ring.prepareRead(slot->from_fd, slot->buffer.get(), g_ring_chunk, slot->offset, RING_TAG(index, 0));
+        break;
+
+    case SLOT_READ:
+        if (slot->length > 0) {
+            slot->state = SLOT_WRITE;
+            slot->pending = 1;
+            ring.prepareWrite(slot->to_fd, slot->buffer.get(), slot->length, slot->offset, RING_TAG(index, 1));
+            break;
+        }
+
+        // End of file: carry over the permission bits and timestamps
+        {
+            const struct timespec times[2] = {
+                {(time_t)slot->st.stx_atime.tv_sec, (long)slot->st.stx_atime.tv_nsec},
+                {(time_t)slot->st.stx_mtime.tv_sec, (long)slot->st.stx_mtime.tv_nsec}
+            };
+            if (-1 == fchmod(slot->to_fd, slot->st.stx_mode & 07777) || -1 == futimens(slot->to_fd, times)) {
+                slot_fail(slot, errno);
+            }
+        }
+        slot_close(ring, slot, index);
+        break;
+
+    case SLOT_CLOSE:
+        slot->state = SLOT_IDLE;
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* Applies the result of one request to its slot */
+static void slot_complete (ring_slot_t *slot, int side, int result,
+                           const progress_callback_t &progress)
+{
+    slot->pending--;
+
+    switch (slot->state) {
+    case SLOT_STAT:
+        if (result < 0) {
+            slot_fail(slot, -result);
+        } else if (side == 0) {
+            slot->from_fd = result;
+        }
+        break;
+    case SLOT_OPEN:
+        if (side == 3) {
+            if (result < 0 && result != -ENOENT) {
+                slot_fail(slot, -result);
+            }
+        } else if (result < 0) {
+            slot_fail(slot, -result);
+        } else if (side == 0) {
+            slot->from_fd = result;
+        } else {
+            slot->to_fd = result;
+        }
+        break;
+    case SLOT_READ:
+        if (result < 0) {
+            slot_fail(slot, -result);
+        } else {
+            slot->length = result;
+        }
+        break;
+    case SLOT_WRITE:
+        if (result < 0) {
+            slot_fail(slot, -result);
+        } else if (result == 0) {
+            slot_fail(slot, EIO);
+        } else {
+            slot->written += result;
+            slot->file->bytes += result;
+            if (progress) {
+                progress(result);
+            }
+        }
+        break;
+    case SLOT_CLOSE:
+        if (side == 0) {
+            slot->from_fd = -1;
+        } else {
+            slot->to_fd = -1;
+        }
+        if (result < 0 && side == 1) {
+            slot_fail(slot, -result);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+RingCopier::RingCopier(IoRing &ring):
+    d_ring(ring)
+{}
+
+bool RingCopier::copy (std::vector<ring_copy_t> &files, progress_callback_t progress)
+{
+    const size_t slot_count = (d_ring.capacity() / 2 > 0 ? d_ring.capacity() / 2 : 1);
+    std::vector<ring_slot_t> in_flight(slot_count);
+    size_t next = 0, active = 0;
+    uint64_t tag;
+    int result;
+
+    if (0 != d_ring.error() || d_ring.capacity() < 2) {
+        for (auto &file : files) {
+            file.handed_back = true;
+        }
+        return false;
+    }
+
+    for (auto &slot : in_flight) {
+        slot.state = SLOT_IDLE;
+        slot.buffer.reset(new char[g_ring_chunk]);
+    }
+
+    while (next < files.size() || active > 0) {
+
+        // Start files in idle slots
+        for (size_t i = 0; i < slot_count && next < files.size(); ++i) {
+            ring_slot_t *slot = &in_flight[i];
+            if (slot->state != SLOT_IDLE) {
+                continue;
+            }
+            ring_copy_t *file = &files[next++];
+            file->bytes = 0;
+            file->error = 0;
+            file->handed_back = false;
+            slot->file = file;
+            slot->state = SLOT_STAT;
+            slot->pending = 2;
+            slot->from_fd = slot->to_fd = -1;
+            slot->offset = 0;
+            slot->length = slot->written = 0;
+            d_ring.prepareStat(file->from_dirfd, file->from, 0,
+                               STATX_SIZE | STATX_MODE | STATX_ATIME | STATX_MTIME,
+                               &slot->st, RING_TAG(i, 2));
+            d_ring.prepareOpen(file->from_dirfd, file->from, O_RDONLY | O_CLOEXEC, 0, RING_TAG(i, 0));
+            active++;
+        }
+
+        // Submit everything prepared and wait for at least one result
+        if (false == d_ring.submit(1)) {
+            int error = errno;
+
+            // Requests the kernel took still use the slots: let them finish first
+            d_ring.drain([&] (uint64_t tag, int result) {
+                slot_complete(&in_flight[RING_TAG_SLOT(tag)], RING_TAG_SIDE(tag), result, progress);
+            });
+            for (auto &slot : in_flight) {
+                if (slot.state != SLOT_IDLE) {
+                    if (slot.from_fd != -1) {
+                        close(slot.from_fd);
+                    }
+                    if (slot.to_fd != -1) {
+                        close(slot.to_fd);
+                    }
+                    slot_fail(&slot, error);
+                }
+            }
+            for (; next < files.size(); ++next) {
+                files[next].handed_back = true;
+            }
+            return false;
+        }
+
+        // Apply results; a slot moves on once its stage is complete
+        while (d_ring.complete(&tag, &result)) {
+            size_t index = RING_TAG_SLOT(tag);
+            ring_slot_t *slot = &in_flight[index];
+            slot_complete(slot, RING_TAG_SIDE(tag), result, progress);
+            if (slot->pending == 0) {
+                slot_advance(d_ring, slot, index);
+                if (slot->state == SLOT_IDLE) {
+                    active--;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+#else
+
+RingCopier::RingCopier(IoRing &ring):
+    d_ring(ring)
+{}
+
+bool RingCopier::copy (std::vector<ring_copy_t> &files, progress_callback_t progress)
+{
+    Q_UNUSED(progress);
+    for (auto &file : files) {
+        file.handed_back = true;
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef IORING_H
+#define IORING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "progress.h"
+
+struct statx;
+
+namespace SWU {
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+/* A file copied by a RingCopier */
+struct ring_copy_t {
+    int from_dirfd;
+    const char *from;
+    int to_dirfd;
+    const char *to;
+    off_t bytes;            /**< Bytes written to the destination */
+    int error;              /**< errno of the failing request (0 on success) */
+    bool handed_back;       /**< Not copied: left to the caller (e.g. too large) */
+};
+
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * A minimal io_uring instance (raw system calls, no liburing).
+ *
+ * Requests are prepared into the submission queue, handed to the kernel in
+ * one system call by submit(), and their results collected with complete().
+ * Each request carries a caller-chosen tag that comes back with its result.
+ * At most capacity() requests may be prepared or in flight at once, which is
+ * also what keeps the completion queue from overflowing.
+\*/
+class IoRing
+{
+private:
+    int d_fd;
+    int d_error;
+    unsigned d_entries;
+    unsigned d_queued, d_inflight;
+    unsigned d_sq_tail;
+
+    // Shared ring memory
+    void *d_sq_ring, *d_cq_ring, *d_sqes;
+    size_t d_sq_ring_size, d_cq_ring_size, d_sqes_size;
+    unsigned *d_sq_head_p, *d_sq_tail_p, *d_sq_mask_p, *d_sq_array;
+    unsigned *d_cq_head_p, *d_cq_tail_p, *d_cq_mask_p;
+    void *d_cqes;
+
+    void *prepare (uint8_t opcode, uint64_t tag);
+
+public:
+
+    /*\
+     * Sets up a ring with (at least) the given number of entries
+     * (check error() afterwards)
+    \*/
+    IoRing(unsigned entries);
+    ~IoRing();
+    IoRing(const IoRing &) = delete;
+    IoRing &operator= (const IoRing &) = delete;
+
+    /*\
+     * Returns 0 if the ring was set up; else errno
+    \*/
+    int error ();
+
+    /*\
+     * Returns the number of requests that may be outstanding at once
+    \*/
+    unsigned capacity ();
+
+    /*\
+     * Returns the number of requests prepared or submitted but not completed
+    \*/
+    unsigned outstanding ();
+
+    /*\
+     * Request preparation. Each returns false if the ring is at capacity.
+     * Paths and buffers must stay valid until the request completes.
+    \*/
+    bool prepareOpen (int dirfd, const char *path, int flags, mode_t mode, uint64_t tag);
+    bool prepareStat (int dirfd, const char *path, int flags, unsigned mask,
+                      struct statx *statx_p, uint64_t tag);
+    bool prepareRead (int fd, void *buffer, unsigned size, off_t offset, uint64_t tag);
+    bool prepareWrite (int fd, const void *buffer, unsigned size, off_t offset, uint64_t tag);
+    bool prepareClose (int fd, uint64_t tag);
+    bool prepareUnlink (int dirfd, const char *path, int flags, uint64_t tag);
+
+    /*\
+     * Links the request prepared last to the next one: that one only starts
+     * once this one completed, whatever its result
+    \*/
+    void link ();
+
+    /*\
+     * Hands the prepared requests to the kernel and blocks until at least
+     * "wait" results are available. Returns false (errno set) on failure.
+    \*/
+    bool submit (unsigned wait = 0);
+
+    /*\
+     * Takes the next available result. Returns false if there is none.
+     * - tag_p: Pointer at which to store the tag of the request
+     * - result_p: Pointer at which to store its result (negative errno on failure)
+    \*/
+    bool complete (uint64_t *tag_p, int *result_p);
+
+    /*\
+     * Drops the prepared requests the kernel did not take, and blocks until
+     * the ones in flight completed, passing their results to "reap" (if
+     * given). Leaves the ring empty, so that it can be used again. Returns
+     * false (errno set) if the ring failed, which makes it unusable.
+    \*/
+    bool drain (std::function<void(uint64_t tag, int result)> reap = nullptr);
+
+    /*\
+     * Returns true if the running kernel supports every request type above
+     * (probed once per process; false where io_uring is missing or disabled)
+    \*/
+    static bool available ();
+
+    /*\
+     * Process-wide queue depth for batched I/O (0: batching disabled)
+    \*/
+    static void setQueueDepth (unsigned depth);
+    static unsigned queueDepth ();
+};
+
+/*\
+ * Copies many (small) files through one ring.
+ *
+ * Every file in flight occupies a slot that steps through: stat and open the
+ * source; unlink and create the destination (only once the source opened);
+ * read and write in chunks; close both. The requests of all slots are submitted together, so a batch of
+ * small files costs a handful of system calls instead of several per file,
+ * and the device sees a queue of capacity() requests instead of one.
+ *
+ * Permission bits and timestamps are set with fchmod/futimens, which io_uring
+ * does not offer. Files above g_ring_max_file are handed back to the caller,
+ * for which an in-kernel copy is cheaper.
+\*/
+class RingCopier
+{
+private:
+    IoRing &d_ring;
+
+public:
+    RingCopier(IoRing &ring);
+
+    /*\
+     * Copies the given files, recording the outcome in each entry. Returns
+     * false if the ring itself failed (entries not yet done are handed back).
+     * - progress: Optional callback receiving the bytes written
+    \*/
+    bool copy (std::vector<ring_copy_t> &files, progress_callback_t progress = nullptr);
+};
+
+}
+
+#endif // IORING_H
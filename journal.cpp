@@ -0,0 +1,543 @@
+#include "journal.h"
+#include "resource_manager.h"
+#include "fileio.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+
+/* enumeration of record types */
+enum record_type_t {
+    RECORD_BEGIN = 1,       /**< Resource roots of the update */
+    RECORD_INTENT,          /**< An operation is about to run */
+    RECORD_DONE,            /**< An operation completed */
+    RECORD_UNDONE,          /**< An operation was undone */
+    RECORD_COMMIT,          /**< The update committed */
+    RECORD_END,             /**< Nothing is left to do */
+    RECORD_CHECKPOINT       /**< A file copy is durable up to an offset */
+};
+
+/* Reads the fields of a record body in order */
+struct record_reader_t {
+    const QByteArray &body;
+    int offset;
+    bool ok;
+
+    record_reader_t (const QByteArray &b): body(b), offset(0), ok(true) {}
+
+    uint32_t u32 () {
+        uint32_t v = 0;
+        if (offset + 4 > body.size()) {
+            ok = false;
+            return 0;
+        }
+        memcpy(&v, body.constData() + offset, 4);
+        offset += 4;
+        return v;
+    }
+
+    uint64_t u64 () {
+        uint64_t low = u32(), high = u32();
+        return (high << 32) | low;
+    }
+
+    uint8_t u8 () {
+        if (offset + 1 > body.size()) {
+            ok = false;
+            return 0;
+        }
+        return static_cast<uint8_t>(body.at(offset++));
+    }
+
+    QString str () {
+        uint32_t length = u32();
+        if (false == ok || offset + (int64_t)length > body.size()) {
+            ok = false;
+            return nullptr;
+        }
+        offset += length;
+        return (length == 0 ? QString() : QString::fromUtf8(body.constData() + offset - length, length));
+    }
+};
+
+
+/*
+ *******************************************************************************
+ *                         Static variable definitions                         *
+ *******************************************************************************
+*/
+
+
+// Record framing: body length and CRC-32 of the body
+static const int g_frame_size = 8;
+
+
+/*
+ *******************************************************************************
+ *                            Forward declarations                             *
+ *******************************************************************************
+*/
+
+
+static uint32_t crc32 (const char *data, size_t size);
+static void put_u32 (QByteArray *body_p, uint32_t value);
+static void put_u64 (QByteArray *body_p, uint64_t value);
+static void put_u64 (QByteArray *body_p, uint64_t value)
+{
+    put_u32(body_p, static_cast<uint32_t>(value));
+    put_u32(body_p, static_cast<uint32_t>(value >> 32));
+}
+
+static void put_u8 (QByteArray *body_p, uint8_t value);
+static void put_str (QByteArray *body_p, const QString s);
+static QByteArray step_record (record_type_t type, journal_phase_t phase, off_t index);
+
+
+/*
+ *******************************************************************************
+ *                         Class definition: Journal                           *
+ *******************************************************************************
+*/
+
+
+Journal::Journal(const QString path):
+    d_path(path),
+    d_fd(-1),
+    d_appended(0),
+    d_synced(0)
+{}
+
+Journal::~Journal()
+{
+    if (d_fd != -1) {
+        ::close(d_fd);
+    }
+}
+
+bool Journal::open (const QByteArray payload, bool resume)
+{
+    ResourceManager &resourceManager = ResourceManager::get_instance();
+    QByteArray record;
+
+    if (resume) {
+        return reopen();
+    }
+    if (false == QDir().mkpath(QFileInfo(d_path).path())) {
+        return false;
+    }
+    if (-1 == (d_fd = ::open(QFile::encodeName(d_path).constData(),
+                             O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600))) {
+        return false;
+    }
+
+    // The journal must be found after a crash: sync its directory entry once
+    if (false == sync_parent(AT_FDCWD, QFile::encodeName(d_path).constData())) {
+        return false;
+    }
+
+    put_u8(&record, RECORD_BEGIN);
+    put_u8(&record, RESOURCE_KEY_ENUM_MAX);
+    for (int key = 0; key < RESOURCE_KEY_ENUM_MAX; ++key) {
+        put_str(&record, resourceManager.getResourcePath(static_cast<resource_root_key_t>(key)));
+    }
+    put_str(&record, QString(payload.toHex()));
+    return sync(append(record));
+}
+
+uint64_t Journal::intent (journal_phase_t phase, off_t index, const operation_record_t &record)
+{
+    QByteArray body = step_record(RECORD_INTENT, phase, index);
+
+    put_u8(&body, record.label);
+    put_u8(&body, record.from_key);
+    put_u8(&body, record.to_key);
+    put_u8(&body, record.from_type);
+    put_u8(&body, record.to_type);
+    put_str(&body, record.from_path);
+    put_str(&body, record.to_path);
+    put_u8(&body, record.incremental ? 1 : 0);
+    put_str(&body, record.buried);
+
+    return append(body);
+}
+
+uint64_t Journal::done (journal_phase_t phase, off_t index)
+{
+    return append(step_record(RECORD_DONE, phase, index));
+}
+
+uint64_t Journal::undone (journal_phase_t phase, off_t index)
+{
+    return append(step_record(RECORD_UNDONE, phase, index));
+}
+
+bool Journal::checkpoint (journal_phase_t phase, off_t index, const copy_checkpoint_t &checkpoint)
+{
+    QByteArray body = step_record(RECORD_CHECKPOINT, phase, index);
+
+    put_u64(&body, checkpoint.offset);
+    put_u64(&body, checkpoint.source_size);
+    put_u64(&body, checkpoint.source_mtime.tv_sec);
+    put_u32(&body, checkpoint.source_mtime.tv_nsec);
+
+    return sync(append(body));
+}
+
+bool Journal::sync (uint64_t sequence)
+{
+    std::lock_guard<std::mutex> sync_guard(d_sync_lock);
+    QByteArray pending;
+    uint64_t target;
+
+    // Whoever synced while this thread waited may have covered it already
+    {
+        std::lock_guard<std::mutex> guard(d_lock);
+        if (d_synced >= std::min(sequence, d_appended)) {
+            return (d_fd != -1);
+        }
+        pending.swap(d_buffer);
+        target = d_appended;
+    }
+
+    // A journal that lost records is of no use: stop writing to it
+    if (d_fd == -1 || false == write_all(d_fd, pending.constData(), pending.size()) || 0 != fdatasync(d_fd)) {
+        if (d_fd != -1) {
+            ::close(d_fd);
+            d_fd = -1;
+        }
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(d_lock);
+    d_synced = target;
+    return true;
+}
+
+bool Journal::commit ()
+{
+    QByteArray record;
+    put_u8(&record, RECORD_COMMIT);
+    return sync(append(record));
+}
+
+bool Journal::close ()
+{
+    QByteArray record;
+    put_u8(&record, RECORD_END);
+    if (false == sync(append(record))) {
+        return false;
+    }
+    ::close(d_fd);
+    d_fd = -1;
+    return (0 == unlink(QFile::encodeName(d_path).constData()));
+}
+
+bool Journal::recover (const QString path, const QByteArray payload, journal_state_t *state_p)
+{
+    ResourceManager &resourceManager = ResourceManager::get_instance();
+    Graveyard &graveyard = Graveyard::get_instance();
+    QFile file(path);
+    QByteArray data;
+    int valid_length = 0;
+
+    // Replay state
+    QVector<QString> roots;
+    QString recorded_payload;
+    std::map<std::pair<int, off_t>, operation_record_t> intents;
+    std::map<std::pair<int, off_t>, copy_checkpoint_t> checkpoints;
+    std::vector<std::pair<int, off_t>> order;
+    std::set<std::pair<int, off_t>> completed, undone;
+    bool begun = false, committed = false, ended = false, ok = true;
+
+    if (state_p != nullptr) {
+        state_p->resumed = false;
+    }
+    if (false == file.exists()) {
+        return true;
+    }
+    if (false == file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    data = file.readAll();
+    file.close();
+
+    // Parse up to the first torn or corrupt record
+    while (valid_length + g_frame_size <= data.size()) {
+        uint32_t length, crc;
+        memcpy(&length, data.constData() + valid_length, 4);
+        memcpy(&crc, data.constData() + valid_length + 4, 4);
+        if ((int64_t)valid_length + g_frame_size + length > data.size() ||
+            crc != crc32(data.constData() + valid_length + g_frame_size, length)) {
+            break;
+        }
+
+        QByteArray body = data.mid(valid_length + g_frame_size, length);
+        record_reader_t r(body);
+        uint8_t type = r.u8();
+        if (type == RECORD_BEGIN) {
+            uint8_t count = r.u8();
+            for (uint8_t i = 0; i < count; ++i) {
+                roots.push_back(r.str());
+            }
+            recorded_payload = r.str();
+            begun = true;
+        } else if (type == RECORD_INTENT || type == RECORD_DONE || type == RECORD_UNDONE ||
+                   type == RECORD_CHECKPOINT) {
+            int phase = r.u8();
+            std::pair<int, off_t> step(phase, r.u32());
+            if (type == RECORD_INTENT) {
+                operation_record_t record;
+                record.label = static_cast<OperationLabel>(r.u8());
+                record.from_key = static_cast<resource_root_key_t>(r.u8());
+                record.to_key = static_cast<resource_root_key_t>(r.u8());
+                record.from_type = static_cast<resource_type_t>(r.u8());
+                record.to_type = static_cast<resource_type_t>(r.u8());
+                record.from_path = r.str();
+                record.to_path = r.str();
+                record.incremental = (r.u8() != 0);
+                record.buried = r.str();
+                if (intents.count(step) == 0) {
+                    order.push_back(step);
+                }
+                intents[step] = record;
+
+                // Started over (by a resumed update): what came before is moot
+                completed.erase(step);
+                undone.erase(step);
+                checkpoints.erase(step);
+            } else if (type == RECORD_CHECKPOINT) {
+                copy_checkpoint_t checkpoint;
+                checkpoint.offset = r.u64();
+                checkpoint.source_size = r.u64();
+                checkpoint.source_mtime.tv_sec = r.u64();
+                checkpoint.source_mtime.tv_nsec = r.u32();
+                checkpoints[step] = checkpoint;
+            } else if (type == RECORD_DONE) {
+                completed.insert(step);
+            } else {
+                undone.insert(step);
+            }
+        } else if (type == RECORD_COMMIT) {
+            committed = true;
+        } else if (type == RECORD_END) {
+            ended = true;
+        }
+        if (false == r.ok) {
+            break;
+        }
+        valid_length += g_frame_size + length;
+    }
+
+    // Nothing was changed, or everything was settled
+    if (false == begun || ended) {
+        qInfo() << "journal: nothing to recover in" << path;
+        return (0 == unlink(QFile::encodeName(path).constData()));
+    }
+
+    // Continue the journal after its last intact record
+    Journal journal(path);
+    if (false == journal.reopen() || 0 != ftruncate(journal.d_fd, valid_length)) {
+        return false;
+    }
+
+    // Resolve the resource paths as the interrupted update did
+    QVector<QString> saved_roots;
+    for (int key = 0; key < RESOURCE_KEY_ENUM_MAX; ++key) {
+        saved_roots.push_back(resourceManager.getResourcePath(static_cast<resource_root_key_t>(key)));
+        if (key < roots.length() && roots.at(key) != nullptr) {
+            resourceManager.setResourcePath(static_cast<resource_root_key_t>(key), roots.at(key));
+        }
+    }
+
+    // The graveyards of the removals: to be emptied in either direction
+    for (const std::pair<int, off_t> &step : order) {
+        const operation_record_t &record = intents[step];
+        if (record.label == LABEL_REMOVE && record.buried != nullptr) {
+            graveyard.adopt(QFileInfo(record.buried).path());
+        }
+    }
+
+    if (false == committed && state_p != nullptr && false == payload.isEmpty() &&
+        recorded_payload == QString(payload.toHex())) {
+        qInfo() << "journal: resuming" << path;
+
+        // A removal in flight may or may not have happened: put it back, to
+        // be run again. Copies in flight continue from their checkpoints.
+        for (auto it = order.rbegin(); ok && it != order.rend(); ++it) {
+            const operation_record_t &record = intents[*it];
+            if (record.label != LABEL_REMOVE || completed.count(*it) > 0 || undone.count(*it) > 0) {
+                continue;
+            }
+            std::shared_ptr<FSOperation> op = FSOperation::from_record(record);
+            if (op == nullptr || RESULT_OK != op->undo()) {
+                ok = false;
+                break;
+            }
+            journal.undone(static_cast<journal_phase_t>(it->first), it->second);
+            undone.insert(*it);
+        }
+
+        (*state_p) = journal_state_t();
+        state_p->resumed = true;
+        for (const std::pair<int, off_t> &step : order) {
+            if (step.first >= JOURNAL_PHASE_ENUM_MAX || undone.count(step) > 0) {
+                continue;
+            }
+            state_p->started[step.first].insert(step.second);
+            if (completed.count(step) > 0) {
+                state_p->completed[step.first].insert(step.second);
+            } else if (checkpoints.count(step) > 0) {
+                state_p->checkpoints[step.first][step.second] = checkpoints[step];
+            }
+        }
+
+        for (int key = 0; key < RESOURCE_KEY_ENUM_MAX; ++key) {
+            resourceManager.setResourcePath(static_cast<resource_root_key_t>(key), saved_roots.at(key));
+        }
+        if (false == journal.sync() || false == ok) {
+            qCritical() << "journal: unable to resume, kept for the next attempt";
+            return false;
+        }
+        return true;
+    }
+
+    if (committed) {
+        qInfo() << "journal: rolling forward" << path;
+    } else {
+        bool started = false;
+        qInfo() << "journal: rolling back" << path;
+
+        // Undo every update operation that may have run, latest first
+        for (auto it = order.rbegin(); ok && it != order.rend(); ++it) {
+            if (it->first != JOURNAL_PHASE_UPDATE) {
+                continue;
+            }
+            started = true;
+            if (undone.count(*it) > 0) {
+                continue;
+            }
+            std::shared_ptr<FSOperation> op = FSOperation::from_record(intents[*it]);
+            if (op == nullptr || RESULT_OK != op->undo()) {
+                ok = false;
+                break;
+            }
+            journal.undone(JOURNAL_PHASE_UPDATE, it->second);
+        }
+
+        // Put back what the backups saved (only needed if the target changed)
+        for (auto it = order.rbegin(); ok && started && it != order.rend(); ++it) {
+            if (it->first != JOURNAL_PHASE_BACKUP || completed.count(*it) == 0 || undone.count(*it) > 0) {
+                continue;
+            }
+            std::shared_ptr<FSOperation> op = FSOperation::from_record(intents[*it]);
+            if (op == nullptr || RESULT_OK != op->invert()) {
+                ok = false;
+                break;
+            }
+            journal.undone(JOURNAL_PHASE_BACKUP, it->second);
+        }
+    }
+
+    for (int key = 0; key < RESOURCE_KEY_ENUM_MAX; ++key) {
+        resourceManager.setResourcePath(static_cast<resource_root_key_t>(key), saved_roots.at(key));
+    }
+    if (false == ok) {
+        journal.sync();
+        qCritical() << "journal: recovery failed, kept for the next attempt";
+        return false;
+    }
+
+    // What was rolled back must be on disk before the journal goes
+    if (false == committed) {
+        ::sync();
+    }
+
+    // The graveyards are all that is left
+    graveyard.reclaim();
+    graveyard.wait();
+    return journal.close();
+}
+
+uint64_t Journal::append (const QByteArray &body)
+{
+    std::lock_guard<std::mutex> guard(d_lock);
+
+    put_u32(&d_buffer, body.size());
+    put_u32(&d_buffer, crc32(body.constData(), body.size()));
+    d_buffer.append(body);
+    return ++d_appended;
+}
+
+bool Journal::reopen ()
+{
+    d_fd = ::open(QFile::encodeName(d_path).constData(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    return (d_fd != -1);
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function definitions                             *
+ *******************************************************************************
+*/
+
+
+/* CRC-32 (IEEE 802.3, reflected) */
+static uint32_t crc32 (const char *data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= static_cast<uint8_t>(data[i]);
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static void put_u32 (QByteArray *body_p, uint32_t value)
+{
+    body_p->append(reinterpret_cast<const char *>(&value), 4);
+}
+
+static void put_u8 (QByteArray *body_p, uint8_t value)
+{
+    body_p->append(static_cast<char>(value));
+}
+
+static void put_str (QByteArray *body_p, const QString s)
+{
+    QByteArray utf8 = s.toUtf8();
+    put_u32(body_p, utf8.size());
+    body_p->append(utf8);
+}
+
+/* Body of an intent, done or undone record (up to the operation index) */
+static QByteArray step_record (record_type_t type, journal_phase_t phase, off_t index)
+{
+    QByteArray body;
+    put_u8(&body, type);
+    put_u8(&body, phase);
+    put_u32(&body, index);
+    return body;
+}
+
@@ -0,0 +1,147 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <QString>
+#include <QByteArray>
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <set>
+#include "fsoperation.h"
+
+namespace SWU {
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+/* enumeration of journaled phases */
+enum journal_phase_t {
+    JOURNAL_PHASE_BACKUP = 0,
+    JOURNAL_PHASE_UPDATE,
+
+    /* Size */
+    JOURNAL_PHASE_ENUM_MAX
+};
+
+/* Where an interrupted update of the same payload left off (see recover) */
+struct journal_state_t {
+    bool resumed;                                               // Continue the journal
+    std::set<off_t> started[JOURNAL_PHASE_ENUM_MAX];            // Intents not undone
+    std::set<off_t> completed[JOURNAL_PHASE_ENUM_MAX];          // Of those, completed
+    std::map<off_t, copy_checkpoint_t> checkpoints[JOURNAL_PHASE_ENUM_MAX];
+};
+
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * An append-only write-ahead journal of the operations of one update, kept
+ * on the target so that an update cut short by a crash or power loss can be
+ * rolled back (or forward) on the next start.
+ *
+ * Every operation is recorded with its intent before it runs and its
+ * completion after; the intent carries what is needed to rebuild and undo it
+ * without the configuration (which may be on media that is gone). Records
+ * are buffered and made durable by sync(), which is batched: one thread
+ * writes and fdatasyncs on behalf of every thread that asked in the meantime.
+ * Only intents have to be durable before their operation starts; a lost
+ * completion merely makes recovery undo an operation once more, which every
+ * undo tolerates.
+ *
+ * Each record is framed with its length and a CRC-32, so a torn tail is
+ * recognised and ignored.
+ *
+ * The journal also names the payload it applies, and records checkpoints
+ * of long file copies. An update interrupted before it committed is resumed
+ * instead of rolled back when the same payload is presented again.
+\*/
+class Journal
+{
+private:
+    QString d_path;
+    int d_fd;
+    std::mutex d_lock, d_sync_lock;
+    QByteArray d_buffer;
+    uint64_t d_appended, d_synced;
+
+    uint64_t append (const QByteArray &record);
+    bool reopen ();
+
+public:
+    Journal(const QString path);
+    ~Journal();
+    Journal(const Journal &) = delete;
+    Journal &operator= (const Journal &) = delete;
+
+    /*\
+     * Starts a new journal (replacing any), recording the resource roots and
+     * the identity of the payload. If "resume" is set, continues the journal
+     * that recover() left in place instead.
+    \*/
+    bool open (const QByteArray payload, bool resume = false);
+
+    /*\
+     * Records that an operation is about to run (not yet durable)
+     * - phase: Phase of the operation
+     * - index: Index of the operation within its phase
+     * - record: Description of the operation (see FSOperation::record)
+    \*/
+    uint64_t intent (journal_phase_t phase, off_t index, const operation_record_t &record);
+
+    /*\
+     * Records that an operation completed (not yet durable)
+    \*/
+    uint64_t done (journal_phase_t phase, off_t index);
+
+    /*\
+     * Records that an operation was undone (not yet durable)
+    \*/
+    uint64_t undone (journal_phase_t phase, off_t index);
+
+    /*\
+     * Records (durably) how far a file copy got; the bytes must be synced
+    \*/
+    bool checkpoint (journal_phase_t phase, off_t index, const copy_checkpoint_t &checkpoint);
+
+    /*\
+     * Makes every record appended so far durable (at least up to "sequence"
+     * if given). Concurrent callers share one write and fdatasync.
+    \*/
+    bool sync (uint64_t sequence = UINT64_MAX);
+
+    /*\
+     * Durably records that the update committed: from here on a restart rolls
+     * forward (finishes the reclamation) instead of back
+    \*/
+    bool commit ();
+
+    /*\
+     * Records that nothing is left to do, and deletes the journal
+    \*/
+    bool close ();
+
+    /*\
+     * Settles the journal left at "path" by an interrupted update, if any:
+     * rolls forward if it committed, else undoes the operations that were
+     * started and not yet undone (latest first), then inverts the completed
+     * backups if an update operation had started. Returns false if this
+     * failed; the journal is then kept for the next attempt.
+     *
+     * If the interrupted update applied "payload" too and "state_p" is given,
+     * nothing is rolled back but the removals in flight: the journal is kept
+     * for open() to continue, and "state_p" says what is left.
+    \*/
+    static bool recover (const QString path, const QByteArray payload = QByteArray(),
+                         journal_state_t *state_p = nullptr);
+};
+
+}
+
+#endif // JOURNAL_H
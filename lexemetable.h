@@ -0,0 +1,142 @@
+#ifndef LEXEMETABLE_H
+#define LEXEMETABLE_H
+
+#include <QChar>
+#include <QString>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace SWU {
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * A fixed set of N lexemes, hashed without collisions into S slots (a power
+ * of two, at least N). The table is meant to be built by the compiler:
+ *
+ *     static constexpr const char *g_names[] = {"file", "directory"};
+ *     static constexpr LexemeTable<2, 4> g_table(g_names);
+ *
+ * The constructor tries one seed of the hash after another until every
+ * lexeme lands in a slot of its own (with S around 2N, within a few seeds).
+ * A lookup then hashes the characters where they are, reads one slot and
+ * compares against the single lexeme found there: it neither allocates nor
+ * converts, so a QString is looked up through its UTF-16 data as is.
+\*/
+template <size_t N, size_t S>
+class LexemeTable
+{
+    static_assert(S >= N && 0 == (S & (S - 1)), "slots must be a power of two, at least the lexemes");
+    static_assert(N < 128, "slot entries are signed chars");
+
+private:
+    const char *const *d_lexemes;
+    uint32_t d_seed;
+    signed char d_slots[S];         /**< Index of the lexeme hashed there (-1: none) */
+
+    static constexpr uint32_t unit (char c)
+    {
+        return static_cast<unsigned char>(c);
+    }
+
+    static uint32_t unit (QChar c)
+    {
+        return c.unicode();
+    }
+
+    // FNV-1a over the code units, the seed mixed into the offset basis
+    template <typename CharT>
+    static constexpr uint32_t hash (const CharT *s, size_t length, uint32_t seed)
+    {
+        uint32_t h = 2166136261u ^ (seed * 16777619u);
+        for (size_t i = 0; i < length; ++i) {
+            h = (h ^ unit(s[i])) * 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+
+    static constexpr size_t length (const char *s)
+    {
+        size_t n = 0;
+        while (s[n] != '\0') {
+            ++n;
+        }
+        return n;
+    }
+
+    // Places every lexeme with the given seed; false on the first collision
+    constexpr bool place (uint32_t seed)
+    {
+        for (size_t i = 0; i < S; ++i) {
+            d_slots[i] = -1;
+        }
+        for (size_t i = 0; i < N; ++i) {
+            size_t slot = hash(d_lexemes[i], length(d_lexemes[i]), seed) & (S - 1);
+            if (d_slots[slot] != -1) {
+                return false;
+            }
+            d_slots[slot] = static_cast<signed char>(i);
+        }
+        return true;
+    }
+
+public:
+    constexpr LexemeTable (const char *const (&lexemes)[N]):
+        d_lexemes(lexemes),
+        d_seed(0),
+        d_slots{}
+    {
+        while (false == place(d_seed)) {
+            ++d_seed;
+        }
+    }
+
+    /*\
+     * Returns the index of the lexeme equal to the "length" code units at
+     * "s", or -1 if there is none
+    \*/
+    template <typename CharT>
+    int find (const CharT *s, size_t length) const
+    {
+        int index = d_slots[hash(s, length, d_seed) & (S - 1)];
+        if (index < 0) {
+            return -1;
+        }
+        const char *lexeme = d_lexemes[index];
+        for (size_t i = 0; i < length; ++i) {
+            if (lexeme[i] == '\0' || unit(lexeme[i]) != unit(s[i])) {
+                return -1;
+            }
+        }
+        return (lexeme[length] == '\0' ? index : -1);
+    }
+
+    int find (const QString &s) const
+    {
+        return find(s.constData(), static_cast<size_t>(s.length()));
+    }
+
+    /*\
+     * Returns the lexeme at "index" (which must be below N)
+    \*/
+    constexpr const char *lexeme (size_t index) const
+    {
+        return d_lexemes[index];
+    }
+
+    /*\
+     * Returns the seed the constructor settled on
+    \*/
+    constexpr uint32_t seed () const
+    {
+        return d_seed;
+    }
+};
+
+}
+
+#endif // LEXEMETABLE_H
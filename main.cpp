@@ -2,23 +2,24 @@
 #include "ui_mainwindow.h"
 
 #include "math.h"
-#include "cfgxmlhandler.h"
-#include "element.h"
-#include "cfgelement.h"
+#include "configreader.h"
 #include "cfgparser.h"
 #include "cfgupdater.h"
 #include "updatethread.h"
+#include "bundle.h"
 
 #include <QApplication>
+#include <QFile>
 #include <QFileInfo>
-#include <QtXml>
+#include <QProcess>
+#include <QDeadlineTimer>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QThread>
 #include <QStorageInfo>
 #include <iostream>
 #include <memory>
-
-#define STOP_SERVICE_STEP   1
-#define START_SERVICE_STEP  1
+#include <cstring>
 
 
 /*!
@@ -54,50 +55,23 @@ static std::unique_ptr<QString> getStyleSheet (const QString path)
  */
 static std::shared_ptr<SWU::Parser> getParser (const char *config_filename)
 {
-    FILE *file_handle;
-    QFile file;
-    QXmlInputSource inputSource;
-    QXmlSimpleReader reader;
-    ConfigXMLHandler handler;
-
-    // Open file
-    if (nullptr == (file_handle = fopen(config_filename, "r"))) {
-        qCritical() << "FILE: Cannot open: " << QString(config_filename) << ": " << QString(strerror(errno)) ;
-        return nullptr;
-    }
+    SWU::ConfigReader reader;
 
-    // Convert to QFile
-    if (false == file.open(file_handle, QIODevice::ReadOnly)) {
-        qCritical() << "QFile: Cannot open: " << QString(config_filename) ;
+    // Map the file
+    if (false == reader.open(QFile::decodeName(config_filename))) {
         return nullptr;
     }
 
-    // Set the XML input source
-    inputSource.setData(file.readAll());
-
-    // Set the XML content handler
-    reader.setContentHandler(&handler);
+    // Parse the elements as they are read
+    std::shared_ptr<SWU::Parser> parser = std::make_shared<SWU::Parser>(reader);
 
-    // Parser input
-    reader.parse(inputSource);
-
-    // Check handler output
-    if (false == handler.parsed()) {
+    // Check reader output
+    if (reader.failed()) {
         qCritical() << "XML Parse: Failed" ;
         return nullptr;
     }
 
-    // Close the file
-    file.close();
-
-    // Convert XML elements to SWU ones
-    QVector<std::shared_ptr<SWU::CFGElement>> config_elements;
-    for (auto element : handler.elementStack()) {
-        config_elements.push_back(std::make_shared<SWU::CFGElement>(element));
-    }
-
-    // Parse the SWU elements now
-    std::shared_ptr<SWU::Parser> parser = std::make_shared<SWU::Parser>(config_elements);
+    // Check parser output
     if (SWU::PARSE_OK != parser->status()) {
         qCritical() << "SWU Parse: Failed for reason: " << QString(parser->fault()) ;
         return nullptr;
@@ -141,37 +115,62 @@ static bool systemd_service_start (QString service)
 class MyUpdaterThread : public UpdateThread, public SWU::UpdateDelegate {
 private:
     std::shared_ptr<SWU::Updater> d_updater_ptr;
-    off_t d_steps, d_total_steps; /**< Update progress is tracked using steps */
+    QMutex d_stage_lock; /**< Progress is reported from worker threads while stages change */
+    int d_progress_value; /**< Update progress is tracked in bytes, shown as percentage */
+    QString d_stage_label; /**< Status of the running stage, shown with the time left */
     QString d_product_id; /**< An example field used to hold a generated product ID string */
+    bool d_services_stopped; /**< Services are restarted on exit only if they were stopped */
 public:
-    MyUpdaterThread(std::shared_ptr<SWU::Parser> parser, QObject *parent = nullptr):
+    MyUpdaterThread(std::shared_ptr<SWU::Parser> parser, bool dry_run = false, QObject *parent = nullptr):
         UpdateThread(parent),
-        d_updater_ptr(nullptr)
+        d_updater_ptr(nullptr),
+        d_progress_value(0),
+        d_services_stopped(false)
     {
 
         // Init the updater
         d_updater_ptr = std::make_shared<SWU::Updater>(parser, *this);
+        d_updater_ptr->setDryRun(dry_run);
     }
 
     /*!
-     * \brief Increments the step counter
+     * \brief Returns the last progress value
      * \return Normalised progress value as an integer on a scale of 0 to 100
      */
-    int advanceStep()
+    int progress ()
     {
-        if (d_steps < d_total_steps) {
-            d_steps++;
-        }
-        return step();
+        QMutexLocker locker(&d_stage_lock);
+        return d_progress_value;
     }
 
-    int step ()
+    /*!
+     * \brief Sets the status of a new stage (the time left is appended as it becomes known)
+     * \param statusLabel The status to show
+     */
+    void setStage (const QString statusLabel)
     {
-        float real = (float)d_steps / (float)d_total_steps * 100.0;
-        int natural = (int)ceil(real);
-        return natural;
+        {
+            QMutexLocker locker(&d_stage_lock);
+            d_stage_label = statusLabel;
+        }
+        setStatus(statusLabel);
     }
 
+    /*!
+     * \brief Returns a coarse, human readable form of a duration
+     * \param seconds The duration in seconds
+     * \return Duration as a QString
+     */
+    static QString durationString (int seconds)
+    {
+        if (seconds < 60) {
+            return QString("less than a minute");
+        }
+        if (seconds < 3600) {
+            return QString("about %1 min").arg((seconds + 30) / 60);
+        }
+        return QString("about %1 h %2 min").arg(seconds / 3600).arg((seconds % 3600) / 60);
+    }
 
     /*!
      * \brief All pre-update tasks go here
@@ -193,11 +192,31 @@ public:
         QString product_id = QString("%1 %2").arg(updater.product(), updater.platform());
         d_product_id = product_id.replace(" ", "_").toLower();
 
-        // Init progress tracking
-        d_steps = 0;
-        d_total_steps = updater.operationCount() +
-                        STOP_SERVICE_STEP +
-                        START_SERVICE_STEP;
+        // Set: final UI
+        progressValue = progress();
+        updateUI(statusLabel, progressValue);
+
+        return SWU::STATUS_OK;
+    }
+
+    /*!
+     * \brief Services are stopped here, once the update is known to fit
+     * \param updater A reference to the updater object
+     * \param plan The space and time the update is predicted to take
+     * \return STATUS_OK if the updater should continue, else error status.
+     */
+    SWU::UpdateStatus on_plan (SWU::Updater &updater, const SWU::update_plan_t &plan) override
+    {
+        Q_UNUSED(updater);
+        QString statusLabel;
+        int progressValue;
+
+        // Set: UI for the prediction
+        if (plan.seconds >= 0) {
+            statusLabel = QString("Update will take %1").arg(durationString(plan.seconds));
+            setStatus(statusLabel);
+            QThread::msleep(1000);
+        }
 
         // Set: UI for stopping services
         statusLabel = "Stopping services ...";
@@ -205,6 +224,7 @@ public:
         QThread::msleep(500);
 
         // Stop: Running instances of target to be updated
+        d_services_stopped = true;
         if (systemd_service_stop("backend.service")) {
             qInfo() << "Notice: Failed to stop backend, continuing anyways";
         }
@@ -213,7 +233,7 @@ public:
         }
 
         // Set: final UI
-        progressValue = advanceStep();
+        progressValue = progress();
         updateUI(statusLabel, progressValue);
 
         return SWU::STATUS_OK;
@@ -232,6 +252,7 @@ public:
         QString statusLabel;
         int progressValue;
         QString search_term, resource_path = nullptr;
+        std::shared_ptr<SWU::Bundle> bundle = nullptr;
 
         // Set: pre UI
         statusLabel = "Locating update resource ...";
@@ -259,6 +280,13 @@ public:
                 continue;
             }
 
+            // Prefer a bundle (one file, no directory lookups) over a product directory
+            QString bundle_path = QDir(resource_path).filePath(d_product_id + ".swb");
+            if (QFileInfo(bundle_path).isFile() && (bundle = SWU::Bundle::open(bundle_path)) != nullptr) {
+                resource_path = bundle_path;
+                break;
+            }
+
             // Set the search term (wildcard to account for possible date or version suffixes)
             search_term = d_product_id + "*";
 
@@ -278,12 +306,13 @@ public:
         }
 
         // Set: post UI
-        progressValue = advanceStep();
+        progressValue = progress();
         updateUI(statusLabel, progressValue);
 
         // If resource path found, then assign to resource manager.
         if (resource_path != nullptr) {
             resourceManager.setResourcePath(SWU::RESOURCE_KEY_REMOTE, resource_path);
+            resourceManager.setBundle(SWU::RESOURCE_KEY_REMOTE, bundle);
             return SWU::STATUS_OK;
         } else {
             return SWU::STATUS_RESOURCE_NOT_FOUND;
@@ -302,14 +331,14 @@ public:
 
         // Set: pre UI
         statusLabel = QString("Verifying %1 ...").arg(index);
-        setStatus(statusLabel);
+        setStage(statusLabel);
         QThread::msleep(500);
 
         // Unimplemented (do whatever checks here)
         Q_UNUSED(op);
 
         // Set: post UI
-        progressValue = advanceStep();
+        progressValue = progress();
         updateUI(statusLabel, progressValue);
 
         return SWU::STATUS_OK;
@@ -327,14 +356,14 @@ public:
 
         // Set: pre UI
         statusLabel = QString("Backing up %1 ...").arg(index);
-        setStatus(statusLabel);
+        setStage(statusLabel);
         QThread::msleep(500);
 
         // Unimplemented (do whatever checks here)
         Q_UNUSED(op);
 
         // Set: post UI
-        progressValue = advanceStep();
+        progressValue = progress();
         updateUI(statusLabel, progressValue);
 
         return SWU::STATUS_OK;
@@ -352,14 +381,14 @@ public:
 
         // Set: pre UI
         statusLabel = QString("Updating %1 ...").arg(index);
-        setStatus(statusLabel);
+        setStage(statusLabel);
         QThread::msleep(500);
 
         // Unimplemented (do whatever checks here)
         Q_UNUSED(op);
 
         // Set: post UI
-        progressValue = advanceStep();
+        progressValue = progress();
         updateUI(statusLabel, progressValue);
 
         return SWU::STATUS_OK;
@@ -367,6 +396,34 @@ public:
 
 
 
+    /*!
+     * \brief Shows the byte-weighted progress and the estimated time left
+     * \param updater Reference to the updater object
+     * \param done Bytes processed so far
+     * \param total Bytes planned for the whole update
+     * \param eta Estimated seconds left (-1 if unknown)
+     */
+    void on_progress (SWU::Updater &updater, off_t done, off_t total, int eta) override
+    {
+        Q_UNUSED(updater);
+        QString statusLabel;
+        int progressValue;
+
+        // Set: progress value (an empty update is complete)
+        progressValue = (total > 0 ? (int)ceil((double)done / (double)total * 100.0) : 100);
+        {
+            QMutexLocker locker(&d_stage_lock);
+            d_progress_value = progressValue;
+            statusLabel = d_stage_label;
+        }
+
+        // Set: status with the time left
+        if (eta >= 0 && done < total && false == statusLabel.isEmpty()) {
+            statusLabel = QString("%1 (%2 left)").arg(statusLabel, durationString(eta));
+        }
+        updateUI(statusLabel, progressValue);
+    }
+
     /*!
      * \brief Executed when the Updater is finished or interrupted
      * \param updater Reference to the updater object
@@ -380,16 +437,25 @@ public:
                                std::shared_ptr<SWU::FSOperation> op,
                                SWU::OperationResult op_result) override
     {
-        Q_UNUSED(op);
         Q_UNUSED(op_result);
         QString statusLabel;
-        int progressValue = step();
+        int progressValue = progress();
         bool shouldTerminate = true;
         bool shouldRecover = false;
 
         switch (status) {
             case SWU::STATUS_OK:
                 statusLabel = "Restarting services ...";
+                if (updater.dryRun() && updater.prediction().seconds >= 0) {
+                    statusLabel = QString("Dry run: the update fits and takes %1")
+                                  .arg(durationString(updater.prediction().seconds));
+                } else if (updater.dryRun()) {
+                    statusLabel = "Dry run: the update fits";
+                }
+                break;
+            case SWU::STATUS_BAD_PLAN:
+                statusLabel = "Not enough space for the update!";
+                progressValue = -1;
                 break;
             case SWU::STATUS_BAD_PLATFORM:
                 statusLabel = "Incompatible platform!";
@@ -402,6 +468,9 @@ public:
                 break;
 
             default:
+                if (op != nullptr && false == op->errstr().isEmpty()) {
+                    qCritical() << "Failed:" << op->errstr();
+                }
                 statusLabel = "Recovering from exception ...";
                 progressValue = -1;
                 shouldRecover = true;
@@ -430,11 +499,11 @@ public:
         // On terminate condition
         if (shouldTerminate) {
 
-            // Restart services
-            if (systemd_service_start("backend.service")) {
+            // Restart services (if they were stopped)
+            if (d_services_stopped && systemd_service_start("backend.service")) {
                 qCritical() << "Failed to start backend, continuing anyways";
             }
-            if (systemd_service_start("frontend.service")) {
+            if (d_services_stopped && systemd_service_start("frontend.service")) {
                 qCritical() << "Failed to start frontend, continuing anyways";
             }
 
@@ -468,18 +537,26 @@ public:
 int main(int argc, char *argv[])
 {
     std::unique_ptr<QString> css;
+    int arg = 1;
+
+    // Option: plan the update (space, time) without changing anything (the
+    // write speed is not timed then, so the duration is mostly unknown)
+    bool dry_run = (argc > arg && 0 == strcmp(argv[arg], "--dry-run"));
+    if (dry_run) {
+        arg++;
+    }
 
     // Check arguments
-    if (argc <= 1) {
+    if (argc <= arg) {
         qCritical() << "No descriptor XML file provided!";
         return EXIT_FAILURE;
     }
 
     // Create application
     QApplication a(argc, argv);
-    if (argc > 2) {
-        if ((nullptr == (css = getStyleSheet(argv[2])))) {
-            qWarning() << "Unable to read stylesheet: \"" << QString(argv[2])
+    if (argc > arg + 1) {
+        if ((nullptr == (css = getStyleSheet(argv[arg + 1])))) {
+            qWarning() << "Unable to read stylesheet: \"" << QString(argv[arg + 1])
                        << "\"";
         } else {
             a.setStyleSheet(*css);
@@ -489,13 +566,13 @@ int main(int argc, char *argv[])
     }
 
     // Get the parser
-    std::shared_ptr<SWU::Parser> parser = getParser(argv[1]);
+    std::shared_ptr<SWU::Parser> parser = getParser(argv[arg]);
     if (nullptr == parser) {
         return EXIT_FAILURE;
     }
 
     // Create the updater thread
-    MyUpdaterThread updaterThread(parser);
+    MyUpdaterThread updaterThread(parser, dry_run);
 
     // Create and show window
     MainWindow w(updaterThread);
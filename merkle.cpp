@@ -0,0 +1,489 @@
+#include "merkle.h"
+#include "fileio.h"
+#include "workpool.h"
+
+#include <QDebug>
+#include <QFile>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <limits>
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+
+static_assert(sizeof(merkle_header_t) == 24, "merkle_header_t must match the on-media layout");
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "sidecars are read and written in host order");
+
+
+/*
+ *******************************************************************************
+ *                         Static variable definitions                         *
+ *******************************************************************************
+*/
+
+
+static const char g_merkle_magic[8] = {'S', 'W', 'U', 'M', 'R', 'K', 'L', '\0'};
+
+static const uint32_t g_merkle_version = 1;
+
+// Accepted chunk sizes (4 KiB to 16 MiB: every verifying worker holds one)
+static const uint32_t g_min_chunk_shift = 12;
+static const uint32_t g_max_chunk_shift = 24;
+
+// Domain separation of leaves and nodes (a leaf cannot pass for a node)
+static const uint8_t g_leaf_prefix = 0x00;
+static const uint8_t g_node_prefix = 0x01;
+
+// Most bytes a verifying worker reads for one run of chunks digested together
+static const size_t g_run_size = 8 << 20;
+
+// Suffix of a sidecar file
+static const char g_sidecar_suffix[] = ".merkle";
+
+
+/*
+ *******************************************************************************
+ *                        Class definition: MerkleTree                         *
+ *******************************************************************************
+*/
+
+
+MerkleTree::MerkleTree(uint32_t chunk_shift, off_t size, std::vector<uint8_t> leaves):
+    d_chunk_shift(chunk_shift),
+    d_size(size),
+    d_leaves(std::move(leaves))
+{}
+
+std::shared_ptr<MerkleTree> MerkleTree::load (int fd, off_t offset, off_t length, const QByteArray root)
+{
+    merkle_header_t header;
+
+    // Header: the leaves must fill the rest of the sidecar exactly
+    if (length < (off_t)sizeof(header) ||
+        sizeof(header) != read_chunk(fd, reinterpret_cast<char *>(&header), sizeof(header), offset)) {
+        return nullptr;
+    }
+    if (0 != memcmp(header.magic, g_merkle_magic, sizeof(g_merkle_magic)) || header.version != g_merkle_version ||
+        header.chunk_shift < g_min_chunk_shift || header.chunk_shift > g_max_chunk_shift ||
+        header.size > (uint64_t)std::numeric_limits<off_t>::max()) {
+        return nullptr;
+    }
+    const uint64_t chunks = std::max<uint64_t>(1, (header.size + (1ull << header.chunk_shift) - 1) >> header.chunk_shift);
+    if ((uint64_t)(length - sizeof(header)) != chunks * SHA256_DIGEST_SIZE) {
+        return nullptr;
+    }
+
+    // Leaves: accepted only if they add up to the declared root
+    std::vector<uint8_t> leaves(chunks * SHA256_DIGEST_SIZE);
+    if ((ssize_t)leaves.size() != read_chunk(fd, reinterpret_cast<char *>(leaves.data()), leaves.size(),
+                                             offset + sizeof(header))) {
+        return nullptr;
+    }
+    if (MerkleTree::root(leaves) != root) {
+        return nullptr;
+    }
+    return std::make_shared<MerkleTree>(header.chunk_shift, header.size, std::move(leaves));
+}
+
+std::shared_ptr<MerkleTree> MerkleTree::loadat (int dirfd, const char *name, const QByteArray root)
+{
+    const std::string path = std::string(name) + g_sidecar_suffix;
+    struct stat st;
+    int fd;
+
+    if (-1 == (fd = openat(dirfd, path.c_str(), O_RDONLY | O_CLOEXEC))) {
+        qDebug() << " --- Unable to open" << QString::fromStdString(path) << ":" << QString(strerror(errno));
+        return nullptr;
+    }
+    std::shared_ptr<MerkleTree> tree = nullptr;
+    if (0 == fstat(fd, &st)) {
+        tree = load(fd, 0, st.st_size, root);
+    }
+    close(fd);
+    return tree;
+}
+
+bool MerkleTree::build (int dirfd, const char *name, uint32_t chunk_shift, QByteArray *root_p)
+{
+    const std::string path = std::string(name) + g_sidecar_suffix, part = path + ".part";
+    const size_t chunk = (size_t)1 << chunk_shift;
+    std::unique_ptr<char[]> buffer(new char[chunk]);
+    std::vector<uint8_t> leaves;
+    merkle_header_t header;
+    off_t size = 0;
+    ssize_t n;
+    int fd;
+
+    if (chunk_shift < g_min_chunk_shift || chunk_shift > g_max_chunk_shift) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Leaves: one per chunk, and one (empty) for an empty file
+    if (-1 == (fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC))) {
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while ((n = read_chunk(fd, buffer.get(), chunk, size)) > 0 || (n == 0 && leaves.empty())) {
+        Sha256 hash;
+        leaf(&hash);
+        hash.update(buffer.get(), n);
+        QByteArray digest = hash.result();
+        leaves.insert(leaves.end(), digest.constData(), digest.constData() + digest.size());
+        size += n;
+        if ((size_t)n < chunk) {
+            break;
+        }
+    }
+    close(fd);
+    if (n < 0) {
+        return false;
+    }
+
+    // Sidecar: written next to the file, then renamed into place
+    memcpy(header.magic, g_merkle_magic, sizeof(g_merkle_magic));
+    header.version = g_merkle_version;
+    header.chunk_shift = chunk_shift;
+    header.size = size;
+    if (-1 == (fd = openat(dirfd, part.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))) {
+        return false;
+    }
+    bool ok = write_chunk(fd, reinterpret_cast<const char *>(&header), sizeof(header), 0) &&
+              write_chunk(fd, reinterpret_cast<const char *>(leaves.data()), leaves.size(), sizeof(header)) &&
+              0 == fsync(fd);
+    close(fd);
+    if (false == ok || -1 == renameat(dirfd, part.c_str(), dirfd, path.c_str())) {
+        unlinkat(dirfd, part.c_str(), 0);
+        return false;
+    }
+
+    (*root_p) = root(leaves);
+    return true;
+}
+
+QByteArray MerkleTree::root ()
+{
+    return root(d_leaves);
+}
+
+off_t MerkleTree::chunkSize ()
+{
+    return (off_t)1 << d_chunk_shift;
+}
+
+off_t MerkleTree::size ()
+{
+    return d_size;
+}
+
+size_t MerkleTree::chunks ()
+{
+    return d_leaves.size() / SHA256_DIGEST_SIZE;
+}
+
+bool MerkleTree::check (size_t index, const char *data, size_t length)
+{
+    if (index >= chunks()) {
+        return false;
+    }
+
+    // Every chunk but the last is full
+    const off_t start = (off_t)index << d_chunk_shift;
+    if ((off_t)length != std::min(chunkSize(), d_size - start)) {
+        return false;
+    }
+    Sha256 hash;
+    leaf(&hash);
+    hash.update(data, length);
+    return check(index, hash.result());
+}
+
+bool MerkleTree::check (size_t index, const QByteArray leaf)
+{
+    return (index < chunks() && leaf.size() == (int)SHA256_DIGEST_SIZE &&
+            0 == memcmp(leaf.constData(), d_leaves.data() + index * SHA256_DIGEST_SIZE, SHA256_DIGEST_SIZE));
+}
+
+size_t MerkleTree::checkRun (size_t first, const char *data, size_t count)
+{
+    std::vector<Sha256> hashes(count);
+    std::vector<const char *> chunks(count);
+    size_t whole = 0;
+
+    if (first + count > this->chunks()) {
+        return 0;
+    }
+
+    // Whole chunks together, the short last one of the file on its own
+    while (whole < count && ((off_t)(first + whole + 1) << d_chunk_shift) <= d_size) {
+        leaf(&hashes[whole]);
+        chunks[whole] = data + ((off_t)whole << d_chunk_shift);
+        whole++;
+    }
+    Sha256::update_many(hashes.data(), chunks.data(), chunkSize(), whole);
+    for (size_t i = 0; i < whole; ++i) {
+        if (false == check(first + i, hashes[i].result())) {
+            return i;
+        }
+    }
+    if (whole < count) {
+        const off_t start = (off_t)(first + whole) << d_chunk_shift;
+        return (check(first + whole, data + ((off_t)whole << d_chunk_shift), d_size - start) ? count : whole);
+    }
+    return count;
+}
+
+/*\
+ * One task per worker: each claims the next unchecked run of chunks (as many
+ * as the hash kernel digests at once, within a bounded buffer) until none is
+ * left, so the reads advance through the file together. A failure raises
+ * a flag that every worker tests before its next read.
+\*/
+bool MerkleTree::verify (int fd, off_t base, progress_callback_t progress, off_t *bad_p)
+{
+    WorkPool &pool = WorkPool::get_instance();
+    WorkGroup group;
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::atomic<off_t> bad(-1);
+    const size_t count = chunks();
+    const size_t run = std::max<size_t>(1, std::min<size_t>(Sha256::lanes(), g_run_size >> d_chunk_shift));
+    const size_t tasks = std::max<size_t>(1, std::min<size_t>(pool.workers(), (count + run - 1) / run));
+
+    posix_fadvise(fd, base, d_size, POSIX_FADV_SEQUENTIAL);
+    for (size_t t = 0; t < tasks; ++t) {
+        pool.submit(group, [this, fd, base, count, run, &progress, &next, &failed, &bad] {
+            std::unique_ptr<char[]> buffer(new char[run << d_chunk_shift]);
+            size_t index;
+            while (false == failed && (index = next.fetch_add(run)) < count) {
+                const size_t n = std::min(run, count - index);
+                const off_t start = (off_t)index << d_chunk_shift;
+                const size_t length = std::min((off_t)n << d_chunk_shift, d_size - start);
+                size_t passed = 0;
+                if ((ssize_t)length != read_chunk(fd, buffer.get(), length, base + start) ||
+                    (passed = checkRun(index, buffer.get(), n)) < n) {
+                    off_t expected = -1;
+                    bad.compare_exchange_strong(expected, index + passed);
+                    failed = true;
+                    break;
+                }
+                if (progress) {
+                    progress(length);
+                }
+            }
+        });
+    }
+    pool.wait(group);
+
+    if (bad_p != nullptr) {
+        (*bad_p) = bad;
+    }
+    return (false == failed);
+}
+
+void MerkleTree::leaf (Sha256 *hash)
+{
+    hash->reset();
+    hash->update(&g_leaf_prefix, sizeof(g_leaf_prefix));
+}
+
+QByteArray MerkleTree::root (const std::vector<uint8_t> &leaves)
+{
+    std::vector<uint8_t> level(leaves);
+
+    if (level.empty() || 0 != level.size() % SHA256_DIGEST_SIZE) {
+        return QByteArray();
+    }
+
+    // Pair up the nodes of each level; an odd one out moves up as is
+    while (level.size() > SHA256_DIGEST_SIZE) {
+        const size_t nodes = level.size() / SHA256_DIGEST_SIZE;
+        std::vector<uint8_t> parents;
+        parents.reserve((nodes + 1) / 2 * SHA256_DIGEST_SIZE);
+        for (size_t i = 0; i < nodes; i += 2) {
+            const uint8_t *left = level.data() + i * SHA256_DIGEST_SIZE;
+            if (i + 1 == nodes) {
+                parents.insert(parents.end(), left, left + SHA256_DIGEST_SIZE);
+                continue;
+            }
+            Sha256 hash;
+            hash.update(&g_node_prefix, sizeof(g_node_prefix));
+            hash.update(left, 2 * SHA256_DIGEST_SIZE);
+            QByteArray digest = hash.result();
+            parents.insert(parents.end(), digest.constData(), digest.constData() + digest.size());
+        }
+        level.swap(parents);
+    }
+    return QByteArray(reinterpret_cast<const char *>(level.data()), SHA256_DIGEST_SIZE);
+}
+
+QString MerkleTree::sidecar (const QString name)
+{
+    return name + QString(g_sidecar_suffix);
+}
+
+
+/*
+ *******************************************************************************
+ *                        Class definition: ChunkStream                        *
+ *******************************************************************************
+*/
+
+
+ChunkStream::ChunkStream(std::shared_ptr<MerkleTree> tree):
+    d_tree(tree),
+    d_partial_offset(0),
+    d_partial_length(0),
+    d_next(0),
+    d_failed(false),
+    d_bad(-1)
+{}
+
+std::shared_ptr<MerkleTree> ChunkStream::tree ()
+{
+    return d_tree;
+}
+
+/*\
+ * A piece is split into a head (up to the first chunk boundary), the chunks
+ * it holds whole, and a tail (from the last boundary on). Whole chunks get a
+ * task per run of as many as the hash kernel digests at once (one, unless it
+ * has lanes); the head and tail go through the partial digest, in order, in
+ * one task of their own.
+\*/
+void ChunkStream::feed (WorkPool &pool, WorkGroup &group, off_t offset, const char *data, size_t length)
+{
+    const off_t chunk = d_tree->chunkSize(), size = d_tree->size(), end = offset + length;
+    off_t position = offset, head_end, tail;
+
+    // Pieces follow each other; a piece at a boundary may also start over
+    if (offset % chunk == 0 && offset <= d_next) {
+        d_next = offset;
+    } else if (offset != d_next) {
+        fail(offset / chunk);
+    }
+    if (end > size) {
+        fail(size / chunk);
+    }
+    if (d_failed || length == 0) {
+        return;
+    }
+    d_next = end;
+
+    // Head: completes the chunk begun by earlier pieces (or all of the piece)
+    head_end = position;
+    if (0 != position % chunk) {
+        head_end = std::min(end, (position / chunk + 1) * chunk);
+        position = head_end;
+    }
+
+    // Whole chunks (the last chunk of the file is whole at its end)
+    const size_t lanes = Sha256::lanes();
+    while (position < end && std::min(position + chunk, size) <= end) {
+        const char *run_data = data + (position - offset);
+        const size_t index = position / chunk;
+        size_t count = 0;
+        while (count < lanes && position < end && std::min(position + chunk, size) <= end) {
+            position = std::min(position + chunk, size);
+            count++;
+        }
+        pool.submit(group, [this, index, run_data, count] {
+            size_t passed;
+            if (false == d_failed && (passed = d_tree->checkRun(index, run_data, count)) < count) {
+                fail(index + passed);
+            }
+        });
+    }
+    tail = position;
+
+    // Head and tail
+    if (head_end > offset || tail < end) {
+        pool.submit(group, [this, offset, data, head_end, tail, end] {
+            std::lock_guard<std::mutex> lock(d_lock);
+            if (head_end > offset) {
+                piece(offset, data, head_end - offset);
+            }
+            if (tail < end) {
+                piece(tail, data + (tail - offset), end - tail);
+            }
+        });
+    }
+}
+
+bool ChunkStream::failed ()
+{
+    return d_failed;
+}
+
+off_t ChunkStream::bad ()
+{
+    return d_bad;
+}
+
+bool ChunkStream::finish (off_t end)
+{
+    std::lock_guard<std::mutex> lock(d_lock);
+
+    // An empty file is one empty chunk, which no piece carried
+    if (end == 0 && d_tree->size() == 0 && false == d_tree->check(0, nullptr, 0)) {
+        fail(0);
+    }
+    if (end != d_tree->size() || end != d_next || d_partial_length != 0) {
+        fail(end / d_tree->chunkSize());
+    }
+    return (false == d_failed);
+}
+
+void ChunkStream::reset ()
+{
+    std::lock_guard<std::mutex> lock(d_lock);
+    d_partial_offset = d_partial_length = d_next = 0;
+    d_failed = false;
+    d_bad = -1;
+}
+
+/* Adds a piece to the partial digest (under d_lock) */
+void ChunkStream::piece (off_t offset, const char *data, size_t length)
+{
+    const off_t chunk = d_tree->chunkSize();
+    const size_t index = offset / chunk;
+    const off_t start = (off_t)index * chunk, chunk_length = std::min(chunk, d_tree->size() - start);
+
+    // A chunk is digested from its start, without gaps
+    if (offset == start) {
+        MerkleTree::leaf(&d_partial);
+        d_partial_offset = start;
+        d_partial_length = 0;
+    } else if (d_partial_offset != start || d_partial_length != offset - start) {
+        fail(index);
+        return;
+    }
+    d_partial.update(data, length);
+    d_partial_length += length;
+
+    if (d_partial_length == chunk_length) {
+        if (false == d_tree->check(index, d_partial.result())) {
+            fail(index);
+        }
+        d_partial_length = 0;
+    }
+}
+
+/* Records a bad chunk (the first one is kept) */
+void ChunkStream::fail (off_t index)
+{
+    off_t expected = -1;
+    d_bad.compare_exchange_strong(expected, index);
+    d_failed = true;
+}
@@ -0,0 +1,200 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <QString>
+#include <QByteArray>
+#include <sys/types.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "hasher.h"
+#include "progress.h"
+
+namespace SWU {
+
+class WorkPool;
+class WorkGroup;
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * Layout of a Merkle sidecar file ("<file>.merkle", all integers
+ * little-endian): the header, then the digest of every chunk of the file
+ * in order (at least one: an empty file has one empty chunk).
+\*/
+struct merkle_header_t {
+    char magic[8];                      /**< g_merkle_magic */
+    uint32_t version;                   /**< g_merkle_version */
+    uint32_t chunk_shift;               /**< log2 of the chunk size */
+    uint64_t size;                      /**< Bytes of the file */
+};
+
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * A MerkleTree holds the chunk digests of a file. Every chunk is a leaf,
+ * SHA-256(0x00 | chunk); a node is SHA-256(0x01 | left | right), and an
+ * odd node out is carried up a level as is. Only the root is declared in
+ * the configuration: the leaves come from a sidecar next to the file and
+ * are accepted only if they hash up to that root.
+ *
+ * Chunks can then be checked independently, so a large file is verified on
+ * every core at once, and a bad chunk is reported as soon as it is read
+ * rather than once the whole file has been.
+\*/
+class MerkleTree
+{
+private:
+    uint32_t d_chunk_shift;
+    off_t d_size;
+    std::vector<uint8_t> d_leaves;
+
+public:
+    MerkleTree(uint32_t chunk_shift, off_t size, std::vector<uint8_t> leaves);
+
+    /*\
+     * Reads the sidecar found at "offset" of "fd" ("length" bytes; e.g. a
+     * bundle entry) and checks it against the declared root. Returns nullptr
+     * if it is malformed or does not match.
+    \*/
+    static std::shared_ptr<MerkleTree> load (int fd, off_t offset, off_t length, const QByteArray root);
+
+    /*\
+     * As above, for the sidecar of file "name" (relative to "dirfd")
+    \*/
+    static std::shared_ptr<MerkleTree> loadat (int dirfd, const char *name, const QByteArray root);
+
+    /*\
+     * Digests the file "name" (relative to "dirfd") in chunks of 2^chunk_shift
+     * bytes and writes its sidecar next to it. Stores the root in "root_p".
+    \*/
+    static bool build (int dirfd, const char *name, uint32_t chunk_shift, QByteArray *root_p);
+
+    /*\
+     * Returns the root of the tree
+    \*/
+    QByteArray root ();
+
+    /*\
+     * Size of a chunk, of the file, and number of chunks
+    \*/
+    off_t chunkSize ();
+    off_t size ();
+    size_t chunks ();
+
+    /*\
+     * Returns true if "data" is chunk "index" (complete: the last chunk may
+     * be short, all others are chunkSize() long)
+    \*/
+    bool check (size_t index, const char *data, size_t length);
+
+    /*\
+     * As above, for a leaf digested elsewhere
+    \*/
+    bool check (size_t index, const QByteArray leaf);
+
+    /*\
+     * Checks the "count" chunks from "first" on, found one after another at
+     * "data" (as in the file), digesting them together where the hash kernel
+     * allows (see Sha256::lanes()). Returns how many passed before the first
+     * bad one.
+    \*/
+    size_t checkRun (size_t first, const char *data, size_t count);
+
+    /*\
+     * Verifies the file at "base" of "fd" chunk by chunk on the worker pool.
+     * The chunks are taken in order (so the reads stay close together), a
+     * run at a time where several are digested together, and the first bad
+     * or unreadable one stops every worker.
+     * - bad_p: Optional pointer at which to store the index of a bad chunk
+    \*/
+    bool verify (int fd, off_t base, progress_callback_t progress = nullptr, off_t *bad_p = nullptr);
+
+    /*\
+     * Starts the leaf digest of a chunk (finish with Sha256::result())
+    \*/
+    static void leaf (Sha256 *hash);
+
+    /*\
+     * Returns the root over the given leaves (32 bytes each)
+    \*/
+    static QByteArray root (const std::vector<uint8_t> &leaves);
+
+    /*\
+     * Returns the name of the sidecar of a file
+    \*/
+    static QString sidecar (const QString name);
+};
+
+/*\
+ * Checks the data of a copy against a MerkleTree as it streams past. Chunks
+ * that arrive whole are checked on the worker pool, while the data is being
+ * written; a chunk that spans several pieces is digested as they come.
+ * Pieces are fed in order, from a chunk boundary on (a piece at a chunk
+ * boundary starts over from there, e.g. when a copy method hands over).
+\*/
+class ChunkStream
+{
+private:
+    std::shared_ptr<MerkleTree> d_tree;
+    std::mutex d_lock;
+    Sha256 d_partial;
+    off_t d_partial_offset, d_partial_length;
+    off_t d_next;
+    std::atomic<bool> d_failed;
+    std::atomic<off_t> d_bad;
+
+    void piece (off_t offset, const char *data, size_t length);
+    void fail (off_t index);
+
+public:
+    ChunkStream(std::shared_ptr<MerkleTree> tree);
+
+    /*\
+     * Tree the data is checked against
+    \*/
+    std::shared_ptr<MerkleTree> tree ();
+
+    /*\
+     * Checks the piece of data found at "offset" of the file. The checks run
+     * in "group": the data must stay untouched, and the next piece unfed,
+     * until the group has been waited for.
+    \*/
+    void feed (WorkPool &pool, WorkGroup &group, off_t offset, const char *data, size_t length);
+
+    /*\
+     * Returns true once a chunk failed its check (the copy should stop)
+    \*/
+    bool failed ();
+
+    /*\
+     * Returns the index of the first chunk found bad (-1: none)
+    \*/
+    off_t bad ();
+
+    /*\
+     * Returns true if the file ended at "end", where the tree says it does,
+     * and every chunk fed passed
+    \*/
+    bool finish (off_t end);
+
+    /*\
+     * Forgets every piece fed so far (and any failure)
+    \*/
+    void reset ();
+};
+
+}
+
+#endif // MERKLE_H
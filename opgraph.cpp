@@ -0,0 +1,160 @@
+#include "opgraph.h"
+#include "workpool.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                     Class definition: OperationGraph                        *
+ *******************************************************************************
+*/
+
+
+OperationGraph::OperationGraph(const QVector<std::shared_ptr<FSOperation>> &operations, off_t first,
+                               const std::set<off_t> &done):
+    d_operations(operations),
+    d_successors(operations.length()),
+    d_predecessors(operations.length(), 0)
+{
+    std::vector<QStringList> reads, writes;
+    std::vector<bool> pending(d_operations.length(), false);
+
+    // Footprints of the operations still to run (those before "first" are done)
+    for (off_t i = 0; i < d_operations.length(); ++i) {
+        pending[i] = (i >= first && done.count(i) == 0);
+        reads.push_back(pending[i] ? d_operations.at(i)->reads() : QStringList());
+        writes.push_back(pending[i] ? d_operations.at(i)->writes() : QStringList());
+    }
+
+    // Edge i -> j (i < j) if either writes where the other reads or writes
+    for (off_t j = first; j < d_operations.length(); ++j) {
+        for (off_t i = first; i < j; ++i) {
+            if (pending[i] && pending[j] &&
+                (overlaps(writes[i], writes[j]) || overlaps(writes[i], reads[j]) || overlaps(reads[i], writes[j]))) {
+                d_successors[i].push_back(j);
+                d_predecessors[j]++;
+            }
+        }
+    }
+
+    // Operations that were already run can never become ready again
+    for (off_t i = 0; i < d_operations.length(); ++i) {
+        if (false == pending[i]) {
+            d_predecessors[i] = -1;
+        }
+    }
+}
+
+size_t OperationGraph::edges ()
+{
+    size_t count = 0;
+    for (const std::vector<off_t> &successors : d_successors) {
+        count += successors.size();
+    }
+    return count;
+}
+
+size_t OperationGraph::dependent ()
+{
+    size_t count = 0;
+    for (off_t predecessors : d_predecessors) {
+        count += (predecessors > 0 ? 1 : 0);
+    }
+    return count;
+}
+
+void OperationGraph::execute (admit_callback_t admit, finish_callback_t finish, flush_callback_t flush)
+{
+    WorkPool &pool = WorkPool::get_instance();
+    WorkGroup group;
+    std::mutex lock;
+    std::condition_variable completed_cv;
+    std::deque<std::pair<off_t, OperationResult>> completed;
+    std::vector<off_t> waiting(d_predecessors);
+    std::set<off_t> ready;
+    std::vector<off_t> admitted;
+    size_t in_flight = 0;
+    bool stop = false;
+
+    for (off_t i = 0; i < d_operations.length(); ++i) {
+        if (waiting[i] == 0) {
+            ready.insert(i);
+        }
+    }
+
+    while (true) {
+
+        // Admit what is ready, first in configuration order first
+        admitted.clear();
+        while (false == stop && false == ready.empty() && in_flight + admitted.size() < pool.workers()) {
+            off_t index = *ready.begin();
+            ready.erase(ready.begin());
+            if (false == admit(index)) {
+                stop = true;
+                break;
+            }
+            admitted.push_back(index);
+        }
+        if (false == admitted.empty() && flush && false == flush()) {
+            admitted.clear();
+            stop = true;
+        }
+
+        // Dispatch the round
+        for (off_t index : admitted) {
+            std::shared_ptr<FSOperation> op = d_operations.at(index);
+            in_flight++;
+            pool.submit(group, [op, index, &lock, &completed_cv, &completed] {
+                OperationResult result = op->execute();
+                std::lock_guard<std::mutex> guard(lock);
+                completed.emplace_back(index, result);
+                completed_cv.notify_one();
+            });
+        }
+        if (in_flight == 0) {
+            break;
+        }
+
+        // Collect one completion and release its successors
+        std::pair<off_t, OperationResult> c;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            completed_cv.wait(guard, [&] { return false == completed.empty(); });
+            c = completed.front();
+            completed.pop_front();
+        }
+        in_flight--;
+        finish(c.first, c.second);
+
+        if (c.second != RESULT_OK) {
+            stop = true;
+            continue;
+        }
+        for (off_t successor : d_successors[c.first]) {
+            if (--waiting[successor] == 0) {
+                ready.insert(successor);
+            }
+        }
+    }
+
+    // The tasks still reference the group until they are fully retired
+    pool.wait(group);
+}
+
+bool OperationGraph::overlaps (const QStringList &a, const QStringList &b)
+{
+    for (const QString &p : a) {
+        for (const QString &q : b) {
+            if (p == q || p == "/" || q == "/" || q.startsWith(p + "/") || p.startsWith(q + "/")) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
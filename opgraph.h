@@ -0,0 +1,93 @@
+#ifndef OPGRAPH_H
+#define OPGRAPH_H
+
+#include <QVector>
+#include <QStringList>
+#include <functional>
+#include <memory>
+#include <set>
+#include <vector>
+#include "fsoperation.h"
+
+namespace SWU {
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * Orders a list of operations by the paths they touch and runs independent
+ * ones concurrently on the worker pool.
+ *
+ * Operation j depends on an earlier operation i if one writes a path that the
+ * other reads or writes, where a path also covers everything below it (so a
+ * remove of a directory conflicts with a copy into it). Reads never conflict
+ * with reads. The edges only ever point forward in configuration order, so
+ * the graph is acyclic, and a conflicting pair always runs in that order.
+ *
+ * Dispatch is deterministic: whenever several operations are ready, the one
+ * first in configuration order goes first. Only the interleaving of
+ * independent operations depends on timing.
+\*/
+class OperationGraph
+{
+public:
+
+    /*\
+     * Called on the dispatching thread before operation "index" starts.
+     * Returning false stops dispatching (operations in flight complete).
+    \*/
+    typedef std::function<bool(off_t index)> admit_callback_t;
+
+    /*\
+     * Called on the dispatching thread once operation "index" completed
+    \*/
+    typedef std::function<void(off_t index, OperationResult result)> finish_callback_t;
+
+    /*\
+     * Called on the dispatching thread after a round of admissions, before
+     * those operations start (e.g. to make their journal records durable).
+     * Returning false stops dispatching; the round does not start.
+    \*/
+    typedef std::function<bool()> flush_callback_t;
+
+private:
+    QVector<std::shared_ptr<FSOperation>> d_operations;
+    std::vector<std::vector<off_t>> d_successors;
+    std::vector<off_t> d_predecessors;
+
+    static bool overlaps (const QStringList &a, const QStringList &b);
+
+public:
+
+    /*\
+     * Derives the dependencies between the operations from index "first" on
+     * (the resource paths must be configured). Operations in "done" completed
+     * earlier as well, and are not run again.
+    \*/
+    OperationGraph(const QVector<std::shared_ptr<FSOperation>> &operations, off_t first = 0,
+                   const std::set<off_t> &done = std::set<off_t>());
+
+    /*\
+     * Returns the number of dependency edges (excluding those to skipped operations)
+    \*/
+    size_t edges ();
+
+    /*\
+     * Returns the number of operations that have to wait for an earlier one
+    \*/
+    size_t dependent ();
+
+    /*\
+     * Executes every operation once its predecessors succeeded. Stops
+     * dispatching at the first failure or refused admission, and returns once
+     * no operation is in flight.
+    \*/
+    void execute (admit_callback_t admit, finish_callback_t finish, flush_callback_t flush = nullptr);
+};
+
+}
+
+#endif // OPGRAPH_H
@@ -0,0 +1,68 @@
+#include "bundle.h"
+#include "merkle.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/*!
+ * \brief Packs an update tree into a bundle file for the updater
+ *
+ * Usage: swu_pack <directory> <bundle>
+ *        swu_pack --merkle <file> [<chunk KiB>]
+ *
+ * The updater looks for "<product>_<platform>.swb" (lower case, spaces as
+ * underscores) at the root of the update media, ahead of the product directory.
+ *
+ * The second form writes the chunk digests of a file to "<file>.merkle" and
+ * prints the root to declare in its merkle attribute. Pack the sidecar along
+ * with the file. Chunks are 1024 KiB unless given (a power of two, 4 KiB to
+ * 16384 KiB).
+ */
+int main (int argc, char *argv[])
+{
+    if ((argc == 3 || argc == 4) && QString(argv[1]) == "--merkle") {
+        unsigned kib = (argc == 4 ? QString(argv[3]).toUInt() : 1024), shift = 10;
+        QByteArray root;
+        while (((1u << (shift - 10)) < kib) && shift < 31) {
+            shift++;
+        }
+        if (kib == 0 || (1u << (shift - 10)) != kib) {
+            qCritical() << "Not a power of two:" << QString(argv[3]);
+            return 2;
+        }
+        if (false == SWU::MerkleTree::build(AT_FDCWD, argv[2], shift, &root)) {
+            qCritical() << "Unable to digest" << QString(argv[2]) << ":" << QString(strerror(errno));
+            return 1;
+        }
+        printf("%s\n", root.toHex().constData());
+        return 0;
+    }
+    if (argc != 3) {
+        qCritical() << "Usage:" << QString(argv[0]) << "<directory> <bundle>";
+        qCritical() << "      " << QString(argv[0]) << "--merkle <file> [<chunk KiB>]";
+        return 2;
+    }
+    QString directory = QString::fromLocal8Bit(argv[1]);
+    QString path = QString::fromLocal8Bit(argv[2]);
+
+    if (false == QFileInfo(directory).isDir()) {
+        qCritical() << "Not a directory:" << directory;
+        return 1;
+    }
+    if (false == SWU::Bundle::pack(directory, path)) {
+        return 1;
+    }
+
+    // Read it back: the index must load as the updater will load it
+    if (nullptr == SWU::Bundle::open(path)) {
+        return 1;
+    }
+    qInfo() << "Packed" << directory << "into" << path << "(" << QFileInfo(path).size() << "bytes )";
+    return 0;
+}
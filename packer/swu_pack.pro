@@ -0,0 +1,34 @@
+QT       += core
+QT       -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = swu_pack
+
+# Packs an update tree into a bundle file (see bundle.h) for the updater, and
+# writes the chunk digests (see merkle.h) of files
+INCLUDEPATH += ..
+
+SOURCES += \
+    main.cpp \
+    ../bundle.cpp \
+    ../fileio.cpp \
+    ../hasher.cpp \
+    ../merkle.cpp \
+    ../treewalker.cpp \
+    ../workpool.cpp
+
+HEADERS += \
+    ../bundle.h \
+    ../fileio.h \
+    ../hasher.h \
+    ../merkle.h \
+    ../progress.h \
+    ../treewalker.h \
+    ../workpool.h
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
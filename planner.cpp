@@ -0,0 +1,389 @@
+#include "planner.h"
+#include "treewalker.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStorageInfo>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                         Static variable definitions                         *
+ *******************************************************************************
+*/
+
+
+// Headroom on every written device: part files, directories, the journal
+static const off_t g_space_margin = 32 << 20;
+
+// Bytes read or written to time a device
+static const off_t g_probe_size = 16 << 20;
+
+// Smallest read worth timing (smaller ones are dominated by latency)
+static const off_t g_probe_min_size = 1 << 20;
+
+// Entries looked at to find a file to time reads on below a directory
+static const unsigned g_probe_entries = 4096;
+
+
+/*
+ *******************************************************************************
+ *                            Forward declarations                             *
+ *******************************************************************************
+*/
+
+
+static bool device_of (const QString path, dev_t *device_p, QString *existing_p);
+static QString probe_file (const QString path, off_t *size_p);
+static double time_read (const QString path, off_t size);
+static double time_write (const QString directory);
+
+
+/*
+ *******************************************************************************
+ *                          Class definition: Planner                          *
+ *******************************************************************************
+*/
+
+
+Planner::Planner():
+    d_plan(update_plan_t{std::vector<device_plan_t>(), 0, 0, -1, true}),
+    d_write_probe(true)
+{}
+
+void Planner::setWriteProbe (bool enabled)
+{
+    d_write_probe = enabled;
+}
+
+/*\
+ * Returns the device holding "path" (added on first sight). A path that does
+ * not exist yet (e.g. a copy destination, or a file inside a bundle) counts
+ * for the device of its closest existing ancestor, which is stored at
+ * "existing_p". Returns nullptr if not even the root can be found.
+\*/
+device_plan_t *Planner::device (const QString path, QString *existing_p)
+{
+    dev_t id;
+
+    if (false == device_of(path, &id, existing_p)) {
+        return nullptr;
+    }
+    for (auto &device : d_plan.devices) {
+        if (device.device == id) {
+            return &device;
+        }
+    }
+    QStorageInfo storage(*existing_p);
+    d_plan.devices.push_back(device_plan_t{id, storage.rootPath(), 0, 0, 0, 0,
+                                           storage.bytesAvailable(), 0, 0,
+                                           QString(), QString(), 0});
+    return &d_plan.devices.back();
+}
+
+void Planner::read (const QString path, off_t bytes)
+{
+    QString existing;
+    device_plan_t *device = this->device(path, &existing);
+
+    if (device == nullptr || bytes == 0) {
+        return;
+    }
+    device->read += bytes;
+    d_plan.read += bytes;
+
+    // Time reads on the largest read
+    if (bytes > device->read_probe_size) {
+        device->read_probe = existing;
+        device->read_probe_size = bytes;
+    }
+}
+
+void Planner::write (const QString path, off_t bytes, off_t released)
+{
+    QString existing;
+    device_plan_t *device = this->device(path, &existing);
+
+    if (device == nullptr) {
+        return;
+    }
+    device->written += bytes;
+    device->released += std::min(bytes, released);
+    d_plan.written += bytes;
+
+    // Time writes next to the first one
+    if (device->write_probe.isEmpty()) {
+        device->write_probe = (QFileInfo(existing).isDir() ? existing : QFileInfo(existing).path());
+    }
+}
+
+update_plan_t Planner::finish ()
+{
+    double seconds = 0;
+
+    for (auto &device : d_plan.devices) {
+        double device_seconds = 0;
+
+        // Space: checked only where something is written
+        if (device.written > 0) {
+            device.required = device.written - device.released + g_space_margin;
+            if (device.required > device.available) {
+                qCritical() << "Not enough space on" << device.root << ": need" << device.required
+                            << "bytes, have" << device.available;
+                d_plan.fits = false;
+            }
+        }
+
+        // Throughput: whatever cannot be timed leaves the duration unknown
+        if (device.read > 0) {
+            off_t size = 0;
+            QString file = probe_file(device.read_probe, &size);
+            if (false == file.isEmpty()) {
+                device.read_rate = time_read(file, std::min(size, g_probe_size));
+            }
+            if (device.read_rate > 0) {
+                device_seconds += device.read / device.read_rate;
+            }
+        }
+        if (device.written > 0 && d_plan.fits && d_write_probe) {
+            device.write_rate = time_write(device.write_probe);
+            if (device.write_rate > 0) {
+                device_seconds += device.written / device.write_rate;
+            }
+        }
+        qInfo() << "plan:" << device.root << "read" << device.read << "bytes at" << (off_t)device.read_rate
+                << "B/s, write" << device.written << "bytes at" << (off_t)device.write_rate
+                << (d_write_probe ? "B/s, need" : "B/s (not timed), need") << device.required << "of" << device.available << "bytes free";
+        seconds = std::max(seconds, device_seconds);
+    }
+
+    // Unknown if a device that does real work could not be timed
+    bool timed = true;
+    for (auto &device : d_plan.devices) {
+        timed = timed && (device.read < g_probe_min_size || device.read_rate > 0) &&
+                (device.written == 0 || device.write_rate > 0);
+    }
+    d_plan.seconds = (timed ? (int)(seconds + 0.5) : -1);
+    qInfo() << "plan:" << d_plan.read << "bytes read," << d_plan.written << "bytes written,"
+            << (d_plan.seconds < 0 ? QString("unknown duration") : QString("about %1 s").arg(d_plan.seconds))
+            << (d_plan.fits ? "" : "(does not fit)")
+            << (d_write_probe ? "" : "(writes not timed: no probe file was written)");
+    return d_plan;
+}
+
+
+/*
+ *******************************************************************************
+ *                     Class definition: SpaceReservation                      *
+ *******************************************************************************
+*/
+
+
+SpaceReservation::SpaceReservation()
+{}
+
+SpaceReservation::~SpaceReservation()
+{
+    release();
+}
+
+bool SpaceReservation::take (const update_plan_t &plan)
+{
+    release();
+    for (auto &device : plan.devices) {
+        if (device.written == 0) {
+            continue;
+        }
+
+        // Allocated for real (written out where the filesystem cannot
+        // preallocate), so that the blocks are taken whatever it supports.
+        // The margin is then left free for the part files, the directories
+        // and the journal, which no copy hands over.
+        const QByteArray path = QFile::encodeName(QDir(device.write_probe).filePath(
+                                                      QString(".swu-reserve-%1").arg(getpid())));
+        int fd = open(path.constData(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        int error = (fd == -1 ? errno : 0);
+        if (fd != -1) {
+            unlink(path.constData());
+            error = posix_fallocate(fd, 0, device.required);
+        }
+        if (error == 0 && -1 == ftruncate(fd, device.required - g_space_margin)) {
+            error = errno;
+        }
+        if (error != 0) {
+            qCritical() << "Unable to reserve" << device.required << "bytes on" << device.root << ":"
+                        << strerror(error);
+            if (fd != -1) {
+                close(fd);
+            }
+            release();
+            return false;
+        }
+        d_held.push_back(held_t{device.device, fd, device.required - g_space_margin});
+    }
+    return true;
+}
+
+void SpaceReservation::handOver (const QString path, off_t bytes)
+{
+    QString existing;
+    dev_t device;
+
+    if (bytes <= 0 || false == device_of(path, &device, &existing)) {
+        return;
+    }
+    for (auto &held : d_held) {
+        if (held.device != device) {
+            continue;
+        }
+        held.size = std::max<off_t>(0, held.size - bytes);
+        if (-1 == ftruncate(held.fd, held.size)) {
+            qWarning() << "Unable to hand over reserved space on" << existing << ":" << strerror(errno);
+        }
+        return;
+    }
+}
+
+void SpaceReservation::release ()
+{
+    for (auto &held : d_held) {
+        close(held.fd);
+    }
+    d_held.clear();
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function definitions                             *
+ *******************************************************************************
+*/
+
+
+/*\
+ * Stores at "device_p" the device holding "path". A path that does not exist
+ * yet counts for the device of its closest existing ancestor, which is stored
+ * at "existing_p". Returns false if not even the root can be found.
+\*/
+static bool device_of (const QString path, dev_t *device_p, QString *existing_p)
+{
+    QString existing = QDir::cleanPath(path);
+    struct stat st;
+
+    while (-1 == stat(QFile::encodeName(existing).constData(), &st)) {
+        QString parent = QFileInfo(existing).path();
+        if (parent == existing) {
+            return false;
+        }
+        existing = parent;
+    }
+    (*device_p) = st.st_dev;
+    (*existing_p) = existing;
+    return true;
+}
+
+/*\
+ * Returns a regular file at or below "path" big enough to time reads on
+ * (the largest of the first few entries of a directory, unless one of them
+ * is big enough). Empty if there is none.
+\*/
+static QString probe_file (const QString path, off_t *size_p)
+{
+    walk_entry_t entry;
+    struct stat st;
+    QString found;
+    unsigned seen = 0;
+
+    if (-1 == stat(QFile::encodeName(path).constData(), &st)) {
+        return QString();
+    }
+    if (S_ISREG(st.st_mode)) {
+        (*size_p) = st.st_size;
+        return (st.st_size >= g_probe_min_size ? path : QString());
+    }
+
+    TreeWalker walker(path);
+    std::vector<QString> directories(1, path);
+    (*size_p) = 0;
+    while (seen++ < g_probe_entries && (*size_p) < g_probe_size && walker.next(&entry)) {
+        switch (entry.event) {
+        case WALK_ENTER_DIRECTORY:
+            directories.push_back(QDir(directories.back()).filePath(QFile::decodeName(entry.name)));
+            break;
+        case WALK_LEAVE_DIRECTORY:
+            directories.pop_back();
+            break;
+        case WALK_FILE:
+            if (0 == fstatat(entry.parent->fd(), entry.name, &st, AT_SYMLINK_NOFOLLOW) && st.st_size > (*size_p)) {
+                found = QDir(directories.back()).filePath(QFile::decodeName(entry.name));
+                (*size_p) = st.st_size;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return ((*size_p) >= g_probe_min_size ? found : QString());
+}
+
+/* Times an uncached read of the first "size" bytes of a file (bytes/s, 0: failed) */
+static double time_read (const QString path, off_t size)
+{
+    std::unique_ptr<char[]> buffer(new char[1 << 20]);
+    off_t done = 0;
+    ssize_t n;
+    int fd;
+
+    if (-1 == (fd = open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC))) {
+        return 0;
+    }
+    posix_fadvise(fd, 0, size, POSIX_FADV_DONTNEED);
+
+    auto start = std::chrono::steady_clock::now();
+    while (done < size && (n = pread(fd, buffer.get(), std::min<off_t>(1 << 20, size - done), done)) > 0) {
+        done += n;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    close(fd);
+
+    return (done >= g_probe_min_size && elapsed.count() > 0 ? done / elapsed.count() : 0);
+}
+
+/* Times a synced write of a probe file in "directory" (bytes/s, 0: failed) */
+static double time_write (const QString directory)
+{
+    const QByteArray path = QFile::encodeName(QDir(directory).filePath(QString(".swu-probe-%1").arg(getpid())));
+    std::unique_ptr<char[]> buffer(new char[1 << 20]);
+    off_t done = 0;
+    ssize_t n;
+    int fd;
+
+    if (directory.isEmpty() ||
+        -1 == (fd = open(path.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600))) {
+        return 0;
+    }
+    memset(buffer.get(), 0, 1 << 20);
+
+    auto start = std::chrono::steady_clock::now();
+    while (done < g_probe_size && (n = pwrite(fd, buffer.get(), 1 << 20, done)) > 0) {
+        done += n;
+    }
+    bool ok = (done >= g_probe_size && 0 == fdatasync(fd));
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    close(fd);
+    unlink(path.constData());
+
+    return (ok && elapsed.count() > 0 ? done / elapsed.count() : 0);
+}
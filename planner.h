@@ -0,0 +1,147 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <QString>
+#include <sys/types.h>
+#include <vector>
+
+namespace SWU {
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+/* What an update does to one device (filesystem) */
+struct device_plan_t {
+    dev_t device;
+    QString root;                       /**< Mount point */
+    off_t read;                         /**< Bytes read from it */
+    off_t written;                      /**< Bytes written to it (backups included) */
+    off_t released;                     /**< Bytes of the files those writes replace */
+    off_t required;                     /**< Free space needed, with a margin */
+    off_t available;                    /**< Free space found */
+    double read_rate;                   /**< Measured bytes per second (0: unknown) */
+    double write_rate;                  /**< As above */
+    QString read_probe;                 /**< Existing file to time reads on */
+    QString write_probe;                /**< Existing directory to time writes in */
+    off_t read_probe_size;
+};
+
+/* Outcome of planning an update */
+struct update_plan_t {
+    std::vector<device_plan_t> devices;
+    off_t read;                         /**< Bytes read, over all devices */
+    off_t written;                      /**< Bytes written, over all devices */
+    int seconds;                        /**< Predicted duration (-1: unknown) */
+    bool fits;                          /**< Every device has the space required */
+};
+
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * Predicts what an update will do before it does anything: the bytes it
+ * reads and writes per device, whether each device has the space for them,
+ * and how long it will take.
+ *
+ * The space needed on a device is what is written to it (backups included)
+ * less the files those writes replace (freed as the update goes), plus
+ * a margin for part files and metadata. Incremental copies are counted in
+ * full, and compressed sources at their stored size.
+ *
+ * The duration comes from the throughput of each device, timed on a short
+ * uncached read of a file the update reads, and a short synced write of a
+ * probe file (removed again) where the update writes. Devices work
+ * concurrently, while the reads and writes of one device add up. Without
+ * the write probe (a dry run must not write), the duration stays unknown
+ * wherever the update writes.
+\*/
+class Planner
+{
+private:
+    update_plan_t d_plan;
+    bool d_write_probe;
+
+    device_plan_t *device (const QString path, QString *existing_p);
+
+public:
+    Planner();
+
+    /*\
+     * Sets whether finish() times writes with a probe file (on by default)
+    \*/
+    void setWriteProbe (bool enabled);
+
+    /*\
+     * Accounts for "bytes" read below "path"
+    \*/
+    void read (const QString path, off_t bytes);
+
+    /*\
+     * Accounts for "bytes" written to "path", replacing "released" bytes
+     * that are there now
+    \*/
+    void write (const QString path, off_t bytes, off_t released);
+
+    /*\
+     * Checks the space on every device and times the devices. Returns the
+     * plan, of which "fits" tells whether the update can go ahead.
+    \*/
+    update_plan_t finish ();
+};
+
+/*\
+ * Holds the space a plan needs on every device it writes to, from the plan
+ * until the update commits, so that no other process takes it meanwhile.
+ * Each device gets a probe-style file allocated to the space required and
+ * unlinked at once: the blocks stay taken while it is open (and are freed
+ * even if the process dies). Unlike the free space figure the plan was
+ * checked against, the allocation counts reserved blocks and quotas, so
+ * a device that cannot actually hold the update fails here, before anything
+ * was stopped. Every copy then gets its bytes handed over right before it
+ * writes them: the file shrinks by as much.
+\*/
+class SpaceReservation
+{
+private:
+    struct held_t {
+        dev_t device;
+        int fd;
+        off_t size;                     /**< Bytes still held */
+    };
+    std::vector<held_t> d_held;
+
+public:
+    SpaceReservation();
+    ~SpaceReservation();
+    SpaceReservation(const SpaceReservation &) = delete;
+    SpaceReservation &operator= (const SpaceReservation &) = delete;
+
+    /*\
+     * Reserves the space required on every device of the plan. Returns false
+     * (holding nothing) if the space cannot be held on a device, whatever
+     * the reason: the update must not start then.
+    \*/
+    bool take (const update_plan_t &plan);
+
+    /*\
+     * Hands "bytes" of the space held on the device of "path" over to a
+     * write about to happen there (all that is left, if less)
+    \*/
+    void handOver (const QString path, off_t bytes);
+
+    /*\
+     * Hands all the space back
+    \*/
+    void release ();
+};
+
+}
+
+#endif // PLANNER_H
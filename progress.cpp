@@ -0,0 +1,98 @@
+#include "progress.h"
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                         Static variable definitions                         *
+ *******************************************************************************
+*/
+
+
+// Minimum time between two throughput samples
+static const std::chrono::milliseconds g_sample_interval(250);
+
+// Weight of the newest sample in the moving average
+static const double g_rate_weight = 0.25;
+
+
+/*
+ *******************************************************************************
+ *                      Class definition: ProgressMeter                        *
+ *******************************************************************************
+*/
+
+
+ProgressMeter::ProgressMeter():
+    d_done(0),
+    d_total(0),
+    d_sample_time(steady_clock_t::now()),
+    d_sample_done(0),
+    d_rate(0.0)
+{}
+
+void ProgressMeter::start (off_t total)
+{
+    d_done = 0;
+    d_total = total;
+    d_sample_time = steady_clock_t::now();
+    d_sample_done = 0;
+    d_rate = 0.0;
+}
+
+void ProgressMeter::add (off_t bytes)
+{
+    d_done += bytes;
+}
+
+void ProgressMeter::settle (off_t bytes)
+{
+    off_t done = d_done.load();
+    while (done < bytes && false == d_done.compare_exchange_weak(done, bytes)) {}
+}
+
+bool ProgressMeter::sample (bool force)
+{
+    steady_clock_t::time_point now = steady_clock_t::now();
+    std::chrono::duration<double> elapsed = now - d_sample_time;
+    off_t done = d_done.load();
+
+    if (false == force && elapsed < g_sample_interval) {
+        return false;
+    }
+
+    // Fold the throughput since the previous sample into the average
+    if (elapsed.count() > 0.0) {
+        double rate = (double)(done - d_sample_done) / elapsed.count();
+        d_rate = (d_rate == 0.0 ? rate : g_rate_weight * rate + (1.0 - g_rate_weight) * d_rate);
+    }
+    d_sample_time = now;
+    d_sample_done = done;
+
+    return true;
+}
+
+off_t ProgressMeter::done ()
+{
+    off_t done = d_done.load();
+    return (done < d_total ? done : d_total);
+}
+
+off_t ProgressMeter::total ()
+{
+    return d_total;
+}
+
+double ProgressMeter::throughput ()
+{
+    return d_rate;
+}
+
+int ProgressMeter::eta ()
+{
+    if (d_rate <= 0.0) {
+        return -1;
+    }
+    return (int)((double)(d_total - done()) / d_rate + 0.5);
+}
@@ -0,0 +1,98 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <sys/types.h>
+
+namespace SWU {
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+/* Receives the number of bytes processed since the previous call */
+typedef std::function<void(off_t bytes)> progress_callback_t;
+
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * Tracks bytes processed against a planned total and estimates the time left.
+ *
+ * add() may be called from any thread. sample() and the getters that depend on
+ * it must be serialized by the caller; sample() rate-limits itself, so it can
+ * be attempted after every add().
+ *
+ * The throughput is an exponentially weighted moving average over samples at
+ * least g_sample_interval apart, so that a burst of small files or a stall on
+ * a single large one does not make the estimate jump around.
+\*/
+class ProgressMeter
+{
+private:
+    typedef std::chrono::steady_clock steady_clock_t;
+
+    std::atomic<off_t> d_done;
+    off_t d_total;
+    steady_clock_t::time_point d_sample_time;
+    off_t d_sample_done;
+    double d_rate;
+
+public:
+    ProgressMeter();
+
+    /*\
+     * Resets the meter and starts the clock
+     * - total: Planned number of bytes
+    \*/
+    void start (off_t total);
+
+    /*\
+     * Accounts for processed bytes (thread safe)
+    \*/
+    void add (off_t bytes);
+
+    /*\
+     * Raises the bytes processed to at least "bytes" (thread safe). Used to
+     * account for work that completed but reported less than was planned.
+    \*/
+    void settle (off_t bytes);
+
+    /*\
+     * Takes a throughput sample if enough time passed (or if forced).
+     * Returns true if a sample was taken, i.e. observers should be updated.
+    \*/
+    bool sample (bool force = false);
+
+    /*\
+     * Returns the bytes processed so far, never more than total()
+    \*/
+    off_t done ();
+
+    /*\
+     * Returns the planned number of bytes
+    \*/
+    off_t total ();
+
+    /*\
+     * Returns the smoothed throughput in bytes per second (0: unknown)
+    \*/
+    double throughput ();
+
+    /*\
+     * Returns the estimated number of seconds left (-1: unknown)
+    \*/
+    int eta ();
+};
+
+}
+
+#endif // PROGRESS_H
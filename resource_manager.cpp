@@ -1,4 +1,10 @@
 #include "resource_manager.h"
+#include "bundle.h"
+#include "treewalker.h"
+
+#include <QFile>
+#include <fcntl.h>
+#include <errno.h>
 
 using namespace SWU;
 
@@ -27,19 +33,78 @@ ResourceManager::ResourceManager()
 {
 
    /* Init hashmaps */
-   d_resource_map[RESOURCE_KEY_ROOT] = QDir::rootPath();
+   setResourcePath(RESOURCE_KEY_ROOT, QDir::rootPath());
 }
 
 QString ResourceManager::getResourcePath(resource_root_key_t key)
 {
-   QString retval = nullptr;
-   if (d_resource_map.contains(key)) {
-       retval = d_resource_map[key];
-   }
-   return retval;
+   /* A const lookup: workers resolve paths concurrently (null if unset) */
+   return d_resource_map.value(key);
 }
 
 void ResourceManager::setResourcePath(resource_root_key_t key, QString path)
 {
    d_resource_map[key] = path;
+
+   /* Handles resolved against the previous root keep it open */
+   int fd = open(QFile::encodeName(path).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   d_root_map[key] = (fd == -1 ? nullptr : std::make_shared<DirectoryHandle>(fd));
+}
+
+std::shared_ptr<DirectoryHandle> ResourceManager::getRoot(resource_root_key_t key)
+{
+   return d_root_map.value(key);
+}
+
+resource_handle_t ResourceManager::resolve(resource_root_key_t key, const QString path)
+{
+   QString full_path = QDir(getResourcePath(key)).filePath(path);
+   std::shared_ptr<DirectoryHandle> root = getRoot(key);
+
+   if (root == nullptr || QDir::isAbsolutePath(path)) {
+       return resource_handle_t{nullptr, AT_FDCWD, QFile::encodeName(full_path), full_path};
+   }
+   return resource_handle_t{root, root->fd(), QFile::encodeName(path.isEmpty() ? QString(".") : path), full_path};
+}
+
+resource_handle_t ResourceManager::resolve(Resource resource)
+{
+   return resolve(resource.rootKey(), resource.path());
+}
+
+resource_handle_t ResourceManager::pinParent(const resource_handle_t &handle)
+{
+   QByteArray name = handle.name;
+
+   /* Split off the last component (a trailing slash names the same entry) */
+   while (name.length() > 1 && name.endsWith("/")) {
+       name = name.left(name.length() - 1);
+   }
+   int cut_index = name.lastIndexOf('/');
+   QByteArray parent = (cut_index < 0 ? QByteArray(".") : name.left(cut_index > 0 ? cut_index : 1));
+   QByteArray entry = name.mid(cut_index + 1);
+   if (entry.isEmpty() || entry == "." || entry == "..") {
+       errno = EINVAL;
+       return resource_handle_t{nullptr, -1, entry, handle.path};
+   }
+
+   /* Directly below an open directory: already pinned */
+   if (cut_index < 0 && handle.root != nullptr) {
+       return resource_handle_t{handle.root, handle.dirfd, entry, handle.path};
+   }
+   int fd = openat(handle.dirfd, parent.constData(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+   if (fd == -1) {
+       return resource_handle_t{nullptr, -1, entry, handle.path};
+   }
+   return resource_handle_t{std::make_shared<DirectoryHandle>(fd), fd, entry, handle.path};
+}
+
+std::shared_ptr<Bundle> ResourceManager::getBundle(resource_root_key_t key)
+{
+   return d_bundle_map.value(key);
+}
+
+void ResourceManager::setBundle(resource_root_key_t key, std::shared_ptr<Bundle> bundle)
+{
+   d_bundle_map[key] = bundle;
 }
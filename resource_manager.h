@@ -3,19 +3,69 @@
 
 #include <QDir>
 #include <QMap>
+#include <memory>
 #include "resource.h"
 
 namespace SWU {
 
+class Bundle;
+class DirectoryHandle;
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+/* A resource path resolved against the open directory of its root */
+struct resource_handle_t {
+    std::shared_ptr<DirectoryHandle> root;  /**< Keeps "dirfd" open (nullptr: AT_FDCWD) */
+    int dirfd;                              /**< Directory "name" is relative to */
+    QByteArray name;                        /**< Native path, as passed to openat() */
+    QString path;                           /**< Full path (for messages) */
+};
+
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
 class ResourceManager
 {
 private:
     QMap<resource_root_key_t, QString> d_resource_map;
+    QMap<resource_root_key_t, std::shared_ptr<DirectoryHandle>> d_root_map;
+    QMap<resource_root_key_t, std::shared_ptr<Bundle>> d_bundle_map;
 public:
     ResourceManager();
+    ResourceManager(const ResourceManager &) = delete;
+    ResourceManager &operator= (const ResourceManager &) = delete;
     static ResourceManager& get_instance();
     QString getResourcePath(resource_root_key_t key);
     void setResourcePath(resource_root_key_t key, QString path);
+
+    // Root directory of a key, opened once when its path is set (nullptr:
+    // no path, or not a directory that could be opened then)
+    std::shared_ptr<DirectoryHandle> getRoot(resource_root_key_t key);
+
+    // Resolves "path" below the root of "key" as QDir(root).filePath(path)
+    // would, but relative to the open root: the prefix is not walked again.
+    // An absolute path (or a root that could not be opened) is kept whole.
+    resource_handle_t resolve(resource_root_key_t key, const QString path);
+    resource_handle_t resolve(Resource resource);
+
+    // Pins a resolved handle to the directory holding its entry, opened once
+    // (O_PATH, not following a link in its place): "name" is left as the last
+    // component, so that a stat and a rename of the entry walk nothing above
+    // it again, however "name" was given. "dirfd" is -1 (errno set) if the
+    // directory cannot be opened, or the entry has no name of its own.
+    static resource_handle_t pinParent(const resource_handle_t &handle);
+
+    // Bundle holding the resources of a root (nullptr: plain files at its path)
+    std::shared_ptr<Bundle> getBundle(resource_root_key_t key);
+    void setBundle(resource_root_key_t key, std::shared_ptr<Bundle> bundle);
 };
 
 }
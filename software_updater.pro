@@ -1,43 +1,66 @@
-QT       += core gui xml
+QT       += core gui
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
-CONFIG += c++11 console
+CONFIG += c++14 console
 
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    arena.cpp \
     attributes.cpp \
-    cfgelement.cpp \
+    bundle.cpp \
     cfgparser.cpp \
     cfgstatemachine.cpp \
     cfgupdater.cpp \
-    cfgxmlhandler.cpp \
-    element.cpp \
+    configreader.cpp \
+    copyengine.cpp \
+    decompressor.cpp \
+    fileio.cpp \
+    hasher.cpp \
     fsoperation.cpp \
+    ioring.cpp \
+    journal.cpp \
     main.cpp \
     mainwindow.cpp \
- \    #update.cpp
+    merkle.cpp \
+    opgraph.cpp \
+    planner.cpp \
+    progress.cpp \
     resource.cpp \
     resource_manager.cpp \
-    updatethread.cpp
+    treewalker.cpp \
+    updatethread.cpp \
+    workpool.cpp
 
 HEADERS += \
+    arena.h \
     attributes.h \
-    cfgelement.h \
+    bundle.h \
     cfgparser.h \
     cfgstatemachine.h \
     cfgupdater.h \
-    cfgxmlhandler.h \
-    element.h \
+    configreader.h \
+    copyengine.h \
+    decompressor.h \
+    fileio.h \
+    hasher.h \
     fsoperation.h \
+    ioring.h \
+    journal.h \
+    lexemetable.h \
     mainwindow.h \
- \    #update.h
+    merkle.h \
+    opgraph.h \
+    planner.h \
+    progress.h \
     resource.h \
     resource_manager.h \
-    updatethread.h
+    treewalker.h \
+    updatethread.h \
+    workpool.h
 
 FORMS += \
     mainwindow.ui
@@ -47,6 +70,14 @@ TRANSLATIONS += \
 
 QMAKE_CXXFLAGS += -v
 
+# Compressed payload files: .xz always, .zst where libzstd is installed
+CONFIG += link_pkgconfig
+PKGCONFIG += liblzma
+packagesExist(libzstd) {
+    PKGCONFIG += libzstd
+    DEFINES += SWU_HAVE_ZSTD
+}
+
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
@@ -0,0 +1,429 @@
+#include "lexemetable.h"
+#include "attributes.h"
+#include "cfgstatemachine.h"
+#include "configreader.h"
+#include "cfgparser.h"
+#include "journal.h"
+#include "resource_manager.h"
+#include "copyengine.h"
+#include "hasher.h"
+
+#include <QDir>
+#include <QFile>
+#include <ftw.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+
+/*
+ *******************************************************************************
+ *                         Static variable definitions                         *
+ *******************************************************************************
+*/
+
+
+// Checks that failed so far
+static int g_failures = 0;
+
+// Scratch directory of this run
+static QString g_directory;
+
+// Lexemes of the table tests: more than half of the slots taken, so that the
+// first seeds collide
+static constexpr const char *g_words[] = {"copy", "from", "to", "remove", "file", "directory"};
+static constexpr SWU::LexemeTable<6, 8> g_word_table(g_words);
+
+// A configuration with everything the reader decodes
+static const char *g_features =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"
+    "<!DOCTYPE configuration>\n"
+    "<!-- leading comment -->\n"
+    "<configuration product='A &amp; B &lt;C&gt;' platform=\"linux\" unknown=\"x\">\n"
+    "    <resource-uri>/run/<![CDATA[me<dia>]]>/sda</resource-uri>\n"
+    "    <validate>\n"
+    "        <file>fr&#111;nt&#x65;nd</file>\n"
+    "        <directory>d<!-- inside -->ir</directory>\n"
+    "    </validate>\n"
+    "    <operations>\n"
+    "        <copy incremental=\"false\">\n"
+    "            <from root=\"Remote\">frontend</from>\n"
+    "            <to root=\"Target\">/opt</to>\n"
+    "        </copy>\n"
+    "    </operations>\n"
+    "</configuration>\n";
+
+
+/*
+ *******************************************************************************
+ *                            Function definitions                             *
+ *******************************************************************************
+*/
+
+
+/* Reports a failed check (the run goes on) */
+#define CHECK(condition) \
+    do { \
+        if (false == (condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            g_failures++; \
+        } \
+    } while (0)
+
+/* Writes "size" bytes of "data" to the scratch file "name", returning its path */
+static QString scratch (const char *name, const char *data, size_t size)
+{
+    QString path = QDir(g_directory).filePath(QString(name));
+    FILE *file = fopen(QFile::encodeName(path).constData(), "w");
+    if (file == nullptr || size != fwrite(data, 1, size, file)) {
+        fprintf(stderr, "Unable to write %s\n", QFile::encodeName(path).constData());
+    }
+    if (file != nullptr) {
+        fclose(file);
+    }
+    return path;
+}
+
+/* Deletes one entry of the scratch directory (for nftw) */
+static int remove_entry (const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    Q_UNUSED(st);
+    Q_UNUSED(flag);
+    Q_UNUSED(ftw);
+    return remove(path);
+}
+
+/* Returns the first element of the configuration with the given token */
+static const SWU::config_element_t *element_of (SWU::ConfigReader &reader, SWU::Token token)
+{
+    const SWU::config_element_t *element;
+
+    for (size_t i = 0; (element = reader.element(i)) != nullptr; ++i) {
+        if (element->token == token) {
+            return element;
+        }
+    }
+    return nullptr;
+}
+
+/*\
+ * Lexeme tables: every lexeme lands in a slot of its own (whatever seed
+ * that took), anything else is not found, and the tables built on them
+ * recognize attribute keys and values and tag names (and name tokens)
+\*/
+static void test_lexeme_table ()
+{
+    // Collisions: resolved by the seed, every lexeme found at its index
+    CHECK(g_word_table.seed() > 0);
+    for (size_t i = 0; i < 6; ++i) {
+        CHECK(g_word_table.find(g_words[i], strlen(g_words[i])) == static_cast<int>(i));
+        CHECK(g_word_table.find(QString(g_words[i])) == static_cast<int>(i));
+        CHECK(0 == strcmp(g_word_table.lexeme(i), g_words[i]));
+    }
+
+    // Unknown: prefixes, extensions, other cases, the empty string
+    CHECK(g_word_table.find("cop", 3) == -1);
+    CHECK(g_word_table.find("copy", 3) == -1);
+    CHECK(g_word_table.find("copyx", 5) == -1);
+    CHECK(g_word_table.find("Copy", 4) == -1);
+    CHECK(g_word_table.find("", 0) == -1);
+    CHECK(g_word_table.find(QString("files")) == -1);
+    CHECK(g_word_table.find(QString::fromUtf8("fil\xc3\xa9")) == -1);
+
+    // Attribute keys and values, by name and by length-delimited bytes
+    SWU::Attributes &attributes = SWU::Attributes::get_instance();
+    for (int key = 0; key < SWU::ATTRIBUTE_KEY_ENUM_MAX; ++key) {
+        QString name = attributes.key_to_str(static_cast<SWU::attribute_key_t>(key));
+        CHECK(attributes.key(name) == key);
+    }
+    for (int value = 0; value < SWU::ATTRIBUTE_VALUE_ENUM_MAX; ++value) {
+        QString name = attributes.value_to_str(static_cast<SWU::attribute_value_t>(value));
+        CHECK(attributes.value(name) == value);
+    }
+    CHECK(attributes.key("sha256=", 6) == SWU::ATTRIBUTE_KEY_SHA256);
+    CHECK(attributes.key(QString("sha")) == SWU::ATTRIBUTE_KEY_ENUM_MAX);
+    CHECK(attributes.key(QString("unknown")) == SWU::ATTRIBUTE_KEY_ENUM_MAX);
+    CHECK(attributes.value(QString("Remote")) == SWU::ATTRIBUTE_VALUE_REMOTE);
+    CHECK(attributes.value(QString("remote")) == SWU::ATTRIBUTE_VALUE_ENUM_MAX);
+
+    // Tags: known ones drive the machine, an unknown one faults it
+    SWU::Machine machine;
+    SWU::Token token = SWU::T_ENUM_MAX;
+    CHECK(machine.input("configuration", 13, false, &token) == SWU::STATUS_READY);
+    CHECK(token == SWU::T_CONFIGURATION_OPEN);
+    CHECK(machine.input(QString("resource-uri"), false, &token) == SWU::STATUS_READY);
+    CHECK(token == SWU::T_RESOURCE_URI_OPEN);
+    CHECK(machine.input("resource-urn", 12, true, &token) == SWU::STATUS_FAULT);
+    CHECK(machine.status() == SWU::STATUS_FAULT);
+    CHECK(machine.input(SWU::T_RESOURCE_URI_CLOSE) == SWU::STATUS_FAULT);
+
+    // Tokens back to their tags
+    CHECK(SWU::Machine::lexeme(SWU::T_CONFIGURATION_OPEN) == QString("<configuration>"));
+    CHECK(SWU::Machine::lexeme(SWU::T_REMOVE_CLOSE) == QString("</remove>"));
+}
+
+/*\
+ * Configuration reader: references, CDATA sections and comments are decoded
+ * into the text they stand for, unknown attributes are dropped, and a file
+ * cut short at any point is reported as malformed
+\*/
+static void test_config_reader ()
+{
+    QString path = scratch("features.xml", g_features, strlen(g_features));
+    const SWU::config_element_t *element;
+    const SWU::config_attribute_t *attribute;
+
+    SWU::ConfigReader reader;
+    CHECK(reader.open(path));
+
+    element = element_of(reader, SWU::T_CONFIGURATION_OPEN);
+    CHECK(element != nullptr);
+    if (element != nullptr) {
+        CHECK(element->attribute_count == 2);
+        attribute = SWU::config_attribute(element, SWU::ATTRIBUTE_KEY_PRODUCT);
+        CHECK(attribute != nullptr && attribute->lexeme.toString() == QString("A & B <C>"));
+        attribute = SWU::config_attribute(element, SWU::ATTRIBUTE_KEY_PLATFORM);
+        CHECK(attribute != nullptr && attribute->lexeme.toString() == QString("linux"));
+        CHECK(SWU::config_attribute(element, SWU::ATTRIBUTE_KEY_PATH) == nullptr);
+    }
+    element = element_of(reader, SWU::T_RESOURCE_URI_OPEN);
+    CHECK(element != nullptr && element->value.toString().trimmed() == QString("/run/me<dia>/sda"));
+    element = element_of(reader, SWU::T_FILE_OPEN);
+    CHECK(element != nullptr && element->value.toString().trimmed() == QString("frontend"));
+    element = element_of(reader, SWU::T_DIRECTORY_OPEN);
+    CHECK(element != nullptr && element->value.toString().trimmed() == QString("dir"));
+    element = element_of(reader, SWU::T_FROM_OPEN);
+    attribute = (element != nullptr ? SWU::config_attribute(element, SWU::ATTRIBUTE_KEY_ROOT) : nullptr);
+    CHECK(attribute != nullptr && attribute->val == SWU::ATTRIBUTE_VALUE_REMOTE);
+    CHECK(false == reader.failed());
+
+    // The parser keeps the decoded text
+    SWU::ConfigReader parsed;
+    CHECK(parsed.open(path));
+    SWU::Parser parser(parsed);
+    CHECK(parser.status() == SWU::PARSE_OK);
+    CHECK(parser.product() == QString("A & B <C>"));
+    CHECK(parser.resource_uris().size() == 1 && parser.resource_uris().first() == QString("/run/me<dia>/sda"));
+    CHECK(parser.validate_operations().size() == 2);
+    CHECK(parser.update_operations().size() == 1);
+
+    // Truncated: inside a tag, an attribute, a reference, a CDATA section, a
+    // comment, and between elements. The parser reads as far as it can; the
+    // reader tells that the document was cut short.
+    const char *cuts[] = {"<configuration pro", "B &l", "me<di", "<!-- ins", "</copy>\n"};
+    for (const char *cut : cuts) {
+        size_t size = strstr(g_features, cut) - g_features + strlen(cut);
+        QString truncated = scratch("truncated.xml", g_features, size);
+        SWU::ConfigReader reader;
+        CHECK(reader.open(truncated));
+        SWU::Parser parser(reader);
+        CHECK(reader.failed());
+    }
+}
+
+/*\
+ * Undo journal: an interrupted update of the same payload resumes with the
+ * steps it had started, completed and checkpointed (a torn last record is
+ * ignored), and one of another payload is rolled back (the backup put back)
+ * and settled
+\*/
+static void test_journal ()
+{
+    SWU::ResourceManager &resourceManager = SWU::ResourceManager::get_instance();
+    QString path = QDir(g_directory).filePath(QString("journal"));
+    QString target = QDir(g_directory).filePath(QString("target"));
+    QString saved = QDir(g_directory).filePath(QString("backup"));
+    QByteArray payload("payload-1"), other("payload-2");
+    SWU::operation_record_t record;
+    SWU::journal_state_t state;
+    struct stat st;
+
+    // A backup of "target/a" (as the parser makes them), which the update
+    // then overwrote, and a copy of "b" that never landed
+    CHECK(0 == mkdir(QFile::encodeName(target).constData(), 0700));
+    CHECK(0 == mkdir(QFile::encodeName(saved).constData(), 0700));
+    scratch("target/a", "new", 3);
+    scratch("backup/a", "old", 3);
+    resourceManager.setResourcePath(SWU::RESOURCE_KEY_REMOTE, g_directory);
+    SWU::CopyOperation backup(SWU::Resource(QDir(target).filePath(QString("a")), SWU::RESOURCE_TYPE_FILE),
+                              SWU::Resource(saved + "/", SWU::RESOURCE_TYPE_FILE));
+    SWU::CopyOperation update(SWU::Resource("b", SWU::RESOURCE_TYPE_FILE, SWU::RESOURCE_KEY_REMOTE),
+                              SWU::Resource(target, SWU::RESOURCE_TYPE_DIRECTORY, SWU::RESOURCE_KEY_ROOT));
+
+    // Interrupted: backup done, update checkpointed halfway, no commit
+    {
+        SWU::Journal journal(path);
+        CHECK(journal.open(payload));
+        CHECK(backup.record(&record));
+        journal.intent(SWU::JOURNAL_PHASE_BACKUP, 0, record);
+        journal.done(SWU::JOURNAL_PHASE_BACKUP, 0);
+        CHECK(update.record(&record));
+        journal.intent(SWU::JOURNAL_PHASE_UPDATE, 3, record);
+        CHECK(journal.checkpoint(SWU::JOURNAL_PHASE_UPDATE, 3, SWU::copy_checkpoint_t{4096, 8192, {1, 2}}));
+        CHECK(journal.sync());
+    }
+
+    // A record torn by the crash
+    CHECK(0 == stat(QFile::encodeName(path).constData(), &st));
+    FILE *file = fopen(QFile::encodeName(path).constData(), "a");
+    CHECK(file != nullptr && 6 == fwrite("\x40\0\0\0\x12\x34", 1, 6, file));
+    if (file != nullptr) {
+        fclose(file);
+    }
+
+    // Same payload: resumed where it left off, the torn tail cut away
+    resourceManager.setResourcePath(SWU::RESOURCE_KEY_REMOTE, QString("/elsewhere"));
+    CHECK(SWU::Journal::recover(path, payload, &state));
+    CHECK(state.resumed);
+    CHECK(state.started[SWU::JOURNAL_PHASE_BACKUP] == std::set<off_t>({0}));
+    CHECK(state.completed[SWU::JOURNAL_PHASE_BACKUP] == std::set<off_t>({0}));
+    CHECK(state.started[SWU::JOURNAL_PHASE_UPDATE] == std::set<off_t>({3}));
+    CHECK(state.completed[SWU::JOURNAL_PHASE_UPDATE].empty());
+    CHECK(state.checkpoints[SWU::JOURNAL_PHASE_UPDATE].count(3) == 1 &&
+          state.checkpoints[SWU::JOURNAL_PHASE_UPDATE][3].offset == 4096 &&
+          state.checkpoints[SWU::JOURNAL_PHASE_UPDATE][3].source_size == 8192);
+    CHECK(resourceManager.getResourcePath(SWU::RESOURCE_KEY_REMOTE) == QString("/elsewhere"));
+    CHECK(QFile::exists(path));
+
+    // The resumed journal takes further records after the intact ones
+    {
+        SWU::Journal journal(path);
+        CHECK(journal.open(payload, true));
+        journal.done(SWU::JOURNAL_PHASE_UPDATE, 3);
+        CHECK(journal.sync());
+    }
+    CHECK(SWU::Journal::recover(path, payload, &state));
+    CHECK(state.resumed && state.completed[SWU::JOURNAL_PHASE_UPDATE] == std::set<off_t>({3}));
+
+    // Another payload: rolled back, and the journal settled
+    CHECK(SWU::Journal::recover(path, other, &state));
+    CHECK(false == state.resumed);
+    CHECK(false == QFile::exists(path));
+    QFile restored(QDir(target).filePath(QString("a")));
+    CHECK(restored.open(QIODevice::ReadOnly) && restored.readAll() == QByteArray("old"));
+
+    // Committed: rolled forward, whatever the payload
+    {
+        SWU::Journal journal(path);
+        CHECK(journal.open(payload));
+        journal.intent(SWU::JOURNAL_PHASE_UPDATE, 0, record);
+        journal.done(SWU::JOURNAL_PHASE_UPDATE, 0);
+        CHECK(journal.commit());
+    }
+    CHECK(SWU::Journal::recover(path, payload, &state));
+    CHECK(false == state.resumed);
+    CHECK(false == QFile::exists(path));
+
+    // Closed: nothing to do
+    {
+        SWU::Journal journal(path);
+        CHECK(journal.open(payload));
+        CHECK(journal.close());
+    }
+    CHECK(false == QFile::exists(path));
+    CHECK(SWU::Journal::recover(path, payload, &state));
+}
+
+
+/*\
+ * Hashes fed together: the same digests as fed one by one, for a group
+ * larger than the lanes of any kernel, with a byte taken before (as the
+ * leaves of a Merkle tree) and a length that ends part way into a block
+\*/
+static void test_hash_many ()
+{
+    std::vector<char> data(11 * 4099);
+    std::vector<const char *> messages;
+    std::vector<SWU::Sha256> many(11), one(11);
+
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 2654435761u >> 13);
+    }
+    for (size_t i = 0; i < 11; ++i) {
+        messages.push_back(data.data() + i * 4099);
+        many[i].update("\0", 1);
+        one[i].update("\0", 1);
+        one[i].update(messages[i], 4099);
+    }
+    SWU::Sha256::update_many(many.data(), messages.data(), 4099, 11);
+    for (size_t i = 0; i < 11; ++i) {
+        CHECK(many[i].result() == one[i].result());
+    }
+    CHECK(SWU::Sha256::lanes() >= 1);
+}
+
+/*\
+ * Copies whose source shrinks half way: in-kernel and through the buffers,
+ * each fails with EIO instead of committing the bytes that made it
+\*/
+static void test_copy_shrink ()
+{
+    std::vector<char> data(20 << 20, 'x');
+    QByteArray from = QFile::encodeName(QDir(g_directory).filePath(QString("shrinking")));
+    QByteArray to = QFile::encodeName(QDir(g_directory).filePath(QString("shrunk")));
+
+    for (int seen = 0; seen < 2; ++seen) {
+        SWU::CopyEngine engine(4096);
+        SWU::Sha256 hash;
+        SWU::copy_report_t report = SWU::copy_report_t();
+        bool truncated = false;
+        scratch("shrinking", data.data(), data.size());
+        int from_fd = open(from.constData(), O_RDONLY);
+        int to_fd = open(to.constData(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        CHECK(from_fd != -1 && to_fd != -1);
+
+        engine.setHash(seen ? &hash : nullptr);
+        engine.setProgress([&] (off_t bytes) {
+            Q_UNUSED(bytes);
+            if (false == truncated) {
+                truncated = (0 == truncate(from.constData(), 8192));
+            }
+        });
+        bool copied = engine.copy(from_fd, to_fd, &report);
+
+        // A reflink shares the extents in one go: nothing to shrink under it
+        CHECK(report.method == SWU::COPY_METHOD_REFLINK || (false == copied && report.error == EIO));
+        close(from_fd);
+        close(to_fd);
+    }
+}
+
+
+/*!
+ * \brief Runs the unit checks
+ *
+ * Usage: swu_test
+ *
+ * Checks the lexeme tables, the configuration reader, the recovery of the
+ * undo journal, copies of a shrinking source and hashes fed together, in
+ * a scratch directory (removed again). Prints every check that failed, and
+ * exits with 1 if any did.
+ */
+int main (int argc, char *argv[])
+{
+    Q_UNUSED(argc);
+    Q_UNUSED(argv);
+
+    g_directory = QDir::tempPath() + QString("/swu_test_%1").arg(getpid());
+    if (-1 == mkdir(QFile::encodeName(g_directory).constData(), 0700)) {
+        fprintf(stderr, "Unable to create %s\n", QFile::encodeName(g_directory).constData());
+        return 1;
+    }
+
+    test_lexeme_table();
+    test_config_reader();
+    test_journal();
+    test_copy_shrink();
+    test_hash_many();
+
+    nftw(QFile::encodeName(g_directory).constData(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    if (g_failures > 0) {
+        printf("%d checks failed\n", g_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
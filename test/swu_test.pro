@@ -0,0 +1,64 @@
+QT       += core
+QT       -= gui
+
+CONFIG += c++14 console
+CONFIG -= app_bundle
+
+TARGET = swu_test
+
+# Unit checks of the lexeme tables, the configuration reader, the
+# recovery of the undo journal, copies of a shrinking source and hashes
+# fed together (see main.cpp): exits with 1 on a failure
+INCLUDEPATH += ..
+
+SOURCES += \
+    main.cpp \
+    ../arena.cpp \
+    ../attributes.cpp \
+    ../bundle.cpp \
+    ../cfgparser.cpp \
+    ../cfgstatemachine.cpp \
+    ../configreader.cpp \
+    ../copyengine.cpp \
+    ../decompressor.cpp \
+    ../fileio.cpp \
+    ../fsoperation.cpp \
+    ../hasher.cpp \
+    ../ioring.cpp \
+    ../journal.cpp \
+    ../merkle.cpp \
+    ../progress.cpp \
+    ../resource.cpp \
+    ../resource_manager.cpp \
+    ../treewalker.cpp \
+    ../workpool.cpp
+
+HEADERS += \
+    ../arena.h \
+    ../attributes.h \
+    ../bundle.h \
+    ../cfgparser.h \
+    ../cfgstatemachine.h \
+    ../configreader.h \
+    ../copyengine.h \
+    ../decompressor.h \
+    ../fileio.h \
+    ../fsoperation.h \
+    ../hasher.h \
+    ../ioring.h \
+    ../journal.h \
+    ../lexemetable.h \
+    ../merkle.h \
+    ../progress.h \
+    ../resource.h \
+    ../resource_manager.h \
+    ../treewalker.h \
+    ../workpool.h
+
+# Compressed payload files, as in the updater
+CONFIG += link_pkgconfig
+PKGCONFIG += liblzma
+packagesExist(libzstd) {
+    PKGCONFIG += libzstd
+    DEFINES += SWU_HAVE_ZSTD
+}
@@ -0,0 +1,234 @@
+#include "treewalker.h"
+
+#include <QFile>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                         Static variable definitions                         *
+ *******************************************************************************
+*/
+
+
+// Size of the getdents64 buffer held by every open directory
+static const long g_dirent_buffer_size = 32 * 1024;
+
+// Layout of the records returned by getdents64 (not exported by glibc)
+struct linux_dirent64 {
+    ino64_t        d_ino;
+    off64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+
+/*
+ *******************************************************************************
+ *                            Forward declarations                             *
+ *******************************************************************************
+*/
+
+static unsigned char entry_type (int dirfd, const struct linux_dirent64 *d);
+static int open_directory (int dirfd, const char *name);
+
+
+/*
+ *******************************************************************************
+ *                     Class definition: DirectoryHandle                       *
+ *******************************************************************************
+*/
+
+
+DirectoryHandle::DirectoryHandle(int fd):
+    d_fd(fd)
+{}
+
+DirectoryHandle::~DirectoryHandle()
+{
+    if (d_fd >= 0) {
+        close(d_fd);
+    }
+}
+
+int DirectoryHandle::fd ()
+{
+    return d_fd;
+}
+
+
+/*
+ *******************************************************************************
+ *                        Class definition: TreeWalker                         *
+ *******************************************************************************
+*/
+
+
+TreeWalker::TreeWalker(const QString path):
+    TreeWalker(AT_FDCWD, QFile::encodeName(path).constData())
+{}
+
+TreeWalker::TreeWalker(int dirfd, const char *name):
+    d_error(0)
+{
+    int fd = open_directory(dirfd, name);
+    if (fd < 0) {
+        d_error = errno;
+        return;
+    }
+    d_root = std::make_shared<DirectoryHandle>(fd);
+    push(d_root, name);
+}
+
+int TreeWalker::error ()
+{
+    return d_error;
+}
+
+std::shared_ptr<DirectoryHandle> TreeWalker::root ()
+{
+    return d_root;
+}
+
+void TreeWalker::push (std::shared_ptr<DirectoryHandle> handle, const char *name)
+{
+    frame_t frame;
+    frame.handle = handle;
+    frame.name = name;
+    frame.buffer.reset(new char[g_dirent_buffer_size]);
+    frame.length = 0;
+    frame.offset = 0;
+    frame.eof = false;
+    d_stack.push_back(std::move(frame));
+}
+
+bool TreeWalker::next (walk_entry_t *entry_p)
+{
+    while (false == d_stack.empty()) {
+        frame_t &f = d_stack.back();
+
+        // Refill the batch (or leave the exhausted directory)
+        if (f.offset >= f.length) {
+            if (f.eof) {
+
+                // The root itself is not reported
+                if (d_stack.size() == 1) {
+                    d_stack.pop_back();
+                    return false;
+                }
+
+                d_leave_name.swap(f.name);
+                entry_p->event = WALK_LEAVE_DIRECTORY;
+                entry_p->directory = f.handle;
+                entry_p->parent = d_stack[d_stack.size() - 2].handle;
+                entry_p->name = d_leave_name.c_str();
+                entry_p->depth = d_stack.size() - 1;
+                entry_p->error = 0;
+                d_stack.pop_back();
+                return true;
+            }
+
+            long n = syscall(SYS_getdents64, f.handle->fd(), f.buffer.get(), g_dirent_buffer_size);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                f.eof = true;
+                entry_p->event = WALK_ERROR;
+                entry_p->directory = f.handle;
+                entry_p->parent = (d_stack.size() > 1 ? d_stack[d_stack.size() - 2].handle : nullptr);
+                entry_p->name = f.name.c_str();
+                entry_p->depth = d_stack.size() - 1;
+                entry_p->error = errno;
+                return true;
+            }
+            f.eof = (n == 0);
+            f.length = n;
+            f.offset = 0;
+            continue;
+        }
+
+        // Take the next record of the batch
+        const struct linux_dirent64 *d =
+                reinterpret_cast<const struct linux_dirent64 *>(f.buffer.get() + f.offset);
+        f.offset += d->d_reclen;
+
+        if (0 == strcmp(d->d_name, ".") || 0 == strcmp(d->d_name, "..")) {
+            continue;
+        }
+
+        entry_p->parent = f.handle;
+        entry_p->directory = nullptr;
+        entry_p->name = d->d_name;
+        entry_p->depth = d_stack.size();
+        entry_p->error = 0;
+
+        switch (entry_type(f.handle->fd(), d)) {
+        case DT_DIR: {
+            int fd = open_directory(f.handle->fd(), d->d_name);
+            if (fd < 0) {
+                entry_p->event = WALK_ERROR;
+                entry_p->error = errno;
+                return true;
+            }
+
+            // Note: push() may move the frame that "f" and "d" refer to
+            std::shared_ptr<DirectoryHandle> handle = std::make_shared<DirectoryHandle>(fd);
+            push(handle, d->d_name);
+            entry_p->event = WALK_ENTER_DIRECTORY;
+            entry_p->directory = handle;
+            entry_p->name = d_stack.back().name.c_str();
+            return true;
+        }
+        case DT_REG:
+            entry_p->event = WALK_FILE;
+            return true;
+        default:
+            entry_p->event = WALK_OTHER;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function definitions                             *
+ *******************************************************************************
+*/
+
+
+/* Returns the DT_* type of an entry, asking the inode only if d_type is unset */
+static unsigned char entry_type (int dirfd, const struct linux_dirent64 *d)
+{
+    struct stat st;
+
+    if (d->d_type != DT_UNKNOWN) {
+        return d->d_type;
+    }
+    if (-1 == fstatat(dirfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+        return DT_UNKNOWN;
+    }
+    switch (st.st_mode & S_IFMT) {
+    case S_IFDIR: return DT_DIR;
+    case S_IFREG: return DT_REG;
+    case S_IFLNK: return DT_LNK;
+    default:      return DT_UNKNOWN;
+    }
+}
+
+static int open_directory (int dirfd, const char *name)
+{
+    return openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+}
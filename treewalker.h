@@ -0,0 +1,120 @@
+#ifndef TREEWALKER_H
+#define TREEWALKER_H
+
+#include <QString>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace SWU {
+
+/*
+ *******************************************************************************
+ *                              Type declarations                              *
+ *******************************************************************************
+*/
+
+/* enumeration of walk events */
+enum walk_event_t {
+    WALK_ENTER_DIRECTORY,   /**< A directory was opened; its entries follow */
+    WALK_LEAVE_DIRECTORY,   /**< All entries of the directory were visited */
+    WALK_FILE,              /**< A regular file */
+    WALK_OTHER,             /**< Symbolic links, devices, sockets, fifos */
+    WALK_ERROR,             /**< A directory could not be opened or read */
+
+    /* Size */
+    WALK_ENUM_MAX
+};
+
+/* An open directory descriptor, closed when the last reference goes */
+class DirectoryHandle
+{
+private:
+    int d_fd;
+public:
+    DirectoryHandle(int fd);
+    ~DirectoryHandle();
+    DirectoryHandle(const DirectoryHandle &) = delete;
+    DirectoryHandle &operator= (const DirectoryHandle &) = delete;
+    int fd ();
+};
+
+/* A single walk event */
+struct walk_entry_t {
+    walk_event_t event;
+    std::shared_ptr<DirectoryHandle> parent;    /**< Directory containing the entry */
+    std::shared_ptr<DirectoryHandle> directory; /**< The directory itself (enter/leave only) */
+    const char *name;                           /**< Entry name, relative to parent */
+    int depth;                                  /**< 1 for entries of the root */
+    int error;                                  /**< errno (WALK_ERROR only) */
+};
+
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * Streams the contents of a directory tree without recursion.
+ *
+ * Directories are read in large batches with getdents64 and every entry is
+ * classified by its d_type; only filesystems that do not fill d_type cost a
+ * fstatat. Children are opened relative to their parent descriptor (openat),
+ * so no path strings are built and the kernel never re-walks a prefix.
+ * Symbolic links are reported but never followed.
+ *
+ * The walk is depth first: a directory's ENTER event precedes its entries and
+ * its LEAVE event follows them (pre-order for copies, post-order for removal).
+ * Names returned by next() remain valid until the following call.
+\*/
+class TreeWalker
+{
+private:
+    struct frame_t {
+        std::shared_ptr<DirectoryHandle> handle;
+        std::string name;
+        std::unique_ptr<char[]> buffer;
+        long length, offset;
+        bool eof;
+    };
+
+    std::vector<frame_t> d_stack;
+    std::shared_ptr<DirectoryHandle> d_root;
+    std::string d_leave_name;
+    int d_error;
+
+    void push (std::shared_ptr<DirectoryHandle> handle, const char *name);
+
+public:
+
+    /*\
+     * Opens the root directory of the walk (check error() afterwards)
+    \*/
+    TreeWalker(const QString path);
+
+    /*\
+     * Walks the directory at "name" relative to "dirfd"
+    \*/
+    TreeWalker(int dirfd, const char *name);
+
+    /*\
+     * Returns 0 if the root was opened; else errno
+    \*/
+    int error ();
+
+    /*\
+     * Returns the root directory handle
+    \*/
+    std::shared_ptr<DirectoryHandle> root ();
+
+    /*\
+     * Produces the next event. Returns false once the walk is complete.
+    \*/
+    bool next (walk_entry_t *entry_p);
+};
+
+}
+
+#endif // TREEWALKER_H
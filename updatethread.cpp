@@ -14,6 +14,7 @@ UpdateThread::~UpdateThread()
 void UpdateThread::initUI(const QString productLabel,
                           const QString statusLabel)
 {
+    QMutexLocker locker(&d_lock);
     d_productLabel = productLabel;
     d_statusLabel = statusLabel;
     d_progressValue = 0;
@@ -22,18 +23,21 @@ void UpdateThread::initUI(const QString productLabel,
 
 void UpdateThread::setStatus(const QString statusLabel)
 {
+    QMutexLocker locker(&d_lock);
     d_statusLabel = statusLabel;
     emit setUI(d_productLabel, d_statusLabel, d_progressValue);
 }
 
 void UpdateThread::setProduct(const QString productLabel)
 {
+    QMutexLocker locker(&d_lock);
     d_productLabel = productLabel;
     emit setUI(d_productLabel, d_statusLabel, d_progressValue);
 }
 
 void UpdateThread::setProgress(int progressValue)
 {
+    QMutexLocker locker(&d_lock);
     d_progressValue = progressValue;
     emit setUI(d_productLabel, d_statusLabel, d_progressValue);
 }
@@ -41,6 +45,7 @@ void UpdateThread::setProgress(int progressValue)
 void UpdateThread::updateUI(const QString statusLabel,
                             int progressValue)
 {
+    QMutexLocker locker(&d_lock);
     d_statusLabel = statusLabel;
     d_progressValue = progressValue;
     emit setUI(d_productLabel, d_statusLabel, d_progressValue);
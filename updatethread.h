@@ -25,6 +25,7 @@ protected:
     virtual void run() override;
 private:
     bool d_abort, d_show_progress;
+    QMutex d_lock; /**< Setters may be called from worker threads */
     QString d_productLabel, d_statusLabel;
     int d_progressValue;
 };
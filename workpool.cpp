@@ -0,0 +1,211 @@
+#include "workpool.h"
+
+#include <QThread>
+
+using namespace SWU;
+
+
+/*
+ *******************************************************************************
+ *                         Static variable definitions                         *
+ *******************************************************************************
+*/
+
+
+// Pool and queue index of the calling thread (-1 if not a worker)
+static thread_local WorkPool *t_pool = nullptr;
+static thread_local int t_index = -1;
+
+
+/*
+ *******************************************************************************
+ *                             Singleton instance                              *
+ *******************************************************************************
+*/
+
+
+WorkPool& WorkPool::get_instance()
+{
+    static WorkPool p;
+    return p;
+}
+
+
+/*
+ *******************************************************************************
+ *                        Class definition: WorkGroup                          *
+ *******************************************************************************
+*/
+
+
+WorkGroup::WorkGroup():
+    d_pending(0),
+    d_queued(0)
+{}
+
+bool WorkGroup::done ()
+{
+    return d_pending.load() == 0;
+}
+
+
+/*
+ *******************************************************************************
+ *                        Class definition: WorkPool                           *
+ *******************************************************************************
+*/
+
+
+WorkPool::WorkPool(unsigned workers):
+    d_queued(0),
+    d_next(0),
+    d_stop(false)
+{
+    if (workers == 0) {
+        workers = QThread::idealThreadCount() > 0 ? QThread::idealThreadCount() : 1;
+    }
+
+    for (unsigned i = 0; i < workers; ++i) {
+        d_queues.emplace_back(new worker_queue_t);
+    }
+    for (unsigned i = 0; i < workers; ++i) {
+        d_threads.emplace_back(&WorkPool::run, this, i);
+    }
+}
+
+WorkPool::~WorkPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(d_lock);
+        d_stop = true;
+    }
+    d_work_cv.notify_all();
+    for (auto &thread : d_threads) {
+        thread.join();
+    }
+}
+
+void WorkPool::submit (WorkGroup &group, task_t task)
+{
+    unsigned index;
+
+    // Workers push to their own deque; outsiders spread round-robin
+    if (t_pool == this) {
+        index = t_index;
+    } else {
+        index = d_next.fetch_add(1) % d_queues.size();
+    }
+
+    group.d_pending++;
+    {
+        std::lock_guard<std::mutex> guard(d_queues[index]->lock);
+        d_queues[index]->tasks.emplace_back(&group, std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> guard(d_lock);
+        d_queued++;
+        group.d_queued++;
+    }
+    d_work_cv.notify_one();
+    d_done_cv.notify_all();
+}
+
+void WorkPool::wait (WorkGroup &group, size_t pending)
+{
+    WorkGroup *g;
+    task_t task;
+
+    while (group.d_pending.load() > pending) {
+
+        // Help out with the group while waiting
+        if (take(t_pool == this ? t_index : -1, &group, &g, &task)) {
+            task();
+            finish(g);
+            continue;
+        }
+
+        // Nothing to take: sleep until the group queues more or completes
+        std::unique_lock<std::mutex> lock(d_lock);
+        d_done_cv.wait(lock, [&] { return group.d_pending.load() <= pending || group.d_queued.load() > 0; });
+    }
+}
+
+unsigned WorkPool::workers ()
+{
+    return d_threads.size();
+}
+
+void WorkPool::run (unsigned index)
+{
+    WorkGroup *group;
+    task_t task;
+
+    t_pool = this;
+    t_index = index;
+
+    while (true) {
+        if (take(index, nullptr, &group, &task)) {
+            task();
+            finish(group);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(d_lock);
+        d_work_cv.wait(lock, [&] { return d_stop || d_queued.load() > 0; });
+        if (d_stop) {
+            return;
+        }
+    }
+}
+
+/*\
+ * Takes a queued task (of group "only", unless nullptr): the newest of the
+ * own deque of worker "index" (-1: none), else the oldest of another
+\*/
+bool WorkPool::take (int index, WorkGroup *only, WorkGroup **group_p, task_t *task_p)
+{
+    size_t n = d_queues.size();
+
+    // Own deque: newest first
+    if (index >= 0) {
+        worker_queue_t *q = d_queues[index].get();
+        std::lock_guard<std::mutex> guard(q->lock);
+        for (auto it = q->tasks.rbegin(); it != q->tasks.rend(); ++it) {
+            if (only == nullptr || it->first == only) {
+                (*group_p) = it->first;
+                (*task_p) = std::move(it->second);
+                q->tasks.erase(std::next(it).base());
+                (*group_p)->d_queued--;
+                d_queued--;
+                return true;
+            }
+        }
+    }
+
+    // Steal: oldest first, starting from the next neighbour
+    for (size_t i = 1; i <= n; ++i) {
+        worker_queue_t *q = d_queues[(index + i) % n].get();
+        std::lock_guard<std::mutex> guard(q->lock);
+        for (auto it = q->tasks.begin(); it != q->tasks.end(); ++it) {
+            if (only == nullptr || it->first == only) {
+                (*group_p) = it->first;
+                (*task_p) = std::move(it->second);
+                q->tasks.erase(it);
+                (*group_p)->d_queued--;
+                d_queued--;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void WorkPool::finish (WorkGroup *group)
+{
+    group->d_pending--;
+
+    // Taking the lock orders the decrement against a waiter's predicate check
+    std::lock_guard<std::mutex> guard(d_lock);
+    d_done_cv.notify_all();
+}
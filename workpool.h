@@ -0,0 +1,105 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SWU {
+
+/*
+ *******************************************************************************
+ *                             Class declarations                              *
+ *******************************************************************************
+*/
+
+/*\
+ * A set of tasks that can be waited upon. Tasks submitted from within a task
+ * of the group (e.g. children of a directory) belong to the same group.
+\*/
+class WorkGroup
+{
+    friend class WorkPool;
+private:
+    std::atomic<size_t> d_pending;
+    std::atomic<size_t> d_queued;
+public:
+    WorkGroup();
+    bool done ();
+};
+
+/*\
+ * A bounded pool of worker threads with work stealing.
+ *
+ * Every worker owns a deque. Tasks submitted by a worker go to the back of its
+ * own deque and are taken back LIFO (depth first, keeps the working set hot);
+ * idle workers steal FIFO from the front of the other deques (breadth first,
+ * takes the largest remaining subtrees). Tasks submitted from outside the pool
+ * are spread round-robin.
+ *
+ * A thread waiting on a group helps execute the queued tasks of that group
+ * (and only those, so that other phases keep overlapping and nested waits
+ * stay shallow), so waiting from within a task (nested parallelism) does
+ * not deadlock.
+\*/
+class WorkPool
+{
+public:
+    typedef std::function<void()> task_t;
+
+private:
+    struct worker_queue_t {
+        std::mutex lock;
+        std::deque<std::pair<WorkGroup *, task_t>> tasks;
+    };
+
+    std::vector<std::unique_ptr<worker_queue_t>> d_queues;
+    std::vector<std::thread> d_threads;
+    std::mutex d_lock;
+    std::condition_variable d_work_cv, d_done_cv;
+    std::atomic<size_t> d_queued;
+    std::atomic<unsigned> d_next;
+    bool d_stop;
+
+    void run (unsigned index);
+    bool take (int index, WorkGroup *only, WorkGroup **group_p, task_t *task_p);
+    void finish (WorkGroup *group);
+
+public:
+
+    /*\
+     * Creates a pool with the given number of workers (0: one per core)
+    \*/
+    WorkPool(unsigned workers = 0);
+    ~WorkPool();
+
+    /*\
+     * Returns the process-wide pool
+    \*/
+    static WorkPool& get_instance();
+
+    /*\
+     * Queues a task as part of the given group
+    \*/
+    void submit (WorkGroup &group, task_t task);
+
+    /*\
+     * Blocks until at most "pending" tasks of the group remain queued or
+     * running (0: every task, including those it spawned, ran)
+    \*/
+    void wait (WorkGroup &group, size_t pending = 0);
+
+    /*\
+     * Returns the number of worker threads
+    \*/
+    unsigned workers ();
+};
+
+}
+
+#endif // WORKPOOL_H